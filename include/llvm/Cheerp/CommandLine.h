@@ -16,21 +16,39 @@
 
 extern llvm::cl::opt<std::string> WastLoader;
 extern llvm::cl::opt<std::string> WasmFile;
+extern llvm::cl::opt<bool> WasmBinary;
+extern llvm::cl::opt<unsigned> CodegenThreads;
+extern llvm::cl::opt<bool> WasmRelooper;
+extern llvm::cl::opt<bool> WasmSIMD;
 extern llvm::cl::opt<std::string> AsmJSMemFile;
 extern llvm::cl::opt<std::string> SourceMap;
 extern llvm::cl::opt<std::string> SourceMapPrefix;
+extern llvm::cl::opt<unsigned> SourceMapSectionSize;
+extern llvm::cl::opt<std::string> TimeReportFile;
+extern llvm::cl::opt<std::string> SizeReportFile;
+extern llvm::cl::opt<std::string> ProfileFile;
+extern llvm::cl::opt<std::string> PointerSummaries;
 extern llvm::cl::opt<bool> PrettyCode;
 extern llvm::cl::opt<bool> SymbolicGlobalsAsmJS;
 extern llvm::cl::opt<bool> MakeModule;
 extern llvm::cl::opt<bool> NoRegisterize;
+extern llvm::cl::opt<bool> RegisterizeLinearScan;
 extern llvm::cl::opt<bool> NoNativeJavaScriptMath;
 extern llvm::cl::opt<bool> NoJavaScriptMathImul;
 extern llvm::cl::opt<bool> NoJavaScriptMathFround;
 extern llvm::cl::opt<bool> NoCredits;
 extern llvm::cl::opt<bool> MeasureTimeToMain;
 extern llvm::cl::opt<bool> ForceTypedArrays;
+extern llvm::cl::opt<unsigned> TypedArrayPoolSize;
+extern llvm::cl::opt<unsigned> DevirtualizeMaxTargets;
+extern llvm::cl::list<std::string> LazyEntryPoints;
+extern llvm::cl::opt<std::string> LazyChunkFile;
+extern llvm::cl::opt<bool> LazyColdFunctions;
+extern llvm::cl::opt<std::string> LazyChunkURL;
 extern llvm::cl::list<std::string> ReservedNames;
 extern llvm::cl::opt<unsigned> CheerpAsmJSHeapSize;
+extern llvm::cl::opt<unsigned> CheerpWasmStackSize;
+extern llvm::cl::opt<unsigned> CheerpWasmMaxMemory;
 extern llvm::cl::opt<bool> BoundsCheck;
 extern llvm::cl::opt<bool> DefinedCheck;
 
@@ -0,0 +1,103 @@
+//===-- Cheerp/Devirtualizer.h - Cheerp indirect call devirtualization ----===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_DEVIRTUALIZER_H
+#define _CHEERP_DEVIRTUALIZER_H
+
+#include "llvm/Cheerp/GlobalDepsAnalyzer.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include <vector>
+
+namespace cheerp
+{
+
+/**
+ * Turn indirect calls with few possible targets into direct calls.
+ *
+ * The possible targets of an asm.js indirect call are the functions in the
+ * GlobalDepsAnalyzer function table for its signature, for generic JS calls
+ * the address taken functions with a compatible signature, or cast to one,
+ * are used.
+ * If there is a single asm.js target the call becomes direct, if there are at
+ * most maxTargets the call is replaced by a chain of guarded direct calls.
+ * Generic JS function pointers can also come from JavaScript code, so there
+ * the indirect call is always kept after the guarded calls.
+ * Otherwise the vtables are inspected to find the functions which can be
+ * loaded from the same slot, and guarded calls to them are emitted before
+ * falling back to the indirect call. A maxTargets of 0 disables the pass.
+ */
+class Devirtualizer : public llvm::ModulePass
+{
+public:
+	static char ID;
+
+	explicit Devirtualizer(uint32_t maxTargets = 2) : ModulePass(ID), maxTargets(maxTargets) { }
+
+	bool runOnModule( llvm::Module & ) override;
+
+	const char *getPassName() const override;
+
+	void getAnalysisUsage( llvm::AnalysisUsage& ) const override;
+private:
+	typedef std::vector<const llvm::Function*> TargetsVec;
+	typedef GlobalDepsAnalyzer::FunctionTableInfoMap FunctionTableInfoMap;
+	/**
+	 * Like GlobalDepsAnalyzer::FunctionSignatureHash, but pointers and integers
+	 * are not interchangeable in generic JS
+	 */
+	static uint32_t getTypeClass(const llvm::Type* t);
+	struct GenericJSSignatureHash
+	{
+		std::size_t operator()(const llvm::FunctionType* const& fTy) const
+		{
+			size_t hash = getTypeClass(fTy->getReturnType());
+			for (const auto& pTy: fTy->params())
+				hash = hash*31 + getTypeClass(pTy);
+			return hash;
+		}
+	};
+	struct GenericJSSignatureCmp
+	{
+		bool operator()(const llvm::FunctionType* const& lhs, const llvm::FunctionType* const& rhs) const
+		{
+			if (lhs->getNumParams() != rhs->getNumParams())
+				return false;
+			if (getTypeClass(lhs->getReturnType()) != getTypeClass(rhs->getReturnType()))
+				return false;
+			for (uint32_t i = 0; i < lhs->getNumParams(); i++)
+			{
+				if (getTypeClass(lhs->getParamType(i)) != getTypeClass(rhs->getParamType(i)))
+					return false;
+			}
+			return true;
+		}
+	};
+	typedef std::unordered_map<const llvm::FunctionType*, TargetsVec,
+		GenericJSSignatureHash, GenericJSSignatureCmp> GenericJSTargetsMap;
+	// An address point inside a constant array of function pointers, usually a vtable
+	typedef std::pair<const llvm::Constant*, uint64_t> AddressPoint;
+
+	void collectAddressPoints( llvm::Module & );
+	bool getVTableTargets( const llvm::CallInst* call, TargetsVec& targets ) const;
+	bool canCallDirectly( const llvm::CallInst* call, const llvm::Function* F ) const;
+	void devirtualizeCall( llvm::CallInst* call, const TargetsVec& targets, bool needsFallback );
+
+	uint32_t maxTargets;
+	std::vector<AddressPoint> addressPoints;
+};
+
+llvm::ModulePass *createDevirtualizerPass(uint32_t maxTargets);
+
+}
+
+#endif
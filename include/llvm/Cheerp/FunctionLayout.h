@@ -0,0 +1,56 @@
+//===-- Cheerp/FunctionLayout.h - Cheerp profile guided function order ----===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_FUNCTION_LAYOUT_H
+#define _CHEERP_FUNCTION_LAYOUT_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include <string>
+
+namespace cheerp
+{
+
+/**
+ * Reorder the functions of the module using an instrumentation profile, as
+ * produced by llvm-profdata. The writers emit functions in module order.
+ *
+ * Functions which have been executed go first, sorted by decreasing entry
+ * count, so that the hot code is kept together. Functions which are not in
+ * the profile keep their relative order, and functions which have never
+ * been executed go last and are marked as cold, so that they can be loaded
+ * lazily. Without a profile the module is not changed
+ */
+class FunctionLayout : public llvm::ModulePass
+{
+public:
+	static char ID;
+
+	explicit FunctionLayout(const std::string& profileFile = std::string()) : ModulePass(ID), profileFile(profileFile) { }
+
+	bool runOnModule( llvm::Module & ) override;
+
+	const char *getPassName() const override;
+
+	void getAnalysisUsage( llvm::AnalysisUsage& ) const override;
+private:
+	// Read the entry count of each function in the profile
+	void readProfile( llvm::StringMap<uint64_t>& entryCounts ) const;
+
+	std::string profileFile;
+};
+
+llvm::ModulePass *createFunctionLayoutPass(const std::string& profileFile);
+
+}
+
+#endif //_CHEERP_FUNCTION_LAYOUT_H
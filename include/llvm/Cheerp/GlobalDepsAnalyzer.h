@@ -42,6 +42,8 @@ public:
 		std::string name;
 		size_t mask;
 		std::vector<const llvm::Function*> functions;
+		// Tables which are never used for dispatch only provide addresses
+		bool hasIndirectCalls = false;
 	};
 	/**
 	 * Custom hash and compare functions for the FunctionTableInfoMap
@@ -201,6 +203,42 @@ public:
 	 */
 	bool needAsmJS() const { return hasAsmJS; }
 	
+	/**
+	 * Compute the asm.js function tables and addresses. Passes which change
+	 * indirect calls after this analysis has run should call it again
+	 */
+	void computeFunctionTables( llvm::Module & );
+
+	/**
+	 * Compute the generic JS functions which are only used by the given entry
+	 * points, directly or through other such functions. They can be compiled
+	 * in a separate chunk which is loaded the first time an entry point is
+	 * called. Entry points which are roots of the program are ignored.
+	 * If coldEntryPoints is set, every function with the cold attribute
+	 * which can be loaded lazily is an entry point as well
+	 */
+	void computeLazyFunctions( llvm::Module &, const std::vector<std::string>& entryPointNames, bool coldEntryPoints = false );
+
+	/**
+	 * Determine if a function is compiled in the lazily loaded chunk
+	 */
+	bool isLazy(const llvm::Function* F) const { return lazyFunctionsSet.count(F); }
+
+	/**
+	 * Determine if a function is an entry point of the lazily loaded chunk
+	 */
+	bool isLazyEntryPoint(const llvm::Function* F) const { return lazyEntryPointsSet.count(F); }
+
+	/**
+	 * Get the functions compiled in the lazily loaded chunk, in module order
+	 */
+	const std::vector<const llvm::Function*> & lazyFunctions() const { return lazyFunctionsList; }
+
+	/**
+	 * Get the lazy functions which may be called from the rest of the program
+	 */
+	const std::vector<const llvm::Function*> & lazyEntryPoints() const { return lazyEntryPointsList; }
+
 	bool runOnModule( llvm::Module & ) override;
 
 	void getAnalysisUsage( llvm::AnalysisUsage& ) const override;
@@ -271,6 +309,10 @@ private:
 	std::unordered_set<const llvm::Function* > asmJSExportedFuncions;
 	std::unordered_set<const llvm::Function* > asmJSImportedFuncions;
 	std::vector< const llvm::Function* > constructorsNeeded;
+	std::unordered_set< const llvm::Function* > lazyFunctionsSet;
+	std::vector< const llvm::Function* > lazyFunctionsList;
+	std::unordered_set< const llvm::Function* > lazyEntryPointsSet;
+	std::vector< const llvm::Function* > lazyEntryPointsList;
 		
 	std::vector< const llvm::GlobalVariable * > varsOrder;
 	const llvm::GlobalVariable* heapStart;
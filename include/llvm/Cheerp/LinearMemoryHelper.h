@@ -16,6 +16,7 @@
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include <map>
+#include <vector>
 
 namespace cheerp
 {
@@ -39,7 +40,15 @@ public:
 	}
 	// Returns the newly assigned address
 	uint32_t addGlobalVariable(const llvm::GlobalVariable* G);
+	// Assign addresses to all the asm.js globals of the module. The ones
+	// which are zero initialized go last, so that the initialized part of the
+	// memory is as small as possible. The _heapStart marker is not assigned
+	// and is returned instead, callers put it where the heap begins
+	const llvm::GlobalVariable* addGlobalVariables(const llvm::Module& M);
 	uint32_t getGlobalVariableAddress(const llvm::GlobalVariable* G) const;
+	// True if G does not need to be written in the initial memory, which is
+	// all zeroes
+	static bool isZeroInitialized(const llvm::GlobalVariable* G);
 	struct ByteListener
 	{
 		virtual void addByte(uint8_t b) = 0;
@@ -48,6 +57,33 @@ public:
 		{
 		}
 	};
+	// A range of bytes to be written in the initial memory
+	struct Segment
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+	/**
+	 * Collects the bytes of a constant, so that they can be written in
+	 * segments which skip the runs of zeroes
+	 */
+	struct ByteBuffer: public ByteListener
+	{
+		// Provides the offsets of the function tables
+		ByteListener& target;
+		std::vector<uint8_t> bytes;
+		ByteBuffer(ByteListener& target):target(target)
+		{
+		}
+		void addByte(uint8_t b) override { bytes.push_back(b); }
+		uint32_t getFunctionTableOffset(llvm::StringRef funcName) override
+		{
+			return target.getFunctionTableOffset(funcName);
+		}
+		// Split the bytes in segments, separated by runs of at least
+		// minZeroRun zeroes. Leading and trailing zeroes are never included
+		void splitZeroRuns(uint32_t minZeroRun, std::vector<Segment>& segments) const;
+	};
 	void compileConstantAsBytes(const llvm::Constant* c, bool asmjs, ByteListener* listener);
 	struct GepListener
 	{
@@ -59,7 +95,13 @@ public:
 	};
 	// Returns the base of the compiled expression
 	const llvm::Value* compileGEP(const llvm::Value* p, GepListener* listener);
-	uint8_t getTotalMemory() const
+	// DataLayout computes struct layouts lazily, do it for all the structs
+	// in the module so that compileGEP can be used from multiple threads
+	void computeStructLayouts(const llvm::Module& M) const;
+	// Reserve the space for a stack growing downward, returns the initial
+	// stack pointer
+	uint32_t addStack(uint32_t size);
+	uint32_t getTotalMemory() const
 	{
 		return heapStart;
 	}
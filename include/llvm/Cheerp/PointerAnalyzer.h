@@ -19,8 +19,11 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/Support/Timer.h"
+#include <mutex>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace cheerp {
 
@@ -204,6 +207,13 @@ public:
 	{
 		kind = getPointerKindForKnown();
 	}
+	// Replace the kind with one resolved by a previous compilation, there is no regularCause for it
+	void setResolvedKind(POINTER_KIND k)
+	{
+		assert(k==COMPLETE_OBJECT || k==SPLIT_REGULAR || k==REGULAR || k==BYTE_LAYOUT);
+		kind = k;
+		clearConstraints();
+	}
 	void dump() const;
 	const llvm::Value* regularCause;
 
@@ -286,6 +296,39 @@ public:
 	static PointerConstantOffsetWrapper staticDefaultValue;
 };
 
+/**
+ * Resolved pointer kinds which can be stored next to the bitcode and reused by the next compilation.
+ *
+ * A slot is anything which fullResolve resolves as a whole: the arguments, the return values, the stored
+ * types and the TypeAndIndex slots of struct members and indirect arguments. Its signature covers the
+ * kinds and the constraints collected for it in the module, so a slot whose signature did not change, and
+ * which does not depend on a slot which changed, keeps the same resolved kind.
+ */
+struct PointerKindSummaries
+{
+	struct Slot
+	{
+		std::string name;
+		uint64_t signature;
+		POINTER_KIND kind;
+	};
+	struct FunctionSummary
+	{
+		std::string name;
+		// MD5 of the function body
+		uint64_t hash;
+		// The arguments, the return value and the slots first loaded from or stored to by the function
+		std::vector<Slot> slots;
+	};
+	// The slots which are not used by any function, like the ones of global initializers
+	std::vector<Slot> moduleSlots;
+	std::vector<FunctionSummary> functions;
+
+	// Parse the summaries written by write, malformed lines are ignored
+	void read(llvm::StringRef buffer);
+	void write(llvm::raw_ostream& out) const;
+};
+
 class PointerAnalyzer : public llvm::ModulePass
 {
 public:
@@ -326,8 +369,20 @@ public:
 	// Notify that a value has been invalidated
 	void invalidate( const llvm::Value * );
 
+	// The queries fill the caches, serialize them while they may be used by
+	// multiple threads
+	void setConcurrentQueries(bool c) const { concurrentQueries = c; }
+
 	// Fully resolve indirect pointer kinds. After you call this function you should not call invalidate anymore.
-	void fullResolve();
+	// Returns the number of indirect kinds which have been resolved
+	uint32_t fullResolve();
+	// Like fullResolve, but the slots which did not change since the previous summaries keep their stored kind
+	// and are not resolved again. The summaries of this module are returned in current, and the functions whose
+	// body or input slots changed in changedFunctions
+	uint32_t fullResolve(const llvm::Module& M, const PointerKindSummaries& previous, PointerKindSummaries& current,
+				std::vector<const llvm::Function*>& changedFunctions);
+	// Like the above, the summaries are read from and then written to the given file
+	uint32_t fullResolve(const llvm::Module& M, llvm::StringRef summariesFile);
 	// Compute all the offsets for REGULAR pointer which may be assumed constant
 	void computeConstantOffsets(const llvm::Module& M );
 
@@ -381,6 +436,15 @@ private:
 	mutable PointerKindData pointerKindData;
 	mutable PointerOffsetData pointerOffsetData;
 	mutable AddressTakenMap addressTakenCache;
+	// Recursive since the queries use each other
+	mutable std::recursive_mutex queryLock;
+	mutable bool concurrentQueries = false;
+	std::unique_lock<std::recursive_mutex> lockQueries() const
+	{
+		if(!concurrentQueries)
+			return std::unique_lock<std::recursive_mutex>();
+		return std::unique_lock<std::recursive_mutex>(queryLock);
+	}
 
 #ifndef NDEBUG
 	mutable llvm::TimerGroup timerGroup;
@@ -123,15 +123,17 @@ public:
 FunctionPass *createPointerToImmutablePHIRemovalPass();
 
 /**
- * This pass removes all free/delete/delete[] calls as their are no-op in Cheerp
+ * This pass removes all free/delete/delete[] calls as their are no-op in Cheerp.
+ * When typed arrays are pooled the calls freeing arrays of immutable types are kept
  */
 class FreeAndDeleteRemoval: public FunctionPass
 {
 private:
+	bool keepTypedArrayFrees;
 	void deleteInstructionAndUnusedOperands(Instruction* I);
 public:
 	static char ID;
-	explicit FreeAndDeleteRemoval() : FunctionPass(ID) { }
+	explicit FreeAndDeleteRemoval(bool keepTypedArrayFrees = false) : FunctionPass(ID), keepTypedArrayFrees(keepTypedArrayFrees) { }
 	bool runOnFunction(Function &F) override;
 	const char *getPassName() const override;
 
@@ -142,7 +144,38 @@ public:
 //
 // FreeAndDeleteRemoval
 //
-FunctionPass *createFreeAndDeleteRemovalPass();
+FunctionPass *createFreeAndDeleteRemovalPass(bool keepTypedArrayFrees = false);
+
+/**
+ * This pass splits struct allocations which do not escape the function into one
+ * register for each used field. Both allocas and single object heap allocations are
+ * handled, as long as the pointer is only used to load and store scalar fields
+ * through constant GEPs or is passed to free/delete.
+ * This avoids creating short lived JS objects, for example in hot loops.
+ */
+class ScalarizeNonEscapingObjects: public FunctionPass
+{
+private:
+	typedef SmallVector<uint32_t, 4> FieldPath;
+	bool isNonEscaping(Instruction* I, Type* objType, SmallVectorImpl<GetElementPtrInst*>& fieldGeps,
+			SmallVectorImpl<Instruction*>& toErase);
+	bool isDeallocation(const Instruction* I);
+	void scalarize(Instruction* I, Type* objType, ArrayRef<GetElementPtrInst*> fieldGeps,
+			ArrayRef<Instruction*> toErase, SmallVectorImpl<AllocaInst*>& newAllocas);
+public:
+	static char ID;
+	explicit ScalarizeNonEscapingObjects() : FunctionPass(ID) { }
+	bool runOnFunction(Function &F) override;
+	const char *getPassName() const override;
+
+	virtual void getAnalysisUsage(AnalysisUsage&) const override;
+};
+
+//===----------------------------------------------------------------------===//
+//
+// ScalarizeNonEscapingObjects
+//
+FunctionPass *createScalarizeNonEscapingObjectsPass();
 
 /**
  * This pass moves allocas as close as possible to the actual users
@@ -44,8 +44,12 @@ public:
 
     std::map<llvm::GlobalVariable *, llvm::Constant *>  modifiedGlobals;
     std::map<char *, AllocData> typedAllocations;
+    // Range of the last global found by recordStore
+    char* lastStoreStart;
+    char* lastStoreEnd;
 
-    explicit PreExecute() : llvm::ModulePass(ID) {
+    explicit PreExecute() : llvm::ModulePass(ID), currentEE(nullptr), currentModule(nullptr),
+        lastStoreStart(nullptr), lastStoreEnd(nullptr) {
     }
 
     const char* getPassName() const override;
@@ -61,6 +65,9 @@ public:
         typedAllocations.insert(std::make_pair(buf, data));
     };
 private:
+    void createEngine(const llvm::Target* target, const std::string& triple, llvm::Module& m);
+    void destroyEngine(llvm::Module& m);
+
     llvm::Constant* findPointerFromGlobal(const llvm::DataLayout* DL,
             llvm::Type* memType, llvm::GlobalValue* GV, char* GlobalStartAddr,
             char* StoredAddr, llvm::Type* Int32Ty);
@@ -12,11 +12,13 @@
 #ifndef _CHEERP_REGISTERIZE_H
 #define _CHEERP_REGISTERIZE_H
 
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 namespace cheerp
 {
@@ -61,7 +63,7 @@ public:
 
 	static char ID;
 	
-	explicit Registerize(bool useFloats = false, bool n = false) : ModulePass(ID), NoRegisterize(n), useFloats(useFloats)
+	explicit Registerize(bool useFloats = false, bool n = false, bool l = false) : ModulePass(ID), NoRegisterize(n), useFloats(useFloats), LinearScan(l), NumLinearScanChunks(0)
 #ifndef NDEBUG
 			, RegistersAssigned(false)
 #endif
@@ -86,13 +88,13 @@ public:
 		return allocaLiveRanges.find(alloca)->second;
 	}
 
-	// Registers should have a consistent JS type
-	enum REGISTER_KIND { OBJECT=0, INTEGER, DOUBLE, FLOAT };
+	// Registers should have a consistent JS type, VECTOR registers only exist in wasm
+	enum REGISTER_KIND { OBJECT=0, INTEGER, DOUBLE, FLOAT, VECTOR };
 
 	struct RegisterInfo
 	{
 		// Try to save bits, we may need more flags here
-		const REGISTER_KIND regKind : 2;
+		const REGISTER_KIND regKind : 3;
 		int needsSecondaryName : 1;
 		RegisterInfo(REGISTER_KIND k, bool n):regKind(k),needsSecondaryName(n)
 		{
@@ -105,6 +107,21 @@ public:
 		return registersForFunctionMap.find(F)->second;
 	}
 
+	// Total number of registers assigned to all the functions
+	uint32_t getNumRegisters() const
+	{
+		uint32_t ret = 0;
+		for (const auto& it: registersForFunctionMap)
+			ret += it.second.size();
+		return ret;
+	}
+
+	// Live range chunks visited by the linear scan assignment, it should grow linearly with the code size
+	uint64_t getNumLinearScanChunks() const
+	{
+		return NumLinearScanChunks;
+	}
+
 	REGISTER_KIND getRegKindFromType(const llvm::Type*, bool asmjs) const;
 
 	// Context used to disambiguate temporary values used in PHI resolution
@@ -144,7 +161,7 @@ private:
 			}
 		};
 	};
-	std::unordered_map<const llvm::Instruction*, uint32_t> registersMap;
+	llvm::DenseMap<const llvm::Instruction*, uint32_t> registersMap;
 	std::unordered_map<InstOnEdge, uint32_t, InstOnEdge::Hash> edgeRegistersMap;
 	std::unordered_map<const llvm::AllocaInst*, LiveRange> allocaLiveRanges;
 	std::unordered_map<const llvm::Function*, std::vector<RegisterInfo>> registersForFunctionMap;
@@ -165,9 +182,13 @@ private:
 			toBB=NULL;
 		}
 	};
-	EdgeContext edgeContext;
+	// The context is per thread, since the workers of a parallel compilation
+	// set it for the PHIs of different functions at the same time
+	static thread_local EdgeContext edgeContext;
 	bool NoRegisterize;
 	bool useFloats;
+	bool LinearScan;
+	uint64_t NumLinearScanChunks;
 #ifndef NDEBUG
 	bool RegistersAssigned;
 #endif
@@ -183,7 +204,7 @@ private:
 		void addUse(uint32_t codePathId, uint32_t thisIndex);
 	};
 	// Map from instructions to their unique identifier
-	typedef std::unordered_map<const llvm::Instruction*, uint32_t> InstIdMapTy;
+	typedef llvm::DenseMap<const llvm::Instruction*, uint32_t> InstIdMapTy;
 	struct CompareInstructionByID
 	{
 	private:
@@ -199,7 +220,58 @@ private:
 		}
 	};
 	// Map from instructions to their live ranges
-	typedef std::map<llvm::Instruction*, InstructionLiveRange, CompareInstructionByID> LiveRangesTy;
+	// Ranges are created in increasing ID order, so they are kept in a vector sorted by ID
+	// and looked up using a dense ID-indexed table
+	class LiveRangesTy
+	{
+	public:
+		typedef std::pair<llvm::Instruction*, InstructionLiveRange> value_type;
+		typedef std::vector<value_type>::iterator iterator;
+		typedef std::vector<value_type>::const_iterator const_iterator;
+		LiveRangesTy(const InstIdMapTy& i):instIdMap(&i),rangeIndex(i.size()+1, 0)
+		{
+		}
+		iterator begin() { return ranges.begin(); }
+		iterator end() { return ranges.end(); }
+		const_iterator begin() const { return ranges.begin(); }
+		const_iterator end() const { return ranges.end(); }
+		std::pair<iterator, bool> emplace(llvm::Instruction* I, const InstructionLiveRange& r)
+		{
+			uint32_t id=getId(I);
+			if(rangeIndex[id])
+				return std::make_pair(ranges.begin()+rangeIndex[id]-1, false);
+			assert(ranges.empty() || getId(ranges.back().first) < id);
+			ranges.emplace_back(I, r);
+			rangeIndex[id]=ranges.size();
+			return std::make_pair(ranges.end()-1, true);
+		}
+		iterator find(const llvm::Instruction* I)
+		{
+			uint32_t id=getId(I);
+			return rangeIndex[id] ? ranges.begin()+rangeIndex[id]-1 : ranges.end();
+		}
+		const_iterator find(const llvm::Instruction* I) const
+		{
+			uint32_t id=getId(I);
+			return rangeIndex[id] ? ranges.begin()+rangeIndex[id]-1 : ranges.end();
+		}
+		size_t count(const llvm::Instruction* I) const
+		{
+			return rangeIndex[getId(I)] ? 1 : 0;
+		}
+	private:
+		const InstIdMapTy* instIdMap;
+		// For each instruction ID the index of its range plus one, or 0 if there is none
+		std::vector<uint32_t> rangeIndex;
+		std::vector<value_type> ranges;
+		uint32_t getId(const llvm::Instruction* I) const
+		{
+			assert(instIdMap->count(I));
+			uint32_t id=instIdMap->find(I)->second;
+			assert(id < rangeIndex.size());
+			return id;
+		}
+	};
 	struct RegisterRange
 	{
 		LiveRange range;
@@ -294,6 +366,7 @@ private:
 	void extendRangeForUsedOperands(llvm::Instruction& I, LiveRangesTy& liveRanges, cheerp::PointerAnalyzer& PA,
 					uint32_t thisIndex, uint32_t codePathId);
 	uint32_t assignToRegisters(llvm::Function& F, const InstIdMapTy& instIdMap, const LiveRangesTy& liveRanges, const PointerAnalyzer& PA);
+	void assignToRegistersLinearScan(const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA);
 	void handlePHI(llvm::Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA);
 	uint32_t findOrCreateRegister(llvm::SmallVector<RegisterRange, 4>& registers, const InstructionLiveRange& range,
 					REGISTER_KIND kind, bool needsSecondaryName);
@@ -351,7 +424,7 @@ private:
 	void assignRegistersToInstructions(llvm::Function& F, cheerp::PointerAnalyzer& PA);
 };
 
-llvm::ModulePass *createRegisterizePass(bool useFloats, bool NoRegisterize);
+llvm::ModulePass *createRegisterizePass(bool useFloats, bool NoRegisterize, bool LinearScan = false);
 
 }
 
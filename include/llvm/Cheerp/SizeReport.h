@@ -0,0 +1,43 @@
+//===-- Cheerp/SizeReport.h - Cheerp output size report --------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_SIZE_REPORT_H
+#define _CHEERP_SIZE_REPORT_H
+
+#include "llvm/IR/GlobalValue.h"
+#include "llvm/Support/raw_ostream.h"
+#include <map>
+#include <utility>
+
+namespace cheerp
+{
+
+/**
+ * Collects how many bytes of the output each function and global variable
+ * contributes, and prints them as JSON sorted by size.
+ *
+ * The JS and wasm writers of the same compilation can share a report, the
+ * bytes are kept separate for each output
+ */
+class SizeReport
+{
+public:
+	enum OUTPUT { JS = 0, WASM };
+	// Add bytes to the contribution of GV to the output
+	void add(const llvm::GlobalValue* GV, OUTPUT output, uint64_t bytes);
+	void print(llvm::raw_ostream& out) const;
+private:
+	std::map<std::pair<const llvm::GlobalValue*, OUTPUT>, uint64_t> sizes;
+};
+
+}
+
+#endif //_CHEERP_SIZE_REPORT_H
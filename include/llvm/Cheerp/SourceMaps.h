@@ -28,6 +28,7 @@ private:
 	const std::string& sourceMapName;
 	const std::string& sourceMapPrefix;
 	llvm::LLVMContext& Ctx;
+	// File and name indices are local to the current section
 	std::map<llvm::StringRef, uint32_t> fileMap;
 	std::map<llvm::StringRef, uint32_t> functionNameMap;
 	uint32_t lastFile;
@@ -37,10 +38,21 @@ private:
 	uint32_t lineOffset;
 	uint32_t lastName;
 	bool lineBegin;
-	void writeBase64VLQInt(int32_t i);
+	// Bytes of mappings after which a new section is started, 0 to generate a single map
+	uint32_t sectionSize;
+	uint32_t sectionMappingsSize;
+	// Position of the generated code
+	uint32_t generatedLine;
+	static char* encodeBase64VLQInt(int32_t i, char* out);
+	void writeSegment(const int32_t* fields, uint32_t numFields);
+	void beginSection();
+	void endSection();
+	void splitSection();
+	void writeSourcesAndNames();
 public:
 	// sourceMapName and sourceMapPrefix life spans should be longer than the one of the SourceMapGenerator
-	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::error_code& ErrorCode);
+	SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C,
+			uint32_t sectionSize, std::error_code& ErrorCode);
 	void setFunctionName(const llvm::DISubprogram &method);
 	void setDebugLoc(const llvm::DebugLoc& debugLoc);
 	void beginFile();
@@ -0,0 +1,66 @@
+//===-- Cheerp/TimeReport.h - Cheerp backend timing report -----------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef _CHEERP_TIME_REPORT_H
+#define _CHEERP_TIME_REPORT_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace cheerp
+{
+
+/**
+ * Collects the wall time and peak memory usage of the phases of the backend,
+ * together with a few counters, and prints them as JSON.
+ *
+ * Phases are sequential: starting a phase ends the current one
+ */
+class TimeReport
+{
+public:
+	TimeReport() : currentPhaseStart(0) {}
+	// Start a new phase, ending the current one if any
+	void beginPhase(llvm::StringRef name);
+	void endPhase();
+	// Add value to the counter called name, creating it if needed
+	void addCounter(llvm::StringRef name, uint64_t value);
+	// End the current phase and print the report
+	void print(llvm::raw_ostream& out);
+	// Peak resident set size of the process in bytes, 0 if not available
+	static uint64_t getPeakRSS();
+private:
+	struct PhaseInfo
+	{
+		std::string name;
+		double wallTime;
+		uint64_t peakRSS;
+	};
+	std::vector<PhaseInfo> phases;
+	// Counters are kept in insertion order to have a stable output
+	std::vector<std::pair<std::string, uint64_t>> counters;
+	std::string currentPhase;
+	double currentPhaseStart;
+};
+
+/**
+ * Starts a phase of the report when it runs, it is added between the
+ * passes of the backend pipeline to time each of them
+ */
+llvm::ModulePass* createTimeReportPhasePass(TimeReport& report, llvm::StringRef phase);
+
+}
+
+#endif //_CHEERP_TIME_REPORT_H
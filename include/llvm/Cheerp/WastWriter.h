@@ -19,6 +19,8 @@
 #include "llvm/Cheerp/LinearMemoryHelper.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
+#include "llvm/Cheerp/SizeReport.h"
+#include "llvm/Cheerp/TimeReport.h"
 #if 0
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Module.h"
@@ -30,20 +32,241 @@
 #include "llvm/IR/DebugLoc.h"
 #include "llvm/IR/Metadata.h"
 #include "llvm/IR/DebugInfo.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/Support/FormattedStream.h"
+#include <array>
+#include <memory>
+#include <mutex>
 #if 0
 #include <set>
 #include <map>
 #include <array>
 #endif
 
+struct RelooperCache;
+
 namespace cheerp
 {
 
 const uint32_t WasmPage = 64*1024;
 
+// Opcodes of the WebAssembly MVP binary encoding
+enum class WasmOpcode : uint8_t
+{
+	UNREACHABLE = 0x00,
+	NOP = 0x01,
+	BLOCK = 0x02,
+	LOOP = 0x03,
+	IF = 0x04,
+	ELSE = 0x05,
+	END = 0x0b,
+	BR = 0x0c,
+	BR_IF = 0x0d,
+	BR_TABLE = 0x0e,
+	RETURN = 0x0f,
+	CALL = 0x10,
+	CALL_INDIRECT = 0x11,
+	DROP = 0x1a,
+	SELECT = 0x1b,
+	GET_LOCAL = 0x20,
+	SET_LOCAL = 0x21,
+	TEE_LOCAL = 0x22,
+	GET_GLOBAL = 0x23,
+	SET_GLOBAL = 0x24,
+	I32_LOAD = 0x28,
+	I64_LOAD = 0x29,
+	F32_LOAD = 0x2a,
+	F64_LOAD = 0x2b,
+	I32_LOAD8_S = 0x2c,
+	I32_LOAD8_U = 0x2d,
+	I32_LOAD16_S = 0x2e,
+	I32_LOAD16_U = 0x2f,
+	I32_STORE = 0x36,
+	I64_STORE = 0x37,
+	F32_STORE = 0x38,
+	F64_STORE = 0x39,
+	I32_STORE8 = 0x3a,
+	I32_STORE16 = 0x3b,
+	CURRENT_MEMORY = 0x3f,
+	GROW_MEMORY = 0x40,
+	I32_CONST = 0x41,
+	I64_CONST = 0x42,
+	F32_CONST = 0x43,
+	F64_CONST = 0x44,
+	I32_EQZ = 0x45,
+	I32_EQ = 0x46,
+	I32_NE = 0x47,
+	I32_LT_S = 0x48,
+	I32_LT_U = 0x49,
+	I32_GT_S = 0x4a,
+	I32_GT_U = 0x4b,
+	I32_LE_S = 0x4c,
+	I32_LE_U = 0x4d,
+	I32_GE_S = 0x4e,
+	I32_GE_U = 0x4f,
+	I64_NE = 0x52,
+	F32_EQ = 0x5b,
+	F32_NE = 0x5c,
+	F32_LT = 0x5d,
+	F32_GT = 0x5e,
+	F32_LE = 0x5f,
+	F32_GE = 0x60,
+	F64_EQ = 0x61,
+	F64_NE = 0x62,
+	F64_LT = 0x63,
+	F64_GT = 0x64,
+	F64_LE = 0x65,
+	F64_GE = 0x66,
+	I32_CLZ = 0x67,
+	I32_CTZ = 0x68,
+	I32_POPCNT = 0x69,
+	I32_ADD = 0x6a,
+	I32_SUB = 0x6b,
+	I32_MUL = 0x6c,
+	I32_DIV_S = 0x6d,
+	I32_DIV_U = 0x6e,
+	I32_REM_S = 0x6f,
+	I32_REM_U = 0x70,
+	I32_AND = 0x71,
+	I32_OR = 0x72,
+	I32_XOR = 0x73,
+	I32_SHL = 0x74,
+	I32_SHR_S = 0x75,
+	I32_SHR_U = 0x76,
+	I64_MUL = 0x7e,
+	F32_ABS = 0x8b,
+	F32_NEG = 0x8c,
+	F32_CEIL = 0x8d,
+	F32_FLOOR = 0x8e,
+	F32_TRUNC = 0x8f,
+	F32_SQRT = 0x91,
+	F32_ADD = 0x92,
+	F32_SUB = 0x93,
+	F32_MUL = 0x94,
+	F32_DIV = 0x95,
+	F64_ABS = 0x99,
+	F64_NEG = 0x9a,
+	F64_CEIL = 0x9b,
+	F64_FLOOR = 0x9c,
+	F64_TRUNC = 0x9d,
+	F64_SQRT = 0x9f,
+	F64_ADD = 0xa0,
+	F64_SUB = 0xa1,
+	F64_MUL = 0xa2,
+	F64_DIV = 0xa3,
+	I32_TRUNC_S_F32 = 0xa8,
+	I32_TRUNC_U_F32 = 0xa9,
+	I32_TRUNC_S_F64 = 0xaa,
+	I32_TRUNC_U_F64 = 0xab,
+	I64_EXTEND_U_I32 = 0xad,
+	F32_CONVERT_S_I32 = 0xb2,
+	F32_CONVERT_U_I32 = 0xb3,
+	F32_DEMOTE_F64 = 0xb6,
+	F64_CONVERT_S_I32 = 0xb7,
+	F64_CONVERT_U_I32 = 0xb8,
+	F64_PROMOTE_F32 = 0xbb,
+	// Prefix of the 128-bit SIMD instructions
+	SIMD_PREFIX = 0xfd,
+};
+
+// Opcodes of the 128-bit SIMD instructions, encoded as a LEB128 after SIMD_PREFIX
+enum class WasmSIMDOpcode : uint32_t
+{
+	V128_LOAD = 0x00,
+	V128_STORE = 0x0b,
+	V128_CONST = 0x0c,
+	I8X16_SHUFFLE = 0x0d,
+	I8X16_SPLAT = 0x0f,
+	I16X8_SPLAT = 0x10,
+	I32X4_SPLAT = 0x11,
+	F32X4_SPLAT = 0x13,
+	F64X2_SPLAT = 0x14,
+	I8X16_EXTRACT_LANE_U = 0x16,
+	I8X16_REPLACE_LANE = 0x17,
+	I16X8_EXTRACT_LANE_U = 0x19,
+	I16X8_REPLACE_LANE = 0x1a,
+	I32X4_EXTRACT_LANE = 0x1b,
+	I32X4_REPLACE_LANE = 0x1c,
+	F32X4_EXTRACT_LANE = 0x1f,
+	F32X4_REPLACE_LANE = 0x20,
+	F64X2_EXTRACT_LANE = 0x21,
+	F64X2_REPLACE_LANE = 0x22,
+	// The integer comparisons of each shape are eq, ne, lt_s, lt_u, gt_s,
+	// gt_u, le_s, le_u, ge_s, ge_u. The float ones are eq, ne, lt, gt, le, ge
+	I8X16_EQ = 0x23,
+	I16X8_EQ = 0x2d,
+	I32X4_EQ = 0x37,
+	F32X4_EQ = 0x41,
+	F64X2_EQ = 0x47,
+	V128_AND = 0x4e,
+	V128_OR = 0x50,
+	V128_XOR = 0x51,
+	V128_BITSELECT = 0x52,
+	I8X16_SHL = 0x6b,
+	I8X16_SHR_S = 0x6c,
+	I8X16_SHR_U = 0x6d,
+	I8X16_ADD = 0x6e,
+	I8X16_SUB = 0x71,
+	I16X8_SHL = 0x8b,
+	I16X8_SHR_S = 0x8c,
+	I16X8_SHR_U = 0x8d,
+	I16X8_ADD = 0x8e,
+	I16X8_SUB = 0x91,
+	I16X8_MUL = 0x95,
+	I32X4_SHL = 0xab,
+	I32X4_SHR_S = 0xac,
+	I32X4_SHR_U = 0xad,
+	I32X4_ADD = 0xae,
+	I32X4_SUB = 0xb1,
+	I32X4_MUL = 0xb5,
+	F32X4_ADD = 0xe4,
+	F32X4_SUB = 0xe5,
+	F32X4_MUL = 0xe6,
+	F32X4_DIV = 0xe7,
+	F64X2_ADD = 0xf0,
+	F64X2_SUB = 0xf1,
+	F64X2_MUL = 0xf2,
+	F64X2_DIV = 0xf3,
+	I32X4_TRUNC_SAT_F32X4_S = 0xf8,
+	I32X4_TRUNC_SAT_F32X4_U = 0xf9,
+	F32X4_CONVERT_I32X4_S = 0xfa,
+	F32X4_CONVERT_I32X4_U = 0xfb,
+};
+
+// Returns true if the type is a 128-bit vector of i8, i16, i32, float or
+// double, or a vector of i1 used as the lane mask of one of them
+bool isSIMDType(const llvm::Type* t);
+// Returns true if the instruction does not involve vectors, or if the writer
+// can lower it to SIMD instructions
+bool canLowerToSIMD(const llvm::Instruction& I);
+// Returns true if the function has vectors which must be scalarized before
+// compiling it to wasm
+bool needsVectorScalarization(const llvm::Function& F);
+
+// Section ids of the WebAssembly MVP binary encoding
+enum WasmSectionId
+{
+	SECTION_CUSTOM = 0,
+	SECTION_TYPE,
+	SECTION_IMPORT,
+	SECTION_FUNCTION,
+	SECTION_TABLE,
+	SECTION_MEMORY,
+	SECTION_GLOBAL,
+	SECTION_EXPORT,
+	SECTION_START,
+	SECTION_ELEMENT,
+	SECTION_CODE,
+	SECTION_DATA
+};
+
 class CheerpWastWriter
 {
+public:
+	enum MODE { WAST = 0, WASM };
 private:
 	llvm::Module& module;
 	llvm::DataLayout targetData;
@@ -56,6 +279,12 @@ private:
 	GlobalDepsAnalyzer & globalDeps;
 	std::unordered_map<const llvm::Function*, uint32_t> functionIds;
 	std::map<llvm::StringRef, uint32_t> functionTableOffsets;
+	// Signature indices in the type section, only used in binary mode.
+	// Equivalent signatures share the same entry
+	std::unordered_map<const llvm::FunctionType*, uint32_t,
+		GlobalDepsAnalyzer::FunctionSignatureHash,
+		GlobalDepsAnalyzer::FunctionSignatureCmp> typeIndices;
+	std::vector<const llvm::FunctionType*> types;
 
 	// Helper class to manage linear memory state
 	LinearMemoryHelper& linearHelper;
@@ -64,31 +293,132 @@ private:
 	uint32_t usedGlobals;
 	uint32_t stackTopGlobal;
 
+	// Sizes of the initial memory (in MB), of the stack (in KB) and the
+	// maximum size of the memory (in MB, 0 means no limit)
+	uint32_t heapSize;
+	uint32_t stackSize;
+	uint32_t maxHeapSize;
+	// Memory limits in WasmPage units, maxMemory is 0 if there is no limit
+	uint32_t minMemory;
+	uint32_t maxMemory;
+	// Initial value of the stack pointer
+	uint32_t stackStart;
+
 	// If true, the Wast file is loaded using a JavaScript loader. This allows
 	// FFI calls to methods outside of the Wast file. When false, write
 	// opcode 'unreachable' for calls to unknown functions.
 	bool useWastLoader;
 
+	// Number of threads used to compile the functions in the code section.
+	// The output does not depend on this value
+	uint32_t codegenThreads;
+
+	// Use the relooper for all functions instead of structuring the reducible
+	// CFGs directly
+	bool useRelooper;
+
+	// State shared by the workers of a parallel compilation, nullptr when
+	// the functions are compiled serially. The inlineable instructions are
+	// computed upfront since querying the PointerAnalyzer fills its caches
+	const llvm::DenseMap<const llvm::Instruction*, bool>* inlineableCache;
+	// Serializes the PHI handling, which needs the PointerAnalyzer
+	std::mutex* analysisLock;
+
+	// Shapes computed by the relooper, reused by functions with the same CFG.
+	// The cache is thread safe and shared with the workers
+	std::shared_ptr<RelooperCache> relooperCache;
+
+	// Word-at-a-time memory helpers, emitted after all the other functions.
+	// memcpy and memmove share the same helper
+	enum MEM_HELPER { MEMMOVE_HELPER = 0, MEMSET_HELPER, MEMCMP_HELPER, NUM_MEM_HELPERS };
+	// Function id of each helper, UINT32_MAX if it is not used
+	std::array<uint32_t, NUM_MEM_HELPERS> memHelperIds;
+
+	// Context used to disambiguate temporary values used in PHI resolution.
+	// It is kept in the writer instead of in Registerize, which is shared
+	// between the workers
+	const llvm::BasicBlock* edgeFromBB;
+	const llvm::BasicBlock* edgeToBB;
+
+	// If not null, the output size of each section is added to the report
+	TimeReport* timeReport;
+	// If not null, the output size of each function and global is added to the report
+	SizeReport* sizeReport;
+
+	/**
+	 * Buffers the contents of a module section. In binary mode the section
+	 * header and size are written to the output stream on destruction, in
+	 * text mode the contents go directly to the output stream
+	 */
+	class Section
+	{
+	private:
+		uint32_t sectionId;
+		CheerpWastWriter& writer;
+		llvm::SmallString<256> buf;
+		llvm::raw_svector_ostream bufStream;
+		// Output position at the beginning of the section
+		uint64_t start;
+	public:
+		llvm::raw_ostream& code;
+		Section(uint32_t sectionId, CheerpWastWriter& writer);
+		~Section();
+	};
+
 	static const char* getTypeString(llvm::Type* t);
-	void compileMethodLocals(const llvm::Function& F, bool needsLabel);
-	void compileMethodParams(const llvm::Function& F);
-	void compileMethodResult(const llvm::Function& F);
-	void compileMethod(const llvm::Function& F);
-	void compileImport(const llvm::Function& F);
-	void compileGlobal(const llvm::GlobalVariable& G);
+	static uint8_t getValType(llvm::Type* t);
+	uint32_t getTypeIndex(const llvm::FunctionType* fTy);
+	void encodePredicate(const llvm::Type* ty, const llvm::CmpInst::Predicate predicate, llvm::raw_ostream& code);
+	void encodeFloatPredicate(const llvm::Type* ty, const llvm::CmpInst::Predicate predicate, llvm::raw_ostream& code);
+	void encodeLoad(llvm::Type* ty, llvm::raw_ostream& code);
+	void encodeStore(llvm::Type* ty, llvm::raw_ostream& code);
+	void encodeBinOp(const llvm::Instruction& I, llvm::raw_ostream& code);
+	void encodeSIMDInst(WasmSIMDOpcode opcode, const llvm::Twine& name, llvm::raw_ostream& code);
+	void encodeSIMDLaneInst(WasmSIMDOpcode opcode, const llvm::Twine& name, uint32_t lane, llvm::raw_ostream& code);
+	void encodeSIMDLoadStoreInst(WasmSIMDOpcode opcode, const char* name, llvm::raw_ostream& code);
+	void encodeV128Const(llvm::ArrayRef<uint8_t> bytes, llvm::raw_ostream& code);
+	void encodeString(llvm::StringRef str, llvm::raw_ostream& code);
+	void compileMethodLocals(llvm::raw_ostream& code, const llvm::Function& F, bool needsLabel);
+	void compileMethodPrologue(llvm::raw_ostream& code, const llvm::Function& F, bool needsLabel);
+	void compileMethodParams(llvm::raw_ostream& code, const llvm::FunctionType* fTy);
+	void compileMethodResult(llvm::raw_ostream& code, const llvm::Type* ty);
+	void compileMethod(llvm::raw_ostream& code, const llvm::Function& F);
+	void compileImport(llvm::raw_ostream& code, const llvm::Function& F);
+	void compileTypeSection();
+	void compileImportSection();
+	void compileFunctionSection();
+	void compileTableSection();
+	void compileMemorySection();
+	void compileGlobalSection();
+	void compileExportSection();
+	void compileStartSection();
+	void compileElementSection();
+	void compileCodeSection();
+	void compileMethodsParallel(const std::vector<const llvm::Function*>& functions, llvm::raw_ostream& code);
+	static MEM_HELPER getMemHelper(const llvm::Function* F);
+	llvm::FunctionType* getMemHelperType(MEM_HELPER helper);
+	uint32_t getNumMemHelpers() const;
+	void compileMemHelper(llvm::raw_ostream& code, MEM_HELPER helper);
 	void compileDataSection();
+	// Write the bytes of a data segment to be loaded at the given address
+	void compileDataSegment(llvm::raw_ostream& code, uint32_t address, llvm::ArrayRef<uint8_t> bytes);
 	// Returns true if it has handled local assignent internally
-	bool compileInstruction(const llvm::Instruction& I);
-	void compileGEP(const llvm::User* gepInst);
-	static const char* getIntegerPredicate(llvm::CmpInst::Predicate p);
+	bool compileInstruction(llvm::raw_ostream& code, const llvm::Instruction& I);
+	// Same as compileInstruction, for instructions with vector operands or results
+	bool compileSIMDInstruction(llvm::raw_ostream& code, const llvm::Instruction& I);
+	void compileGEP(llvm::raw_ostream& code, const llvm::User* gepInst);
+	bool isInlineable(const llvm::Instruction& I) const;
+	uint32_t getRegisterId(const llvm::Instruction* I) const;
 
 	struct WastBytesWriter: public LinearMemoryHelper::ByteListener
 	{
-		llvm::formatted_raw_ostream& stream;
+		llvm::raw_ostream& code;
 		std::map<llvm::StringRef, uint32_t>& functionTableOffsets;
-		WastBytesWriter(llvm::formatted_raw_ostream& stream,
-						std::map<llvm::StringRef, uint32_t>& functionTableOffsets)
-			: stream(stream), functionTableOffsets(functionTableOffsets)
+		MODE mode;
+		WastBytesWriter(llvm::raw_ostream& code,
+						std::map<llvm::StringRef, uint32_t>& functionTableOffsets,
+						MODE mode)
+			: code(code), functionTableOffsets(functionTableOffsets), mode(mode)
 		{
 		}
 		void addByte(uint8_t b) override;
@@ -98,8 +428,9 @@ private:
 	struct WastGepWriter: public LinearMemoryHelper::GepListener
 	{
 		CheerpWastWriter& writer;
+		llvm::raw_ostream& code;
 		bool first;
-		WastGepWriter(CheerpWastWriter& writer):writer(writer),first(true)
+		WastGepWriter(CheerpWastWriter& writer, llvm::raw_ostream& code):writer(writer),code(code),first(true)
 		{
 		}
 		void addValue(const llvm::Value* v, uint32_t size) override;
@@ -107,12 +438,22 @@ private:
 	};
 public:
 	llvm::formatted_raw_ostream& stream;
+	// Text (S-expressions) or binary output
+	const MODE mode;
 	CheerpWastWriter(llvm::Module& m, llvm::formatted_raw_ostream& s, cheerp::PointerAnalyzer & PA,
 			cheerp::Registerize & registerize,
 			cheerp::GlobalDepsAnalyzer & gda,
 			cheerp::LinearMemoryHelper & linearHelper,
 			llvm::LLVMContext& C,
-			bool useWastLoader):
+			bool useWastLoader,
+			uint32_t heapSize,
+			uint32_t stackSize,
+			uint32_t maxHeapSize,
+			MODE mode = WAST,
+			uint32_t codegenThreads = 1,
+			bool useRelooper = false,
+			TimeReport* timeReport = nullptr,
+			SizeReport* sizeReport = nullptr):
 		module(m),
 		targetData(&m),
 		currentFun(NULL),
@@ -123,21 +464,46 @@ public:
 		linearHelper(linearHelper),
 		usedGlobals(0),
 		stackTopGlobal(0),
+		heapSize(heapSize),
+		stackSize(stackSize),
+		maxHeapSize(maxHeapSize),
+		minMemory(0),
+		maxMemory(0),
+		stackStart(0),
 		useWastLoader(useWastLoader),
-		stream(s)
+		codegenThreads(codegenThreads),
+		useRelooper(useRelooper),
+		inlineableCache(nullptr),
+		analysisLock(nullptr),
+		edgeFromBB(nullptr),
+		edgeToBB(nullptr),
+		timeReport(timeReport),
+		sizeReport(sizeReport),
+		stream(s),
+		mode(mode)
 	{
+		memHelperIds.fill(UINT32_MAX);
 	}
 	void makeWast();
-	void compileBB(const llvm::BasicBlock& BB);
-	void compileDowncast(llvm::ImmutableCallSite callV);
-	void compileConstantExpr(const llvm::ConstantExpr* ce);
-	void compileConstant(const llvm::Constant* c);
-	void compileOperand(const llvm::Value* v);
-	void compileSignedInteger(const llvm::Value* v, bool forComparison);
-	void compileUnsignedInteger(const llvm::Value* v);
+	// Encode an instruction in text or binary form, text instructions are terminated by a newline
+	void encodeInst(WasmOpcode opcode, const char* name, llvm::raw_ostream& code);
+	void encodeS32Inst(WasmOpcode opcode, const char* name, int32_t immediate, llvm::raw_ostream& code);
+	void encodeU32Inst(WasmOpcode opcode, const char* name, uint32_t immediate, llvm::raw_ostream& code);
+	void encodeBlockInst(WasmOpcode opcode, const char* name, llvm::raw_ostream& code);
+	void encodeLoadStoreInst(WasmOpcode opcode, const char* name, uint32_t alignLog2, llvm::raw_ostream& code);
+	void encodeMemoryInst(WasmOpcode opcode, const char* name, llvm::raw_ostream& code);
+	void encodeBranchTable(const std::vector<uint32_t>& table, uint32_t defaultBlock, llvm::raw_ostream& code);
+	void compileBB(llvm::raw_ostream& code, const llvm::BasicBlock& BB);
+	void compileDowncast(llvm::raw_ostream& code, llvm::ImmutableCallSite callV);
+	void compileConstantExpr(llvm::raw_ostream& code, const llvm::ConstantExpr* ce);
+	void compileConstant(llvm::raw_ostream& code, const llvm::Constant* c);
+	void compileSIMDConstant(llvm::raw_ostream& code, const llvm::Constant* c);
+	void compileOperand(llvm::raw_ostream& code, const llvm::Value* v);
+	void compileSignedInteger(llvm::raw_ostream& code, const llvm::Value* v, bool forComparison);
+	void compileUnsignedInteger(llvm::raw_ostream& code, const llvm::Value* v);
 	bool needsPointerKindConversion(const llvm::Instruction* phi, const llvm::Value* incoming);
 	bool needsPointerKindConversionForBlocks(const llvm::BasicBlock* to, const llvm::BasicBlock* from);
-	void compilePHIOfBlockFromOtherBlock(const llvm::BasicBlock* to, const llvm::BasicBlock* from);
+	void compilePHIOfBlockFromOtherBlock(llvm::raw_ostream& code, const llvm::BasicBlock* to, const llvm::BasicBlock* from);
 };
 
 }
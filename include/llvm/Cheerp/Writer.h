@@ -18,7 +18,9 @@
 #include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
+#include "llvm/Cheerp/SizeReport.h"
 #include "llvm/Cheerp/SourceMaps.h"
+#include "llvm/Cheerp/TimeReport.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Instructions.h"
@@ -29,8 +31,10 @@
 #include <set>
 #include <map>
 #include <array>
+#include <memory>
 
 struct Relooper;
+struct RelooperCache;
 
 namespace cheerp
 {
@@ -44,6 +48,10 @@ class NewLineHandler
 
 /**
  * Black magic to conditionally enable indented output
+ *
+ * Without indentation and source maps every write goes straight to the
+ * underlying stream. The column offset is only tracked when a source map is
+ * generated, using the known length of characters and strings
  */
 class ostream_proxy
 {
@@ -52,27 +60,53 @@ public:
 		stream(s),
 		sourceMapGenerator(g),
 		readableOutput(readableOutput),
+		plainOutput(!readableOutput && !g),
 		newLine(true),
 		indentLevel(0)
 	{}
+	// Write to another stream, continuing with the indentation of this proxy.
+	// Used to compile parts of the output separately, without source maps
+	ostream_proxy( llvm::raw_ostream & s, const ostream_proxy& other ) :
+		stream(s),
+		sourceMapGenerator(nullptr),
+		readableOutput(other.readableOutput),
+		plainOutput(other.plainOutput),
+		newLine(other.newLine),
+		indentLevel(other.indentLevel)
+	{
+		assert(!other.sourceMapGenerator);
+	}
+
+	// Number of bytes written to the underlying stream
+	uint64_t tell() const { return stream.tell(); }
+
+	// Append the output of a proxy created from this one, it is already
+	// indented and leaves the indentation as it found it
+	void append(llvm::StringRef s) { stream << s; }
 
 	friend ostream_proxy& operator<<( ostream_proxy & os, char c )
 	{
-		uint64_t begin = os.stream.tell();
-		os.write_indent(c);
-		uint64_t end = os.stream.tell();
+		if(os.plainOutput)
+		{
+			os.stream << c;
+			return os;
+		}
+		uint32_t written = os.write_indent(c);
 		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+			os.sourceMapGenerator->addLineOffset(written);
 		return os;
 	}
 
 	friend ostream_proxy& operator<<( ostream_proxy & os, llvm::StringRef s )
 	{
-		uint64_t begin = os.stream.tell();
-		os.write_indent(s);
-		uint64_t end = os.stream.tell();
+		if(os.plainOutput)
+		{
+			os.stream << s;
+			return os;
+		}
+		uint32_t written = os.write_indent(s);
 		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+			os.sourceMapGenerator->addLineOffset(written);
 		return os;
 	}
 
@@ -92,16 +126,18 @@ public:
 		!std::is_convertible<T&&, llvm::StringRef>::value, // Use this only if T is not convertible to StringRef
 		ostream_proxy&>::type operator<<( ostream_proxy & os, T && t )
 	{
-		uint64_t begin = os.stream.tell();
-		if ( os.newLine && os.readableOutput )
-			for ( int i = 0; i < os.indentLevel; i++ )
-				os.stream << '\t';
-
+		if(os.plainOutput)
+		{
+			os.stream << std::forward<T>(t);
+			return os;
+		}
+		// The length of formatted values is not known in advance
+		uint64_t begin = os.sourceMapGenerator ? os.stream.tell() : 0;
+		os.write_tabs(os.indentLevel);
 		os.stream << std::forward<T>(t);
 		os.newLine = false;
-		uint64_t end = os.stream.tell();
 		if(os.sourceMapGenerator)
-			os.sourceMapGenerator->addLineOffset(end-begin);
+			os.sourceMapGenerator->addLineOffset(os.stream.tell()-begin);
 		return os;
 	}
 
@@ -124,24 +160,43 @@ private:
 		return ans;
 	}
 
-	template<class T>
-	void write_indent(T && t)
+	static uint32_t length( char c ) { return 1; }
+	static uint32_t length( llvm::StringRef s ) { return s.size(); }
+
+	// Write the indentation if we are at the beginning of a line, return
+	// the number of tabs written
+	uint32_t write_tabs(int level)
 	{
-		int oldIndent = indentLevel;
-		if (updateIndent( std::forward<T>(t) ) )
-			oldIndent--;
+		if ( !newLine || !readableOutput || level <= 0 )
+			return 0;
+		for ( int i = 0; i < level; i++ )
+			stream << '\t';
+		return level;
+	}
 
-		if ( newLine && readableOutput )
-			for ( int i = 0; i < oldIndent; i++ )
-				stream << '\t';
+	// Return the number of bytes written
+	template<class T>
+	uint32_t write_indent(T && t)
+	{
+		uint32_t written = 0;
+		if ( readableOutput )
+		{
+			int oldIndent = indentLevel;
+			if (updateIndent( std::forward<T>(t) ) )
+				oldIndent--;
+			written = write_tabs(oldIndent);
+		}
 
 		stream << std::forward<T>(t);
 		newLine = false;
+		return written + length(std::forward<T>(t));
 	}
 
 	llvm::raw_ostream & stream;
 	SourceMapGenerator* sourceMapGenerator;
 	bool readableOutput;
+	// Neither indentation nor source maps are needed
+	bool plainOutput;
 	bool newLine;
 	int indentLevel;
 };
@@ -206,10 +261,23 @@ private:
 	// double. Without this flag, normal arrays are used since they are
 	// currently faster on v8.
 	bool forceTypedArrays;
+	// Maximum size in bytes of the typed arrays recycled through the pools,
+	// 0 if pools are not used
+	uint32_t typedArrayPoolSize;
 	// Flag to signal if we should use js variables instead of literals for globals addresses
 	bool symbolicGlobalsAsmJS;
 	// Flag to signal if we should emit readable or compressed output
 	bool readableOutput;
+	// Shapes computed by the relooper, reused by functions with the same CFG
+	std::shared_ptr<RelooperCache> relooperCache;
+	// If not null, the output size of each section is added to the report
+	TimeReport* timeReport;
+	// If not null, the output size of each function and global is added to the report
+	SizeReport* sizeReport;
+	// The URL of the chunk containing the lazily loaded functions, or empty if not present
+	std::string lazyChunkURL;
+	// Number of threads compiling the functions, the output does not depend on it
+	uint32_t codegenThreads;
 
 	/**
 	 * \addtogroup MemFunction methods to handle memcpy, memmove, mallocs and free (and alike)
@@ -234,6 +302,14 @@ private:
 	uint32_t compileArraySize(const DynamicAllocInfo& info, bool shouldPrint, bool isBytes = false);
 	void compileAllocation(const DynamicAllocInfo& info);
 	void compileFree(const llvm::Value* obj);
+	/**
+	 * Return true if the allocation is a small typed array that can be taken from the pools
+	 */
+	bool isPooledAllocation(const DynamicAllocInfo& info);
+	/**
+	 * Compile the helpers that manage the pools of free typed arrays
+	 */
+	void compileTypedArrayPoolHelpers();
 
 	/** @} */
 
@@ -384,7 +460,11 @@ private:
 
 	void compileMethodLocal(llvm::StringRef name, Registerize::REGISTER_KIND kind);
 	void compileMethodLocals(const llvm::Function& F, bool needsLabel);
-	void compileMethod(const llvm::Function& F);
+	// Anonymous methods are compiled as function expressions
+	void compileMethod(const llvm::Function& F, bool anonymous = false);
+	// Compile the functions in order, on codegenThreads threads if possible
+	void compileMethods(const std::vector<const llvm::Function*>& functions);
+	void compileMethodsParallel(const std::vector<const llvm::Function*>& functions);
 	/**
 	 * Helper structure for compiling globals
 	 */
@@ -415,6 +495,16 @@ private:
 	 * a file, usable from the browser and node
 	 */
 	void compileFetchBuffer();
+	/**
+	 * Compile a quoted JS string literal, escaping the special characters
+	 */
+	void compileStringLiteral(llvm::StringRef str);
+	/**
+	 * Compile the stubs of the entry points of the lazily loaded chunk, and
+	 * the helper which synchronously loads the chunk the first time a stub
+	 * is called
+	 */
+	void compileLazyStubs();
 	/**
 	 * This method supports both ConstantArray and ConstantDataSequential
 	 */
@@ -503,7 +593,12 @@ public:
 			bool checkDefined,
 			bool compileGlobalsAddrAsmJS,
 			const std::string& wasmFile,
-			bool forceTypedArrays):
+			bool forceTypedArrays,
+			uint32_t typedArrayPoolSize,
+			TimeReport* timeReport = nullptr,
+			SizeReport* sizeReport = nullptr,
+			const std::string& lazyChunkURL = std::string(),
+			uint32_t codegenThreads = 1):
 		module(m),
 		targetData(&m),
 		currentFun(NULL),
@@ -528,12 +623,59 @@ public:
 		checkDefined(checkDefined),
 		wasmFile(wasmFile),
 		forceTypedArrays(forceTypedArrays),
+		typedArrayPoolSize(typedArrayPoolSize),
 		symbolicGlobalsAsmJS(compileGlobalsAddrAsmJS),
 		readableOutput(readableOutput),
+		timeReport(timeReport),
+		sizeReport(sizeReport),
+		lazyChunkURL(lazyChunkURL),
+		codegenThreads(codegenThreads),
 		stream(s, sourceMapGenerator, readableOutput)
 	{
 	}
+	// Copy of a writer which compiles to another stream, used by the workers
+	// of a parallel compilation
+	CheerpWriter(const CheerpWriter& other, llvm::raw_ostream& s):
+		module(other.module),
+		targetData(other.targetData),
+		currentFun(NULL),
+		PA(other.PA),
+		registerize(other.registerize),
+		globalDeps(other.globalDeps),
+		namegen(other.namegen),
+		types(other.types),
+		compiledGVars(other.compiledGVars),
+		linearHelper(other.linearHelper),
+		asmJSMem(other.asmJSMem),
+		asmJSMemFile(other.asmJSMemFile),
+		sourceMapGenerator(nullptr),
+		NewLine(),
+		useNativeJavaScriptMath(other.useNativeJavaScriptMath),
+		useMathImul(other.useMathImul),
+		useMathFround(other.useMathFround),
+		makeModule(other.makeModule),
+		addCredits(other.addCredits),
+		measureTimeToMain(other.measureTimeToMain),
+		heapSize(other.heapSize),
+		checkBounds(other.checkBounds),
+		checkDefined(other.checkDefined),
+		wasmFile(other.wasmFile),
+		forceTypedArrays(other.forceTypedArrays),
+		typedArrayPoolSize(other.typedArrayPoolSize),
+		symbolicGlobalsAsmJS(other.symbolicGlobalsAsmJS),
+		readableOutput(other.readableOutput),
+		relooperCache(other.relooperCache),
+		timeReport(nullptr),
+		sizeReport(nullptr),
+		lazyChunkURL(other.lazyChunkURL),
+		codegenThreads(1),
+		stream(s, other.stream)
+	{
+	}
 	void makeJS();
+	// Compile the functions of the lazily loaded chunk, when evaluated it
+	// returns the entry points in the order of GlobalDepsAnalyzer::lazyEntryPoints
+	void makeLazyChunk();
 	void compileBB(const llvm::BasicBlock& BB);
 	void compileConstant(const llvm::Constant* c, PARENT_PRIORITY parentPrio = HIGHEST);
 	void compileOperand(const llvm::Value* v, PARENT_PRIORITY parentPrio = HIGHEST, bool allowBooleanObjects = false);
@@ -558,9 +700,9 @@ public:
 	 */
 	void compileMathDeclAsmJS();
 	/**
-	 * Compile the memmove helper function for asm.js code
+	 * Compile the memmove, memset and memcmp helper functions for asm.js code
 	 */
-	void compileMemmoveHelperAsmJS();
+	void compileMemFuncHelpersAsmJS();
 	/**
 	 * Compile a bound-checking statement on REGULAR or SPLIT_REGULAR pointer
 	 */
@@ -594,9 +736,10 @@ public:
 	 */
 	void compileCheckDefinedHelper();
 	/**
-	 * Run relooper on a function, this code is here since it is also used by CheerpWastWriter
+	 * Run relooper on a function, this code is here since it is also used by CheerpWastWriter.
+	 * If a cache is passed the shapes are reused from functions with the same CFG
 	 */
-	static Relooper* runRelooperOnFunction(const llvm::Function& F);
+	static Relooper* runRelooperOnFunction(const llvm::Function& F, RelooperCache* cache = nullptr);
 };
 
 }
@@ -300,6 +300,9 @@ void initializeAllocaArraysPass(PassRegistry&);
 void initializeReplaceNopCastsAndByteSwapsPass(PassRegistry&);
 void initializeTypeOptimizerPass(PassRegistry&);
 void initializeDelayAllocasPass(PassRegistry&);
+void initializeScalarizeNonEscapingObjectsPass(PassRegistry&);
+void initializeDevirtualizerPass(PassRegistry&);
+void initializeFunctionLayoutPass(PassRegistry&);
 void initializePreExecutePass(PassRegistry&);
 void initializeExpandStructRegsPass(PassRegistry&);
 }
@@ -16,10 +16,12 @@
 #define LLVM_TRANSFORMS_SCALAR_H
 
 #include "llvm/ADT/StringRef.h"
+#include <functional>
 
 namespace llvm {
 
 class BasicBlockPass;
+class Function;
 class FunctionPass;
 class Pass;
 class GetElementPtrInst;
@@ -385,6 +387,10 @@ FunctionPass *createSampleProfileLoaderPass(StringRef Name);
 // ScalarizerPass - Converts vector operations into scalar operations
 //
 FunctionPass *createScalarizerPass();
+// Cheerp: ScalarizeLoadStore forces vector loads and stores to be split as
+// well, and only the functions accepted by Ftor are scalarized
+FunctionPass *createScalarizerPass(bool ScalarizeLoadStore,
+                                   std::function<bool(const Function &)> Ftor = nullptr);
 
 //===----------------------------------------------------------------------===//
 //
@@ -0,0 +1,312 @@
+//===-- Devirtualizer.cpp - Cheerp indirect call devirtualization ---------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpDevirtualizer"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Cheerp/Devirtualizer.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InlineAsm.h"
+#include "llvm/IR/Instructions.h"
+#include <algorithm>
+
+STATISTIC(NumDirectCalls, "Number of indirect calls turned into direct calls");
+STATISTIC(NumGuardedCalls, "Number of indirect calls turned into guarded direct calls");
+
+using namespace llvm;
+
+namespace cheerp
+{
+
+uint32_t Devirtualizer::getTypeClass(const Type* t)
+{
+	if (t->isVoidTy())
+		return 0;
+	else if (t->isIntegerTy())
+		return 1;
+	else if (t->isFloatingPointTy())
+		return 2;
+	else if (t->isPointerTy())
+		return 3;
+	return 4;
+}
+
+void Devirtualizer::collectAddressPoints(Module& module)
+{
+	addressPoints.clear();
+	for (GlobalVariable& GV : module.globals())
+	{
+		if (!GV.isConstant() || !GV.hasDefinitiveInitializer())
+			continue;
+		for (User* U : GV.users())
+		{
+			// Address points are constant GEPs to an element of an array of pointers
+			const ConstantExpr* CE = dyn_cast<ConstantExpr>(U);
+			if (!CE || CE->getOpcode() != Instruction::GetElementPtr || CE->getNumOperands() < 3)
+				continue;
+			const ConstantInt* firstIdx = dyn_cast<ConstantInt>(CE->getOperand(1));
+			if (!firstIdx || !firstIdx->isZero())
+				continue;
+			const Constant* parent = GV.getInitializer();
+			for (unsigned i = 2; parent && i < CE->getNumOperands() - 1; i++)
+			{
+				const ConstantInt* idx = dyn_cast<ConstantInt>(CE->getOperand(i));
+				parent = idx ? parent->getAggregateElement(idx->getZExtValue()) : nullptr;
+			}
+			const ConstantInt* lastIdx = dyn_cast<ConstantInt>(CE->getOperand(CE->getNumOperands() - 1));
+			if (!parent || !lastIdx || !parent->getType()->isArrayTy() ||
+				!parent->getType()->getArrayElementType()->isPointerTy())
+				continue;
+			addressPoints.push_back(std::make_pair(parent, lastIdx->getZExtValue()));
+		}
+	}
+}
+
+bool Devirtualizer::getVTableTargets(const CallInst* call, TargetsVec& targets) const
+{
+	// Look for the pattern used by virtual calls: the called value is loaded from
+	// a constant offset of a pointer which is itself loaded from the object
+	const LoadInst* LI = dyn_cast<LoadInst>(call->getCalledValue()->stripPointerCastsSafe());
+	if (!LI)
+		return false;
+	const Value* slotPtr = LI->getPointerOperand()->stripPointerCastsSafe();
+	int64_t slot = 0;
+	if (const GetElementPtrInst* GEP = dyn_cast<GetElementPtrInst>(slotPtr))
+	{
+		const ConstantInt* idx = GEP->getNumIndices() == 1 ? dyn_cast<ConstantInt>(GEP->getOperand(1)) : nullptr;
+		if (!idx)
+			return false;
+		slot = idx->getSExtValue();
+		slotPtr = GEP->getPointerOperand()->stripPointerCastsSafe();
+	}
+	if (!isa<LoadInst>(slotPtr))
+		return false;
+	for (const AddressPoint& ap : addressPoints)
+	{
+		int64_t index = ap.second + slot;
+		if (index < 0 || uint64_t(index) >= ap.first->getType()->getArrayNumElements())
+			continue;
+		const Constant* entry = ap.first->getAggregateElement(index);
+		const Function* F = entry ? dyn_cast<Function>(entry->stripPointerCastsSafe()) : nullptr;
+		if (F && std::find(targets.begin(), targets.end(), F) == targets.end())
+			targets.push_back(F);
+	}
+	return true;
+}
+
+bool Devirtualizer::canCallDirectly(const CallInst* call, const Function* F) const
+{
+	const Function* caller = call->getParent()->getParent();
+	bool asmjs = caller->getSection() == StringRef("asmjs");
+	// Direct calls between the asm.js module and generic JS need to be known by GlobalDepsAnalyzer
+	if (asmjs != (F->getSection() == StringRef("asmjs")))
+		return false;
+	if (F->isVarArg() || F->isIntrinsic())
+		return false;
+	const FunctionType* fTy = cast<FunctionType>(call->getCalledValue()->getType()->getPointerElementType());
+	if (F->getFunctionType() == fTy)
+		return true;
+	// Calls to a casted function are still direct in generic JS, but not in asm.js
+	return !asmjs && F->getFunctionType()->getNumParams() == fTy->getNumParams();
+}
+
+void Devirtualizer::devirtualizeCall(CallInst* call, const TargetsVec& targets, bool needsFallback)
+{
+	Value* calledValue = call->getCalledValue();
+	auto getCallee = [calledValue](const Function* F) -> Constant*
+	{
+		Constant* callee = const_cast<Function*>(F);
+		if (callee->getType() != calledValue->getType())
+			callee = ConstantExpr::getBitCast(callee, calledValue->getType());
+		return callee;
+	};
+	if (targets.size() == 1 && !needsFallback)
+	{
+		call->setCalledFunction(getCallee(targets[0]));
+		NumDirectCalls++;
+		return;
+	}
+
+	BasicBlock* BB = call->getParent();
+	Function* F = BB->getParent();
+	LLVMContext& C = F->getContext();
+	BasicBlock* mergeBlock = BB->splitBasicBlock(call, "devirt.end");
+	BB->getTerminator()->eraseFromParent();
+	PHINode* phi = nullptr;
+	if (!call->getType()->isVoidTy())
+	{
+		phi = PHINode::Create(call->getType(), targets.size() + needsFallback, "", mergeBlock->begin());
+		call->replaceAllUsesWith(phi);
+	}
+	// Without a fallback the last target does not need to be checked
+	uint32_t numGuards = needsFallback ? targets.size() : targets.size() - 1;
+	BasicBlock* current = BB;
+	for (uint32_t i = 0; i < targets.size(); i++)
+	{
+		Constant* callee = getCallee(targets[i]);
+		BasicBlock* callBlock = current;
+		if (i < numGuards)
+		{
+			callBlock = BasicBlock::Create(C, "devirt.call", F, mergeBlock);
+			BasicBlock* nextBlock = BasicBlock::Create(C, "devirt.next", F, mergeBlock);
+			Value* isTarget = new ICmpInst(*current, CmpInst::ICMP_EQ, calledValue, callee);
+			BranchInst::Create(callBlock, nextBlock, isTarget, current);
+			current = nextBlock;
+		}
+		CallInst* directCall = cast<CallInst>(call->clone());
+		directCall->setCalledFunction(callee);
+		callBlock->getInstList().push_back(directCall);
+		BranchInst::Create(mergeBlock, callBlock);
+		if (phi)
+			phi->addIncoming(directCall, callBlock);
+	}
+	if (needsFallback)
+	{
+		call->removeFromParent();
+		current->getInstList().push_back(call);
+		BranchInst::Create(mergeBlock, current);
+		if (phi)
+			phi->addIncoming(call, current);
+	}
+	else
+		call->eraseFromParent();
+	NumGuardedCalls++;
+}
+
+bool Devirtualizer::runOnModule(Module& module)
+{
+	GlobalDepsAnalyzer& GDA = getAnalysis<GlobalDepsAnalyzer>();
+	const FunctionTableInfoMap& functionTables = GDA.functionTables();
+
+	if (maxTargets == 0)
+		return false;
+
+	// Generic JS can call any address taken function through a pointer
+	GenericJSTargetsMap genericJSTargets;
+	auto addGenericJSTarget = [&genericJSTargets](const FunctionType* fTy, const Function* F)
+	{
+		TargetsVec& targets = genericJSTargets[fTy];
+		if (std::find(targets.begin(), targets.end(), F) == targets.end())
+			targets.push_back(F);
+	};
+	std::vector<CallInst*> indirectCalls;
+	for (Function& F : module)
+	{
+		if (F.hasAddressTaken())
+			addGenericJSTarget(F.getFunctionType(), &F);
+		// The address may also be taken as a different function type
+		for (const User* U : F.users())
+		{
+			const ConstantExpr* CE = dyn_cast<ConstantExpr>(U);
+			if (!CE || CE->getOpcode() != Instruction::BitCast)
+				continue;
+			if (const FunctionType* castTy = dyn_cast<FunctionType>(CE->getType()->getPointerElementType()))
+				addGenericJSTarget(castTy, &F);
+		}
+		for (BasicBlock& BB : F)
+		{
+			for (Instruction& I : BB)
+			{
+				CallInst* call = dyn_cast<CallInst>(&I);
+				if (!call || call->isMustTailCall() || isa<InlineAsm>(call->getCalledValue()) ||
+					isa<Function>(call->getCalledValue()->stripPointerCastsSafe()))
+					continue;
+				indirectCalls.push_back(call);
+			}
+		}
+	}
+	if (indirectCalls.empty())
+		return false;
+	collectAddressPoints(module);
+
+	bool Changed = false;
+	for (CallInst* call : indirectCalls)
+	{
+		const FunctionType* fTy = cast<FunctionType>(call->getCalledValue()->getType()->getPointerElementType());
+		if (fTy->isVarArg())
+			continue;
+		// Find the set of functions which may be called. It is complete for asm.js,
+		// but generic JS pointers may also come from casts we do not see or from
+		// JavaScript code, so the indirect call is always kept as a fallback there
+		TargetsVec possibleTargets;
+		bool asmjs = call->getParent()->getParent()->getSection() == StringRef("asmjs");
+		if (asmjs)
+		{
+			auto it = functionTables.find(fTy);
+			if (it == functionTables.end())
+				continue;
+			possibleTargets = it->second.functions;
+		}
+		else
+		{
+			auto it = genericJSTargets.find(fTy);
+			if (it == genericJSTargets.end())
+				continue;
+			possibleTargets.assign(it->second.begin(), it->second.end());
+		}
+		bool allDirect = std::all_of(possibleTargets.begin(), possibleTargets.end(),
+			[&](const Function* F) { return canCallDirectly(call, F); });
+		if (possibleTargets.empty())
+			continue;
+		if (allDirect && possibleTargets.size() <= maxTargets)
+		{
+			devirtualizeCall(call, possibleTargets, /*needsFallback*/ !asmjs);
+			Changed = true;
+			continue;
+		}
+		// Guess the likely targets from the vtables and keep the indirect call as a fallback
+		TargetsVec vtableTargets;
+		if (!getVTableTargets(call, vtableTargets))
+			continue;
+		vtableTargets.erase(std::remove_if(vtableTargets.begin(), vtableTargets.end(),
+			[&](const Function* F)
+			{
+				return std::find(possibleTargets.begin(), possibleTargets.end(), F) == possibleTargets.end() ||
+					!canCallDirectly(call, F);
+			}), vtableTargets.end());
+		if (vtableTargets.empty() || vtableTargets.size() > maxTargets)
+			continue;
+		devirtualizeCall(call, vtableTargets, /*needsFallback*/ true);
+		Changed = true;
+	}
+	// Some function tables may not be used for dispatch anymore
+	if (Changed)
+		GDA.computeFunctionTables(module);
+	return Changed;
+}
+
+const char* Devirtualizer::getPassName() const
+{
+	return "Devirtualizer";
+}
+
+void Devirtualizer::getAnalysisUsage(AnalysisUsage& AU) const
+{
+	AU.addRequired<GlobalDepsAnalyzer>();
+	AU.addPreserved<GlobalDepsAnalyzer>();
+
+	llvm::ModulePass::getAnalysisUsage(AU);
+}
+
+char Devirtualizer::ID = 0;
+
+ModulePass* createDevirtualizerPass(uint32_t maxTargets)
+{
+	return new Devirtualizer(maxTargets);
+}
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(Devirtualizer, "Devirtualizer", "Turn indirect calls with few possible targets into direct calls",
+			false, false)
+INITIALIZE_PASS_END(Devirtualizer, "Devirtualizer", "Turn indirect calls with few possible targets into direct calls",
+			false, false)
@@ -0,0 +1,134 @@
+//===-- FunctionLayout.cpp - Cheerp profile guided function order ---------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "CheerpFunctionLayout"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Cheerp/FunctionLayout.h"
+#include "llvm/ProfileData/InstrProfReader.h"
+#include "llvm/Support/ErrorHandling.h"
+#include <algorithm>
+#include <vector>
+
+STATISTIC(NumHotFunctions, "Number of functions executed according to the profile");
+STATISTIC(NumColdFunctions, "Number of functions never executed according to the profile");
+
+using namespace llvm;
+
+namespace cheerp
+{
+
+void FunctionLayout::readProfile(StringMap<uint64_t>& entryCounts) const
+{
+	auto readerOrError = InstrProfReader::create(profileFile);
+	if (std::error_code ErrorCode = readerOrError.getError())
+	{
+		// An error occurred reading the profile, bail out
+		llvm::report_fatal_error(ErrorCode.message(), false);
+		return;
+	}
+	InstrProfReader& reader = *readerOrError.get();
+	for (const InstrProfRecord& record : reader)
+	{
+		// The first counter is the one of the function entry
+		uint64_t count = record.Counts.empty() ? 0 : record.Counts[0];
+		uint64_t& entry = entryCounts[record.Name];
+		entry = std::max(entry, count);
+		// Functions with local linkage are prefixed by the name of their file
+		size_t colon = record.Name.rfind(':');
+		if (colon != StringRef::npos)
+		{
+			uint64_t& localEntry = entryCounts[record.Name.substr(colon + 1)];
+			localEntry = std::max(localEntry, count);
+		}
+	}
+	if (reader.hasError())
+		llvm::report_fatal_error(reader.getError().message(), false);
+}
+
+bool FunctionLayout::runOnModule(Module& module)
+{
+	if (profileFile.empty())
+		return false;
+
+	StringMap<uint64_t> entryCounts;
+	readProfile(entryCounts);
+
+	std::vector<std::pair<Function*, uint64_t>> hot;
+	std::vector<Function*> unknown;
+	std::vector<Function*> cold;
+	for (Function& F : module)
+	{
+		if (F.empty())
+			continue;
+		auto it = entryCounts.find(F.getName());
+		if (it == entryCounts.end())
+			unknown.push_back(&F);
+		else if (it->second == 0)
+		{
+			// The writers can load cold functions lazily
+			F.addFnAttr(Attribute::Cold);
+			cold.push_back(&F);
+		}
+		else
+			hot.push_back(std::make_pair(&F, it->second));
+	}
+	std::stable_sort(hot.begin(), hot.end(),
+		[](const std::pair<Function*, uint64_t>& lhs, const std::pair<Function*, uint64_t>& rhs)
+		{
+			return lhs.second > rhs.second;
+		});
+	NumHotFunctions += hot.size();
+	NumColdFunctions += cold.size();
+
+	// Move the definitions to the end of the list in the new order,
+	// declarations are not emitted so they can stay where they are
+	Module::FunctionListType& functions = module.getFunctionList();
+	auto moveToEnd = [&](Function* F)
+	{
+		functions.splice(functions.end(), functions, F);
+	};
+	for (const auto& it : hot)
+		moveToEnd(it.first);
+	for (Function* F : unknown)
+		moveToEnd(F);
+	for (Function* F : cold)
+		moveToEnd(F);
+	return !hot.empty() || !cold.empty();
+}
+
+const char* FunctionLayout::getPassName() const
+{
+	return "FunctionLayout";
+}
+
+void FunctionLayout::getAnalysisUsage(AnalysisUsage& AU) const
+{
+	// Only the order of the functions changes
+	AU.setPreservesAll();
+
+	llvm::ModulePass::getAnalysisUsage(AU);
+}
+
+char FunctionLayout::ID = 0;
+
+ModulePass* createFunctionLayoutPass(const std::string& profileFile)
+{
+	return new FunctionLayout(profileFile);
+}
+
+}
+
+using namespace cheerp;
+
+INITIALIZE_PASS_BEGIN(FunctionLayout, "FunctionLayout", "Reorder functions using an instrumentation profile",
+			false, false)
+INITIALIZE_PASS_END(FunctionLayout, "FunctionLayout", "Reorder functions using an instrumentation profile",
+			false, false)
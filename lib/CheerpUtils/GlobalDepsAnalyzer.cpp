@@ -18,6 +18,7 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/ValueSymbolTable.h"
 #include "llvm/Support/FormattedStream.h"
+#include <algorithm>
 
 using namespace llvm;
 
@@ -165,11 +166,53 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 
 	NumRemovedGlobals = filterModule(module);
 
+	computeFunctionTables(module);
+	return true;
+}
+
+/**
+ * Like Function::hasAddressTaken, but ignore the uses from dead constants
+ * and from unused instructions, which are not compiled
+ */
+static bool isAddressTaken(const Value* V, const Function& F)
+{
+	for (const Use& U : V->uses())
+	{
+		const User* user = U.getUser();
+		if (const Instruction* I = dyn_cast<Instruction>(user))
+		{
+			ImmutableCallSite CS(I);
+			if (V == &F && CS && CS.isCallee(&U))
+				continue;
+			if (!I->isTerminator() && I->use_empty() && !I->mayHaveSideEffects())
+				continue;
+			return true;
+		}
+		else if (isa<Constant>(user) && !isa<GlobalValue>(user))
+		{
+			if (isAddressTaken(user, F))
+				return true;
+		}
+		else
+			return true;
+	}
+	return false;
+}
+
+void GlobalDepsAnalyzer::computeFunctionTables( llvm::Module & module )
+{
+	functionTableInfoMap.clear();
+	functionAddressesMap.clear();
 	// If a function is used in indirect calls in asm.js code, put it in the
 	// FunctionTableInfoMap and assign an address to it
-	for (const Function& F : module.getFunctionList()) {
+	for (Function& F : module.getFunctionList()) {
 		bool asmjs = F.getSection() == StringRef("asmjs");
-		if (asmjs && F.hasAddressTaken())
+		if (!asmjs)
+			continue;
+		// Constants left behind by removed globals or by constant folding
+		// are not real uses
+		F.removeDeadConstantUsers();
+		if (isAddressTaken(&F, F))
 		{
 			const FunctionType* fTy = F.getFunctionType();
 			FunctionTableInfo& info = functionTableInfoMap[fTy];
@@ -177,6 +220,24 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 			info.functions.push_back(&F);
 		}
 	}
+	// Find out which tables are actually used by indirect calls
+	for (const Function& F : module.getFunctionList()) {
+		if (F.getSection() != StringRef("asmjs"))
+			continue;
+		for (const BasicBlock& BB : F)
+		{
+			for (const Instruction& I : BB)
+			{
+				const CallInst* ci = dyn_cast<CallInst>(&I);
+				if (!ci || ci->getCalledFunction() || ci->isInlineAsm())
+					continue;
+				const FunctionType* fTy = cast<FunctionType>(ci->getCalledValue()->getType()->getPointerElementType());
+				auto it = functionTableInfoMap.find(fTy);
+				if (it != functionTableInfoMap.end())
+					it->second.hasIndirectCalls = true;
+			}
+		}
+	}
 	// Complete the FunctionTableInfo
 	for (auto& t: functionTableInfoMap)
 	{
@@ -187,7 +248,108 @@ bool GlobalDepsAnalyzer::runOnModule( llvm::Module & module )
 				next_power_of_2 <<= 1;
 		t.second.mask = next_power_of_2 - 1;
 	}
-	return true;
+}
+
+void GlobalDepsAnalyzer::computeLazyFunctions( llvm::Module & module, const std::vector<std::string>& entryPointNames, bool coldEntryPoints )
+{
+	lazyFunctionsSet.clear();
+	lazyFunctionsList.clear();
+	lazyEntryPointsSet.clear();
+	lazyEntryPointsList.clear();
+
+	// The roots are referenced by the writer directly, so they must be
+	// available from the beginning
+	std::unordered_set<const Function*> roots(constructorsNeeded.begin(), constructorsNeeded.end());
+	for (const GlobalValue* GV : externals)
+	{
+		if (const Function* F = dyn_cast<Function>(GV))
+			roots.insert(F);
+	}
+	auto isCandidate = [&](const Function* F)
+	{
+		return F && !F->empty() && F->getSection() != StringRef("asmjs") &&
+			!roots.count(F) && !asmJSImportedFuncions.count(F);
+	};
+	std::unordered_set<const Function*> entryPoints;
+	for (const std::string& name : entryPointNames)
+	{
+		const Function* F = module.getFunction(name);
+		if (!isCandidate(F))
+		{
+			llvm::errs() << "warning: " << name << " cannot be loaded lazily\n";
+			continue;
+		}
+		entryPoints.insert(F);
+	}
+	if (coldEntryPoints)
+	{
+		// Cold functions which are not candidates are silently kept in the main output
+		for (const Function& F : module)
+		{
+			if (F.hasFnAttribute(Attribute::Cold) && isCandidate(&F))
+				entryPoints.insert(&F);
+		}
+	}
+
+	// Start from everything which is directly called by the entry points
+	std::vector<const Function*> queue(entryPoints.begin(), entryPoints.end());
+	lazyFunctionsSet.insert(entryPoints.begin(), entryPoints.end());
+	while (!queue.empty())
+	{
+		const Function* F = queue.back();
+		queue.pop_back();
+		for (const BasicBlock& BB : *F)
+		{
+			for (const Instruction& I : BB)
+			{
+				ImmutableCallSite CS(&I);
+				if (!CS)
+					continue;
+				const Function* callee = CS.getCalledFunction();
+				if (isCandidate(callee) && lazyFunctionsSet.insert(callee).second)
+					queue.push_back(callee);
+			}
+		}
+	}
+
+	// Functions which are used outside of the lazy ones go back to the
+	// main output, until nothing changes. Entry points can be used
+	// anywhere, they are replaced by stubs that load the chunk
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (auto it = lazyFunctionsSet.begin(); it != lazyFunctionsSet.end();)
+		{
+			const Function* F = *it;
+			bool onlyLazyUses = entryPoints.count(F) || std::all_of(F->use_begin(), F->use_end(), [&](const Use& U)
+			{
+				const Instruction* I = dyn_cast<Instruction>(U.getUser());
+				if (!I || !lazyFunctionsSet.count(I->getParent()->getParent()))
+					return false;
+				ImmutableCallSite CS(I);
+				return CS && CS.isCallee(&U);
+			});
+			if (onlyLazyUses)
+				++it;
+			else
+			{
+				it = lazyFunctionsSet.erase(it);
+				changed = true;
+			}
+		}
+	}
+
+	for (const Function& F : module.getFunctionList())
+	{
+		if (!lazyFunctionsSet.count(&F))
+			continue;
+		lazyFunctionsList.push_back(&F);
+		if (!entryPoints.count(&F))
+			continue;
+		lazyEntryPointsSet.insert(&F);
+		lazyEntryPointsList.push_back(&F);
+	}
 }
 
 void GlobalDepsAnalyzer::visitGlobal( const GlobalValue * C, VisitedSet & visited, const SubExprVec & subexpr )
@@ -335,7 +497,9 @@ void GlobalDepsAnalyzer::visitFunction(const Function* F, VisitedSet& visited)
 					if (calleeIsAsmJS && !isAsmJS)
 						asmJSExportedFuncions.insert(calledFunc);
 					// normal function called from asm.js (exclude client globals for now)
-					else if (!calleeIsAsmJS && isAsmJS && !TypeSupport::isClientGlobal(calledFunc))
+					// A missing memcmp is provided by the backend helpers
+					else if (!calleeIsAsmJS && isAsmJS && !TypeSupport::isClientGlobal(calledFunc) &&
+						!(calledFunc->empty() && calledFunc->getName() == "memcmp"))
 						asmJSImportedFuncions.insert(calledFunc);
 				}
 				// TODO: Handle import/export of indirect calls if possible
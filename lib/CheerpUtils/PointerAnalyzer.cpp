@@ -9,20 +9,32 @@
 //
 //===----------------------------------------------------------------------===//
 
+#define DEBUG_TYPE "CheerpPointerAnalyzer"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/PointerAnalyzer.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/Argument.h"
+#include "llvm/IR/AssemblyAnnotationWriter.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/Support/FormattedStream.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include <numeric>
 
 using namespace llvm;
 
+STATISTIC(NumReusedSlots, "Number of pointer kind slots reused from the summaries");
+STATISTIC(NumChangedSlots, "Number of pointer kind slots solved again since the summaries");
+STATISTIC(NumChangedFunctions, "Number of functions whose body or input pointer kind slots changed since the summaries");
+
 namespace cheerp {
 
 PointerKindWrapper PointerKindWrapper::staticDefaultValue(COMPLETE_OBJECT);
@@ -1301,6 +1313,7 @@ void PointerAnalyzer::prefetchFunc(const Function& F) const
 
 const PointerKindWrapper& PointerAnalyzer::getFinalPointerKindWrapper(const Value* p) const
 {
+	auto lock = lockQueries();
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
 #endif //NDEBUG
@@ -1347,6 +1360,7 @@ const PointerConstantOffsetWrapper& PointerAnalyzer::getFinalPointerConstantOffs
 
 POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 {
+	auto lock = lockQueries();
 #ifndef NDEBUG
 	TimerGuard guard(gpkTimer);
 #endif //NDEBUG
@@ -1362,6 +1376,7 @@ POINTER_KIND PointerAnalyzer::getPointerKind(const Value* p) const
 
 POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 {
+	auto lock = lockQueries();
 	if(TypeSupport::hasByteLayout(F->getReturnType()->getPointerElementType()))
 		return BYTE_LAYOUT;
 
@@ -1380,6 +1395,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForReturn(const Function* F) const
 
 POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) const
 {
+	auto lock = lockQueries();
 	IndirectPointerKindConstraint c(STORED_TYPE_CONSTRAINT, pointerType->getPointerElementType());
 	auto it=pointerKindData.constraintsMap.find(c);
 	if(it==pointerKindData.constraintsMap.end())
@@ -1397,6 +1413,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForStoredType(Type* pointerType) con
 
 POINTER_KIND PointerAnalyzer::getPointerKindForArgumentTypeAndIndex( const TypeAndIndex& argTypeAndIndex ) const
 {
+	auto lock = lockQueries();
 	if(TypeSupport::hasByteLayout(argTypeAndIndex.type))
 		return BYTE_LAYOUT;
 
@@ -1414,6 +1431,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForArgumentTypeAndIndex( const TypeA
 
 POINTER_KIND PointerAnalyzer::getPointerKindForMemberPointer(const TypeAndIndex& baseAndIndex) const
 {
+	auto lock = lockQueries();
 	IndirectPointerKindConstraint c(BASE_AND_INDEX_CONSTRAINT, baseAndIndex);
 	auto it=pointerKindData.constraintsMap.find(c);
 	if(it==pointerKindData.constraintsMap.end())
@@ -1448,6 +1466,7 @@ POINTER_KIND PointerAnalyzer::getPointerKindForMemberImpl(const TypeAndIndex& ba
 
 POINTER_KIND PointerAnalyzer::getPointerKindForMember(const TypeAndIndex& baseAndIndex) const
 {
+	auto lock = lockQueries();
 	return getPointerKindForMemberImpl(baseAndIndex, pointerKindData, addressTakenCache);
 }
 
@@ -1501,6 +1520,7 @@ REGULAR_POINTER_PREFERENCE PointerAnalyzer::getRegularPreference(const IndirectP
 
 const ConstantInt* PointerAnalyzer::getConstantOffsetForPointer(const Value * v) const
 {
+	auto lock = lockQueries();
 	auto it=pointerOffsetData.valueMap.find(v);
 	if(it==pointerOffsetData.valueMap.end())
 		return NULL;
@@ -1528,6 +1548,7 @@ const ConstantInt* PointerAnalyzer::getConstantOffsetForPointer(const Value * v)
 
 const llvm::ConstantInt* PointerAnalyzer::getConstantOffsetForMember( const TypeAndIndex& baseAndIndex ) const
 {
+	auto lock = lockQueries();
 	auto it=pointerOffsetData.constraintsMap.find(IndirectPointerKindConstraint(BASE_AND_INDEX_CONSTRAINT, baseAndIndex));
 	if(it==pointerOffsetData.constraintsMap.end())
 		return NULL;
@@ -1587,8 +1608,9 @@ void PointerAnalyzer::invalidate(const Value * v)
 	assert( !pointerOffsetData.valueMap.count(v) );
 }
 
-void PointerAnalyzer::fullResolve()
+uint32_t PointerAnalyzer::fullResolve()
 {
+	uint32_t numResolved = 0;
 	for(auto& it: pointerKindData.argsMap)
 	{
 		if(it.second!=INDIRECT)
@@ -1597,6 +1619,7 @@ void PointerAnalyzer::fullResolve()
 			continue;
 		}
 		bool mayCache = true;
+		numResolved++;
 		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
 		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==SPLIT_REGULAR || k==REGULAR);
 		it.second = k;
@@ -1610,6 +1633,7 @@ void PointerAnalyzer::fullResolve()
 			continue;
 		}
 		bool mayCache = true;
+		numResolved++;
 		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
 		// BYTE_LAYOUT is not expected for the kind of pointers to member
 		assert(k==COMPLETE_OBJECT || k==SPLIT_REGULAR || k==REGULAR);
@@ -1626,6 +1650,7 @@ void PointerAnalyzer::fullResolve()
 			continue;
 		}
 		bool mayCache = true;
+		numResolved++;
 		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
 		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR || k==SPLIT_REGULAR);
 		it.second = k;
@@ -1636,6 +1661,7 @@ void PointerAnalyzer::fullResolve()
 		if(it.second!=INDIRECT)
 			continue;
 		bool mayCache = true;
+		numResolved++;
 		const PointerKindWrapper& k=PointerResolverForKindVisitor(pointerKindData, addressTakenCache).resolvePointerKind(it.second, mayCache);
 		assert(k==COMPLETE_OBJECT || k==BYTE_LAYOUT || k==REGULAR || k==SPLIT_REGULAR);
 		it.second = k;
@@ -1643,6 +1669,474 @@ void PointerAnalyzer::fullResolve()
 #ifndef NDEBUG
 	fullyResolved = true;
 #endif
+	return numResolved;
+}
+
+namespace {
+
+uint64_t getSummaryHash(StringRef str)
+{
+	MD5 md5;
+	md5.update(str);
+	MD5::MD5Result result;
+	md5.final(result);
+	uint64_t hash = 0;
+	for(uint32_t i = 0; i < 8; i++)
+		hash |= uint64_t(result[i]) << (i*8);
+	return hash;
+}
+
+// Named structs are written without their body
+void writeSlotType(raw_ostream& os, Type* t)
+{
+	StructType* st = dyn_cast<StructType>(t);
+	if(st && st->hasName())
+		os << '%' << st->getName();
+	else
+		os << *t;
+}
+
+std::string getArgSlotName(const Argument* arg)
+{
+	std::string name;
+	raw_string_ostream os(name);
+	os << "arg " << arg->getParent()->getName() << ' ' << arg->getArgNo();
+	return os.str();
+}
+
+std::string getMemberSlotName(const TypeAndIndex& member)
+{
+	std::string name;
+	raw_string_ostream os(name);
+	os << "member ";
+	writeSlotType(os, member.type);
+	os << ' ' << member.index;
+	return os.str();
+}
+
+std::string getConstraintSlotName(const IndirectPointerKindConstraint& c)
+{
+	std::string name;
+	raw_string_ostream os(name);
+	switch(c.kind)
+	{
+		case RETURN_CONSTRAINT:
+			os << "return " << c.funcPtr->getName();
+			break;
+		case DIRECT_ARG_CONSTRAINT:
+			os << "direct_arg " << c.argPtr->getParent()->getName() << ' ' << c.argPtr->getArgNo();
+			break;
+		case STORED_TYPE_CONSTRAINT:
+			os << "stored_type ";
+			writeSlotType(os, c.typePtr);
+			break;
+		case RETURN_TYPE_CONSTRAINT:
+			os << "return_type ";
+			writeSlotType(os, c.typePtr);
+			break;
+		case BASE_AND_INDEX_CONSTRAINT:
+			os << "base_and_index ";
+			writeSlotType(os, c.typePtr);
+			os << ' ' << c.i;
+			break;
+		case INDIRECT_ARG_CONSTRAINT:
+			os << "indirect_arg ";
+			writeSlotType(os, c.typePtr);
+			os << ' ' << c.i;
+			break;
+		case DIRECT_ARG_CONSTRAINT_IF_ADDRESS_TAKEN:
+			os << "direct_arg_if_address_taken " << c.argPtr->getParent()->getName() << ' ' << c.argPtr->getArgNo();
+			break;
+	}
+	return os.str();
+}
+
+// Records where each function starts in the printed module
+class FunctionOffsetsWriter: public AssemblyAnnotationWriter
+{
+public:
+	void emitFunctionAnnot(const Function* F, formatted_raw_ostream& os) override
+	{
+		offsets.push_back(std::make_pair(F, os.tell()));
+	}
+	std::vector<std::pair<const Function*, uint64_t>> offsets;
+};
+
+struct SummarySlot
+{
+	std::string name;
+	PointerKindWrapper* kind;
+	// Only set for the slots in constraintsMap
+	const IndirectPointerKindConstraint* constraint;
+	// The slots read while resolving this one
+	std::vector<uint32_t> inputs;
+	uint64_t signature;
+	// Set if the slot, or any slot it reads, changed since the summaries
+	bool dirty;
+};
+
+/**
+ * The slots resolved by fullResolve, and the slots which are read to resolve each one.
+ * It must be built before fullResolve, as it uses the constraints of the kinds
+ */
+class SummarySlotGraph
+{
+public:
+	SummarySlotGraph(PointerAnalyzer::PointerKindData& pointerKindData, PointerAnalyzer::AddressTakenMap& addressTakenCache);
+	// Append the slots read by resolvePointerKind for k to inputs, and their names to names.
+	// Constraints which use the default kind are described by the name of the constraint
+	void getInputs(const PointerKindWrapper& k, std::vector<uint32_t>& inputs, std::vector<std::string>& names);
+
+	std::vector<SummarySlot> slots;
+	DenseMap<const Argument*, uint32_t> argSlots;
+	std::map<TypeAndIndex, uint32_t> memberSlots;
+	DenseMap<const IndirectPointerKindConstraint*, uint32_t> constraintSlots;
+private:
+	// Return the slot which resolveConstraint reads for c, or -1 if it uses the default kind
+	int32_t getInput(const IndirectPointerKindConstraint& c);
+
+	PointerAnalyzer::PointerKindData& pointerKindData;
+	PointerAnalyzer::AddressTakenMap& addressTakenCache;
+};
+
+SummarySlotGraph::SummarySlotGraph(PointerAnalyzer::PointerKindData& pointerKindData, PointerAnalyzer::AddressTakenMap& addressTakenCache):
+	pointerKindData(pointerKindData), addressTakenCache(addressTakenCache)
+{
+	for(auto& it: pointerKindData.argsMap)
+	{
+		const Argument* arg = cast<Argument>(it.first);
+		argSlots[arg] = slots.size();
+		slots.push_back(SummarySlot{getArgSlotName(arg), &it.second, NULL, {}, 0, false});
+	}
+	for(auto& it: pointerKindData.baseStructAndIndexMapForMembers)
+	{
+		memberSlots[it.first] = slots.size();
+		slots.push_back(SummarySlot{getMemberSlotName(it.first), &it.second, NULL, {}, 0, false});
+	}
+	for(auto& it: pointerKindData.constraintsMap)
+	{
+		// The kinds of the direct arguments are stored in argsMap
+		if(it.first.kind == DIRECT_ARG_CONSTRAINT || it.first.kind == DIRECT_ARG_CONSTRAINT_IF_ADDRESS_TAKEN)
+			continue;
+		constraintSlots[&it.first] = slots.size();
+		slots.push_back(SummarySlot{getConstraintSlotName(it.first), &it.second, &it.first, {}, 0, false});
+	}
+
+	// The signature covers everything fullResolve uses for the slot
+	for(SummarySlot& slot: slots)
+	{
+		std::vector<std::string> names;
+		getInputs(*slot.kind, slot.inputs, names);
+		if(slot.constraint && slot.constraint->kind == BASE_AND_INDEX_CONSTRAINT)
+		{
+			// The regular preference depends on the kind of the member
+			TypeAndIndex member(slot.constraint->typePtr, slot.constraint->i, TypeAndIndex::STRUCT_MEMBER);
+			auto it = memberSlots.find(member);
+			if(it != memberSlots.end())
+			{
+				slot.inputs.push_back(it->second);
+				names.push_back(slots[it->second].name);
+			}
+			else
+				names.push_back("!" + getMemberSlotName(member));
+		}
+		std::sort(names.begin(), names.end());
+		std::string signature;
+		raw_string_ostream os(signature);
+		os << slot.name << '\n' << slot.kind->getPointerKind(PREF_NONE) << '\n';
+		for(const std::string& name: names)
+			os << name << '\n';
+		slot.signature = getSummaryHash(os.str());
+	}
+}
+
+int32_t SummarySlotGraph::getInput(const IndirectPointerKindConstraint& c)
+{
+	switch(c.kind)
+	{
+		case DIRECT_ARG_CONSTRAINT:
+		{
+			if (addressTakenCache.checkAddressTaken(c.argPtr->getParent()))
+			{
+				Type* argPointedType = c.argPtr->getType()->getPointerElementType();
+				TypeAndIndex typeAndIndex(argPointedType, c.argPtr->getArgNo(), TypeAndIndex::ARGUMENT);
+				return getInput(IndirectPointerKindConstraint( INDIRECT_ARG_CONSTRAINT, typeAndIndex));
+			}
+			auto it = argSlots.find(c.argPtr);
+			return it == argSlots.end() ? -1 : it->second;
+		}
+		case DIRECT_ARG_CONSTRAINT_IF_ADDRESS_TAKEN:
+		{
+			if (!addressTakenCache.checkAddressTaken(c.argPtr->getParent()))
+				return -1;
+			auto it = argSlots.find(c.argPtr);
+			return it == argSlots.end() ? -1 : it->second;
+		}
+		default:
+		{
+			auto it = pointerKindData.constraintsMap.find(c);
+			if(it == pointerKindData.constraintsMap.end())
+				return -1;
+			return constraintSlots.find(&it->first)->second;
+		}
+	}
+}
+
+void SummarySlotGraph::getInputs(const PointerKindWrapper& k, std::vector<uint32_t>& inputs, std::vector<std::string>& names)
+{
+	for(const IndirectPointerKindConstraint* c: k.constraints)
+	{
+		int32_t input = getInput(*c);
+		if(input < 0)
+		{
+			names.push_back("!" + getConstraintSlotName(*c));
+			continue;
+		}
+		inputs.push_back(input);
+		names.push_back(slots[input].name);
+	}
+}
+
+}
+
+void PointerKindSummaries::read(StringRef buffer)
+{
+	moduleSlots.clear();
+	functions.clear();
+	SmallVector<StringRef, 16> lines;
+	buffer.split(lines, "\n", -1, false);
+	for(StringRef line: lines)
+	{
+		SmallVector<StringRef, 4> fields;
+		if(line.startswith("function\t"))
+		{
+			line.split(fields, "\t", 2);
+			FunctionSummary summary;
+			if(fields.size() != 3 || fields[1].getAsInteger(16, summary.hash))
+				continue;
+			summary.name = fields[2];
+			functions.push_back(summary);
+		}
+		else if(line.startswith("slot\t"))
+		{
+			line.split(fields, "\t", 3);
+			Slot slot;
+			if(fields.size() != 4 || fields[1].getAsInteger(16, slot.signature))
+				continue;
+			// Only resolved kinds can be reused
+			if(fields[2].size() != 1 || fields[2][0] < '0' + COMPLETE_OBJECT || fields[2][0] > '0' + BYTE_LAYOUT)
+				continue;
+			slot.kind = POINTER_KIND(fields[2][0] - '0');
+			slot.name = fields[3];
+			if(functions.empty())
+				moduleSlots.push_back(slot);
+			else
+				functions.back().slots.push_back(slot);
+		}
+	}
+}
+
+void PointerKindSummaries::write(raw_ostream& out) const
+{
+	auto writeSlot = [&out](const Slot& slot)
+	{
+		out << "slot\t";
+		out.write_hex(slot.signature);
+		out << '\t' << char('0' + slot.kind) << '\t' << slot.name << '\n';
+	};
+	for(const Slot& slot: moduleSlots)
+		writeSlot(slot);
+	for(const FunctionSummary& summary: functions)
+	{
+		out << "function\t";
+		out.write_hex(summary.hash);
+		out << '\t' << summary.name << '\n';
+		for(const Slot& slot: summary.slots)
+			writeSlot(slot);
+	}
+}
+
+uint32_t PointerAnalyzer::fullResolve(const Module& M, const PointerKindSummaries& previous, PointerKindSummaries& current,
+					std::vector<const Function*>& changedFunctions)
+{
+	// Names which are not unique can't be matched, they are mapped to NULL
+	StringMap<const PointerKindSummaries::Slot*> previousSlots;
+	StringMap<const PointerKindSummaries::FunctionSummary*> previousFunctions;
+	auto addPreviousSlot = [&previousSlots](const PointerKindSummaries::Slot& slot)
+	{
+		auto it = previousSlots.insert(std::make_pair(slot.name, &slot));
+		if(!it.second)
+			it.first->second = NULL;
+	};
+	for(const PointerKindSummaries::Slot& slot: previous.moduleSlots)
+		addPreviousSlot(slot);
+	for(const PointerKindSummaries::FunctionSummary& summary: previous.functions)
+	{
+		auto it = previousFunctions.insert(std::make_pair(summary.name, &summary));
+		if(!it.second)
+			it.first->second = NULL;
+		for(const PointerKindSummaries::Slot& slot: summary.slots)
+			addPreviousSlot(slot);
+	}
+
+	SummarySlotGraph graph(pointerKindData, addressTakenCache);
+	std::vector<SummarySlot>& slots = graph.slots;
+
+	// A slot must be solved again if it is new, if its signature changed or if it reads a slot which must be solved again
+	StringMap<uint32_t> nameCount;
+	for(const SummarySlot& slot: slots)
+		nameCount[slot.name]++;
+	std::vector<std::vector<uint32_t>> users(slots.size());
+	std::vector<uint32_t> worklist;
+	for(uint32_t i = 0; i < slots.size(); i++)
+	{
+		for(uint32_t input: slots[i].inputs)
+			users[input].push_back(i);
+		const PointerKindSummaries::Slot* previousSlot = previousSlots.lookup(slots[i].name);
+		if(!previousSlot || previousSlot->signature != slots[i].signature || nameCount[slots[i].name] != 1)
+		{
+			slots[i].dirty = true;
+			worklist.push_back(i);
+		}
+	}
+	while(!worklist.empty())
+	{
+		uint32_t i = worklist.back();
+		worklist.pop_back();
+		for(uint32_t user: users[i])
+		{
+			if(slots[user].dirty)
+				continue;
+			slots[user].dirty = true;
+			worklist.push_back(user);
+		}
+	}
+
+	// Collect the slots used by each function, before the kinds are resolved
+	std::vector<std::pair<const Function*, std::vector<uint32_t>>> functionSlots;
+	for(const Function& F: M)
+	{
+		if(F.empty())
+			continue;
+		std::vector<uint32_t> inputs;
+		for(const Argument& arg: F.getArgumentList())
+		{
+			auto it = graph.argSlots.find(&arg);
+			if(it != graph.argSlots.end())
+				inputs.push_back(it->second);
+		}
+		auto ret = pointerKindData.constraintsMap.find(IndirectPointerKindConstraint(RETURN_CONSTRAINT, &F));
+		if(ret != pointerKindData.constraintsMap.end())
+			inputs.push_back(graph.constraintSlots.find(&ret->first)->second);
+		auto addValueInputs = [&](const Value* v)
+		{
+			auto it = pointerKindData.valueMap.find(v);
+			if(it == pointerKindData.valueMap.end())
+				return;
+			std::vector<uint32_t> valueInputs;
+			std::vector<std::string> names;
+			graph.getInputs(it->second, valueInputs, names);
+			std::sort(valueInputs.begin(), valueInputs.end(), [&slots](uint32_t a, uint32_t b)
+			{
+				return slots[a].name < slots[b].name;
+			});
+			inputs.insert(inputs.end(), valueInputs.begin(), valueInputs.end());
+		};
+		for(const Argument& arg: F.getArgumentList())
+			addValueInputs(&arg);
+		for(const BasicBlock& BB: F)
+			for(const Instruction& I: BB)
+				addValueInputs(&I);
+		functionSlots.push_back(std::make_pair(&F, std::move(inputs)));
+	}
+
+	for(SummarySlot& slot: slots)
+	{
+		if(slot.dirty)
+		{
+			NumChangedSlots++;
+			continue;
+		}
+		slot.kind->setResolvedKind(previousSlots.lookup(slot.name)->kind);
+		NumReusedSlots++;
+	}
+
+	uint32_t numResolved = fullResolve();
+
+	current.moduleSlots.clear();
+	current.functions.clear();
+	changedFunctions.clear();
+	auto getSummarySlot = [&slots](uint32_t i)
+	{
+		return PointerKindSummaries::Slot{slots[i].name, slots[i].signature, slots[i].kind->getPointerKind(PREF_NONE)};
+	};
+	// Printing each function on its own would number the whole module every time, so print it once
+	std::string moduleText;
+	FunctionOffsetsWriter offsetsWriter;
+	{
+		raw_string_ostream os(moduleText);
+		M.print(os, &offsetsWriter);
+	}
+	DenseMap<const Function*, StringRef> functionTexts;
+	for(uint32_t i = 0; i < offsetsWriter.offsets.size(); i++)
+	{
+		uint64_t end = i + 1 < offsetsWriter.offsets.size() ? offsetsWriter.offsets[i + 1].second : moduleText.size();
+		uint64_t start = offsetsWriter.offsets[i].second;
+		functionTexts[offsetsWriter.offsets[i].first] = StringRef(moduleText).slice(start, end);
+	}
+	std::vector<bool> written(slots.size(), false);
+	for(const auto& it: functionSlots)
+	{
+		const Function* F = it.first;
+		PointerKindSummaries::FunctionSummary summary{F->getName(), getSummaryHash(functionTexts.lookup(F)), {}};
+		const PointerKindSummaries::FunctionSummary* previousSummary = previousFunctions.lookup(F->getName());
+		bool changed = !previousSummary || previousSummary->hash != summary.hash;
+		for(uint32_t i: it.second)
+		{
+			changed |= slots[i].dirty;
+			if(written[i])
+				continue;
+			written[i] = true;
+			summary.slots.push_back(getSummarySlot(i));
+		}
+		current.functions.push_back(std::move(summary));
+		if(!changed)
+			continue;
+		DEBUG(dbgs() << "Pointer kinds of " << F->getName() << " changed since the summaries\n");
+		NumChangedFunctions++;
+		changedFunctions.push_back(F);
+	}
+	for(uint32_t i = 0; i < slots.size(); i++)
+	{
+		if(!written[i])
+			current.moduleSlots.push_back(getSummarySlot(i));
+	}
+	std::sort(current.moduleSlots.begin(), current.moduleSlots.end(),
+		[](const PointerKindSummaries::Slot& a, const PointerKindSummaries::Slot& b)
+		{
+			return a.name < b.name;
+		});
+	return numResolved;
+}
+
+uint32_t PointerAnalyzer::fullResolve(const Module& M, StringRef summariesFile)
+{
+	// A missing file is the same as empty summaries
+	PointerKindSummaries previous;
+	ErrorOr<std::unique_ptr<MemoryBuffer>> previousFile = MemoryBuffer::getFile(summariesFile);
+	if(previousFile)
+		previous.read((*previousFile)->getBuffer());
+
+	PointerKindSummaries current;
+	std::vector<const Function*> changedFunctions;
+	uint32_t numResolved = fullResolve(M, previous, current, changedFunctions);
+
+	std::error_code ErrorCode;
+	raw_fd_ostream out(summariesFile, ErrorCode, sys::fs::F_Text);
+	if(ErrorCode)
+		llvm::report_fatal_error(ErrorCode.message(), false);
+	current.write(out);
+	return numResolved;
 }
 
 void PointerAnalyzer::computeConstantOffsets(const Module& M)
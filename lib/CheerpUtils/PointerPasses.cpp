@@ -20,17 +20,21 @@
 #include "llvm/Cheerp/Utility.h"
 #include "llvm/IR/CallSite.h"
 #include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Utils/ValueMapper.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/PromoteMemToReg.h"
 #include <set>
 #include <map>
 
 STATISTIC(NumIndirectFun, "Number of indirect functions processed");
 STATISTIC(NumAllocasTransformedToArrays, "Number of allocas of values transformed to allocas of arrays");
+STATISTIC(NumObjectsScalarized, "Number of non escaping objects split into registers");
 
 namespace llvm {
 
@@ -568,6 +572,12 @@ bool FreeAndDeleteRemoval::runOnFunction(Function& F)
 			if(F->getIntrinsicID()==Intrinsic::cheerp_deallocate ||
 				F->getName()=="free")
 			{
+				if(keepTypedArrayFrees && call->getNumArgOperands() == 1)
+				{
+					Type* pointedType = call->getArgOperand(0)->stripPointerCastsSafe()->getType()->getPointerElementType();
+					if(cheerp::TypeSupport::isTypedArrayType(pointedType, /* forceTypedArrays*/ true))
+						continue;
+				}
 				deleteInstructionAndUnusedOperands(call);
 				Changed = true;
 			}
@@ -588,7 +598,200 @@ void FreeAndDeleteRemoval::getAnalysisUsage(AnalysisUsage & AU) const
 	llvm::Pass::getAnalysisUsage(AU);
 }
 
-FunctionPass *createFreeAndDeleteRemovalPass() { return new FreeAndDeleteRemoval(); }
+FunctionPass *createFreeAndDeleteRemovalPass(bool keepTypedArrayFrees) { return new FreeAndDeleteRemoval(keepTypedArrayFrees); }
+
+bool ScalarizeNonEscapingObjects::isDeallocation(const Instruction* I)
+{
+	const CallInst* call = dyn_cast<CallInst>(I);
+	if(!call || call->getNumArgOperands() != 1)
+		return false;
+	const Function* F = call->getCalledFunction();
+	if(!F)
+		return false;
+	return F->getIntrinsicID()==Intrinsic::cheerp_deallocate || F->getName()=="free" || F->getName()=="_ZdlPv";
+}
+
+static bool isScalarizableObjectType(Type* t)
+{
+	StructType* st = dyn_cast<StructType>(t);
+	if(!st || st->isOpaque())
+		return false;
+	return !cheerp::TypeSupport::hasByteLayout(st) && !cheerp::TypeSupport::isClientType(st);
+}
+
+static bool isLifetimeMarker(const Instruction* I)
+{
+	const IntrinsicInst* II = dyn_cast<IntrinsicInst>(I);
+	return II && (II->getIntrinsicID()==Intrinsic::lifetime_start || II->getIntrinsicID()==Intrinsic::lifetime_end);
+}
+
+bool ScalarizeNonEscapingObjects::isNonEscaping(Instruction* I, Type* objType, SmallVectorImpl<GetElementPtrInst*>& fieldGeps,
+		SmallVectorImpl<Instruction*>& toErase)
+{
+	SmallVector<Value*, 4> pointers;
+	pointers.push_back(I);
+	while(!pointers.empty())
+	{
+		Value* V = pointers.pop_back_val();
+		bool isObjectPointer = V->getType()->getPointerElementType() == objType;
+		for(User* U: V->users())
+		{
+			Instruction* userInst = cast<Instruction>(U);
+			if(GetElementPtrInst* gep = dyn_cast<GetElementPtrInst>(userInst))
+			{
+				// Only constant paths to a scalar field are supported
+				if(!isObjectPointer || gep->getPointerOperand() != V || !gep->hasAllConstantIndices())
+					return false;
+				if(!cast<ConstantInt>(gep->getOperand(1))->isZero())
+					return false;
+				Type* fieldType = gep->getType()->getPointerElementType();
+				if(!fieldType->isIntegerTy() && !fieldType->isFloatingPointTy() && !fieldType->isPointerTy())
+					return false;
+				for(User* gepUser: gep->users())
+				{
+					if(LoadInst* LI = dyn_cast<LoadInst>(gepUser))
+					{
+						if(LI->isVolatile())
+							return false;
+					}
+					else if(StoreInst* SI = dyn_cast<StoreInst>(gepUser))
+					{
+						if(SI->isVolatile() || SI->getValueOperand() == gep)
+							return false;
+					}
+					else
+						return false;
+				}
+				fieldGeps.push_back(gep);
+			}
+			else if(isa<BitCastInst>(userInst) ||
+				(isa<IntrinsicInst>(userInst) && cast<IntrinsicInst>(userInst)->getIntrinsicID()==Intrinsic::cheerp_cast_user))
+			{
+				toErase.push_back(userInst);
+				if(userInst->getType()->getPointerElementType() == objType)
+				{
+					pointers.push_back(userInst);
+					continue;
+				}
+				// Casts to other types are only allowed to reach free/delete or lifetime markers
+				for(User* castUser: userInst->users())
+				{
+					Instruction* castUserInst = cast<Instruction>(castUser);
+					if(!isDeallocation(castUserInst) && !isLifetimeMarker(castUserInst))
+						return false;
+					toErase.push_back(castUserInst);
+				}
+			}
+			else if(isDeallocation(userInst) || isLifetimeMarker(userInst))
+				toErase.push_back(userInst);
+			else
+				return false;
+		}
+	}
+	return true;
+}
+
+void ScalarizeNonEscapingObjects::scalarize(Instruction* I, Type* objType, ArrayRef<GetElementPtrInst*> fieldGeps,
+		ArrayRef<Instruction*> toErase, SmallVectorImpl<AllocaInst*>& newAllocas)
+{
+	Function* F = I->getParent()->getParent();
+	Instruction* entryInsertionPoint = F->getEntryBlock().getFirstInsertionPt();
+	std::map<FieldPath, AllocaInst*> fieldAllocas;
+	for(GetElementPtrInst* gep: fieldGeps)
+	{
+		FieldPath path;
+		for(auto it = gep->idx_begin() + 1; it != gep->idx_end(); ++it)
+			path.push_back(cast<ConstantInt>(*it)->getZExtValue());
+		AllocaInst*& fieldAlloca = fieldAllocas[path];
+		if(!fieldAlloca)
+		{
+			Type* fieldType = gep->getType()->getPointerElementType();
+			fieldAlloca = new AllocaInst(fieldType, I->getName()+".field", entryInsertionPoint);
+			// Objects are always zero initialized in the generated code, keep the same semantics
+			new StoreInst(Constant::getNullValue(fieldType), fieldAlloca, I);
+			newAllocas.push_back(fieldAlloca);
+		}
+		gep->replaceAllUsesWith(fieldAlloca);
+		gep->eraseFromParent();
+	}
+	// Users are always collected after the casts they use
+	for(auto it = toErase.rbegin(); it != toErase.rend(); ++it)
+		(*it)->eraseFromParent();
+	assert(I->use_empty());
+	I->eraseFromParent();
+	NumObjectsScalarized++;
+}
+
+bool ScalarizeNonEscapingObjects::runOnFunction(Function& F)
+{
+	if (F.getSection()==StringRef("asmjs"))
+		return false;
+
+	DataLayoutPass* DLP = getAnalysisIfAvailable<DataLayoutPass>();
+	const DataLayout* DL = DLP ? &DLP->getDataLayout() : nullptr;
+
+	SmallVector<std::pair<Instruction*, Type*>, 8> candidates;
+	for ( BasicBlock& BB : F )
+	{
+		for ( Instruction& I : BB )
+		{
+			if(AllocaInst* AI = dyn_cast<AllocaInst>(&I))
+			{
+				if(!AI->isArrayAllocation() && isScalarizableObjectType(AI->getAllocatedType()))
+					candidates.push_back(std::make_pair(AI, AI->getAllocatedType()));
+			}
+			else if(DL && isa<CallInst>(I))
+			{
+				cheerp::DynamicAllocInfo info(&I, DL, false);
+				if(!info.isValidAlloc())
+					continue;
+				cheerp::DynamicAllocInfo::AllocType allocType = info.getAllocType();
+				if(allocType != cheerp::DynamicAllocInfo::malloc && allocType != cheerp::DynamicAllocInfo::opnew &&
+					allocType != cheerp::DynamicAllocInfo::cheerp_allocate)
+					continue;
+				Type* objType = info.getCastedType()->getPointerElementType();
+				if(!isScalarizableObjectType(objType))
+					continue;
+				// Only allocations of exactly one object
+				const ConstantInt* byteSize = dyn_cast<ConstantInt>(info.getByteSizeArg());
+				if(!byteSize || byteSize->getZExtValue() != DL->getTypeAllocSize(objType))
+					continue;
+				candidates.push_back(std::make_pair(&I, objType));
+			}
+		}
+	}
+
+	SmallVector<AllocaInst*, 8> newAllocas;
+	for(auto& c: candidates)
+	{
+		SmallVector<GetElementPtrInst*, 8> fieldGeps;
+		SmallVector<Instruction*, 8> toErase;
+		if(!isNonEscaping(c.first, c.second, fieldGeps, toErase))
+			continue;
+		scalarize(c.first, c.second, fieldGeps, toErase, newAllocas);
+	}
+	if(newAllocas.empty())
+		return false;
+	DominatorTree* DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+	PromoteMemToReg(newAllocas, *DT);
+	return true;
+}
+
+const char* ScalarizeNonEscapingObjects::getPassName() const
+{
+	return "ScalarizeNonEscapingObjects";
+}
+
+char ScalarizeNonEscapingObjects::ID = 0;
+
+void ScalarizeNonEscapingObjects::getAnalysisUsage(AnalysisUsage & AU) const
+{
+	AU.addRequired<DominatorTreeWrapperPass>();
+	AU.addPreserved<DominatorTreeWrapperPass>();
+	llvm::Pass::getAnalysisUsage(AU);
+}
+
+FunctionPass *createScalarizeNonEscapingObjectsPass() { return new ScalarizeNonEscapingObjects(); }
 
 Instruction* DelayAllocas::findCommonInsertionPoint(AllocaInst* AI, DominatorTree* DT, Instruction* currentInsertionPoint, Instruction* user)
 {
@@ -701,6 +904,11 @@ INITIALIZE_PASS_BEGIN(AllocaArrays, "AllocaArrays", "Transform allocas of REGULA
 INITIALIZE_PASS_END(AllocaArrays, "AllocaArrays", "Transform allocas of REGULAR type to arrays of 1 element",
 			false, false)
 
+INITIALIZE_PASS_BEGIN(ScalarizeNonEscapingObjects, "ScalarizeNonEscapingObjects", "Split non escaping objects into registers",
+			false, false)
+INITIALIZE_PASS_END(ScalarizeNonEscapingObjects, "ScalarizeNonEscapingObjects", "Split non escaping objects into registers",
+			false, false)
+
 INITIALIZE_PASS_BEGIN(DelayAllocas, "DelayAllocas", "Moves allocas as close as possible to the actual users",
 			false, false)
 INITIALIZE_PASS_END(DelayAllocas, "DelayAllocas", "Moves allocas as close as possible to the actual users",
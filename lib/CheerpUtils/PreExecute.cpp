@@ -343,6 +343,11 @@ static void* LazyFunctionCreator(const std::string& funcName)
 
 void PreExecute::recordStore(void* Addr)
 {
+    // Initializers usually fill a global with many consecutive stores, skip
+    // the lookup if the address is in the last modified global
+    char* StoreAddr = (char*)Addr;
+    if(StoreAddr >= lastStoreStart && StoreAddr < lastStoreEnd)
+        return;
     // Look for the address in the globals, if found keep note of this
     const GlobalValue* GV=currentEE->getGlobalValueAtAddress(Addr);
     if(!GV)
@@ -350,6 +355,9 @@ void PreExecute::recordStore(void* Addr)
     if(const GlobalVariable* GVar = dyn_cast<GlobalVariable>(GV))
     {
         modifiedGlobals.insert(std::make_pair(const_cast<GlobalVariable*>(GVar),nullptr));
+        Type* globalType = GVar->getType()->getPointerElementType();
+        lastStoreStart = (char*)currentEE->getPointerToGlobal(GVar);
+        lastStoreEnd = lastStoreStart + currentModule->getDataLayout()->getTypeAllocSize(globalType);
         return;
     }
 }
@@ -483,6 +491,15 @@ GlobalValue* PreExecute::getGlobalForMalloc(const DataLayout* DL, char* StoredAd
     return allocData.globalValue;
 }
 
+template<typename T>
+static Constant* computeDataArrayFromMemory(ArrayType* AT, const char* Addr)
+{
+    // Assume little endian
+    SmallVector<T, 64> Elements(AT->getNumElements());
+    memcpy(Elements.data(), Addr, Elements.size() * sizeof(T));
+    return ConstantDataArray::get(AT->getContext(), Elements);
+}
+
 Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
         Type* memType, char* Addr)
 {
@@ -527,6 +544,18 @@ Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
     {
         Type* elementType = AT->getElementType();
         uint32_t elementSize = DL->getTypeAllocSize(elementType);
+        // ConstantArray::get turns arrays of plain numbers into data arrays,
+        // build them directly from memory instead of element by element
+        if (elementType->isIntegerTy(8) && elementSize == 1)
+            return computeDataArrayFromMemory<uint8_t>(AT, Addr);
+        if (elementType->isIntegerTy(16) && elementSize == 2)
+            return computeDataArrayFromMemory<uint16_t>(AT, Addr);
+        if (elementType->isIntegerTy(32) && elementSize == 4)
+            return computeDataArrayFromMemory<uint32_t>(AT, Addr);
+        if (elementType->isFloatTy() && elementSize == 4)
+            return computeDataArrayFromMemory<float>(AT, Addr);
+        if (elementType->isDoubleTy() && elementSize == 8)
+            return computeDataArrayFromMemory<double>(AT, Addr);
         SmallVector<Constant*, 4> Elements;
         for(uint32_t i = 0; i < AT->getNumElements(); i++) {
             char* elementAddr = Addr + i*elementSize;
@@ -592,13 +621,12 @@ Constant* PreExecute::computeInitializerFromMemory(const DataLayout* DL,
     return NULL;
 }
 
-bool PreExecute::runOnConstructor(const Target* target, const std::string& triple, llvm::Module& m, llvm::Function* func)
+void PreExecute::createEngine(const Target* target, const std::string& triple, llvm::Module& m)
 {
-    bool Changed = false;
-
     std::string error;
     TargetMachine* machine;
-    machine = target->createTargetMachine(triple, "", "", TargetOptions());
+    // The interpreter does not need a target machine, the host target may not be built
+    machine = target ? target->createTargetMachine(triple, "", "", TargetOptions()) : nullptr;
 
     std::unique_ptr<Module> uniqM(&m);
 
@@ -612,12 +640,57 @@ bool PreExecute::runOnConstructor(const Target* target, const std::string& tripl
     assert(currentEE && "failed to create execution engine!");
     currentEE->InstallStoreListener(StoreListener);
     currentEE->InstallLazyFunctionCreator(LazyFunctionCreator);
+}
+
+void PreExecute::destroyEngine(llvm::Module& m)
+{
+    typedAllocations.clear();
+
+#ifdef DEBUG_PRE_EXECUTE
+    currentEE->printMemoryStats();
+#endif
+
+    bool removed = currentEE->removeModule(&m);
+    assert(removed && "failed to free the module from ExecutionEngine");
+
+    delete currentEE;
+
+    currentEE = NULL;
+}
+
+bool PreExecute::runOnConstructor(const Target* target, const std::string& triple, llvm::Module& m, llvm::Function* func)
+{
+    bool Changed = false;
+
+    // The engine is shared by all the constructors, the memory already
+    // contains the effects of the previous ones
+    if(!currentEE)
+        createEngine(target, triple, m);
+    lastStoreStart = lastStoreEnd = nullptr;
 
     currentEE->runFunction(func, std::vector< GenericValue >());
     if(currentEE->hasFailed())
     {
-        // Execution could not be safely completed. Clean up.
+        // Execution could not be safely completed. Clean up, and start again
+        // from the initializers with the next constructor
         modifiedGlobals.clear();
+        destroyEngine(m);
+        return false;
+    }
+
+    const DataLayout *DL = m.getDataLayout();
+    // Memory promoted to globals by previous constructors may have been
+    // modified without storing to a global
+    for(auto& it: typedAllocations)
+    {
+        GlobalVariable* GV = it.second.globalValue;
+        if(!GV)
+            continue;
+        Constant* newInit = computeInitializerFromMemory(DL, GV->getType()->getPointerElementType(), it.first);
+        if(newInit == GV->getInitializer())
+            continue;
+        GV->setInitializer(newInit);
+        Changed = true;
     }
 
     // Compute new initializer for the modified globals
@@ -626,7 +699,6 @@ bool PreExecute::runOnConstructor(const Target* target, const std::string& tripl
         GlobalVariable* GV = it.first;
         void* Addr = currentEE->getPointerToGlobal(GV);
         Constant* newInit;
-        const DataLayout *DL = m.getDataLayout();
         Type *ptrType = GV->getType()->getPointerElementType();
         newInit = computeInitializerFromMemory(DL, ptrType, (char*)Addr);
         assert(newInit);
@@ -642,18 +714,6 @@ bool PreExecute::runOnConstructor(const Target* target, const std::string& tripl
     }
 
     modifiedGlobals.clear();
-    typedAllocations.clear();
-
-#ifdef DEBUG_PRE_EXECUTE
-    currentEE->printMemoryStats();
-#endif
-
-    bool removed = currentEE->removeModule(&m);
-    assert(removed && "failed to free the module from ExecutionEngine");
-
-    delete currentEE;
-
-    currentEE = NULL;
     return Changed;
 }
 
@@ -694,17 +754,24 @@ bool PreExecute::runOnModule(Module& m)
         }
     }
 
+    Function* mainFunc = nullptr;
+    bool mainChanged = false;
     if (PreExecuteMain)
     {
-        Function* mainFunc = m.getFunction("_Z7webMainv");
+        mainFunc = m.getFunction("_Z7webMainv");
         if (!mainFunc)
             mainFunc = m.getFunction("main");
         assert(mainFunc && "unable to find main/webMain in module!");
-        if(runOnConstructor(target, triple, m, mainFunc))
-        {
-            Changed |= true;
-            mainFunc->eraseFromParent();
-        }
+        mainChanged = runOnConstructor(target, triple, m, mainFunc);
+    }
+
+    if (currentEE)
+        destroyEngine(m);
+
+    if (mainChanged)
+    {
+        Changed |= true;
+        mainFunc->eraseFromParent();
     }
 
     // Delete global constructors and remove the main body
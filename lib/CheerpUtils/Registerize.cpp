@@ -19,6 +19,8 @@
 #include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/Support/Debug.h"
+#include <algorithm>
+#include <functional>
 
 using namespace llvm;
 
@@ -62,6 +64,8 @@ const char* Registerize::getPassName() const
 	return "CheerpRegisterize";
 }
 
+thread_local Registerize::EdgeContext Registerize::edgeContext;
+
 uint32_t Registerize::getRegisterId(const llvm::Instruction* I) const
 {
 	assert(RegistersAssigned);
@@ -379,7 +383,7 @@ uint32_t Registerize::assignToRegisters(Function& F, const InstIdMapTy& instIdMa
 {
 	llvm::SmallVector<RegisterRange, 4> registers;
 	// First try to assign all PHI operands to the same register as the PHI itself
-	for(auto it: liveRanges)
+	for(const auto& it: liveRanges)
 	{
 		Instruction* I=it.first;
 		if(!isa<PHINode>(I))
@@ -387,18 +391,23 @@ uint32_t Registerize::assignToRegisters(Function& F, const InstIdMapTy& instIdMa
 		handlePHI(*I, liveRanges, registers, PA);
 	}
 	// Assign a register to the remaining instructions
-	for(auto it: liveRanges)
+	if(LinearScan)
+		assignToRegistersLinearScan(liveRanges, registers, PA);
+	else
 	{
-		Instruction* I=it.first;
-		if(isa<PHINode>(I))
-			continue;
-		InstructionLiveRange& range=it.second;
-		// Move on if a register is already assigned
-		if(registersMap.count(I))
-			continue;
-		bool asmjs = I->getParent()->getParent()->getSection()==StringRef("asmjs");
-		uint32_t chosenRegister=findOrCreateRegister(registers, range, getRegKindFromType(I->getType(), asmjs), cheerp::needsSecondaryName(I, PA));
-		registersMap[I] = chosenRegister;
+		for(const auto& it: liveRanges)
+		{
+			Instruction* I=it.first;
+			if(isa<PHINode>(I))
+				continue;
+			const InstructionLiveRange& range=it.second;
+			// Move on if a register is already assigned
+			if(registersMap.count(I))
+				continue;
+			bool asmjs = I->getParent()->getParent()->getSection()==StringRef("asmjs");
+			uint32_t chosenRegister=findOrCreateRegister(registers, range, getRegKindFromType(I->getType(), asmjs), cheerp::needsSecondaryName(I, PA));
+			registersMap[I] = chosenRegister;
+		}
 	}
 	// Assign registers for temporary values required to break loops in PHIs
 	class RegisterizePHIHandler: public EndOfBlockPHIHandler
@@ -490,6 +499,81 @@ uint32_t Registerize::assignToRegisters(Function& F, const InstIdMapTy& instIdMa
 	return registers.size();
 }
 
+void Registerize::assignToRegistersLinearScan(const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA)
+{
+	// Ranges are visited in order of their start. For each kind busy registers are kept in a min-heap
+	// sorted by the end of their last chunk, once the end is reached the register is free for all
+	// the following ranges. Holes in the middle of registers are not reused.
+	typedef std::pair<uint32_t, uint32_t> EndAndRegister;
+	std::vector<EndAndRegister> busyRegisters[5];
+	std::vector<uint32_t> freeRegisters[5];
+	auto getRangeEnd = [this](const LiveRange& range)
+	{
+		uint32_t end = 0;
+		// Empty chunks still interfere with ranges starting at the same point
+		for(const LiveRangeChunk& chunk: range)
+			end = std::max(end, std::max(chunk.end, chunk.start+1));
+		NumLinearScanChunks += range.size();
+		return end;
+	};
+	// Registers already used by PHIs can be reused as well
+	for(uint32_t i=0;i<registers.size();i++)
+		busyRegisters[registers[i].info.regKind].push_back(EndAndRegister(getRangeEnd(registers[i].range), i));
+	for(std::vector<EndAndRegister>& busy: busyRegisters)
+		std::make_heap(busy.begin(), busy.end(), std::greater<EndAndRegister>());
+	std::vector<std::pair<uint32_t, const LiveRangesTy::value_type*>> pendingRanges;
+	for(const auto& it: liveRanges)
+	{
+		if(isa<PHINode>(it.first) || registersMap.count(it.first))
+			continue;
+		uint32_t start = 0xffffffff;
+		for(const LiveRangeChunk& chunk: it.second.range)
+			start = std::min(start, chunk.start);
+		NumLinearScanChunks += it.second.range.size();
+		pendingRanges.push_back(std::make_pair(start, &it));
+	}
+	std::stable_sort(pendingRanges.begin(), pendingRanges.end(),
+		[](const std::pair<uint32_t, const LiveRangesTy::value_type*>& l, const std::pair<uint32_t, const LiveRangesTy::value_type*>& r)
+		{
+			return l.first < r.first;
+		});
+	for(const auto& it: pendingRanges)
+	{
+		Instruction* I=it.second->first;
+		const InstructionLiveRange& range=it.second->second;
+		bool asmjs = I->getParent()->getParent()->getSection()==StringRef("asmjs");
+		REGISTER_KIND kind = getRegKindFromType(I->getType(), asmjs);
+		bool needsSecondaryName = cheerp::needsSecondaryName(I, PA);
+		std::vector<EndAndRegister>& busy = busyRegisters[kind];
+		std::vector<uint32_t>& available = freeRegisters[kind];
+		while(!busy.empty() && busy.front().first <= it.first)
+		{
+			available.push_back(busy.front().second);
+			std::pop_heap(busy.begin(), busy.end(), std::greater<EndAndRegister>());
+			busy.pop_back();
+		}
+		uint32_t chosenRegister;
+		if(available.empty())
+		{
+			chosenRegister = registers.size();
+			registers.push_back(RegisterRange(range.range, kind, needsSecondaryName));
+		}
+		else
+		{
+			chosenRegister = available.back();
+			available.pop_back();
+			// The register ends before the range starts, so they can't interfere
+			RegisterRange& regRange = registers[chosenRegister];
+			regRange.range.merge(range.range);
+			regRange.info.needsSecondaryName |= needsSecondaryName;
+		}
+		registersMap[I] = chosenRegister;
+		// The register was free, so its new end is the end of the range
+		busy.push_back(EndAndRegister(getRangeEnd(range.range), chosenRegister));
+		std::push_heap(busy.begin(), busy.end(), std::greater<EndAndRegister>());
+	}
+}
+
 void Registerize::handlePHI(Instruction& I, const LiveRangesTy& liveRanges, llvm::SmallVector<RegisterRange, 4>& registers, const PointerAnalyzer& PA)
 {
 	bool asmjs = I.getParent()->getParent()->getSection()==StringRef("asmjs");
@@ -567,6 +651,9 @@ Registerize::REGISTER_KIND Registerize::getRegKindFromType(const llvm::Type* t,
 		return FLOAT;
 	else if(t->isFloatingPointTy())
 		return DOUBLE;
+	// Vectors are only left in asm.js functions compiled to wasm SIMD
+	else if(asmjs && t->isVectorTy())
+		return VECTOR;
 	// Pointers in asm.js are just integers
 	else if(asmjs)
 		return INTEGER;
@@ -615,8 +702,11 @@ bool Registerize::LiveRange::doesInterfere(const LiveRange& other) const
 
 void Registerize::LiveRange::merge(const LiveRange& other)
 {
+	// If other starts after the end of this range appending is enough to keep the chunks sorted
+	bool needsSort = !std::is_sorted(other.begin(), other.end()) || (!empty() && !other.empty() && back().end > other.front().start);
 	insert(end(), other.begin(), other.end());
-	std::sort(begin(), end());
+	if(needsSort)
+		std::sort(begin(), end());
 	//TODO: Merge adjacent ranges
 }
 
@@ -1001,9 +1091,9 @@ void Registerize::invalidateLiveRangeForAllocas(llvm::Function& F)
 	}
 }
 
-ModulePass* createRegisterizePass(bool useFloats, bool NoRegisterize)
+ModulePass* createRegisterizePass(bool useFloats, bool NoRegisterize, bool LinearScan)
 {
-	return new Registerize(useFloats, NoRegisterize);
+	return new Registerize(useFloats, NoRegisterize, LinearScan);
 }
 
 }
@@ -240,6 +240,13 @@ bool StructMemFuncLowering::runOnBlock(BasicBlock& BB)
 		if(mode==NONE)
 			continue;
 		Type* pointedType = F->getFunctionType()->getParamType(0)->getPointerElementType();
+		// Linear memory code uses the word-at-a-time helpers of the backend, unless it is a single element
+		if(BB.getParent()->getSection() == StringRef("asmjs"))
+		{
+			ConstantInt* constantSize = dyn_cast<ConstantInt>(CI->getOperand(2));
+			if(!constantSize || constantSize->getZExtValue() > DL->getTypeAllocSize(pointedType))
+				continue;
+		}
 		//We want to decompose everything which is not a byte layout structure. memset is always decomposed.
 		if(mode != MEMSET)
 		{
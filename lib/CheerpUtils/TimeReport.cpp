@@ -0,0 +1,133 @@
+//===-- TimeReport.cpp - Cheerp backend timing report ---------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/TimeReport.h"
+#include "llvm/Config/config.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/Timer.h"
+#ifdef HAVE_SYS_RESOURCE_H
+#include <sys/resource.h>
+#endif
+
+using namespace llvm;
+
+namespace cheerp
+{
+
+void TimeReport::beginPhase(StringRef name)
+{
+	endPhase();
+	currentPhase = name;
+	currentPhaseStart = TimeRecord::getCurrentTime(true).getWallTime();
+}
+
+void TimeReport::endPhase()
+{
+	if (currentPhase.empty())
+		return;
+	double wallTime = TimeRecord::getCurrentTime(false).getWallTime() - currentPhaseStart;
+	phases.push_back(PhaseInfo{currentPhase, wallTime, getPeakRSS()});
+	currentPhase.clear();
+}
+
+void TimeReport::addCounter(StringRef name, uint64_t value)
+{
+	for (auto& counter: counters)
+	{
+		if (counter.first == name)
+		{
+			counter.second += value;
+			return;
+		}
+	}
+	counters.push_back(std::make_pair(name.str(), value));
+}
+
+void TimeReport::print(raw_ostream& out)
+{
+	endPhase();
+	double totalTime = 0;
+	out << "{\n\t\"phases\": [";
+	for (uint32_t i = 0; i < phases.size(); i++)
+	{
+		const PhaseInfo& phase = phases[i];
+		totalTime += phase.wallTime;
+		out << (i ? ",\n" : "\n") << "\t\t{\"name\": \"";
+		out.write_escaped(phase.name);
+		out << "\", \"wall_time\": " << format("%.6f", phase.wallTime);
+		out << ", \"peak_rss\": " << phase.peakRSS << "}";
+	}
+	out << "\n\t],\n\t\"counters\": {";
+	for (uint32_t i = 0; i < counters.size(); i++)
+	{
+		out << (i ? ",\n" : "\n") << "\t\t\"";
+		out.write_escaped(counters[i].first);
+		out << "\": " << counters[i].second;
+	}
+	out << "\n\t},\n";
+	out << "\t\"wall_time\": " << format("%.6f", totalTime) << ",\n";
+	out << "\t\"peak_rss\": " << getPeakRSS() << "\n}\n";
+}
+
+uint64_t TimeReport::getPeakRSS()
+{
+#if defined(HAVE_GETRUSAGE) && defined(HAVE_SYS_RESOURCE_H)
+	struct rusage RU;
+	if (::getrusage(RUSAGE_SELF, &RU) != 0)
+		return 0;
+#ifdef __APPLE__
+	// Darwin reports the size in bytes
+	return RU.ru_maxrss;
+#else
+	return uint64_t(RU.ru_maxrss) * 1024;
+#endif
+#else
+	return 0;
+#endif
+}
+
+namespace
+{
+
+class TimeReportPhase : public ModulePass
+{
+public:
+	static char ID;
+	TimeReportPhase(TimeReport& report, StringRef phase) : ModulePass(ID), report(report), phase(phase) {}
+	bool runOnModule(Module&) override
+	{
+		report.beginPhase(phase);
+		return false;
+	}
+	void getAnalysisUsage(AnalysisUsage& AU) const override
+	{
+		AU.setPreservesAll();
+	}
+	const char* getPassName() const override
+	{
+		return "TimeReportPhase";
+	}
+private:
+	TimeReport& report;
+	std::string phase;
+};
+
+char TimeReportPhase::ID = 0;
+
+}
+
+ModulePass* createTimeReportPhasePass(TimeReport& report, StringRef phase)
+{
+	return new TimeReportPhase(report, phase);
+}
+
+}
@@ -185,6 +185,9 @@ bool isInlineable(const Instruction& I, const PointerAnalyzer& PA)
 			case Instruction::FPToUI:
 			case Instruction::PtrToInt:
 			case Instruction::IntToPtr:
+			case Instruction::ExtractElement:
+			case Instruction::InsertElement:
+			case Instruction::ShuffleVector:
 				return true;
 			default:
 				llvm::report_fatal_error(Twine("Unsupported opcode: ",StringRef(I.getOpcodeName())), false);
@@ -757,6 +760,9 @@ void initializeCheerpOpts(PassRegistry &Registry)
 	initializeReplaceNopCastsAndByteSwapsPass(Registry);
 	initializeTypeOptimizerPass(Registry);
 	initializeDelayAllocasPass(Registry);
+	initializeScalarizeNonEscapingObjectsPass(Registry);
+	initializeDevirtualizerPass(Registry);
+	initializeFunctionLayoutPass(Registry);
 	initializePreExecutePass(Registry);
 	initializeExpandStructRegsPass(Registry);
 }
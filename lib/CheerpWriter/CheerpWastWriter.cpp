@@ -10,11 +10,19 @@
 //===----------------------------------------------------------------------===//
 
 #include <algorithm>
+#include <atomic>
+#include <thread>
 
 #include "Relooper.h"
 #include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/Writer.h"
 #include "llvm/Cheerp/WastWriter.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/Support/LEB128.h"
+#include "llvm/Support/Threading.h"
 
 using namespace cheerp;
 using namespace llvm;
@@ -27,11 +35,13 @@ class BlockType
 public:
 	BLOCK_TYPE type;
 	uint32_t depth;
+	int label;
 
-	BlockType(BLOCK_TYPE bt, uint32_t depth = 0)
+	BlockType(BLOCK_TYPE bt, uint32_t depth = 0, int label = -1)
 	 :
 		type(bt),
-		depth(depth)
+		depth(depth),
+		label(label)
 	{}
 };
 
@@ -51,15 +61,18 @@ class CheerpWastRenderInterface: public RenderInterface
 {
 private:
 	CheerpWastWriter* writer;
+	llvm::raw_ostream& code;
 	std::vector<BlockType> blockTypes;
 	uint32_t labelLocal;
 	void renderCondition(const BasicBlock* B, int branchId);
 	void indent();
+	uint32_t findLabeledLoopDepth(int labelId) const;
 public:
 	const BasicBlock* lastDepth0Block;
-	CheerpWastRenderInterface(CheerpWastWriter* w, uint32_t labelLocal)
+	CheerpWastRenderInterface(CheerpWastWriter* w, llvm::raw_ostream& code, uint32_t labelLocal)
 	 :
 		writer(w),
+		code(code),
 		labelLocal(labelLocal),
 		lastDepth0Block(nullptr)
 	{ }
@@ -96,13 +109,50 @@ void CheerpWastRenderInterface::renderBlock(const void* privateBlock)
 		lastDepth0Block = bb;
 	else
 		lastDepth0Block = nullptr;
-	writer->compileBB(*bb);
+	writer->compileBB(code, *bb);
 }
 
 void CheerpWastRenderInterface::indent()
 {
+	if (writer->mode != CheerpWastWriter::WAST)
+		return;
 	for(uint32_t i=0;i<blockTypes.size();i++)
-		writer->stream << "  ";
+		code << "  ";
+}
+
+uint32_t CheerpWastRenderInterface::findLabeledLoopDepth(int labelId) const
+{
+	// Named labels only exist in the text format, in binary mode the
+	// relative depth of the labeled loop has to be computed
+	uint32_t breakIndex = 0;
+	for (uint32_t i = 0; i < blockTypes.size(); i++)
+	{
+		const BlockType& block = blockTypes[blockTypes.size() - i - 1];
+		switch(block.type)
+		{
+			case WHILE1:
+				if (block.label == labelId)
+					return breakIndex;
+				// loop + block
+				breakIndex += 2;
+				break;
+			case DO:
+				if (block.label == labelId)
+					return breakIndex;
+				breakIndex += 1;
+				break;
+			case IF:
+				breakIndex += block.depth + 1;
+				break;
+			case SWITCH:
+				// The switch keeps open one block for each case still to be rendered
+				breakIndex += block.depth;
+				break;
+			case CASE:
+				break;
+		}
+	}
+	llvm_unreachable("labeled loop not found");
 }
 
 void CheerpWastRenderInterface::renderCondition(const BasicBlock* bb, int branchId)
@@ -115,7 +165,7 @@ void CheerpWastRenderInterface::renderCondition(const BasicBlock* bb, int branch
 		assert(bi->isConditional());
 		//The second branch is the default
 		assert(branchId==0);
-		writer->compileOperand(bi->getCondition());
+		writer->compileOperand(code, bi->getCondition());
 	}
 	else if(isa<SwitchInst>(term))
 	{
@@ -125,10 +175,9 @@ void CheerpWastRenderInterface::renderCondition(const BasicBlock* bb, int branch
 		for(int i=1;i<branchId;i++)
 			++it;
 		const BasicBlock* dest=it.getCaseSuccessor();
-		writer->compileOperand(si->getCondition());
-		writer->stream << '\n';
-		writer->compileOperand(it.getCaseValue());
-		writer->stream << "\ni32.eq";
+		writer->compileOperand(code, si->getCondition());
+		writer->compileOperand(code, it.getCaseValue());
+		writer->encodeInst(WasmOpcode::I32_EQ, "i32.eq", code);
 		//We found the destination, there may be more cases for the same
 		//destination though
 		for(++it;it!=si->case_end();++it)
@@ -136,11 +185,10 @@ void CheerpWastRenderInterface::renderCondition(const BasicBlock* bb, int branch
 			if(it.getCaseSuccessor()==dest)
 			{
 				//Also add this condition
-				writer->stream << '\n';
-				writer->compileOperand(si->getCondition());
-				writer->stream << '\n';
-				writer->compileOperand(it.getCaseValue());
-				writer->stream << "\ni32.eq\ni32.or";
+				writer->compileOperand(code, si->getCondition());
+				writer->compileOperand(code, it.getCaseValue());
+				writer->encodeInst(WasmOpcode::I32_EQ, "i32.eq", code);
+				writer->encodeInst(WasmOpcode::I32_OR, "i32.or", code);
 			}
 		}
 	}
@@ -186,27 +234,22 @@ void CheerpWastRenderInterface::renderSwitchOnLabel(IdShapeMap& idShapeMap)
 	}
 
 	for (uint32_t i = 0; i < idShapeMap.size() + 1; i++)
-		writer->stream << "block\n";
+		writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
 
 	// Wrap the br_table instruction in its own block
-	writer->stream << "block\n";
-	writer->stream << "get_local " << labelLocal;
+	writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
+	writer->encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", labelLocal, code);
 	if (min != 0)
 	{
-		writer->stream << "\ni32.const " << min;
-		writer->stream << "\ni32.sub";
+		writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", min, code);
+		writer->encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
 	}
-	writer->stream << "\nbr_table";
-
-	for (auto label : table)
-		writer->stream << " " << label;
-	writer->stream << " 0\n";
-
-	writer->stream << "\nend\n";
+	writer->encodeBranchTable(table, 0, code);
+	writer->encodeInst(WasmOpcode::END, "end", code);
 
 	// The first block does not do anything, and breaks out of the switch.
-	writer->stream << "br " << idShapeMap.size() << "\n";
-	writer->stream << "\nend\n";
+	writer->encodeU32Inst(WasmOpcode::BR, "br", idShapeMap.size(), code);
+	writer->encodeInst(WasmOpcode::END, "end", code);
 
 	blockTypes.emplace_back(SWITCH, idShapeMap.size());
 }
@@ -295,24 +338,21 @@ void CheerpWastRenderInterface::renderSwitchBlockBegin(const void* privateSwitch
 
 	// Print the case blocks and the default block.
 	for (uint32_t i = 0; i < caseBlocks + 1; i++)
-		writer->stream << "block\n";
+		writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
 
 	// Wrap the br_table instruction in its own block.
-	writer->stream << "block\n";
-	writer->compileOperand(si->getCondition());
+	writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
+	writer->compileOperand(code, si->getCondition());
 	if (min != 0)
 	{
-		writer->stream << "\ni32.const " << min;
-		writer->stream << "\ni32.sub";
+		writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", min, code);
+		writer->encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
 	}
-	writer->stream << "\nbr_table";
 
 	// Print the case labels and the default label.
-	for (auto label : table)
-		writer->stream << " " << label;
-	writer->stream << " " << caseBlocks << "\n";
+	writer->encodeBranchTable(std::vector<uint32_t>(table.begin(), table.end()), caseBlocks, code);
 
-	writer->stream << "end\n";
+	writer->encodeInst(WasmOpcode::END, "end", code);
 
 	blockTypes.emplace_back(SWITCH, caseBlocks + 1);
 }
@@ -337,13 +377,12 @@ void CheerpWastRenderInterface::renderIfBlockBegin(const void* privateBlock, int
 	if(!first)
 	{
 		indent();
-		writer->stream << "else\n";
+		writer->encodeInst(WasmOpcode::ELSE, "else", code);
 	}
 	// The condition goes first
 	renderCondition(bb, branchId);
-	writer->stream << '\n';
 	indent();
-	writer->stream << "if\n";
+	writer->encodeBlockInst(WasmOpcode::IF, "if", code);
 	if(first)
 	{
 		blockTypes.emplace_back(IF);
@@ -361,7 +400,7 @@ void CheerpWastRenderInterface::renderIfBlockBegin(const void* privateBlock, con
 	if(!first)
 	{
 		indent();
-		writer->stream << "else\n";
+		writer->encodeInst(WasmOpcode::ELSE, "else", code);
 	}
 	// The condition goes first
 	for(uint32_t i=0;i<skipBranchIds.size();i++)
@@ -374,13 +413,12 @@ assert(false);
 #endif
 		}
 		renderCondition(bb, skipBranchIds[i]);
-		writer->stream << '\n';
 	}
 	// Invert result
-	writer->stream << "i32.const 1\n";
-	writer->stream << "i32.xor\n";
+	writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 1, code);
+	writer->encodeInst(WasmOpcode::I32_XOR, "i32.xor", code);
 	indent();
-	writer->stream << "if\n";
+	writer->encodeBlockInst(WasmOpcode::IF, "if", code);
 
 	if(first)
 	{
@@ -399,7 +437,7 @@ void CheerpWastRenderInterface::renderElseBlockBegin()
 	assert(blockTypes.back().type == IF);
 
 	indent();
-	writer->stream << "else\n";
+	writer->encodeInst(WasmOpcode::ELSE, "else", code);
 }
 
 void CheerpWastRenderInterface::renderBlockEnd()
@@ -411,14 +449,14 @@ void CheerpWastRenderInterface::renderBlockEnd()
 	if(block.type == WHILE1)
 	{
 		// TODO: Why do we even need to fake value
-		writer->stream << "i32.const 0\n";
-		writer->stream << "br 1\n";
-		writer->stream << "end\n";
-		writer->stream << "end\n";
+		writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 0, code);
+		writer->encodeU32Inst(WasmOpcode::BR, "br", 1, code);
+		writer->encodeInst(WasmOpcode::END, "end", code);
+		writer->encodeInst(WasmOpcode::END, "end", code);
 	}
 	else if (block.type == CASE)
 	{
-		writer->stream << "end\n";
+		writer->encodeInst(WasmOpcode::END, "end", code);
 		BlockType* switchBlock = findSwitchBlockType(blockTypes);
 		assert(switchBlock->depth > 0);
 		switchBlock->depth--;
@@ -428,7 +466,7 @@ void CheerpWastRenderInterface::renderBlockEnd()
 		for(uint32_t i = 0; i < block.depth + 1; i++)
 		{
 			indent();
-			writer->stream << "end\n";
+			writer->encodeInst(WasmOpcode::END, "end", code);
 		}
 	}
 	else if (block.type == SWITCH)
@@ -445,7 +483,7 @@ void CheerpWastRenderInterface::renderBlockPrologue(const void* privateBlockTo,
 {
 	const BasicBlock* bbTo=(const BasicBlock*)privateBlockTo;
 	const BasicBlock* bbFrom=(const BasicBlock*)privateBlockFrom;
-	writer->compilePHIOfBlockFromOtherBlock(bbTo, bbFrom);
+	writer->compilePHIOfBlockFromOtherBlock(code, bbTo, bbFrom);
 }
 
 bool CheerpWastRenderInterface::hasBlockPrologue(const void* privateBlockTo, const void* privateBlockFrom) const
@@ -467,9 +505,9 @@ void CheerpWastRenderInterface::renderWhileBlockBegin()
 	// br 1 -> break
 	// br 2 -> continue
 	indent();
-	writer->stream << "loop\n";
+	writer->encodeBlockInst(WasmOpcode::LOOP, "loop", code);
 	indent();
-	writer->stream << "block\n";
+	writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
 	blockTypes.emplace_back(WHILE1);
 }
 
@@ -478,25 +516,38 @@ void CheerpWastRenderInterface::renderWhileBlockBegin(int blockLabel)
 	// Wrap a block in a loop so that:
 	// br 1 -> break
 	// br 2 -> continue
-	indent();
-	writer->stream << "loop $c" << blockLabel << "\n";
-	indent();
-	writer->stream << "block $" << blockLabel << "\n";
-	blockTypes.emplace_back(WHILE1);
+	if (writer->mode == CheerpWastWriter::WAST)
+	{
+		indent();
+		code << "loop $c" << blockLabel << "\n";
+		indent();
+		code << "block $" << blockLabel << "\n";
+	}
+	else
+	{
+		writer->encodeBlockInst(WasmOpcode::LOOP, "loop", code);
+		writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
+	}
+	blockTypes.emplace_back(WHILE1, 0, blockLabel);
 }
 
 void CheerpWastRenderInterface::renderDoBlockBegin()
 {
 	indent();
-	writer->stream << "block\n";
+	writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
 	blockTypes.emplace_back(DO);
 }
 
 void CheerpWastRenderInterface::renderDoBlockBegin(int blockLabel)
 {
-	indent();
-	writer->stream << "block $" << blockLabel << "\n";
-	blockTypes.emplace_back(DO);
+	if (writer->mode == CheerpWastWriter::WAST)
+	{
+		indent();
+		code << "block $" << blockLabel << "\n";
+	}
+	else
+		writer->encodeBlockInst(WasmOpcode::BLOCK, "block", code);
+	blockTypes.emplace_back(DO, 0, blockLabel);
 }
 
 void CheerpWastRenderInterface::renderDoBlockEnd()
@@ -506,7 +557,7 @@ void CheerpWastRenderInterface::renderDoBlockEnd()
 	blockTypes.pop_back();
 
 	indent();
-	writer->stream << "end\n";
+	writer->encodeInst(WasmOpcode::END, "end", code);
 }
 
 void CheerpWastRenderInterface::renderBreak()
@@ -516,7 +567,7 @@ void CheerpWastRenderInterface::renderBreak()
 	{
 		BlockType* switchBlock = findSwitchBlockType(blockTypes);
 		assert(switchBlock->depth > 0);
-		writer->stream << "br " << (switchBlock->depth - 1) << "\n";
+		writer->encodeU32Inst(WasmOpcode::BR, "br", switchBlock->depth - 1, code);
 	}
 	else
 	{
@@ -530,7 +581,7 @@ void CheerpWastRenderInterface::renderBreak()
 
 			breakIndex += blockTypes[blockTypes.size() - i - 1].depth + 1;
 		}
-		writer->stream << "br " << breakIndex << "\n";
+		writer->encodeU32Inst(WasmOpcode::BR, "br", breakIndex, code);
 	}
 }
 
@@ -538,7 +589,10 @@ void CheerpWastRenderInterface::renderBreak(int labelId)
 {
 	// DO blocks only have one label
 	// WHILE1 blocks have the "block" without a prefix
-	writer->stream << "br $" << labelId << '\n';
+	if (writer->mode == CheerpWastWriter::WAST)
+		code << "br $" << labelId << '\n';
+	else
+		writer->encodeU32Inst(WasmOpcode::BR, "br", findLabeledLoopDepth(labelId), code);
 }
 
 void CheerpWastRenderInterface::renderContinue()
@@ -554,497 +608,1497 @@ void CheerpWastRenderInterface::renderContinue()
 		breakIndex += blockTypes[blockTypes.size() - i - 1].depth + 1;
 	}
 	breakIndex += 1;
-	writer->stream << "br " << breakIndex << "\n";
+	writer->encodeU32Inst(WasmOpcode::BR, "br", breakIndex, code);
 }
 
 void CheerpWastRenderInterface::renderContinue(int labelId)
 {
-	writer->stream << "br $c" << labelId << '\n';
+	if (writer->mode == CheerpWastWriter::WAST)
+		code << "br $c" << labelId << '\n';
+	else
+		writer->encodeU32Inst(WasmOpcode::BR, "br", findLabeledLoopDepth(labelId) + 1, code);
 }
 
 void CheerpWastRenderInterface::renderLabel(int labelId)
 {
-	writer->stream << "i32.const " << labelId << '\n';
-	writer->stream << "set_local " << labelLocal << '\n';
+	writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", labelId, code);
+	writer->encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", labelLocal, code);
 }
 
 void CheerpWastRenderInterface::renderIfOnLabel(int labelId, bool first)
 {
 	// TODO: Use first to optimize dispatch
-	writer->stream << "i32.const " << labelId << '\n';
-	writer->stream << "get_local " << labelLocal << '\n';
-	writer->stream << "i32.eq\n";
+	writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", labelId, code);
+	writer->encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", labelLocal, code);
+	writer->encodeInst(WasmOpcode::I32_EQ, "i32.eq", code);
 	indent();
-	writer->stream << "if\n";
+	writer->encodeBlockInst(WasmOpcode::IF, "if", code);
 	blockTypes.emplace_back(IF);
 }
 
-bool CheerpWastWriter::needsPointerKindConversion(const Instruction* phi, const Value* incoming)
-{
-	const Instruction* incomingInst=dyn_cast<Instruction>(incoming);
-	if(!incomingInst)
-		return true;
-	return isInlineable(*incomingInst, PA) ||
-		registerize.getRegisterId(phi)!=registerize.getRegisterId(incomingInst);
-}
-
-
-bool CheerpWastWriter::needsPointerKindConversionForBlocks(const BasicBlock* to, const BasicBlock* from)
+/**
+ * Builds the wasm control flow of a function directly from its CFG, without
+ * going through the relooper. Blocks are visited in dominator tree order: loop
+ * headers are wrapped in a loop, and blocks with more than one forward predecessor
+ * are placed right after a block. Every jump is then a br to an enclosing scope
+ * and the label local is never needed. Only reducible CFGs can be structured.
+ */
+class CheerpWastStructurizer
 {
-	class PHIHandler: public EndOfBlockPHIHandler
+private:
+	enum SCOPE_KIND { BLOCK_FOLLOWED_BY, LOOP_HEADED_BY, IF_ELSE, SWITCH_CASE };
+	struct Scope
 	{
-	public:
-		PHIHandler(CheerpWastWriter& w):EndOfBlockPHIHandler(w.PA),needsPointerKindConversion(false),writer(w)
-		{
-		}
-		~PHIHandler()
-		{
-		}
-		bool needsPointerKindConversion;
-	private:
-		CheerpWastWriter& writer;
-		void handleRecursivePHIDependency(const Instruction* incoming) override
+		SCOPE_KIND kind;
+		const BasicBlock* bb;
+		Scope(SCOPE_KIND kind, const BasicBlock* bb):kind(kind),bb(bb)
 		{
 		}
-		void handlePHI(const Instruction* phi, const Value* incoming) override
-		{
-			needsPointerKindConversion |= writer.needsPointerKindConversion(phi, incoming);
-		}
 	};
+	CheerpWastWriter* writer;
+	llvm::raw_ostream& code;
+	const Function& F;
+	DominatorTree DT;
+	// Reverse postorder index of the reachable blocks
+	DenseMap<const BasicBlock*, uint32_t> rpoIndex;
+	DenseSet<const BasicBlock*> loopHeaders;
+	DenseSet<const BasicBlock*> mergeBlocks;
+	std::vector<Scope> scopes;
+	bool structurable;
+	void indent();
+	void openScope(WasmOpcode opcode, const char* name, SCOPE_KIND kind, const BasicBlock* bb);
+	void closeScope();
+	uint32_t findScopeDepth(SCOPE_KIND kind, const BasicBlock* bb) const;
+	bool isForwardEdge(const BasicBlock* from, const BasicBlock* to) const
+	{
+		return rpoIndex.lookup(from) < rpoIndex.lookup(to);
+	}
+	bool isDirectBranch(const BasicBlock* from, const BasicBlock* to) const;
+	uint32_t findBranchDepth(const BasicBlock* from, const BasicBlock* to) const;
+	void compileTree(const BasicBlock* bb);
+	void compileWithin(const BasicBlock* bb, ArrayRef<const BasicBlock*> mergeChildren);
+	void compileTerminator(const BasicBlock* bb);
+	void compileSwitch(const BasicBlock* bb, const SwitchInst* si);
+	void compileBranch(const BasicBlock* from, const BasicBlock* to);
+public:
+	const BasicBlock* lastDepth0Block;
+	CheerpWastStructurizer(CheerpWastWriter* w, llvm::raw_ostream& code, const Function& F);
+	bool canStructurize() const { return structurable; }
+	void compile();
+};
 
-	auto handler = PHIHandler(*this);
-	handler.runOnEdge(registerize, from, to);
-	return handler.needsPointerKindConversion;
-}
-
-void CheerpWastWriter::compilePHIOfBlockFromOtherBlock(const BasicBlock* to, const BasicBlock* from)
+CheerpWastStructurizer::CheerpWastStructurizer(CheerpWastWriter* w, raw_ostream& code, const Function& F)
+ :
+	writer(w),
+	code(code),
+	F(F),
+	structurable(true),
+	lastDepth0Block(nullptr)
 {
-	class WriterPHIHandler: public EndOfBlockPHIHandler
+	DT.recalculate(const_cast<Function&>(F));
+	ReversePostOrderTraversal<const Function*> RPOT(&F);
+	uint32_t index = 0;
+	for(const BasicBlock* bb: RPOT)
+		rpoIndex.insert(std::make_pair(bb, index++));
+
+	for(const BasicBlock* bb: RPOT)
 	{
-	public:
-		WriterPHIHandler(CheerpWastWriter& w, const BasicBlock* f, const BasicBlock* t):EndOfBlockPHIHandler(w.PA),writer(w),fromBB(f),toBB(t)
-		{
-		}
-		~WriterPHIHandler()
-		{
-		}
-	private:
-		CheerpWastWriter& writer;
-		const BasicBlock* fromBB;
-		const BasicBlock* toBB;
-		void handleRecursivePHIDependency(const Instruction* incoming) override
+		// Exceptions are left to the relooper
+		const TerminatorInst* term = bb->getTerminator();
+		if(!isa<BranchInst>(term) && !isa<SwitchInst>(term) && !isa<ReturnInst>(term) && !isa<UnreachableInst>(term))
 		{
-			assert(incoming);
-			writer.stream << "get_local " << (1 + writer.currentFun->arg_size() + writer.registerize.getRegisterId(incoming)) << '\n';
-			writer.stream << "set_local " << (1 + writer.currentFun->arg_size() + writer.registerize.getRegisterIdForEdge(incoming, fromBB, toBB)) << '\n';
+			structurable = false;
+			return;
 		}
-		void handlePHI(const Instruction* phi, const Value* incoming) override
+		SmallPtrSet<const BasicBlock*, 4> forwardPreds;
+		for(auto it = pred_begin(bb); it != pred_end(bb); ++it)
 		{
-			// We can avoid assignment from the same register if no pointer kind conversion is required
-			if(!writer.needsPointerKindConversion(phi, incoming))
+			const BasicBlock* pred = *it;
+			if(!rpoIndex.count(pred))
+				continue;
+			if(isForwardEdge(pred, bb))
+				forwardPreds.insert(pred);
+			else if(DT.dominates(bb, pred))
+				loopHeaders.insert(bb);
+			else
+			{
+				// A retreating edge which is not a back edge, the CFG is irreducible
+				structurable = false;
 				return;
-			// 1) Put the value on the stack
-			writer.registerize.setEdgeContext(fromBB, toBB);
-			writer.compileOperand(incoming);
-			writer.registerize.clearEdgeContext();
-			// 2) Save the value in the phi
-			writer.stream << "\nset_local " << (1 + writer.currentFun->arg_size() + writer.registerize.getRegisterId(phi)) << '\n';
+			}
 		}
-	};
-	WriterPHIHandler(*this, from, to).runOnEdge(registerize, from, to);
+		if(forwardPreds.size() > 1)
+			mergeBlocks.insert(bb);
+	}
 }
 
-const char* CheerpWastWriter::getTypeString(Type* t)
+void CheerpWastStructurizer::indent()
 {
-	if(t->isIntegerTy() || t->isPointerTy())
-		return "i32";
-	else if(t->isFloatTy())
-		return "f32";
-	else if(t->isDoubleTy())
-		return "f64";
-	else
-	{
-		llvm::errs() << "Unsupported type " << *t << "\n";
-		llvm_unreachable("Unsuppored type");
-	}
+	if (writer->mode != CheerpWastWriter::WAST)
+		return;
+	for(uint32_t i=0;i<scopes.size();i++)
+		code << "  ";
 }
 
-void CheerpWastWriter::compileGEP(const llvm::User* gep_inst)
+void CheerpWastStructurizer::openScope(WasmOpcode opcode, const char* name, SCOPE_KIND kind, const BasicBlock* bb)
 {
-	WastGepWriter gepWriter(*this);
-	const llvm::Value *p = linearHelper.compileGEP(gep_inst, &gepWriter);
-	compileOperand(p);
-	if(!gepWriter.first)
-		stream << "\ni32.add";
+	indent();
+	writer->encodeBlockInst(opcode, name, code);
+	scopes.emplace_back(kind, bb);
 }
 
-void CheerpWastWriter::compileSignedInteger(const llvm::Value* v, bool forComparison)
+void CheerpWastStructurizer::closeScope()
 {
-	uint32_t shiftAmount = 32-v->getType()->getIntegerBitWidth();
-	if(const ConstantInt* C = dyn_cast<ConstantInt>(v))
+	assert(!scopes.empty());
+	scopes.pop_back();
+	indent();
+	writer->encodeInst(WasmOpcode::END, "end", code);
+	if(scopes.empty())
+		lastDepth0Block = nullptr;
+}
+
+uint32_t CheerpWastStructurizer::findScopeDepth(SCOPE_KIND kind, const BasicBlock* bb) const
+{
+	uint32_t depth = 0;
+	for(auto it = scopes.rbegin(); it != scopes.rend(); ++it, ++depth)
 	{
-		if(forComparison)
-			stream << "i32.const " << (C->getSExtValue() << shiftAmount) << '\n';
-		else
-			stream << "i32.const " << C->getSExtValue() << '\n';
-		return;
+		if(it->kind == kind && it->bb == bb)
+			return depth;
 	}
+	llvm_unreachable("structured scope not found");
+}
 
-	compileOperand(v);
-	stream << '\n';
+bool CheerpWastStructurizer::isDirectBranch(const BasicBlock* from, const BasicBlock* to) const
+{
+	// Jumps to loop headers and merge blocks only need a br, as long as no PHI
+	// has to be assigned on the edge
+	if(isForwardEdge(from, to) && !mergeBlocks.count(to))
+		return false;
+	if(to->getFirstNonPHI() == &to->front())
+		return true;
+	return !writer->needsPointerKindConversionForBlocks(to, from);
+}
 
-	if (shiftAmount == 0)
-		return;
+uint32_t CheerpWastStructurizer::findBranchDepth(const BasicBlock* from, const BasicBlock* to) const
+{
+	if(isForwardEdge(from, to))
+		return findScopeDepth(BLOCK_FOLLOWED_BY, to);
+	return findScopeDepth(LOOP_HEADED_BY, to);
+}
 
-	if (forComparison)
-	{
-		// When comparing two signed values we can avoid the right shift
-		stream << "i32.const " << shiftAmount << '\n';
-		stream << "i32.shl\n";
-	}
-	else
-	{
-		stream << "i32.const " << shiftAmount << '\n';
-		stream << "i32.shl\n";
-		stream << "i32.const " << shiftAmount << '\n';
-		stream << "i32.shr_s\n";
-	}
+void CheerpWastStructurizer::compile()
+{
+	assert(structurable);
+	compileTree(&F.getEntryBlock());
+	assert(scopes.empty());
 }
 
-void CheerpWastWriter::compileUnsignedInteger(const llvm::Value* v)
+void CheerpWastStructurizer::compileTree(const BasicBlock* bb)
 {
-	if(const ConstantInt* C = dyn_cast<ConstantInt>(v))
+	// The merge blocks immediately dominated by this block are placed after it,
+	// the one with the highest reverse postorder index goes last
+	SmallVector<const BasicBlock*, 4> mergeChildren;
+	for(const DomTreeNode* child: *DT.getNode(const_cast<BasicBlock*>(bb)))
 	{
-		stream << "i32.const " << C->getZExtValue() << '\n';
-		return;
+		if(mergeBlocks.count(child->getBlock()))
+			mergeChildren.push_back(child->getBlock());
 	}
+	std::sort(mergeChildren.begin(), mergeChildren.end(),
+		[this](const BasicBlock* a, const BasicBlock* b) { return rpoIndex.lookup(a) < rpoIndex.lookup(b); });
 
-	compileOperand(v);
-	stream << '\n';
-
-	uint32_t initialSize = v->getType()->getIntegerBitWidth();
-	if(initialSize != 32)
+	if(loopHeaders.count(bb))
 	{
-		stream << "i32.const " << getMaskForBitWidth(initialSize) << '\n';
-		stream << "i32.and\n";
+		openScope(WasmOpcode::LOOP, "loop", LOOP_HEADED_BY, bb);
+		compileWithin(bb, mergeChildren);
+		closeScope();
 	}
+	else
+		compileWithin(bb, mergeChildren);
 }
 
-void CheerpWastWriter::compileConstantExpr(const ConstantExpr* ce)
+void CheerpWastStructurizer::compileWithin(const BasicBlock* bb, ArrayRef<const BasicBlock*> mergeChildren)
 {
-	switch(ce->getOpcode())
+	if(mergeChildren.empty())
 	{
-		case Instruction::GetElementPtr:
-		{
-			compileGEP(ce);
-			break;
-		}
-		case Instruction::BitCast:
-		{
-			assert(ce->getOperand(0)->getType()->isPointerTy());
-			compileOperand(ce->getOperand(0));
-			break;
-		}
-		case Instruction::IntToPtr:
-		{
-			compileOperand(ce->getOperand(0));
-			break;
-		}
-		case Instruction::ICmp:
-		{
-			CmpInst::Predicate p = (CmpInst::Predicate)ce->getPredicate();
-			compileOperand(ce->getOperand(0));
-			stream << '\n';
-			compileOperand(ce->getOperand(1));
-			stream << '\n';
-			stream << getTypeString(ce->getOperand(0)->getType())
-				<< '.' << getIntegerPredicate(p);
-			break;
-		}
-		case Instruction::PtrToInt:
-		{
-			compileOperand(ce->getOperand(0));
-			break;
-		}
-#if 0
-		case Instruction::Select:
-		{
-			compileSelect(ce, ce->getOperand(0), ce->getOperand(1), ce->getOperand(2), HIGHEST);
-			break;
-		}
-		case Instruction::Sub:
-		{
-			compileSubtraction(ce->getOperand(0), ce->getOperand(1), HIGHEST);
-			break;
-		}
-#endif
-		default:
-			stream << "undefined";
-			llvm::errs() << "warning: Unsupported constant expr " << ce->getOpcodeName() << '\n';
+		lastDepth0Block = scopes.empty() ? bb : nullptr;
+		writer->compileBB(code, *bb);
+		compileTerminator(bb);
+		return;
 	}
+	// Jumping to the end of the block reaches the merge block
+	const BasicBlock* next = mergeChildren.back();
+	openScope(WasmOpcode::BLOCK, "block", BLOCK_FOLLOWED_BY, next);
+	compileWithin(bb, mergeChildren.drop_back());
+	closeScope();
+	compileTree(next);
 }
 
-void CheerpWastWriter::compileConstant(const Constant* c)
+void CheerpWastStructurizer::compileTerminator(const BasicBlock* bb)
 {
-	if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(c))
+	const TerminatorInst* term = bb->getTerminator();
+	if(const SwitchInst* si = dyn_cast<SwitchInst>(term))
 	{
-		compileConstantExpr(CE);
+		compileSwitch(bb, si);
+		return;
 	}
-	else if(const ConstantInt* i=dyn_cast<ConstantInt>(c))
+	// Returns and unreachable are completely handled by compileBB
+	const BranchInst* bi = dyn_cast<BranchInst>(term);
+	if(!bi)
+		return;
+	if(bi->isUnconditional() || bi->getSuccessor(0) == bi->getSuccessor(1))
 	{
-		stream << getTypeString(i->getType()) << ".const ";
-		if(i->getBitWidth()==32)
-			stream << i->getSExtValue();
-		else
-			stream << i->getZExtValue();
+		compileBranch(bb, bi->getSuccessor(0));
+		return;
 	}
-	else if(const ConstantFP* f=dyn_cast<ConstantFP>(c))
+	const BasicBlock* ifTrue = bi->getSuccessor(0);
+	const BasicBlock* ifFalse = bi->getSuccessor(1);
+	writer->compileOperand(code, bi->getCondition());
+	// Prefer a br_if when one of the targets is only a jump to an enclosing scope
+	if(isDirectBranch(bb, ifTrue))
 	{
-		stream << getTypeString(f->getType()) << ".const ";
-		if(f->getValueAPF().isInfinity())
-		{
-			if(f->getValueAPF().isNegative())
-				stream << '-';
-			stream << "infinity";
-		}
-		else if(f->getValueAPF().isNaN())
-		{
-			stream << "nan";
-		}
-		else
-		{
-			APFloat apf = f->getValueAPF();
-			char buf[40];
-			// TODO: Figure out the right amount of hexdigits
-			unsigned charCount = apf.convertToHexString(buf, f->getType()->isFloatTy() ? 8 : 16, false, APFloat::roundingMode::rmNearestTiesToEven);
-			assert(charCount < 40);
-			stream << buf;
-		}
+		writer->encodeU32Inst(WasmOpcode::BR_IF, "br_if", findBranchDepth(bb, ifTrue), code);
+		compileBranch(bb, ifFalse);
 	}
-	else if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(c))
+	else if(isDirectBranch(bb, ifFalse))
 	{
-		stream << "i32.const " << linearHelper.getGlobalVariableAddress(GV);
+		writer->encodeInst(WasmOpcode::I32_EQZ, "i32.eqz", code);
+		writer->encodeU32Inst(WasmOpcode::BR_IF, "br_if", findBranchDepth(bb, ifFalse), code);
+		compileBranch(bb, ifTrue);
 	}
-	else if(isa<ConstantPointerNull>(c))
+	else
 	{
-		stream << "i32.const 0";
+		openScope(WasmOpcode::IF, "if", IF_ELSE, nullptr);
+		compileBranch(bb, ifTrue);
+		indent();
+		writer->encodeInst(WasmOpcode::ELSE, "else", code);
+		compileBranch(bb, ifFalse);
+		closeScope();
 	}
-	else if(isa<Function>(c))
+}
+
+void CheerpWastStructurizer::compileSwitch(const BasicBlock* bb, const SwitchInst* si)
+{
+	// Every destination which is not a direct branch gets its own block, its
+	// code is placed right after the end of the block
+	SmallVector<const BasicBlock*, 8> caseBlocks;
+	SmallPtrSet<const BasicBlock*, 8> visited;
+	for(auto it = succ_begin(bb); it != succ_end(bb); ++it)
 	{
-		const Function* F = cast<Function>(c);
-		if (globalDeps.functionAddresses().count(F) &&
-			globalDeps.functionTables().count(F->getFunctionType()))
+		if(visited.insert(*it).second && !isDirectBranch(bb, *it))
+			caseBlocks.push_back(*it);
+	}
+	for(auto it = caseBlocks.rbegin(); it != caseBlocks.rend(); ++it)
+		openScope(WasmOpcode::BLOCK, "block", SWITCH_CASE, *it);
+
+	auto findDestDepth = [&](const BasicBlock* dest) -> uint32_t
+	{
+		if(std::find(caseBlocks.begin(), caseBlocks.end(), dest) != caseBlocks.end())
+			return findScopeDepth(SWITCH_CASE, dest);
+		return findBranchDepth(bb, dest);
+	};
+
+	int64_t max = std::numeric_limits<int64_t>::min();
+	int64_t min = std::numeric_limits<int64_t>::max();
+	for (auto& c: si->cases())
+	{
+		int64_t curr = c.getCaseValue()->getSExtValue();
+		max = std::max(max, curr);
+		min = std::min(min, curr);
+	}
+	uint32_t numCases = si->getNumCases();
+	uint32_t defaultDepth = findDestDepth(si->getDefaultDest());
+	if(numCases && max - min < 4 * int64_t(numCases))
+	{
+		// Dense cases use a jump table
+		std::vector<uint32_t> table(max - min + 1, defaultDepth);
+		for (auto& c: si->cases())
+			table[c.getCaseValue()->getSExtValue() - min] = findDestDepth(c.getCaseSuccessor());
+		writer->compileOperand(code, si->getCondition());
+		if (min != 0)
 		{
-			int offset = globalDeps.functionAddresses().at(F);
-			const auto& functionTable = globalDeps.functionTables().at(F->getFunctionType());
-			int functionTableOffset = functionTableOffsets.at(functionTable.name);
-			stream << "i32.const " << functionTableOffset + offset;
+			writer->encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", min, code);
+			writer->encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
 		}
-		else
+		writer->encodeBranchTable(table, defaultDepth, code);
+	}
+	else
+	{
+		// Sparse cases are checked one by one
+		for (auto& c: si->cases())
 		{
-			c->dump();
-			assert(false);
+			writer->compileOperand(code, si->getCondition());
+			writer->compileOperand(code, c.getCaseValue());
+			writer->encodeInst(WasmOpcode::I32_EQ, "i32.eq", code);
+			writer->encodeU32Inst(WasmOpcode::BR_IF, "br_if", findDestDepth(c.getCaseSuccessor()), code);
 		}
+		writer->encodeU32Inst(WasmOpcode::BR, "br", defaultDepth, code);
 	}
-	else if (isa<UndefValue>(c))
+
+	for(const BasicBlock* dest: caseBlocks)
 	{
-		stream << "i32.const 0";
+		closeScope();
+		compileBranch(bb, dest);
 	}
+}
+
+void CheerpWastStructurizer::compileBranch(const BasicBlock* from, const BasicBlock* to)
+{
+	if(to->getFirstNonPHI() != &to->front())
+		writer->compilePHIOfBlockFromOtherBlock(code, to, from);
+	if(!isForwardEdge(from, to) || mergeBlocks.count(to))
+		writer->encodeU32Inst(WasmOpcode::BR, "br", findBranchDepth(from, to), code);
 	else
 	{
-		c->dump();
-		assert(false);
+		// This edge is the only way to reach the block, so it is dominated by from
+		compileTree(to);
 	}
 }
 
-void CheerpWastWriter::compileOperand(const llvm::Value* v)
+CheerpWastWriter::Section::Section(uint32_t sectionId, CheerpWastWriter& writer)
+	: sectionId(sectionId), writer(writer), bufStream(buf), start(writer.stream.tell()),
+	code(writer.mode == WASM ? static_cast<raw_ostream&>(bufStream) : static_cast<raw_ostream&>(writer.stream))
 {
-	if(const Constant* c=dyn_cast<Constant>(v))
-		compileConstant(c);
-	else if(const Instruction* it=dyn_cast<Instruction>(v))
+}
+
+CheerpWastWriter::Section::~Section()
+{
+	if (writer.mode == WASM)
 	{
-		if(isInlineable(*it, PA))
-			compileInstruction(*it);
-		else
-			stream << "get_local " << (1 + currentFun->arg_size() + registerize.getRegisterId(it));
+		StringRef contents = bufStream.str();
+		writer.stream << char(sectionId);
+		encodeULEB128(contents.size(), writer.stream);
+		writer.stream << contents;
 	}
-	else if(const Argument* arg=dyn_cast<Argument>(v))
+	if (writer.timeReport)
 	{
-		stream << "get_local " << arg->getArgNo();
+		static const char* sectionNames[] = { "custom", "type", "import", "function", "table", "memory",
+			"global", "export", "start", "element", "code", "data" };
+		assert(sectionId < sizeof(sectionNames) / sizeof(sectionNames[0]));
+		writer.timeReport->addCounter(std::string("wasm_bytes_") + sectionNames[sectionId], writer.stream.tell() - start);
 	}
+}
+
+void CheerpWastWriter::encodeInst(WasmOpcode opcode, const char* name, raw_ostream& code)
+{
+	if (mode == WASM)
+		code << char(opcode);
 	else
+		code << name << '\n';
+}
+
+void CheerpWastWriter::encodeS32Inst(WasmOpcode opcode, const char* name, int32_t immediate, raw_ostream& code)
+{
+	if (mode == WASM)
 	{
-		v->dump();
-		assert(false);
+		code << char(opcode);
+		encodeSLEB128(immediate, code);
 	}
+	else
+		code << name << ' ' << immediate << '\n';
 }
 
-const char* CheerpWastWriter::getIntegerPredicate(llvm::CmpInst::Predicate p)
+void CheerpWastWriter::encodeU32Inst(WasmOpcode opcode, const char* name, uint32_t immediate, raw_ostream& code)
 {
-	switch(p)
+	if (mode == WASM)
 	{
-		case CmpInst::ICMP_EQ:
-			return "eq";
-		case CmpInst::ICMP_NE:
-			return "ne";
-		case CmpInst::ICMP_SGE:
-			return "ge_s";
-		case CmpInst::ICMP_SGT:
-			return "gt_s";
-		case CmpInst::ICMP_SLE:
-			return "le_s";
-		case CmpInst::ICMP_SLT:
-			return "lt_s";
-		case CmpInst::ICMP_UGE:
-			return "ge_u";
-		case CmpInst::ICMP_UGT:
-			return "gt_u";
-		case CmpInst::ICMP_ULE:
-			return "le_u";
-		case CmpInst::ICMP_ULT:
-			return "lt_u";
-		default:
-			llvm::errs() << "Handle predicate " << p << "\n";
-			break;
+		code << char(opcode);
+		encodeULEB128(immediate, code);
 	}
-	return "";
+	else
+		code << name << ' ' << immediate << '\n';
 }
 
-void CheerpWastWriter::compileDowncast(ImmutableCallSite callV)
+void CheerpWastWriter::encodeBlockInst(WasmOpcode opcode, const char* name, raw_ostream& code)
 {
-	assert(callV.arg_size() == 2);
-	assert(callV.getCalledFunction()->getIntrinsicID() == Intrinsic::cheerp_downcast);
+	if (mode == WASM)
+	{
+		// Blocks never produce a value
+		code << char(opcode) << char(0x40);
+	}
+	else
+		code << name << '\n';
+}
 
-	const Value* src = callV.getArgument(0);
-	const Value* offset = callV.getArgument(1);
+void CheerpWastWriter::encodeLoadStoreInst(WasmOpcode opcode, const char* name, uint32_t alignLog2, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		code << char(opcode);
+		// The alignment hint matches the text format default (natural alignment), the offset is always 0
+		encodeULEB128(alignLog2, code);
+		encodeULEB128(0, code);
+	}
+	else
+		code << name << '\n';
+}
 
-	Type* t = src->getType()->getPointerElementType();
+void CheerpWastWriter::encodeMemoryInst(WasmOpcode opcode, const char* name, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		// Reserved memory index
+		code << char(opcode) << char(0);
+	}
+	else
+		code << name << '\n';
+}
 
-	compileOperand(src);
-	stream << '\n';
+void CheerpWastWriter::encodeBranchTable(const std::vector<uint32_t>& table, uint32_t defaultBlock, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		code << char(WasmOpcode::BR_TABLE);
+		encodeULEB128(table.size(), code);
+		for (auto label : table)
+			encodeULEB128(label, code);
+		encodeULEB128(defaultBlock, code);
+	}
+	else
+	{
+		code << "br_table";
+		for (auto label : table)
+			code << " " << label;
+		code << " " << defaultBlock << "\n";
+	}
+}
 
-	if(!TypeSupport::isClientType(t) &&
-			(!isa<ConstantInt>(offset) || !cast<ConstantInt>(offset)->isNullValue()))
+void CheerpWastWriter::encodeString(StringRef str, raw_ostream& code)
+{
+	assert(mode == WASM);
+	encodeULEB128(str.size(), code);
+	code << str;
+}
+
+// Lane shape of a SIMD value, masks have the shape of the values they select
+enum SIMD_SHAPE { I8X16 = 0, I16X8, I32X4, F32X4, F64X2 };
+
+struct SIMDShapeInfo
+{
+	const char* name;
+	WasmSIMDOpcode splat;
+	WasmSIMDOpcode extractLane;
+	const char* extractLaneName;
+	WasmSIMDOpcode replaceLane;
+	// First comparison of the shape, see WasmSIMDOpcode for the order
+	WasmSIMDOpcode compare;
+	// First arithmetic instruction of the shape, shl for the integer shapes
+	// and add for the floating point ones
+	WasmSIMDOpcode arithmetic;
+};
+
+static const SIMDShapeInfo simdShapes[] = {
+	{ "i8x16", WasmSIMDOpcode::I8X16_SPLAT, WasmSIMDOpcode::I8X16_EXTRACT_LANE_U, "extract_lane_u",
+		WasmSIMDOpcode::I8X16_REPLACE_LANE, WasmSIMDOpcode::I8X16_EQ, WasmSIMDOpcode::I8X16_SHL },
+	{ "i16x8", WasmSIMDOpcode::I16X8_SPLAT, WasmSIMDOpcode::I16X8_EXTRACT_LANE_U, "extract_lane_u",
+		WasmSIMDOpcode::I16X8_REPLACE_LANE, WasmSIMDOpcode::I16X8_EQ, WasmSIMDOpcode::I16X8_SHL },
+	{ "i32x4", WasmSIMDOpcode::I32X4_SPLAT, WasmSIMDOpcode::I32X4_EXTRACT_LANE, "extract_lane",
+		WasmSIMDOpcode::I32X4_REPLACE_LANE, WasmSIMDOpcode::I32X4_EQ, WasmSIMDOpcode::I32X4_SHL },
+	{ "f32x4", WasmSIMDOpcode::F32X4_SPLAT, WasmSIMDOpcode::F32X4_EXTRACT_LANE, "extract_lane",
+		WasmSIMDOpcode::F32X4_REPLACE_LANE, WasmSIMDOpcode::F32X4_EQ, WasmSIMDOpcode::F32X4_ADD },
+	{ "f64x2", WasmSIMDOpcode::F64X2_SPLAT, WasmSIMDOpcode::F64X2_EXTRACT_LANE, "extract_lane",
+		WasmSIMDOpcode::F64X2_REPLACE_LANE, WasmSIMDOpcode::F64X2_EQ, WasmSIMDOpcode::F64X2_ADD },
+};
+
+static bool isSIMDMask(const Type* t)
+{
+	return t->isVectorTy() && t->getVectorElementType()->isIntegerTy(1);
+}
+
+static const SIMDShapeInfo& getSIMDShape(const Type* t)
+{
+	Type* elementType = t->getVectorElementType();
+	if(elementType->isFloatTy())
+		return simdShapes[F32X4];
+	if(elementType->isDoubleTy())
+		return simdShapes[F64X2];
+	uint32_t numElements = t->getVectorNumElements();
+	assert(numElements != 2 && "i64x2 is not supported");
+	return simdShapes[numElements == 16 ? I8X16 : numElements == 8 ? I16X8 : I32X4];
+}
+
+static bool usesVectors(const Instruction& I)
+{
+	if(I.getType()->isVectorTy())
+		return true;
+	for(const Value* op: I.operands())
 	{
-		compileOperand(offset);
-		stream << '\n';
-		stream << "i32.add\n";
+		if(op->getType()->isVectorTy())
+			return true;
+	}
+	return false;
+}
+
+// Vector constants are encoded as raw bytes, so they can only contain numbers
+static bool isSIMDConstant(const Constant* c)
+{
+	for(uint32_t i = 0; i < c->getType()->getVectorNumElements(); i++)
+	{
+		const Constant* element = c->getAggregateElement(i);
+		if(!element || !(isa<ConstantInt>(element) || isa<ConstantFP>(element) || isa<UndefValue>(element)))
+			return false;
+	}
+	return true;
+}
+
+// Returns the scalar replicated in all the lanes of v, or nullptr if it is
+// not known to be a splat
+static const Value* getSplatScalar(const Value* v)
+{
+	if(const Constant* c = dyn_cast<Constant>(v))
+	{
+		const Constant* first = c->getAggregateElement(0u);
+		for(uint32_t i = 1; i < c->getType()->getVectorNumElements(); i++)
+		{
+			if(c->getAggregateElement(i) != first)
+				return nullptr;
+		}
+		return first;
+	}
+	// The splat idiom: an insertelement in lane 0 broadcasted by a shufflevector
+	const ShuffleVectorInst* si = dyn_cast<ShuffleVectorInst>(v);
+	if(!si)
+		return nullptr;
+	for(int lane: si->getShuffleMask())
+	{
+		if(lane > 0)
+			return nullptr;
 	}
+	const InsertElementInst* ie = dyn_cast<InsertElementInst>(si->getOperand(0));
+	if(!ie || !isa<ConstantInt>(ie->getOperand(2)) || !cast<ConstantInt>(ie->getOperand(2))->isZero())
+		return nullptr;
+	return ie->getOperand(1);
 }
 
-bool CheerpWastWriter::compileInstruction(const Instruction& I)
+bool cheerp::isSIMDType(const Type* t)
 {
+	if(!t->isVectorTy())
+		return false;
+	Type* elementType = t->getVectorElementType();
+	uint32_t numElements = t->getVectorNumElements();
+	if(elementType->isIntegerTy(1))
+		return numElements == 2 || numElements == 4 || numElements == 8 || numElements == 16;
+	if(elementType->isIntegerTy(8))
+		return numElements == 16;
+	if(elementType->isIntegerTy(16))
+		return numElements == 8;
+	if(elementType->isIntegerTy(32) || elementType->isFloatTy())
+		return numElements == 4;
+	if(elementType->isDoubleTy())
+		return numElements == 2;
+	return false;
+}
+
+bool cheerp::canLowerToSIMD(const Instruction& I)
+{
+	if(!usesVectors(I))
+		return true;
+	if(I.getType()->isVectorTy() && !isSIMDType(I.getType()))
+		return false;
+	for(uint32_t i = 0; i < I.getNumOperands(); i++)
+	{
+		const Value* op = I.getOperand(i);
+		// The mask of shufflevector is an immediate
+		if(!op->getType()->isVectorTy() || (isa<ShuffleVectorInst>(I) && i == 2))
+			continue;
+		if(!isSIMDType(op->getType()))
+			return false;
+		if(isa<Constant>(op) && !isSIMDConstant(cast<Constant>(op)))
+			return false;
+	}
+	Type* t = I.getType();
 	switch(I.getOpcode())
 	{
-		case Instruction::Alloca:
+		case Instruction::Load:
+			return !isSIMDMask(t);
+		case Instruction::Store:
+			return !isSIMDMask(I.getOperand(0)->getType());
+		case Instruction::And:
+		case Instruction::Or:
+		case Instruction::Xor:
+		case Instruction::FAdd:
+		case Instruction::FSub:
+		case Instruction::FMul:
+		case Instruction::FDiv:
+		case Instruction::PHI:
+			return true;
+		case Instruction::Add:
+		case Instruction::Sub:
+			return !isSIMDMask(t);
+		case Instruction::Mul:
+			// There is no i8x16.mul
+			return t->getVectorElementType()->isIntegerTy(16) || t->getVectorElementType()->isIntegerTy(32);
+		case Instruction::Shl:
+		case Instruction::LShr:
+		case Instruction::AShr:
+			// All the lanes are shifted by the same amount
+			return !isSIMDMask(t) && getSplatScalar(I.getOperand(1));
+		case Instruction::ICmp:
+			return !isSIMDMask(I.getOperand(0)->getType());
+		case Instruction::FCmp:
 		{
-			const AllocaInst* ai = cast<AllocaInst>(&I);
-			Type* allocTy = ai->getAllocatedType();
-			// TODO: There is another method that includes the alignment
-			uint32_t size = targetData.getTypeAllocSize(allocTy);
-			uint32_t alignment = TypeSupport::getAlignmentAsmJS(targetData, allocTy);
-			assert (!ai->isArrayAllocation());
-			assert((alignment & (alignment-1)) == 0 && "alignment must be power of 2");
-			// We grow the stack down for now
-			// 1) Push the current stack pointer
-			stream << "get_global " << stackTopGlobal << '\n';
-			// 2) Push the allocation size
-			stream << "i32.const " << size << '\n';
-			// 3) Substract the size
-			stream << "i32.sub\n";
-			// 3.1) Optionally align the stack down
-			if(size % alignment)
+			switch(cast<CmpInst>(I).getPredicate())
 			{
-				stream << "i32.const " << uint32_t(0-alignment) << '\n';
-				stream << "i32.and\n";
+				case CmpInst::FCMP_FALSE:
+				case CmpInst::FCMP_TRUE:
+				case CmpInst::FCMP_ORD:
+				case CmpInst::FCMP_UNO:
+					return false;
+				default:
+					return true;
 			}
-			// 4) Write the location to the local, but preserve the value
-			stream << "tee_local " << (1 + currentFun->arg_size() + registerize.getRegisterId(&I)) << '\n';
-			// 5) Save the new stack position
-			stream << "set_global " << stackTopGlobal << '\n';
-			return true;
 		}
-		case Instruction::Add:
+		case Instruction::Select:
+			return true;
+		case Instruction::ExtractElement:
+			return isa<ConstantInt>(I.getOperand(1));
+		case Instruction::InsertElement:
+			return !isSIMDMask(t) && isa<ConstantInt>(I.getOperand(2));
+		case Instruction::ShuffleVector:
+			// Only shuffles between vectors of the same type
+			return I.getOperand(0)->getType() == t;
+		case Instruction::BitCast:
+			return isSIMDType(I.getOperand(0)->getType()) && !isSIMDMask(I.getOperand(0)->getType()) && !isSIMDMask(t);
+		case Instruction::SIToFP:
+		case Instruction::UIToFP:
+			return t->getVectorElementType()->isFloatTy() && I.getOperand(0)->getType()->getVectorElementType()->isIntegerTy(32);
+		case Instruction::FPToSI:
+		case Instruction::FPToUI:
+			return t->getVectorElementType()->isIntegerTy(32) && I.getOperand(0)->getType()->getVectorElementType()->isFloatTy();
+		case Instruction::ZExt:
+		case Instruction::SExt:
+			// Masks are widened to lanes of all zeros or all ones
+			return isSIMDMask(I.getOperand(0)->getType()) && !isSIMDMask(t);
+		default:
+			return false;
+	}
+}
+
+bool cheerp::needsVectorScalarization(const Function& F)
+{
+	// Only asm.js functions are compiled to wasm, the others become JavaScript
+	bool asmjs = F.getSection() == StringRef("asmjs");
+	for(const BasicBlock& BB: F)
+	{
+		for(const Instruction& I: BB)
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".add";
-			break;
+			if(!canLowerToSIMD(I) || (!asmjs && usesVectors(I)))
+				return true;
 		}
-		case Instruction::And:
+	}
+	return false;
+}
+
+void CheerpWastWriter::encodeSIMDInst(WasmSIMDOpcode opcode, const Twine& name, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		code << char(WasmOpcode::SIMD_PREFIX);
+		encodeULEB128(uint32_t(opcode), code);
+	}
+	else
+		code << name << '\n';
+}
+
+void CheerpWastWriter::encodeSIMDLaneInst(WasmSIMDOpcode opcode, const Twine& name, uint32_t lane, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		code << char(WasmOpcode::SIMD_PREFIX);
+		encodeULEB128(uint32_t(opcode), code);
+		code << char(lane);
+	}
+	else
+		code << name << ' ' << lane << '\n';
+}
+
+void CheerpWastWriter::encodeSIMDLoadStoreInst(WasmSIMDOpcode opcode, const char* name, raw_ostream& code)
+{
+	if (mode == WASM)
+	{
+		code << char(WasmOpcode::SIMD_PREFIX);
+		encodeULEB128(uint32_t(opcode), code);
+		// Natural alignment and no offset, like encodeLoadStoreInst
+		encodeULEB128(4, code);
+		encodeULEB128(0, code);
+	}
+	else
+		code << name << '\n';
+}
+
+void CheerpWastWriter::encodeV128Const(ArrayRef<uint8_t> bytes, raw_ostream& code)
+{
+	assert(bytes.size() == 16);
+	if (mode == WASM)
+	{
+		code << char(WasmOpcode::SIMD_PREFIX);
+		encodeULEB128(uint32_t(WasmSIMDOpcode::V128_CONST), code);
+		for(uint8_t b: bytes)
+			code << char(b);
+		return;
+	}
+	code << "v128.const i8x16";
+	for(uint8_t b: bytes)
+		code << ' ' << uint32_t(b);
+	code << '\n';
+}
+
+bool CheerpWastWriter::needsPointerKindConversion(const Instruction* phi, const Value* incoming)
+{
+	const Instruction* incomingInst=dyn_cast<Instruction>(incoming);
+	if(!incomingInst)
+		return true;
+	return isInlineable(*incomingInst) ||
+		getRegisterId(phi)!=getRegisterId(incomingInst);
+}
+
+
+bool CheerpWastWriter::needsPointerKindConversionForBlocks(const BasicBlock* to, const BasicBlock* from)
+{
+	class PHIHandler: public EndOfBlockPHIHandler
+	{
+	public:
+		PHIHandler(CheerpWastWriter& w):EndOfBlockPHIHandler(w.PA),needsPointerKindConversion(false),writer(w)
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".and";
-			break;
 		}
-		case Instruction::AShr:
+		~PHIHandler()
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".shr_s";
-			break;
 		}
-		case Instruction::BitCast:
+		bool needsPointerKindConversion;
+	private:
+		CheerpWastWriter& writer;
+		void handleRecursivePHIDependency(const Instruction* incoming) override
 		{
-			assert(I.getType()->isPointerTy());
-			compileOperand(I.getOperand(0));
-			break;
 		}
-		case Instruction::Br:
-			break;
-		case Instruction::VAArg:
+		void handlePHI(const Instruction* phi, const Value* incoming) override
 		{
-			const VAArgInst& vi=cast<VAArgInst>(I);
+			needsPointerKindConversion |= writer.needsPointerKindConversion(phi, incoming);
+		}
+	};
 
-			// Load the current argument
-			compileOperand(vi.getPointerOperand());
-			stream << "\n";
-			stream << "i32.load\n";
-			stream << getTypeString(vi.getType()) << ".load\n";
+	std::unique_lock<std::mutex> guard;
+	if (analysisLock)
+		guard = std::unique_lock<std::mutex>(*analysisLock);
+	auto handler = PHIHandler(*this);
+	handler.runOnEdge(registerize, from, to);
+	return handler.needsPointerKindConversion;
+}
 
-			// Move varargs pointer to next argument
-			compileOperand(vi.getPointerOperand());
-			stream << "\n";
-			compileOperand(vi.getPointerOperand());
-			stream << "\n";
-			stream << "i32.load\n";
-			stream << "i32.const 8\n";
-			stream << "i32.add\n";
-			stream << "i32.store\n";
-			break;
+void CheerpWastWriter::compilePHIOfBlockFromOtherBlock(raw_ostream& code, const BasicBlock* to, const BasicBlock* from)
+{
+	class WriterPHIHandler: public EndOfBlockPHIHandler
+	{
+	public:
+		WriterPHIHandler(CheerpWastWriter& w, raw_ostream& c, const BasicBlock* f, const BasicBlock* t):EndOfBlockPHIHandler(w.PA),writer(w),code(c),fromBB(f),toBB(t)
+		{
 		}
-		case Instruction::Call:
+		~WriterPHIHandler()
 		{
-			const CallInst& ci = cast<CallInst>(I);
-			const Function * calledFunc = ci.getCalledFunction();
-			const Value * calledValue = ci.getCalledValue();
-			const PointerType* pTy = cast<PointerType>(calledValue->getType());
-			const FunctionType* fTy = cast<FunctionType>(pTy->getElementType());
-			assert(!ci.isInlineAsm());
+		}
+	private:
+		CheerpWastWriter& writer;
+		raw_ostream& code;
+		const BasicBlock* fromBB;
+		const BasicBlock* toBB;
+		void handleRecursivePHIDependency(const Instruction* incoming) override
+		{
+			assert(incoming);
+			writer.encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", 1 + writer.currentFun->arg_size() + writer.getRegisterId(incoming), code);
+			writer.encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", 1 + writer.currentFun->arg_size() + writer.registerize.getRegisterIdForEdge(incoming, fromBB, toBB), code);
+		}
+		void handlePHI(const Instruction* phi, const Value* incoming) override
+		{
+			// We can avoid assignment from the same register if no pointer kind conversion is required
+			if(!writer.needsPointerKindConversion(phi, incoming))
+				return;
+			// 1) Put the value on the stack
+			assert(!writer.edgeFromBB && !writer.edgeToBB);
+			writer.edgeFromBB = fromBB;
+			writer.edgeToBB = toBB;
+			writer.compileOperand(code, incoming);
+			writer.edgeFromBB = nullptr;
+			writer.edgeToBB = nullptr;
+			// 2) Save the value in the phi
+			writer.encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", 1 + writer.currentFun->arg_size() + writer.getRegisterId(phi), code);
+		}
+	};
+	std::unique_lock<std::mutex> guard;
+	if (analysisLock)
+		guard = std::unique_lock<std::mutex>(*analysisLock);
+	WriterPHIHandler(*this, code, from, to).runOnEdge(registerize, from, to);
+}
 
-			if (calledFunc)
-			{
-				switch (calledFunc->getIntrinsicID())
-				{
-					case Intrinsic::trap:
-					{
-						stream << "unreachable ;; trap\n";
-						return true;
-					}
-					case Intrinsic::vastart:
-					{
-						compileOperand(ci.getOperand(0));
-						stream << '\n';
+const char* CheerpWastWriter::getTypeString(Type* t)
+{
+	if(t->isIntegerTy() || t->isPointerTy())
+		return "i32";
+	else if(t->isFloatTy())
+		return "f32";
+	else if(t->isDoubleTy())
+		return "f64";
+	else
+	{
+		llvm::errs() << "Unsupported type " << *t << "\n";
+		llvm_unreachable("Unsuppored type");
+	}
+}
+
+uint8_t CheerpWastWriter::getValType(Type* t)
+{
+	if(t->isIntegerTy() || t->isPointerTy())
+		return 0x7f;
+	else if(t->isFloatTy())
+		return 0x7d;
+	else if(t->isDoubleTy())
+		return 0x7c;
+	else
+	{
+		llvm::errs() << "Unsupported type " << *t << "\n";
+		llvm_unreachable("Unsuppored type");
+	}
+}
+
+uint32_t CheerpWastWriter::getTypeIndex(const FunctionType* fTy)
+{
+	auto it = typeIndices.find(fTy);
+	if (it != typeIndices.end())
+		return it->second;
+	uint32_t index = types.size();
+	typeIndices.insert(std::make_pair(fTy, index));
+	types.push_back(fTy);
+	return index;
+}
+
+void CheerpWastWriter::encodePredicate(const Type* ty, const CmpInst::Predicate predicate, raw_ostream& code)
+{
+	assert(ty->isIntegerTy() || ty->isPointerTy());
+	switch(predicate)
+	{
+		case CmpInst::ICMP_EQ:
+			encodeInst(WasmOpcode::I32_EQ, "i32.eq", code);
+			break;
+		case CmpInst::ICMP_NE:
+			encodeInst(WasmOpcode::I32_NE, "i32.ne", code);
+			break;
+		case CmpInst::ICMP_SGE:
+			encodeInst(WasmOpcode::I32_GE_S, "i32.ge_s", code);
+			break;
+		case CmpInst::ICMP_SGT:
+			encodeInst(WasmOpcode::I32_GT_S, "i32.gt_s", code);
+			break;
+		case CmpInst::ICMP_SLE:
+			encodeInst(WasmOpcode::I32_LE_S, "i32.le_s", code);
+			break;
+		case CmpInst::ICMP_SLT:
+			encodeInst(WasmOpcode::I32_LT_S, "i32.lt_s", code);
+			break;
+		case CmpInst::ICMP_UGE:
+			encodeInst(WasmOpcode::I32_GE_U, "i32.ge_u", code);
+			break;
+		case CmpInst::ICMP_UGT:
+			encodeInst(WasmOpcode::I32_GT_U, "i32.gt_u", code);
+			break;
+		case CmpInst::ICMP_ULE:
+			encodeInst(WasmOpcode::I32_LE_U, "i32.le_u", code);
+			break;
+		case CmpInst::ICMP_ULT:
+			encodeInst(WasmOpcode::I32_LT_U, "i32.lt_u", code);
+			break;
+		default:
+			llvm::errs() << "Handle predicate " << predicate << "\n";
+			break;
+	}
+}
+
+void CheerpWastWriter::encodeFloatPredicate(const Type* ty, const CmpInst::Predicate predicate, raw_ostream& code)
+{
+	bool isFloat = ty->isFloatTy();
+	assert(isFloat || ty->isDoubleTy());
+	switch(predicate)
+	{
+		// TODO: Handle ordered vs unordered
+		case CmpInst::FCMP_UEQ:
+		case CmpInst::FCMP_OEQ:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_EQ, "f32.eq", code);
+			else
+				encodeInst(WasmOpcode::F64_EQ, "f64.eq", code);
+			break;
+		case CmpInst::FCMP_UNE:
+		case CmpInst::FCMP_ONE:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_NE, "f32.ne", code);
+			else
+				encodeInst(WasmOpcode::F64_NE, "f64.ne", code);
+			break;
+		case CmpInst::FCMP_ULT:
+		case CmpInst::FCMP_OLT:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_LT, "f32.lt", code);
+			else
+				encodeInst(WasmOpcode::F64_LT, "f64.lt", code);
+			break;
+		case CmpInst::FCMP_OGT:
+		case CmpInst::FCMP_UGT:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_GT, "f32.gt", code);
+			else
+				encodeInst(WasmOpcode::F64_GT, "f64.gt", code);
+			break;
+		case CmpInst::FCMP_ULE:
+		case CmpInst::FCMP_OLE:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_LE, "f32.le", code);
+			else
+				encodeInst(WasmOpcode::F64_LE, "f64.le", code);
+			break;
+		case CmpInst::FCMP_UGE:
+		case CmpInst::FCMP_OGE:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_GE, "f32.ge", code);
+			else
+				encodeInst(WasmOpcode::F64_GE, "f64.ge", code);
+			break;
+		default:
+			llvm::errs() << "Handle predicate " << predicate << "\n";
+			break;
+	}
+}
+
+void CheerpWastWriter::encodeLoad(Type* ty, raw_ostream& code)
+{
+	if(ty->isIntegerTy())
+	{
+		uint32_t bitWidth = ty->getIntegerBitWidth();
+		if(bitWidth == 1)
+			bitWidth = 8;
+		// Currently assume unsigned, like Cheerp. We may optimize this be looking at a following sext or zext instruction.
+		if(bitWidth == 8)
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD8_U, "i32.load8_u", 0, code);
+		else if(bitWidth == 16)
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD16_U, "i32.load16_u", 1, code);
+		else
+		{
+			assert(bitWidth == 32);
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD, "i32.load", 2, code);
+		}
+	}
+	else if(ty->isFloatTy())
+		encodeLoadStoreInst(WasmOpcode::F32_LOAD, "f32.load", 2, code);
+	else if(ty->isDoubleTy())
+		encodeLoadStoreInst(WasmOpcode::F64_LOAD, "f64.load", 3, code);
+	else
+	{
+		assert(ty->isPointerTy());
+		encodeLoadStoreInst(WasmOpcode::I32_LOAD, "i32.load", 2, code);
+	}
+}
+
+void CheerpWastWriter::encodeStore(Type* ty, raw_ostream& code)
+{
+	// When storing values with size less than 32-bit we need to truncate them
+	if(ty->isIntegerTy())
+	{
+		uint32_t bitWidth = ty->getIntegerBitWidth();
+		if(bitWidth == 1)
+			bitWidth = 8;
+		if(bitWidth == 8)
+			encodeLoadStoreInst(WasmOpcode::I32_STORE8, "i32.store8", 0, code);
+		else if(bitWidth == 16)
+			encodeLoadStoreInst(WasmOpcode::I32_STORE16, "i32.store16", 1, code);
+		else
+		{
+			assert(bitWidth == 32);
+			encodeLoadStoreInst(WasmOpcode::I32_STORE, "i32.store", 2, code);
+		}
+	}
+	else if(ty->isFloatTy())
+		encodeLoadStoreInst(WasmOpcode::F32_STORE, "f32.store", 2, code);
+	else if(ty->isDoubleTy())
+		encodeLoadStoreInst(WasmOpcode::F64_STORE, "f64.store", 3, code);
+	else
+	{
+		assert(ty->isPointerTy());
+		encodeLoadStoreInst(WasmOpcode::I32_STORE, "i32.store", 2, code);
+	}
+}
+
+void CheerpWastWriter::encodeBinOp(const Instruction& I, raw_ostream& code)
+{
+	compileOperand(code, I.getOperand(0));
+	compileOperand(code, I.getOperand(1));
+	bool isFloat = I.getType()->isFloatTy();
+	switch(I.getOpcode())
+	{
+		case Instruction::Add:
+			encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
+			break;
+		case Instruction::And:
+			encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+			break;
+		case Instruction::AShr:
+			encodeInst(WasmOpcode::I32_SHR_S, "i32.shr_s", code);
+			break;
+		case Instruction::LShr:
+			encodeInst(WasmOpcode::I32_SHR_U, "i32.shr_u", code);
+			break;
+		case Instruction::Mul:
+			encodeInst(WasmOpcode::I32_MUL, "i32.mul", code);
+			break;
+		case Instruction::Or:
+			encodeInst(WasmOpcode::I32_OR, "i32.or", code);
+			break;
+		case Instruction::Shl:
+			encodeInst(WasmOpcode::I32_SHL, "i32.shl", code);
+			break;
+		case Instruction::Sub:
+			encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
+			break;
+		case Instruction::Xor:
+			encodeInst(WasmOpcode::I32_XOR, "i32.xor", code);
+			break;
+		case Instruction::SDiv:
+			encodeInst(WasmOpcode::I32_DIV_S, "i32.div_s", code);
+			break;
+		case Instruction::UDiv:
+			encodeInst(WasmOpcode::I32_DIV_U, "i32.div_u", code);
+			break;
+		case Instruction::SRem:
+			encodeInst(WasmOpcode::I32_REM_S, "i32.rem_s", code);
+			break;
+		case Instruction::URem:
+			encodeInst(WasmOpcode::I32_REM_U, "i32.rem_u", code);
+			break;
+		case Instruction::FAdd:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_ADD, "f32.add", code);
+			else
+				encodeInst(WasmOpcode::F64_ADD, "f64.add", code);
+			break;
+		case Instruction::FDiv:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_DIV, "f32.div", code);
+			else
+				encodeInst(WasmOpcode::F64_DIV, "f64.div", code);
+			break;
+		case Instruction::FMul:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_MUL, "f32.mul", code);
+			else
+				encodeInst(WasmOpcode::F64_MUL, "f64.mul", code);
+			break;
+		case Instruction::FSub:
+			if (isFloat)
+				encodeInst(WasmOpcode::F32_SUB, "f32.sub", code);
+			else
+				encodeInst(WasmOpcode::F64_SUB, "f64.sub", code);
+			break;
+		default:
+			llvm_unreachable("unexpected binary operator");
+	}
+}
+
+void CheerpWastWriter::compileGEP(raw_ostream& code, const llvm::User* gep_inst)
+{
+	WastGepWriter gepWriter(*this, code);
+	const llvm::Value *p = linearHelper.compileGEP(gep_inst, &gepWriter);
+	compileOperand(code, p);
+	if(!gepWriter.first)
+		encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
+}
+
+bool CheerpWastWriter::isInlineable(const Instruction& I) const
+{
+	if (inlineableCache)
+	{
+		auto it = inlineableCache->find(&I);
+		assert(it != inlineableCache->end());
+		return it->second;
+	}
+	return cheerp::isInlineable(I, PA);
+}
+
+uint32_t CheerpWastWriter::getRegisterId(const Instruction* I) const
+{
+	if (edgeFromBB)
+		return registerize.getRegisterIdForEdge(I, edgeFromBB, edgeToBB);
+	return registerize.getRegisterId(I);
+}
+
+void CheerpWastWriter::compileSignedInteger(raw_ostream& code, const llvm::Value* v, bool forComparison)
+{
+	uint32_t shiftAmount = 32-v->getType()->getIntegerBitWidth();
+	if(const ConstantInt* C = dyn_cast<ConstantInt>(v))
+	{
+		if(forComparison)
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", C->getSExtValue() << shiftAmount, code);
+		else
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", C->getSExtValue(), code);
+		return;
+	}
+
+	compileOperand(code, v);
+
+	if (shiftAmount == 0)
+		return;
+
+	if (forComparison)
+	{
+		// When comparing two signed values we can avoid the right shift
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", shiftAmount, code);
+		encodeInst(WasmOpcode::I32_SHL, "i32.shl", code);
+	}
+	else
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", shiftAmount, code);
+		encodeInst(WasmOpcode::I32_SHL, "i32.shl", code);
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", shiftAmount, code);
+		encodeInst(WasmOpcode::I32_SHR_S, "i32.shr_s", code);
+	}
+}
+
+void CheerpWastWriter::compileUnsignedInteger(raw_ostream& code, const llvm::Value* v)
+{
+	if(const ConstantInt* C = dyn_cast<ConstantInt>(v))
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", C->getZExtValue(), code);
+		return;
+	}
+
+	compileOperand(code, v);
+
+	uint32_t initialSize = v->getType()->getIntegerBitWidth();
+	if(initialSize != 32)
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", getMaskForBitWidth(initialSize), code);
+		encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+	}
+}
+
+void CheerpWastWriter::compileConstantExpr(raw_ostream& code, const ConstantExpr* ce)
+{
+	switch(ce->getOpcode())
+	{
+		case Instruction::GetElementPtr:
+		{
+			compileGEP(code, ce);
+			break;
+		}
+		case Instruction::BitCast:
+		{
+			assert(ce->getOperand(0)->getType()->isPointerTy());
+			compileOperand(code, ce->getOperand(0));
+			break;
+		}
+		case Instruction::IntToPtr:
+		{
+			compileOperand(code, ce->getOperand(0));
+			break;
+		}
+		case Instruction::ICmp:
+		{
+			CmpInst::Predicate p = (CmpInst::Predicate)ce->getPredicate();
+			compileOperand(code, ce->getOperand(0));
+			compileOperand(code, ce->getOperand(1));
+			encodePredicate(ce->getOperand(0)->getType(), p, code);
+			break;
+		}
+		case Instruction::PtrToInt:
+		{
+			compileOperand(code, ce->getOperand(0));
+			break;
+		}
+#if 0
+		case Instruction::Select:
+		{
+			compileSelect(ce, ce->getOperand(0), ce->getOperand(1), ce->getOperand(2), HIGHEST);
+			break;
+		}
+		case Instruction::Sub:
+		{
+			compileSubtraction(ce->getOperand(0), ce->getOperand(1), HIGHEST);
+			break;
+		}
+#endif
+		default:
+			encodeInst(WasmOpcode::UNREACHABLE, "unreachable", code);
+			llvm::errs() << "warning: Unsupported constant expr " << ce->getOpcodeName() << '\n';
+	}
+}
+
+void CheerpWastWriter::compileConstant(raw_ostream& code, const Constant* c)
+{
+	if(c->getType()->isVectorTy())
+	{
+		compileSIMDConstant(code, c);
+		return;
+	}
+	if(const ConstantExpr* CE = dyn_cast<ConstantExpr>(c))
+	{
+		compileConstantExpr(code, CE);
+	}
+	else if(const ConstantInt* i=dyn_cast<ConstantInt>(c))
+	{
+		if(i->getBitWidth()==32)
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", i->getSExtValue(), code);
+		else
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", i->getZExtValue(), code);
+	}
+	else if(const ConstantFP* f=dyn_cast<ConstantFP>(c))
+	{
+		bool isFloat = f->getType()->isFloatTy();
+		if (mode == WASM)
+		{
+			// Floating point immediates are encoded as little endian IEEE 754 bit patterns
+			code << char(isFloat ? WasmOpcode::F32_CONST : WasmOpcode::F64_CONST);
+			uint64_t bits = f->getValueAPF().bitcastToAPInt().getZExtValue();
+			for(uint32_t i = 0; i < (isFloat ? 32u : 64u); i += 8)
+				code << char((bits >> i) & 255);
+			return;
+		}
+		code << getTypeString(f->getType()) << ".const ";
+		if(f->getValueAPF().isInfinity())
+		{
+			if(f->getValueAPF().isNegative())
+				code << '-';
+			code << "infinity";
+		}
+		else if(f->getValueAPF().isNaN())
+		{
+			code << "nan";
+		}
+		else
+		{
+			APFloat apf = f->getValueAPF();
+			char buf[40];
+			// TODO: Figure out the right amount of hexdigits
+			unsigned charCount = apf.convertToHexString(buf, isFloat ? 8 : 16, false, APFloat::roundingMode::rmNearestTiesToEven);
+			assert(charCount < 40);
+			code << buf;
+		}
+		code << '\n';
+	}
+	else if(const GlobalVariable* GV = dyn_cast<GlobalVariable>(c))
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", linearHelper.getGlobalVariableAddress(GV), code);
+	}
+	else if(isa<ConstantPointerNull>(c))
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 0, code);
+	}
+	else if(isa<Function>(c))
+	{
+		const Function* F = cast<Function>(c);
+		if (globalDeps.functionAddresses().count(F) &&
+			globalDeps.functionTables().count(F->getFunctionType()))
+		{
+			int offset = globalDeps.functionAddresses().at(F);
+			const auto& functionTable = globalDeps.functionTables().at(F->getFunctionType());
+			int functionTableOffset = functionTableOffsets.at(functionTable.name);
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", functionTableOffset + offset, code);
+		}
+		else
+		{
+			c->dump();
+			assert(false);
+		}
+	}
+	else if (isa<UndefValue>(c))
+	{
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 0, code);
+	}
+	else
+	{
+		c->dump();
+		assert(false);
+	}
+}
+
+void CheerpWastWriter::compileSIMDConstant(raw_ostream& code, const Constant* c)
+{
+	uint32_t numElements = c->getType()->getVectorNumElements();
+	uint32_t laneBytes = 16 / numElements;
+	uint8_t bytes[16] = { 0 };
+	for(uint32_t i = 0; i < numElements; i++)
+	{
+		const Constant* element = c->getAggregateElement(i);
+		uint64_t bits = 0;
+		if(const ConstantInt* ci = dyn_cast<ConstantInt>(element))
+		{
+			// The lanes of masks are all ones when true
+			if(ci->getBitWidth() == 1)
+				bits = ci->isZero() ? 0 : ~uint64_t(0);
+			else
+				bits = ci->getZExtValue();
+		}
+		else if(const ConstantFP* f = dyn_cast<ConstantFP>(element))
+			bits = f->getValueAPF().bitcastToAPInt().getZExtValue();
+		else
+			assert(isa<UndefValue>(element));
+		// Lanes are little endian
+		for(uint32_t j = 0; j < laneBytes; j++)
+			bytes[i * laneBytes + j] = (bits >> (j * 8)) & 255;
+	}
+	encodeV128Const(bytes, code);
+}
+
+void CheerpWastWriter::compileOperand(raw_ostream& code, const llvm::Value* v)
+{
+	if(const Constant* c=dyn_cast<Constant>(v))
+		compileConstant(code, c);
+	else if(const Instruction* it=dyn_cast<Instruction>(v))
+	{
+		if(isInlineable(*it))
+			compileInstruction(code, *it);
+		else
+			encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", 1 + currentFun->arg_size() + getRegisterId(it), code);
+	}
+	else if(const Argument* arg=dyn_cast<Argument>(v))
+	{
+		encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", arg->getArgNo(), code);
+	}
+	else
+	{
+		v->dump();
+		assert(false);
+	}
+}
+
+void CheerpWastWriter::compileDowncast(raw_ostream& code, ImmutableCallSite callV)
+{
+	assert(callV.arg_size() == 2);
+	assert(callV.getCalledFunction()->getIntrinsicID() == Intrinsic::cheerp_downcast);
+
+	const Value* src = callV.getArgument(0);
+	const Value* offset = callV.getArgument(1);
+
+	Type* t = src->getType()->getPointerElementType();
+
+	compileOperand(code, src);
+
+	if(!TypeSupport::isClientType(t) &&
+			(!isa<ConstantInt>(offset) || !cast<ConstantInt>(offset)->isNullValue()))
+	{
+		compileOperand(code, offset);
+		encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
+	}
+}
+
+bool CheerpWastWriter::compileInstruction(raw_ostream& code, const Instruction& I)
+{
+	if(usesVectors(I))
+		return compileSIMDInstruction(code, I);
+	switch(I.getOpcode())
+	{
+		case Instruction::Alloca:
+		{
+			const AllocaInst* ai = cast<AllocaInst>(&I);
+			Type* allocTy = ai->getAllocatedType();
+			// TODO: There is another method that includes the alignment
+			uint32_t size = targetData.getTypeAllocSize(allocTy);
+			uint32_t alignment = TypeSupport::getAlignmentAsmJS(targetData, allocTy);
+			assert (!ai->isArrayAllocation());
+			assert((alignment & (alignment-1)) == 0 && "alignment must be power of 2");
+			// We grow the stack down for now
+			// 1) Push the current stack pointer
+			encodeU32Inst(WasmOpcode::GET_GLOBAL, "get_global", stackTopGlobal, code);
+			// 2) Push the allocation size
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", size, code);
+			// 3) Substract the size
+			encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
+			// 3.1) Optionally align the stack down
+			if(size % alignment)
+			{
+				encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", uint32_t(0-alignment), code);
+				encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+			}
+			// 4) Write the location to the local, but preserve the value
+			encodeU32Inst(WasmOpcode::TEE_LOCAL, "tee_local", 1 + currentFun->arg_size() + getRegisterId(&I), code);
+			// 5) Save the new stack position
+			encodeU32Inst(WasmOpcode::SET_GLOBAL, "set_global", stackTopGlobal, code);
+			return true;
+		}
+		case Instruction::Add:
+		case Instruction::And:
+		case Instruction::AShr:
+		case Instruction::LShr:
+		case Instruction::Mul:
+		case Instruction::Or:
+		case Instruction::Shl:
+		case Instruction::Sub:
+		case Instruction::Xor:
+		case Instruction::SDiv:
+		case Instruction::UDiv:
+		case Instruction::SRem:
+		case Instruction::URem:
+		case Instruction::FAdd:
+		case Instruction::FDiv:
+		case Instruction::FMul:
+		case Instruction::FSub:
+		{
+			encodeBinOp(I, code);
+			break;
+		}
+		case Instruction::BitCast:
+		{
+			assert(I.getType()->isPointerTy());
+			compileOperand(code, I.getOperand(0));
+			break;
+		}
+		case Instruction::Br:
+			break;
+		case Instruction::VAArg:
+		{
+			const VAArgInst& vi=cast<VAArgInst>(I);
+
+			// Load the current argument
+			compileOperand(code, vi.getPointerOperand());
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD, "i32.load", 2, code);
+			encodeLoad(vi.getType(), code);
+
+			// Move varargs pointer to next argument
+			compileOperand(code, vi.getPointerOperand());
+			compileOperand(code, vi.getPointerOperand());
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD, "i32.load", 2, code);
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 8, code);
+			encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
+			encodeLoadStoreInst(WasmOpcode::I32_STORE, "i32.store", 2, code);
+			break;
+		}
+		case Instruction::Call:
+		{
+			const CallInst& ci = cast<CallInst>(I);
+			const Function * calledFunc = ci.getCalledFunction();
+			const Value * calledValue = ci.getCalledValue();
+			const PointerType* pTy = cast<PointerType>(calledValue->getType());
+			const FunctionType* fTy = cast<FunctionType>(pTy->getElementType());
+			assert(!ci.isInlineAsm());
+
+			if (calledFunc)
+			{
+				MEM_HELPER helper = getMemHelper(calledFunc);
+				if (helper != NUM_MEM_HELPERS)
+				{
+					assert(memHelperIds[helper] != UINT32_MAX);
+					// The alignment and volatile arguments of the intrinsics are not needed
+					for (uint32_t i = 0; i < 3; i++)
+						compileOperand(code, ci.getOperand(i));
+					encodeU32Inst(WasmOpcode::CALL, "call", memHelperIds[helper], code);
+					// Only memcmp has a result
+					return helper != MEMCMP_HELPER;
+				}
+				switch (calledFunc->getIntrinsicID())
+				{
+					case Intrinsic::trap:
+					{
+						encodeInst(WasmOpcode::UNREACHABLE, "unreachable", code);
+						return true;
+					}
+					case Intrinsic::vastart:
+					{
+						compileOperand(code, ci.getOperand(0));
 						uint32_t numArgs = I.getParent()->getParent()->arg_size();
-						stream << "get_local " << numArgs << "\n";
-						stream << "i32.store\n";
+						encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", numArgs, code);
+						encodeLoadStoreInst(WasmOpcode::I32_STORE, "i32.store", 2, code);
 						return true;
 					}
 					case Intrinsic::invariant_start:
@@ -1055,12 +2109,12 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 					}
 					case Intrinsic::cheerp_downcast:
 					{
-						compileDowncast(&ci);
+						compileDowncast(code, &ci);
 						return false;
 					}
 					case Intrinsic::cheerp_downcast_current:
 					{
-						compileOperand(ci.getOperand(0));
+						compileOperand(code, ci.getOperand(0));
 						return false;
 					}
 					case Intrinsic::cheerp_cast_user:
@@ -1068,20 +2122,30 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 						if(ci.use_empty())
 							return true;
 
-						compileOperand(ci.getOperand(0));
+						compileOperand(code, ci.getOperand(0));
 						return false;
 					}
 					case Intrinsic::flt_rounds:
 					{
 						// Rounding mode 1: nearest
-						stream << "i32.const 1\n";
+						encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 1, code);
 						return false;
 					}
 					case Intrinsic::ctlz:
 					{
-						compileOperand(ci.getOperand(0));
-						stream << '\n';
-						stream << "i32.clz\n";
+						compileOperand(code, ci.getOperand(0));
+						encodeInst(WasmOpcode::I32_CLZ, "i32.clz", code);
+						return false;
+					}
+					case Intrinsic::cheerp_current_memory:
+					{
+						encodeMemoryInst(WasmOpcode::CURRENT_MEMORY, "current_memory", code);
+						return false;
+					}
+					case Intrinsic::cheerp_grow_memory:
+					{
+						compileOperand(code, ci.getOperand(0));
+						encodeMemoryInst(WasmOpcode::GROW_MEMORY, "grow_memory", code);
 						return false;
 					}
 					default:
@@ -1107,36 +2171,36 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 						op != ci.op_begin() + arg_size - 1; op--)
 				{
 					i++;
-					stream << "get_global " << stackTopGlobal << '\n';
-					stream << "i32.const 8\n";
-					stream << "i32.sub\n";
+					encodeU32Inst(WasmOpcode::GET_GLOBAL, "get_global", stackTopGlobal, code);
+					encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 8, code);
+					encodeInst(WasmOpcode::I32_SUB, "i32.sub", code);
 					// TODO: use 'tee_global' when it's available?
-					stream << "set_global " << stackTopGlobal << '\n';
-					stream << "get_global " << stackTopGlobal << '\n';
-					compileOperand(op->get());
-					stream << "\n";
-					stream << getTypeString(op->get()->getType()) << ".store\n";
+					encodeU32Inst(WasmOpcode::SET_GLOBAL, "set_global", stackTopGlobal, code);
+					encodeU32Inst(WasmOpcode::GET_GLOBAL, "get_global", stackTopGlobal, code);
+					compileOperand(code, op->get());
+					encodeStore(op->get()->getType(), code);
 				}
 			}
 
 			for (auto op = ci.op_begin();
 					op != ci.op_begin() + fTy->getNumParams(); ++op)
 			{
-				compileOperand(op->get());
-				stream << '\n';
+				compileOperand(code, op->get());
 			}
 
 			if (calledFunc)
 			{
-				if (functionIds.count(calledFunc))
+				auto it = functionIds.find(calledFunc);
+				if (it != functionIds.end())
 				{
-					stream << "call " << functionIds[calledFunc];
+					encodeU32Inst(WasmOpcode::CALL, "call", it->second, code);
 				}
 				else
 				{
 					// TODO implement ffi calls to the browser side.
-					stream << "unreachable ;; unknown call \""
-						<< calledFunc->getName() << "\"\n";
+					if (mode == WAST)
+						code << ";; unknown call \"" << calledFunc->getName() << "\"\n";
+					encodeInst(WasmOpcode::UNREACHABLE, "unreachable", code);
 					return true;
 				}
 			}
@@ -1145,123 +2209,73 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 				if (globalDeps.functionTables().count(fTy))
 				{
 					const auto& table = globalDeps.functionTables().at(fTy);
-					compileOperand(calledValue);
-					stream << '\n';
-					stream << "call_indirect $vt_" << table.name;
+					compileOperand(code, calledValue);
+					if (mode == WASM)
+					{
+						code << char(WasmOpcode::CALL_INDIRECT);
+						encodeULEB128(getTypeIndex(fTy), code);
+						// Reserved table index
+						code << char(0);
+					}
+					else
+						code << "call_indirect $vt_" << table.name << '\n';
 				}
 				else
 				{
 					// TODO implement ffi calls to the browser side.
-					stream << "unreachable ;; unknown indirect call\n";
+					if (mode == WAST)
+						code << ";; unknown indirect call\n";
+					encodeInst(WasmOpcode::UNREACHABLE, "unreachable", code);
 					return true;
 				}
 			}
 
 			if(ci.getType()->isVoidTy())
-			{
-				stream << '\n';
 				return true;
-			}
-			break;
-		}
-		case Instruction::FAdd:
-		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".add";
 			break;
 		}
 		case Instruction::FCmp:
 		{
 			const CmpInst& ci = cast<CmpInst>(I);
-			compileOperand(ci.getOperand(0));
-			stream << '\n';
-			compileOperand(ci.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(ci.getOperand(0)->getType()) << '.';
-			switch(ci.getPredicate())
-			{
-				// TODO: Handle ordered vs unordered
-				case CmpInst::FCMP_UEQ:
-				case CmpInst::FCMP_OEQ:
-					stream << "eq";
-					break;
-				case CmpInst::FCMP_UNE:
-				case CmpInst::FCMP_ONE:
-					stream << "ne";
-					break;
-				case CmpInst::FCMP_ULT:
-				case CmpInst::FCMP_OLT:
-					stream << "lt";
-					break;
-				case CmpInst::FCMP_OGT:
-				case CmpInst::FCMP_UGT:
-					stream << "gt";
-					break;
-				case CmpInst::FCMP_ULE:
-				case CmpInst::FCMP_OLE:
-					stream << "le";
-					break;
-				case CmpInst::FCMP_UGE:
-				case CmpInst::FCMP_OGE:
-					stream << "ge";
-					break;
-				default:
-					llvm::errs() << "Handle predicate for " << ci << "\n";
-					break;
-			}
-			break;
-		}
-		case Instruction::FDiv:
-		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".div";
+			compileOperand(code, ci.getOperand(0));
+			compileOperand(code, ci.getOperand(1));
+			encodeFloatPredicate(ci.getOperand(0)->getType(), ci.getPredicate(), code);
 			break;
 		}
 		case Instruction::FRem:
 		{
 			// No FRem in wasm, implement manually
 			// frem x, y -> fsub (x, fmul( ftrunc ( fdiv (x, y) ), y ) )
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".div\n";
-			stream << getTypeString(I.getType()) << ".trunc\n";
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".mul\n";
-			stream << getTypeString(I.getType()) << ".sub";
-			break;
-		}
-		case Instruction::FMul:
-		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".mul";
-			break;
-		}
-		case Instruction::FSub:
-		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".sub";
+			bool isFloat = I.getType()->isFloatTy();
+			compileOperand(code, I.getOperand(0));
+			compileOperand(code, I.getOperand(0));
+			compileOperand(code, I.getOperand(1));
+			if (isFloat)
+			{
+				encodeInst(WasmOpcode::F32_DIV, "f32.div", code);
+				encodeInst(WasmOpcode::F32_TRUNC, "f32.trunc", code);
+			}
+			else
+			{
+				encodeInst(WasmOpcode::F64_DIV, "f64.div", code);
+				encodeInst(WasmOpcode::F64_TRUNC, "f64.trunc", code);
+			}
+			compileOperand(code, I.getOperand(1));
+			if (isFloat)
+			{
+				encodeInst(WasmOpcode::F32_MUL, "f32.mul", code);
+				encodeInst(WasmOpcode::F32_SUB, "f32.sub", code);
+			}
+			else
+			{
+				encodeInst(WasmOpcode::F64_MUL, "f64.mul", code);
+				encodeInst(WasmOpcode::F64_SUB, "f64.sub", code);
+			}
 			break;
 		}
 		case Instruction::GetElementPtr:
 		{
-			compileGEP(&I);
+			compileGEP(code, &I);
 			break;
 		}
 		case Instruction::ICmp:
@@ -1270,33 +2284,25 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 			CmpInst::Predicate p = (CmpInst::Predicate)ci.getPredicate();
 			if(ci.getOperand(0)->getType()->isPointerTy())
 			{
-				compileOperand(ci.getOperand(0));
-				stream << '\n';
-				compileOperand(ci.getOperand(1));
-				stream << '\n';
+				compileOperand(code, ci.getOperand(0));
+				compileOperand(code, ci.getOperand(1));
 			}
 			else if(CmpInst::isSigned(p))
 			{
-				compileSignedInteger(ci.getOperand(0), true);
-				stream << '\n';
-				compileSignedInteger(ci.getOperand(1), true);
-				stream << '\n';
+				compileSignedInteger(code, ci.getOperand(0), true);
+				compileSignedInteger(code, ci.getOperand(1), true);
 			}
 			else if (CmpInst::isUnsigned(p) || !I.getOperand(0)->getType()->isIntegerTy(32))
 			{
-				compileUnsignedInteger(ci.getOperand(0));
-				stream << '\n';
-				compileUnsignedInteger(ci.getOperand(1));
-				stream << '\n';
+				compileUnsignedInteger(code, ci.getOperand(0));
+				compileUnsignedInteger(code, ci.getOperand(1));
 			}
 			else
 			{
-				compileSignedInteger(ci.getOperand(0), true);
-				stream << '\n';
-				compileSignedInteger(ci.getOperand(1), true);
-				stream << '\n';
+				compileSignedInteger(code, ci.getOperand(0), true);
+				compileSignedInteger(code, ci.getOperand(1), true);
 			}
-			stream << getTypeString(ci.getOperand(0)->getType()) << '.' << getIntegerPredicate(ci.getPredicate());
+			encodePredicate(ci.getOperand(0)->getType(), p, code);
 			break;
 		}
 		case Instruction::Load:
@@ -1304,444 +2310,1378 @@ bool CheerpWastWriter::compileInstruction(const Instruction& I)
 			const LoadInst& li = cast<LoadInst>(I);
 			const Value* ptrOp=li.getPointerOperand();
 			// 1) The pointer
-			compileOperand(ptrOp);
-			stream << '\n';
+			compileOperand(code, ptrOp);
 			// 2) Load
-			stream << getTypeString(li.getType()) << ".load";
-			if(li.getType()->isIntegerTy())
+			encodeLoad(li.getType(), code);
+			break;
+		}
+		case Instruction::PtrToInt:
+		{
+			compileOperand(code, I.getOperand(0));
+			break;
+		}
+		case Instruction::Store:
+		{
+			const StoreInst& si = cast<StoreInst>(I);
+			const Value* ptrOp=si.getPointerOperand();
+			const Value* valOp=si.getValueOperand();
+			// 1) The pointer
+			compileOperand(code, ptrOp);
+			// 2) The value
+			compileOperand(code, valOp);
+			// 3) Store
+			encodeStore(valOp->getType(), code);
+			break;
+		}
+		case Instruction::Switch:
+			break;
+		case Instruction::Trunc:
+		{
+			// TODO: We need to mask the value
+			compileOperand(code, I.getOperand(0));
+			break;
+		}
+		case Instruction::Ret:
+		{
+			const ReturnInst& ri = cast<ReturnInst>(I);
+			Value* retVal = ri.getReturnValue();
+			if(retVal)
+				compileOperand(code, I.getOperand(0));
+			// Restore old stack
+			encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", currentFun->arg_size(), code);
+			encodeU32Inst(WasmOpcode::SET_GLOBAL, "set_global", stackTopGlobal, code);
+			encodeInst(WasmOpcode::RETURN, "return", code);
+			break;
+		}
+		case Instruction::Select:
+		{
+			const SelectInst& si = cast<SelectInst>(I);
+			compileOperand(code, si.getTrueValue());
+			compileOperand(code, si.getFalseValue());
+			compileOperand(code, si.getCondition());
+			encodeInst(WasmOpcode::SELECT, "select", code);
+			break;
+		}
+		case Instruction::SExt:
+		{
+			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
+			compileOperand(code, I.getOperand(0));
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 32-bitWidth, code);
+			encodeInst(WasmOpcode::I32_SHL, "i32.shl", code);
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 32-bitWidth, code);
+			encodeInst(WasmOpcode::I32_SHR_S, "i32.shr_s", code);
+			break;
+		}
+		case Instruction::FPToSI:
+		{
+			compileOperand(code, I.getOperand(0));
+			if (I.getOperand(0)->getType()->isFloatTy())
+				encodeInst(WasmOpcode::I32_TRUNC_S_F32, "i32.trunc_s/f32", code);
+			else
+				encodeInst(WasmOpcode::I32_TRUNC_S_F64, "i32.trunc_s/f64", code);
+			break;
+		}
+		case Instruction::FPToUI:
+		{
+			compileOperand(code, I.getOperand(0));
+			if (I.getOperand(0)->getType()->isFloatTy())
+				encodeInst(WasmOpcode::I32_TRUNC_U_F32, "i32.trunc_u/f32", code);
+			else
+				encodeInst(WasmOpcode::I32_TRUNC_U_F64, "i32.trunc_u/f64", code);
+			break;
+		}
+		case Instruction::SIToFP:
+		{
+			compileOperand(code, I.getOperand(0));
+			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
+			if(bitWidth != 32)
 			{
-				uint32_t bitWidth = li.getType()->getIntegerBitWidth();
-				if(bitWidth == 1)
-					bitWidth = 8;
-				if(bitWidth < 32)
-				{
-					assert(bitWidth == 8 || bitWidth == 16);
-					// Currently assume unsigned, like Cheerp. We may optimize this be looking at a following sext or zext instruction.
-					stream << bitWidth << "_u";
-				}
+				// Sign extend
+				encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 32-bitWidth, code);
+				encodeInst(WasmOpcode::I32_SHL, "i32.shl", code);
+				encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 32-bitWidth, code);
+				encodeInst(WasmOpcode::I32_SHR_S, "i32.shr_s", code);
 			}
+			if (I.getType()->isFloatTy())
+				encodeInst(WasmOpcode::F32_CONVERT_S_I32, "f32.convert_s/i32", code);
+			else
+				encodeInst(WasmOpcode::F64_CONVERT_S_I32, "f64.convert_s/i32", code);
 			break;
 		}
-		case Instruction::LShr:
+		case Instruction::UIToFP:
+		{
+			compileOperand(code, I.getOperand(0));
+			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
+			if(bitWidth != 32)
+			{
+				encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", getMaskForBitWidth(bitWidth), code);
+				encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+			}
+			if (I.getType()->isFloatTy())
+				encodeInst(WasmOpcode::F32_CONVERT_U_I32, "f32.convert_u/i32", code);
+			else
+				encodeInst(WasmOpcode::F64_CONVERT_U_I32, "f64.convert_u/i32", code);
+			break;
+		}
+		case Instruction::FPTrunc:
+		{
+			assert(I.getType()->isFloatTy());
+			assert(I.getOperand(0)->getType()->isDoubleTy());
+			compileOperand(code, I.getOperand(0));
+			encodeInst(WasmOpcode::F32_DEMOTE_F64, "f32.demote/f64", code);
+			break;
+		}
+		case Instruction::FPExt:
+		{
+			assert(I.getType()->isDoubleTy());
+			assert(I.getOperand(0)->getType()->isFloatTy());
+			compileOperand(code, I.getOperand(0));
+			encodeInst(WasmOpcode::F64_PROMOTE_F32, "f64.promote/f32", code);
+			break;
+		}
+		case Instruction::ZExt:
+		{
+			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
+			compileOperand(code, I.getOperand(0));
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", getMaskForBitWidth(bitWidth), code);
+			encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+			break;
+		}
+		case Instruction::Unreachable:
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".shr_u";
+			encodeInst(WasmOpcode::UNREACHABLE, "unreachable", code);
 			break;
 		}
+		default:
+		{
+			I.dump();
+			llvm::errs() << "\tImplement inst " << I.getOpcodeName() << '\n';
+		}
+	}
+	return false;
+}
+
+bool CheerpWastWriter::compileSIMDInstruction(raw_ostream& code, const Instruction& I)
+{
+	assert(canLowerToSIMD(I));
+	Type* t = I.getType();
+	switch(I.getOpcode())
+	{
+		case Instruction::Add:
+		case Instruction::Sub:
 		case Instruction::Mul:
+		case Instruction::Shl:
+		case Instruction::LShr:
+		case Instruction::AShr:
+		case Instruction::FAdd:
+		case Instruction::FSub:
+		case Instruction::FMul:
+		case Instruction::FDiv:
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".mul";
+			const SIMDShapeInfo& shape = getSIMDShape(t);
+			compileOperand(code, I.getOperand(0));
+			// Shifts take a scalar amount
+			if(Instruction::isShift(I.getOpcode()))
+				compileOperand(code, getSplatScalar(I.getOperand(1)));
+			else
+				compileOperand(code, I.getOperand(1));
+			// Offsets from the first arithmetic instruction of the shape
+			uint32_t offset = 0;
+			const char* opName = nullptr;
+			switch(I.getOpcode())
+			{
+				case Instruction::Shl: offset = 0; opName = "shl"; break;
+				case Instruction::AShr: offset = 1; opName = "shr_s"; break;
+				case Instruction::LShr: offset = 2; opName = "shr_u"; break;
+				case Instruction::Add: offset = 3; opName = "add"; break;
+				case Instruction::Sub: offset = 6; opName = "sub"; break;
+				case Instruction::Mul: offset = 10; opName = "mul"; break;
+				case Instruction::FAdd: offset = 0; opName = "add"; break;
+				case Instruction::FSub: offset = 1; opName = "sub"; break;
+				case Instruction::FMul: offset = 2; opName = "mul"; break;
+				case Instruction::FDiv: offset = 3; opName = "div"; break;
+			}
+			encodeSIMDInst(WasmSIMDOpcode(uint32_t(shape.arithmetic) + offset), Twine(shape.name) + "." + opName, code);
 			break;
 		}
+		case Instruction::And:
 		case Instruction::Or:
+		case Instruction::Xor:
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".or";
+			compileOperand(code, I.getOperand(0));
+			compileOperand(code, I.getOperand(1));
+			if(I.getOpcode() == Instruction::And)
+				encodeSIMDInst(WasmSIMDOpcode::V128_AND, "v128.and", code);
+			else if(I.getOpcode() == Instruction::Or)
+				encodeSIMDInst(WasmSIMDOpcode::V128_OR, "v128.or", code);
+			else
+				encodeSIMDInst(WasmSIMDOpcode::V128_XOR, "v128.xor", code);
 			break;
 		}
-		case Instruction::PtrToInt:
+		case Instruction::ICmp:
+		case Instruction::FCmp:
 		{
-			compileOperand(I.getOperand(0));
+			const CmpInst& ci = cast<CmpInst>(I);
+			const SIMDShapeInfo& shape = getSIMDShape(ci.getOperand(0)->getType());
+			compileOperand(code, ci.getOperand(0));
+			compileOperand(code, ci.getOperand(1));
+			// Offsets from the first comparison of the shape
+			uint32_t offset = 0;
+			const char* opName = nullptr;
+			switch(ci.getPredicate())
+			{
+				case CmpInst::ICMP_EQ: offset = 0; opName = "eq"; break;
+				case CmpInst::ICMP_NE: offset = 1; opName = "ne"; break;
+				case CmpInst::ICMP_SLT: offset = 2; opName = "lt_s"; break;
+				case CmpInst::ICMP_ULT: offset = 3; opName = "lt_u"; break;
+				case CmpInst::ICMP_SGT: offset = 4; opName = "gt_s"; break;
+				case CmpInst::ICMP_UGT: offset = 5; opName = "gt_u"; break;
+				case CmpInst::ICMP_SLE: offset = 6; opName = "le_s"; break;
+				case CmpInst::ICMP_ULE: offset = 7; opName = "le_u"; break;
+				case CmpInst::ICMP_SGE: offset = 8; opName = "ge_s"; break;
+				case CmpInst::ICMP_UGE: offset = 9; opName = "ge_u"; break;
+				// TODO: Handle ordered vs unordered, like the scalar comparisons
+				case CmpInst::FCMP_OEQ:
+				case CmpInst::FCMP_UEQ: offset = 0; opName = "eq"; break;
+				case CmpInst::FCMP_ONE:
+				case CmpInst::FCMP_UNE: offset = 1; opName = "ne"; break;
+				case CmpInst::FCMP_OLT:
+				case CmpInst::FCMP_ULT: offset = 2; opName = "lt"; break;
+				case CmpInst::FCMP_OGT:
+				case CmpInst::FCMP_UGT: offset = 3; opName = "gt"; break;
+				case CmpInst::FCMP_OLE:
+				case CmpInst::FCMP_ULE: offset = 4; opName = "le"; break;
+				case CmpInst::FCMP_OGE:
+				case CmpInst::FCMP_UGE: offset = 5; opName = "ge"; break;
+				default:
+					llvm_unreachable("unexpected vector predicate");
+			}
+			encodeSIMDInst(WasmSIMDOpcode(uint32_t(shape.compare) + offset), Twine(shape.name) + "." + opName, code);
 			break;
 		}
-		case Instruction::Shl:
+		case Instruction::Select:
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".shl";
+			const SelectInst& si = cast<SelectInst>(I);
+			compileOperand(code, si.getTrueValue());
+			compileOperand(code, si.getFalseValue());
+			compileOperand(code, si.getCondition());
+			// Masks select each lane, their lanes are all ones or all zeros
+			if(si.getCondition()->getType()->isVectorTy())
+				encodeSIMDInst(WasmSIMDOpcode::V128_BITSELECT, "v128.bitselect", code);
+			else
+				encodeInst(WasmOpcode::SELECT, "select", code);
 			break;
 		}
-		case Instruction::Store:
+		case Instruction::ExtractElement:
 		{
-			const StoreInst& si = cast<StoreInst>(I);
-			const Value* ptrOp=si.getPointerOperand();
-			const Value* valOp=si.getValueOperand();
-			// 1) The pointer
-			compileOperand(ptrOp);
-			stream << '\n';
-			// 2) The value
-			compileOperand(valOp);
-			stream << '\n';
-			// 3) Store
-			stream << getTypeString(valOp->getType()) << ".store";
-			// When storing values with size less than 32-bit we need to truncate them
-			if(valOp->getType()->isIntegerTy())
+			const Value* vec = I.getOperand(0);
+			uint32_t lane = cast<ConstantInt>(I.getOperand(1))->getZExtValue();
+			compileOperand(code, vec);
+			if(isSIMDMask(vec->getType()))
+			{
+				// Reading 32 bits at most of a mask lane is enough
+				if(vec->getType()->getVectorNumElements() == 2)
+					encodeSIMDLaneInst(WasmSIMDOpcode::I32X4_EXTRACT_LANE, "i32x4.extract_lane", lane * 2, code);
+				else
+				{
+					const SIMDShapeInfo& shape = getSIMDShape(vec->getType());
+					encodeSIMDLaneInst(shape.extractLane, Twine(shape.name) + "." + shape.extractLaneName, lane, code);
+				}
+				encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 1, code);
+				encodeInst(WasmOpcode::I32_AND, "i32.and", code);
+			}
+			else
+			{
+				const SIMDShapeInfo& shape = getSIMDShape(vec->getType());
+				encodeSIMDLaneInst(shape.extractLane, Twine(shape.name) + "." + shape.extractLaneName, lane, code);
+			}
+			break;
+		}
+		case Instruction::InsertElement:
+		{
+			const SIMDShapeInfo& shape = getSIMDShape(t);
+			compileOperand(code, I.getOperand(0));
+			compileOperand(code, I.getOperand(1));
+			uint32_t lane = cast<ConstantInt>(I.getOperand(2))->getZExtValue();
+			encodeSIMDLaneInst(shape.replaceLane, Twine(shape.name) + ".replace_lane", lane, code);
+			break;
+		}
+		case Instruction::ShuffleVector:
+		{
+			const ShuffleVectorInst& si = cast<ShuffleVectorInst>(I);
+			if(!isSIMDMask(t))
 			{
-				uint32_t bitWidth = valOp->getType()->getIntegerBitWidth();
-				if(bitWidth == 1)
-					bitWidth = 8;
-				if(bitWidth < 32)
+				if(const Value* scalar = getSplatScalar(&si))
 				{
-					assert(bitWidth == 8 || bitWidth == 16);
-					stream << bitWidth;
+					const SIMDShapeInfo& shape = getSIMDShape(t);
+					compileOperand(code, scalar);
+					encodeSIMDInst(shape.splat, Twine(shape.name) + ".splat", code);
+					break;
 				}
 			}
-			stream << '\n';
+			compileOperand(code, si.getOperand(0));
+			compileOperand(code, si.getOperand(1));
+			// The shuffle selects bytes, undefined lanes take the first one
+			uint32_t numElements = t->getVectorNumElements();
+			uint32_t laneBytes = 16 / numElements;
+			uint8_t bytes[16];
+			for(uint32_t i = 0; i < numElements; i++)
+			{
+				int lane = std::max(si.getMaskValue(i), 0);
+				for(uint32_t j = 0; j < laneBytes; j++)
+					bytes[i * laneBytes + j] = lane * laneBytes + j;
+			}
+			if (mode == WASM)
+			{
+				code << char(WasmOpcode::SIMD_PREFIX);
+				encodeULEB128(uint32_t(WasmSIMDOpcode::I8X16_SHUFFLE), code);
+				for(uint8_t b: bytes)
+					code << char(b);
+			}
+			else
+			{
+				code << "i8x16.shuffle";
+				for(uint8_t b: bytes)
+					code << ' ' << uint32_t(b);
+				code << '\n';
+			}
+			break;
+		}
+		case Instruction::BitCast:
+		case Instruction::SExt:
+		{
+			// Sign extended masks keep all their bits
+			compileOperand(code, I.getOperand(0));
+			break;
+		}
+		case Instruction::ZExt:
+		{
+			compileOperand(code, I.getOperand(0));
+			uint32_t numElements = t->getVectorNumElements();
+			uint8_t bytes[16] = { 0 };
+			for(uint32_t i = 0; i < numElements; i++)
+				bytes[i * (16 / numElements)] = 1;
+			encodeV128Const(bytes, code);
+			encodeSIMDInst(WasmSIMDOpcode::V128_AND, "v128.and", code);
+			break;
+		}
+		case Instruction::SIToFP:
+		{
+			compileOperand(code, I.getOperand(0));
+			encodeSIMDInst(WasmSIMDOpcode::F32X4_CONVERT_I32X4_S, "f32x4.convert_i32x4_s", code);
+			break;
+		}
+		case Instruction::UIToFP:
+		{
+			compileOperand(code, I.getOperand(0));
+			encodeSIMDInst(WasmSIMDOpcode::F32X4_CONVERT_I32X4_U, "f32x4.convert_i32x4_u", code);
+			break;
+		}
+		case Instruction::FPToSI:
+		{
+			compileOperand(code, I.getOperand(0));
+			encodeSIMDInst(WasmSIMDOpcode::I32X4_TRUNC_SAT_F32X4_S, "i32x4.trunc_sat_f32x4_s", code);
 			break;
 		}
-		case Instruction::Sub:
+		case Instruction::FPToUI:
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".sub";
+			compileOperand(code, I.getOperand(0));
+			encodeSIMDInst(WasmSIMDOpcode::I32X4_TRUNC_SAT_F32X4_U, "i32x4.trunc_sat_f32x4_u", code);
 			break;
 		}
-		case Instruction::Switch:
+		case Instruction::Load:
+		{
+			compileOperand(code, cast<LoadInst>(I).getPointerOperand());
+			encodeSIMDLoadStoreInst(WasmSIMDOpcode::V128_LOAD, "v128.load", code);
 			break;
-		case Instruction::Trunc:
+		}
+		case Instruction::Store:
 		{
-			// TODO: We need to mask the value
-			compileOperand(I.getOperand(0));
+			const StoreInst& si = cast<StoreInst>(I);
+			compileOperand(code, si.getPointerOperand());
+			compileOperand(code, si.getValueOperand());
+			encodeSIMDLoadStoreInst(WasmSIMDOpcode::V128_STORE, "v128.store", code);
 			break;
 		}
-		case Instruction::Ret:
+		default:
 		{
-			const ReturnInst& ri = cast<ReturnInst>(I);
-			Value* retVal = ri.getReturnValue();
-			if(retVal)
+			I.dump();
+			llvm::errs() << "\tImplement SIMD inst " << I.getOpcodeName() << '\n';
+		}
+	}
+	return false;
+}
+
+void CheerpWastWriter::compileBB(raw_ostream& code, const BasicBlock& BB)
+{
+	BasicBlock::const_iterator I=BB.begin();
+	BasicBlock::const_iterator IE=BB.end();
+	for(;I!=IE;++I)
+	{
+		if(isInlineable(*I))
+			continue;
+		if(I->getOpcode()==Instruction::PHI) //Phys are manually handled
+			continue;
+		if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&(*I)))
+		{
+			//Skip some kind of intrinsics
+			if(II->getIntrinsicID()==Intrinsic::lifetime_start ||
+				II->getIntrinsicID()==Intrinsic::lifetime_end ||
+				II->getIntrinsicID()==Intrinsic::dbg_declare ||
+				II->getIntrinsicID()==Intrinsic::dbg_value)
 			{
-				compileOperand(I.getOperand(0));
-				stream << '\n';
+				continue;
 			}
-			// Restore old stack
-			stream << "get_local " << currentFun->arg_size() << "\n";
-			stream << "set_global " << stackTopGlobal << '\n';
-			stream << "return\n";
-			break;
 		}
-		case Instruction::SDiv:
-		case Instruction::UDiv:
-		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".div_"
-				<< (I.getOpcode() == Instruction::SDiv ? 's' : 'u');
-			break;
+
+		// Display file and line markers in WAST for debugging purposes
+		const llvm::DebugLoc& debugLoc = I->getDebugLoc();
+		if (mode == WAST && !debugLoc.isUnknown()) {
+			MDNode* file = debugLoc.getScope(Ctx);
+			assert(file);
+			assert(file->getNumOperands()>=2);
+			MDNode* fileNamePath = cast<MDNode>(file->getOperand(1));
+			assert(fileNamePath->getNumOperands()==2);
+			StringRef fileName = cast<MDString>(fileNamePath->getOperand(0))->getString();
+			uint32_t currentLine = debugLoc.getLine();
+			code << ";; " << fileName << ":" << currentLine << "\n";
 		}
-		case Instruction::SRem:
-		case Instruction::URem:
+
+		if(I->isTerminator() || !I->use_empty() || I->mayHaveSideEffects())
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".rem_"
-				<< (I.getOpcode() == Instruction::SRem ? 's' : 'u');
-			break;
+			if(!compileInstruction(code, *I) && !I->getType()->isVoidTy())
+			{
+				if(I->use_empty())
+					encodeInst(WasmOpcode::DROP, "drop", code);
+				else
+					encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", 1 + currentFun->arg_size() + getRegisterId(I), code);
+			}
 		}
-		case Instruction::Select:
+	}
+}
+
+void CheerpWastWriter::compileMethodLocals(raw_ostream& code, const Function& F, bool needsLabel)
+{
+	const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
+	// The first local after ther params stores the previous stack address
+	std::vector<uint8_t> locals;
+	locals.push_back(0x7f);
+	// Emit the registers, careful as the registerize id is offset by the number of args
+	for(const Registerize::RegisterInfo& regInfo: regsInfo)
+	{
+		assert(regInfo.regKind != Registerize::OBJECT);
+		assert(!regInfo.needsSecondaryName);
+		switch(regInfo.regKind)
 		{
-			const SelectInst& si = cast<SelectInst>(I);
-			compileOperand(si.getTrueValue());
-			stream << '\n';
-			compileOperand(si.getFalseValue());
-			stream << '\n';
-			compileOperand(si.getCondition());
-			stream << '\n';
-			stream << "select";
-			break;
+			case Registerize::DOUBLE:
+				locals.push_back(0x7c);
+				break;
+			case Registerize::FLOAT:
+				locals.push_back(0x7d);
+				break;
+			case Registerize::INTEGER:
+				locals.push_back(0x7f);
+				break;
+			case Registerize::VECTOR:
+				locals.push_back(0x7b);
+				break;
+			default:
+				assert(false);
 		}
-		case Instruction::SExt:
+	}
+	// If needed, label is the very last local
+	if(needsLabel)
+		locals.push_back(0x7f);
+
+	if (mode == WASM)
+	{
+		// Locals are encoded as runs of the same type
+		std::vector<std::pair<uint32_t, uint8_t>> groups;
+		for(uint8_t t: locals)
 		{
-			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
-			compileOperand(I.getOperand(0));
-			stream << "\ni32.const " << (32-bitWidth) << '\n';
-			stream << "i32.shl\n";
-			stream << "i32.const " << (32-bitWidth) << '\n';
-			stream << "i32.shr_s";
-			break;
+			if(!groups.empty() && groups.back().second == t)
+				groups.back().first++;
+			else
+				groups.emplace_back(1, t);
 		}
-		case Instruction::FPToSI:
+		encodeULEB128(groups.size(), code);
+		for(const auto& g: groups)
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n' << getTypeString(I.getType()) << ".trunc_s/" << getTypeString(I.getOperand(0)->getType());
-			break;
+			encodeULEB128(g.first, code);
+			code << char(g.second);
 		}
-		case Instruction::FPToUI:
+		return;
+	}
+
+	code << "(local";
+	for(uint8_t t: locals)
+	{
+		switch(t)
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n' << getTypeString(I.getType()) << ".trunc_u/" << getTypeString(I.getOperand(0)->getType());
-			break;
+			case 0x7c:
+				code << " f64";
+				break;
+			case 0x7d:
+				code << " f32";
+				break;
+			case 0x7b:
+				code << " v128";
+				break;
+			default:
+				code << " i32";
+				break;
 		}
-		case Instruction::SIToFP:
+	}
+	code << ")\n";
+}
+
+void CheerpWastWriter::compileMethodPrologue(raw_ostream& code, const Function& F, bool needsLabel)
+{
+	compileMethodLocals(code, F, needsLabel);
+	// Save the stack address in the first local after the params
+	// TODO: Only save the stack address if required
+	encodeU32Inst(WasmOpcode::GET_GLOBAL, "get_global", stackTopGlobal, code);
+	encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", F.arg_size(), code);
+}
+
+void CheerpWastWriter::compileMethodParams(raw_ostream& code, const FunctionType* fTy)
+{
+	uint32_t numArgs = fTy->getNumParams();
+	if(numArgs)
+	{
+		code << "(param";
+		for(uint32_t i = 0; i < numArgs; i++)
+			code << ' ' << getTypeString(fTy->getParamType(i));
+		code << ')';
+	}
+}
+
+void CheerpWastWriter::compileMethodResult(raw_ostream& code, const Type* ty)
+{
+	if(!ty->isVoidTy())
+		code << "(result " << getTypeString(const_cast<Type*>(ty)) << ')';
+}
+
+void CheerpWastWriter::compileMethod(raw_ostream& code, const Function& F)
+{
+	currentFun = &F;
+	// In binary mode the body is prefixed by its size
+	SmallString<256> buf;
+	raw_svector_ostream bufStream(buf);
+	raw_ostream& body = mode == WASM ? static_cast<raw_ostream&>(bufStream) : code;
+	if (mode == WAST)
+	{
+		code << "(func";
+		code << " $" << F.getName();
+		// TODO: We should not export them all
+		code << " (export \"" << NameGenerator::filterLLVMName(F.getName(),NameGenerator::NAME_FILTER_MODE::GLOBAL) << "\")";
+		compileMethodParams(code, F.getFunctionType());
+		compileMethodResult(code, F.getReturnType());
+		code << '\n';
+	}
+	uint32_t numArgs = F.arg_size();
+	const llvm::BasicBlock* lastDepth0Block = nullptr;
+	if(F.size() == 1)
+	{
+		compileMethodPrologue(body, F, false);
+		compileBB(body, *F.begin());
+		lastDepth0Block = &(*F.begin());
+	}
+	else
+	{
+		// Reducible CFGs are structured directly, the relooper is the fallback
+		bool structured = false;
+		if(!useRelooper)
 		{
-			compileOperand(I.getOperand(0));
-			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
-			if(bitWidth != 32)
+			CheerpWastStructurizer structurizer(this, body, F);
+			if(structurizer.canStructurize())
 			{
-				// Sign extend
-				stream << "\ni32.const " << (32-bitWidth) << '\n';
-				stream << "i32.shl\n";
-				stream << "i32.const " << (32-bitWidth) << '\n';
-				stream << "i32.shr_s";
+				compileMethodPrologue(body, F, false);
+				structurizer.compile();
+				lastDepth0Block = structurizer.lastDepth0Block;
+				structured = true;
 			}
-			stream << '\n' << getTypeString(I.getType()) << ".convert_s/" << getTypeString(I.getOperand(0)->getType());
-			break;
 		}
-		case Instruction::UIToFP:
+		if(!structured)
 		{
-			compileOperand(I.getOperand(0));
-			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
-			if(bitWidth != 32)
+			Relooper* rl = CheerpWriter::runRelooperOnFunction(F, relooperCache.get());
+			compileMethodPrologue(body, F, rl->needsLabel());
+			const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
+			uint32_t numRegs = regsInfo.size();
+			// label is the very last local
+			CheerpWastRenderInterface ri(this, body, 1+numArgs+numRegs);
+			rl->Render(&ri);
+			lastDepth0Block = ri.lastDepth0Block;
+			delete rl;
+		}
+	}
+	// A function has to terminate with a return instruction
+	if(!lastDepth0Block || !isa<ReturnInst>(lastDepth0Block->getTerminator()))
+	{
+		// Add a fake return
+		Type* retTy = F.getReturnType();
+		if(retTy->isFloatTy() || retTy->isDoubleTy())
+		{
+			if (mode == WASM)
 			{
-				stream << "\ni32.const " << getMaskForBitWidth(bitWidth);
+				body << char(retTy->isFloatTy() ? WasmOpcode::F32_CONST : WasmOpcode::F64_CONST);
+				for(uint32_t i = 0; i < (retTy->isFloatTy() ? 4u : 8u); i++)
+					body << char(0);
 			}
-			stream << '\n' << getTypeString(I.getType()) << ".convert_u/" << getTypeString(I.getOperand(0)->getType());
-			break;
+			else
+				body << getTypeString(retTy) << ".const 0\n";
 		}
-		case Instruction::FPTrunc:
+		else if(!retTy->isVoidTy())
+			encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 0, body);
+		encodeInst(WasmOpcode::RETURN, "return", body);
+	}
+	if (mode == WASM)
+	{
+		encodeInst(WasmOpcode::END, "end", body);
+		StringRef contents = bufStream.str();
+		encodeULEB128(contents.size(), code);
+		code << contents;
+	}
+	else
+		code << ")\n";
+}
+
+void CheerpWastWriter::compileImport(raw_ostream& code, const Function& F)
+{
+	assert(useWastLoader);
+	StringRef name = NameGenerator::filterLLVMName(F.getName(),NameGenerator::NAME_FILTER_MODE::GLOBAL);
+	if (mode == WASM)
+	{
+		encodeString("imports", code);
+		encodeString(name, code);
+		// Function import
+		code << char(0x00);
+		encodeULEB128(getTypeIndex(F.getFunctionType()), code);
+		return;
+	}
+	code << "(func (import \"imports\" \"";
+	code << name;
+	code << "\")";
+	compileMethodParams(code, F.getFunctionType());
+	compileMethodResult(code, F.getReturnType());
+	code << ")\n";
+}
+
+void CheerpWastWriter::compileTypeSection()
+{
+	if (mode == WAST)
+	{
+		// Define function type variables
+		for (const auto& table : globalDeps.functionTables())
 		{
-			assert(I.getType()->isFloatTy());
-			assert(I.getOperand(0)->getType()->isDoubleTy());
-			compileOperand(I.getOperand(0));
-			stream << '\n' << getTypeString(I.getType()) << ".demote/" << getTypeString(I.getOperand(0)->getType());
-			break;
+			if (!table.second.hasIndirectCalls)
+				continue;
+			stream << "(type " << "$vt_" << table.second.name << " (func ";
+			const llvm::Function& F = *table.second.functions[0];
+			compileMethodParams(stream, F.getFunctionType());
+			compileMethodResult(stream, F.getReturnType());
+			stream << "))\n";
 		}
-		case Instruction::FPExt:
+		return;
+	}
+
+	if (types.empty())
+		return;
+
+	Section section(SECTION_TYPE, *this);
+	encodeULEB128(types.size(), section.code);
+	for (const FunctionType* fTy : types)
+	{
+		section.code << char(0x60);
+		encodeULEB128(fTy->getNumParams(), section.code);
+		for (Type* paramTy : fTy->params())
+			section.code << char(getValType(paramTy));
+		if (fTy->getReturnType()->isVoidTy())
+			encodeULEB128(0, section.code);
+		else
 		{
-			assert(I.getType()->isDoubleTy());
-			assert(I.getOperand(0)->getType()->isFloatTy());
-			compileOperand(I.getOperand(0));
-			stream << '\n' << getTypeString(I.getType()) << ".promote/" << getTypeString(I.getOperand(0)->getType());
-			break;
+			encodeULEB128(1, section.code);
+			section.code << char(getValType(fTy->getReturnType()));
 		}
-		case Instruction::Xor:
+	}
+}
+
+void CheerpWastWriter::compileImportSection()
+{
+	if (!useWastLoader || globalDeps.asmJSImports().empty())
+		return;
+
+	Section section(SECTION_IMPORT, *this);
+	if (mode == WASM)
+		encodeULEB128(globalDeps.asmJSImports().size(), section.code);
+	for (const Function* F : globalDeps.asmJSImports())
+		compileImport(section.code, *F);
+}
+
+void CheerpWastWriter::compileFunctionSection()
+{
+	// In the text format function signatures are declared inline
+	if (mode == WAST)
+		return;
+
+	uint32_t count = 0;
+	for (const Function& F : module.getFunctionList())
+	{
+		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+			count++;
+	}
+	bool hasConstructors = !globalDeps.constructors().empty() && !useWastLoader;
+	if (hasConstructors)
+		count++;
+	count += getNumMemHelpers();
+	if (count == 0)
+		return;
+
+	Section section(SECTION_FUNCTION, *this);
+	encodeULEB128(count, section.code);
+	for (const Function& F : module.getFunctionList())
+	{
+		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+			encodeULEB128(getTypeIndex(F.getFunctionType()), section.code);
+	}
+	if (hasConstructors)
+		encodeULEB128(getTypeIndex(FunctionType::get(Type::getVoidTy(Ctx), false)), section.code);
+	for (uint32_t i = 0; i < NUM_MEM_HELPERS; i++)
+	{
+		if (memHelperIds[i] != UINT32_MAX)
+			encodeULEB128(getTypeIndex(getMemHelperType(MEM_HELPER(i))), section.code);
+	}
+}
+
+void CheerpWastWriter::compileTableSection()
+{
+	// Only the tables used by indirect calls are part of the wasm table,
+	// the other functions just have an address past its end
+	uint32_t count = 0;
+	for (const auto& table : globalDeps.functionTables())
+	{
+		if (table.second.hasIndirectCalls)
+			count += table.second.functions.size();
+	}
+	if (count == 0)
+		return;
+
+	if (mode == WAST)
+	{
+		// Define 'table' with functions
+		stream << "(table anyfunc (elem";
+		for (const auto& table : globalDeps.functionTables())
+		{
+			if (!table.second.hasIndirectCalls)
+				continue;
+			for (const auto& F : table.second.functions)
+				stream << " $" << F->getName();
+		}
+		stream << "))\n";
+		return;
+	}
+
+	Section section(SECTION_TABLE, *this);
+	encodeULEB128(1, section.code);
+	// anyfunc
+	section.code << char(0x70);
+	// The table has a maximum, like the one defined with an inline segment
+	encodeULEB128(1, section.code);
+	encodeULEB128(count, section.code);
+	encodeULEB128(count, section.code);
+}
+
+void CheerpWastWriter::compileMemorySection()
+{
+	// Define the memory for the module, min and max are in WasmPage units.
+	// Without a maximum the memory can grow up to the 4GiB limit
+	if (mode == WAST)
+	{
+		stream << "(memory (export \"memory\") " << minMemory;
+		if (maxMemory)
+			stream << ' ' << maxMemory;
+		stream << ")\n";
+		return;
+	}
+
+	Section section(SECTION_MEMORY, *this);
+	encodeULEB128(1, section.code);
+	// Flags, 1 if the memory has a maximum
+	encodeULEB128(maxMemory ? 1 : 0, section.code);
+	encodeULEB128(minMemory, section.code);
+	if (maxMemory)
+		encodeULEB128(maxMemory, section.code);
+}
+
+void CheerpWastWriter::compileGlobalSection()
+{
+	// The stack grows downward from the end of its reserved area
+	if (mode == WAST)
+	{
+		stream << "(global (mut i32) (i32.const " << stackStart << "))\n";
+		return;
+	}
+
+	Section section(SECTION_GLOBAL, *this);
+	encodeULEB128(usedGlobals, section.code);
+	// Mutable i32
+	section.code << char(0x7f) << char(0x01);
+	encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", stackStart, section.code);
+	encodeInst(WasmOpcode::END, "end", section.code);
+}
+
+void CheerpWastWriter::compileExportSection()
+{
+	// In the text format exports are declared inline
+	if (mode == WAST)
+		return;
+
+	std::vector<const Function*> exported;
+	for (const Function& F : module.getFunctionList())
+	{
+		// TODO: We should not export them all
+		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+			exported.push_back(&F);
+	}
+
+	Section section(SECTION_EXPORT, *this);
+	encodeULEB128(exported.size() + 1, section.code);
+	for (const Function* F : exported)
+	{
+		encodeString(NameGenerator::filterLLVMName(F->getName(),NameGenerator::NAME_FILTER_MODE::GLOBAL), section.code);
+		// Function export
+		section.code << char(0x00);
+		encodeULEB128(functionIds.at(F), section.code);
+	}
+	encodeString("memory", section.code);
+	// Memory export
+	section.code << char(0x02);
+	encodeULEB128(0, section.code);
+}
+
+void CheerpWastWriter::compileStartSection()
+{
+	// Experimental entry point for wast code
+	llvm::Function* wastStart = module.getFunction("_Z9wastStartv");
+	uint32_t startFunction = 0;
+	if(wastStart && globalDeps.constructors().empty())
+	{
+		assert(functionIds.count(wastStart));
+		startFunction = functionIds[wastStart];
+	}
+	else if (!globalDeps.constructors().empty() && !useWastLoader)
+	{
+		startFunction = functionIds.size();
+	}
+	else
+		return;
+
+	if (mode == WAST)
+	{
+		stream << "(start " << startFunction << ")\n";
+		return;
+	}
+
+	Section section(SECTION_START, *this);
+	encodeULEB128(startFunction, section.code);
+}
+
+void CheerpWastWriter::compileElementSection()
+{
+	// In the text format the elements are declared inline with the table
+	if (mode == WAST)
+		return;
+
+	std::vector<uint32_t> elements;
+	for (const auto& table : globalDeps.functionTables())
+	{
+		if (!table.second.hasIndirectCalls)
+			continue;
+		for (const auto& F : table.second.functions)
+			elements.push_back(functionIds.at(F));
+	}
+	if (elements.empty())
+		return;
+
+	Section section(SECTION_ELEMENT, *this);
+	// A single segment for table 0, starting at offset 0
+	encodeULEB128(1, section.code);
+	encodeULEB128(0, section.code);
+	encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", 0, section.code);
+	encodeInst(WasmOpcode::END, "end", section.code);
+	encodeULEB128(elements.size(), section.code);
+	for (uint32_t id : elements)
+		encodeULEB128(id, section.code);
+}
+
+void CheerpWastWriter::compileCodeSection()
+{
+	uint32_t count = 0;
+	for (const Function& F : module.getFunctionList())
+	{
+		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+			count++;
+	}
+	bool hasConstructors = !globalDeps.constructors().empty() && !useWastLoader;
+	if (hasConstructors)
+		count++;
+	count += getNumMemHelpers();
+	if (count == 0)
+		return;
+
+	Section section(SECTION_CODE, *this);
+	if (mode == WASM)
+		encodeULEB128(count, section.code);
+
+	// Actually compile the code
+	std::vector<const Function*> functions;
+	for ( const Function & F : module.getFunctionList() )
+	{
+		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+			functions.push_back(&F);
+	}
+	if (codegenThreads > 1 && functions.size() > 1 && llvm_is_multithreaded())
+		compileMethodsParallel(functions, section.code);
+	else
+	{
+		for (const Function* F : functions)
 		{
-			compileOperand(I.getOperand(0));
-			stream << '\n';
-			compileOperand(I.getOperand(1));
-			stream << '\n';
-			stream << getTypeString(I.getType()) << ".xor";
-			break;
+			uint64_t start = section.code.tell();
+			compileMethod(section.code, *F);
+			if (sizeReport)
+				sizeReport->add(F, SizeReport::WASM, section.code.tell() - start);
 		}
-		case Instruction::ZExt:
+	}
+
+	// Construct an anonymous function that calls the global constructors.
+	if (hasConstructors)
+	{
+		SmallString<256> buf;
+		raw_svector_ostream bufStream(buf);
+		raw_ostream& body = mode == WASM ? static_cast<raw_ostream&>(bufStream) : section.code;
+		if (mode == WASM)
 		{
-			uint32_t bitWidth = I.getOperand(0)->getType()->getIntegerBitWidth();
-			compileOperand(I.getOperand(0));
-			stream << "\ni32.const " << getMaskForBitWidth(bitWidth) << '\n';
-			stream << "i32.and";
-			break;
+			// No locals
+			encodeULEB128(0, body);
 		}
-		case Instruction::Unreachable:
+		else
+			body << "(func\n";
+		for (const Function* F : globalDeps.constructors())
 		{
-			stream << "unreachable\n";
-			break;
+			if (F->getSection() == StringRef("asmjs"))
+				encodeU32Inst(WasmOpcode::CALL, "call", functionIds.at(F), body);
 		}
-		default:
+
+		llvm::Function* wastStart = module.getFunction("_Z9wastStartv");
+		if (wastStart)
+			encodeU32Inst(WasmOpcode::CALL, "call", functionIds.at(wastStart), body);
+
+		if (mode == WASM)
 		{
-			I.dump();
-			llvm::errs() << "\tImplement inst " << I.getOpcodeName() << '\n';
+			encodeInst(WasmOpcode::END, "end", body);
+			StringRef contents = bufStream.str();
+			encodeULEB128(contents.size(), section.code);
+			section.code << contents;
 		}
+		else
+			body << ")\n";
+	}
+
+	for (uint32_t i = 0; i < NUM_MEM_HELPERS; i++)
+	{
+		if (memHelperIds[i] != UINT32_MAX)
+			compileMemHelper(section.code, MEM_HELPER(i));
 	}
-	return false;
 }
 
-void CheerpWastWriter::compileBB(const BasicBlock& BB)
+void CheerpWastWriter::compileMethodsParallel(const std::vector<const Function*>& functions, raw_ostream& code)
 {
-	BasicBlock::const_iterator I=BB.begin();
-	BasicBlock::const_iterator IE=BB.end();
-	for(;I!=IE;++I)
+	// The analyses keep lazily filled caches, populate everything that the
+	// workers will query before starting them
+	DenseMap<const Instruction*, bool> inlineable;
+	for (const Function* F : functions)
 	{
-		if(isInlineable(*I, PA))
-			continue;
-		if(I->getOpcode()==Instruction::PHI) //Phys are manually handled
-			continue;
-		if(const IntrinsicInst* II=dyn_cast<IntrinsicInst>(&(*I)))
+		for (const BasicBlock& BB : *F)
 		{
-			//Skip some kind of intrinsics
-			if(II->getIntrinsicID()==Intrinsic::lifetime_start ||
-				II->getIntrinsicID()==Intrinsic::lifetime_end ||
-				II->getIntrinsicID()==Intrinsic::dbg_declare ||
-				II->getIntrinsicID()==Intrinsic::dbg_value)
-			{
-				continue;
-			}
-		}
-
-		// Display file and line markers in WAST for debugging purposes
-		const llvm::DebugLoc& debugLoc = I->getDebugLoc();
-		if (!debugLoc.isUnknown()) {
-			MDNode* file = debugLoc.getScope(Ctx);
-			assert(file);
-			assert(file->getNumOperands()>=2);
-			MDNode* fileNamePath = cast<MDNode>(file->getOperand(1));
-			assert(fileNamePath->getNumOperands()==2);
-			StringRef fileName = cast<MDString>(fileNamePath->getOperand(0))->getString();
-			uint32_t currentLine = debugLoc.getLine();
-			stream << ";; " << fileName << ":" << currentLine << "\n";
+			for (const Instruction& I : BB)
+				inlineable.insert(std::make_pair(&I, cheerp::isInlineable(I, PA)));
 		}
+	}
+	linearHelper.computeStructLayouts(module);
+	std::mutex lock;
 
-		if(I->isTerminator() || !I->use_empty() || I->mayHaveSideEffects())
+	// Every function is compiled to its own buffer by a copy of this writer,
+	// the buffers are then written in order so the output does not depend
+	// on the scheduling
+	std::vector<std::string> bodies(functions.size());
+	std::atomic<uint32_t> nextFunction(0);
+	auto worker = [&]()
+	{
+		CheerpWastWriter writer(*this);
+		writer.inlineableCache = &inlineable;
+		writer.analysisLock = &lock;
+		for (uint32_t i = nextFunction++; i < functions.size(); i = nextFunction++)
 		{
-			if(!compileInstruction(*I) && !I->getType()->isVoidTy())
-			{
-				if(I->use_empty())
-					stream << "\ndrop\n";
-				else
-					stream << "\nset_local " << (1 + currentFun->arg_size() + registerize.getRegisterId(I)) << '\n';
-			}
+			raw_string_ostream body(bodies[i]);
+			writer.compileMethod(body, *functions[i]);
+			body.flush();
 		}
+	};
+
+	uint32_t numThreads = std::min<size_t>(codegenThreads, functions.size());
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < numThreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread& t : threads)
+		t.join();
+
+	for (uint32_t i = 0; i < functions.size(); i++)
+	{
+		code << bodies[i];
+		if (sizeReport)
+			sizeReport->add(functions[i], SizeReport::WASM, bodies[i].size());
 	}
 }
 
-void CheerpWastWriter::compileMethodLocals(const Function& F, bool needsLabel)
+CheerpWastWriter::MEM_HELPER CheerpWastWriter::getMemHelper(const Function* F)
 {
-	const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
-	// The first local after ther params stores the previous stack address
-	stream << "(local i32";
-	// Emit the registers, careful as the registerize id is offset by the number of args
-	for(const Registerize::RegisterInfo& regInfo: regsInfo)
+	switch (F->getIntrinsicID())
 	{
-		stream << ' ';
-		assert(regInfo.regKind != Registerize::OBJECT);
-		assert(!regInfo.needsSecondaryName);
-		switch(regInfo.regKind)
-		{
-			case Registerize::DOUBLE:
-				stream << "f64";
-				break;
-			case Registerize::FLOAT:
-				stream << "f32";
-				break;
-			case Registerize::INTEGER:
-				stream << "i32";
-				break;
-			default:
-				assert(false);
-		}
+		case Intrinsic::memcpy:
+		case Intrinsic::memmove:
+			return MEMMOVE_HELPER;
+		case Intrinsic::memset:
+			return MEMSET_HELPER;
+		case Intrinsic::not_intrinsic:
+			// Only calls to a missing memcmp are replaced, a user implementation is kept
+			if (F->isDeclaration() && F->getName() == "memcmp" && F->arg_size() == 3)
+				return MEMCMP_HELPER;
+			return NUM_MEM_HELPERS;
+		default:
+			return NUM_MEM_HELPERS;
 	}
-	// If needed, label is the very last local
-	if(needsLabel)
-		stream << " i32";
-	stream << ")\n";
 }
 
-void CheerpWastWriter::compileMethodParams(const Function& F)
+FunctionType* CheerpWastWriter::getMemHelperType(MEM_HELPER helper)
 {
-	uint32_t numArgs = F.arg_size();
-	if(numArgs)
-	{
-		stream << "(param";
-		llvm::FunctionType* FTy = F.getFunctionType();
-		for(uint32_t i = 0; i < numArgs; i++)
-			stream << ' ' << getTypeString(FTy->getParamType(i));
-		stream << ')';
-	}
+	Type* i32 = Type::getInt32Ty(Ctx);
+	Type* params[] = { i32, i32, i32 };
+	Type* retTy = helper == MEMCMP_HELPER ? i32 : Type::getVoidTy(Ctx);
+	return FunctionType::get(retTy, params, false);
 }
 
-void CheerpWastWriter::compileMethodResult(const Function& F)
+uint32_t CheerpWastWriter::getNumMemHelpers() const
 {
-	if(!F.getReturnType()->isVoidTy())
-		stream << "(result " << getTypeString(F.getReturnType()) << ')';
+	return std::count_if(memHelperIds.begin(), memHelperIds.end(), [](uint32_t id) { return id != UINT32_MAX; });
 }
 
-void CheerpWastWriter::compileMethod(const Function& F)
+void CheerpWastWriter::compileMemHelper(raw_ostream& code, MEM_HELPER helper)
 {
-	currentFun = &F;
-	stream << "(func";
-	stream << " $" << F.getName();
-	// TODO: We should not export them all
-	stream << " (export \"" << NameGenerator::filterLLVMName(F.getName(),NameGenerator::NAME_FILTER_MODE::GLOBAL) << "\")";
-	uint32_t numArgs = F.arg_size();
-	compileMethodParams(F);
-	compileMethodResult(F);
-	stream << '\n';
-	const llvm::BasicBlock* lastDepth0Block = nullptr;
-	if(F.size() == 1)
+	// Parameters are (dst, src, size) for memmove, (dst, val, size) for memset
+	// and (a, b, size) for memcmp. The index is the first local, memset uses
+	// an i64 local for the splatted value and memcmp two locals for the bytes
+	const uint32_t P0 = 0, P1 = 1, SIZE = 2, I = 3, L4 = 4, L5 = 5;
+	static const char* names[] = { "__wasm_memmove", "__wasm_memset", "__wasm_memcmp" };
+
+	SmallString<256> buf;
+	raw_svector_ostream bufStream(buf);
+	raw_ostream& body = mode == WASM ? static_cast<raw_ostream&>(bufStream) : code;
+	if (mode == WAST)
 	{
-		compileMethodLocals(F, false);
-		// TODO: Only save the stack address if required
-		stream << "get_global " << stackTopGlobal << '\n';
-		stream << "set_local " << numArgs << "\n";
-		compileBB(*F.begin());
-		lastDepth0Block = &(*F.begin());
+		code << "(func $" << names[helper];
+		compileMethodParams(code, getMemHelperType(helper));
+		compileMethodResult(code, getMemHelperType(helper)->getReturnType());
+		code << '\n';
 	}
-	else
+	switch (helper)
 	{
-		Relooper* rl = CheerpWriter::runRelooperOnFunction(F);
-		compileMethodLocals(F, rl->needsLabel());
-		// TODO: Only save the stack address if required
-		stream << "get_global " << stackTopGlobal << '\n';
-		stream << "set_local " << numArgs << "\n";
-		uint32_t numArgs = F.arg_size();
-		const std::vector<Registerize::RegisterInfo>& regsInfo = registerize.getRegistersForFunction(&F);
-		uint32_t numRegs = regsInfo.size();
-		// label is the very last local
-		CheerpWastRenderInterface ri(this, 1+numArgs+numRegs);
-		rl->Render(&ri);
-		lastDepth0Block = ri.lastDepth0Block;
-	}
-	// A function has to terminate with a return instruction
-	if(!lastDepth0Block || !isa<ReturnInst>(lastDepth0Block->getTerminator()))
+		case MEMMOVE_HELPER:
+			if (mode == WASM)
+			{
+				encodeULEB128(1, body);
+				encodeULEB128(1, body);
+				body << char(0x7f);
+			}
+			else
+				body << "(local i32)\n";
+			break;
+		case MEMSET_HELPER:
+			if (mode == WASM)
+			{
+				encodeULEB128(2, body);
+				encodeULEB128(1, body);
+				body << char(0x7f);
+				encodeULEB128(1, body);
+				body << char(0x7e);
+			}
+			else
+				body << "(local i32 i64)\n";
+			break;
+		case MEMCMP_HELPER:
+			if (mode == WASM)
+			{
+				encodeULEB128(1, body);
+				encodeULEB128(3, body);
+				body << char(0x7f);
+			}
+			else
+				body << "(local i32 i32 i32)\n";
+			break;
+		default:
+			llvm_unreachable("Unexpected memory helper");
+	}
+
+	auto getLocal = [&](uint32_t l) { encodeU32Inst(WasmOpcode::GET_LOCAL, "get_local", l, body); };
+	auto setLocal = [&](uint32_t l) { encodeU32Inst(WasmOpcode::SET_LOCAL, "set_local", l, body); };
+	auto i32Const = [&](int32_t v) { encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", v, body); };
+	auto inst = [&](WasmOpcode opcode, const char* name) { encodeInst(opcode, name, body); };
+	// Push base+i
+	auto address = [&](uint32_t base) { getLocal(base); getLocal(I); inst(WasmOpcode::I32_ADD, "i32.add"); };
+	auto increment = [&](int32_t v) { getLocal(I); i32Const(v); inst(WasmOpcode::I32_ADD, "i32.add"); setLocal(I); };
+	// Exit the enclosing block if the condition is true
+	auto breakIf = [&](uint32_t depth) { encodeU32Inst(WasmOpcode::BR_IF, "br_if", depth, body); };
+	// A loop nested in a block, the loop body breaks out with breakIf(1)
+	auto beginLoop = [&]() {
+		encodeBlockInst(WasmOpcode::BLOCK, "block", body);
+		encodeBlockInst(WasmOpcode::LOOP, "loop", body);
+	};
+	auto endLoop = [&]() {
+		encodeU32Inst(WasmOpcode::BR, "br", 0, body);
+		inst(WasmOpcode::END, "end");
+		inst(WasmOpcode::END, "end");
+	};
+	// Condition for the word loops: size-i < 8
+	auto lessThanWordLeft = [&]() {
+		getLocal(SIZE); getLocal(I); inst(WasmOpcode::I32_SUB, "i32.sub");
+		i32Const(8); inst(WasmOpcode::I32_LT_U, "i32.lt_u");
+	};
+	// Condition for the head loops: base+i is aligned to 8
+	auto isAligned = [&](uint32_t base) {
+		address(base); i32Const(7); inst(WasmOpcode::I32_AND, "i32.and"); inst(WasmOpcode::I32_EQZ, "i32.eqz");
+	};
+	// Open a block that is skipped if size < 8
+	auto beginWords = [&]() {
+		encodeBlockInst(WasmOpcode::BLOCK, "block", body);
+		getLocal(SIZE); i32Const(8); inst(WasmOpcode::I32_LT_U, "i32.lt_u");
+		breakIf(0);
+	};
+	auto copyByte = [&]() {
+		address(P0);
+		address(P1);
+		encodeLoadStoreInst(WasmOpcode::I32_LOAD8_U, "i32.load8_u", 0, body);
+		encodeLoadStoreInst(WasmOpcode::I32_STORE8, "i32.store8", 0, body);
+	};
+	// The destination is aligned, the source might not be
+	auto copyWord = [&]() {
+		address(P0);
+		address(P1);
+		encodeLoadStoreInst(WasmOpcode::I64_LOAD, "i64.load", 0, body);
+		encodeLoadStoreInst(WasmOpcode::I64_STORE, "i64.store", 3, body);
+	};
+
+	switch (helper)
 	{
-		// Add a fake return
-		if(!F.getReturnType()->isVoidTy())
-			stream << getTypeString(F.getReturnType()) << ".const 0\n";
-		stream << "return\n";
+		case MEMMOVE_HELPER:
+		{
+			// A forward copy is safe unless dst is inside [src,src+size)
+			getLocal(P0); getLocal(P1); inst(WasmOpcode::I32_SUB, "i32.sub");
+			getLocal(SIZE); inst(WasmOpcode::I32_GE_U, "i32.ge_u");
+			encodeBlockInst(WasmOpcode::IF, "if", body);
+			beginWords();
+			beginLoop();
+			isAligned(P0); breakIf(1);
+			copyByte(); increment(1);
+			endLoop();
+			beginLoop();
+			lessThanWordLeft(); breakIf(1);
+			copyWord(); increment(8);
+			endLoop();
+			inst(WasmOpcode::END, "end");
+			beginLoop();
+			getLocal(I); getLocal(SIZE); inst(WasmOpcode::I32_GE_U, "i32.ge_u"); breakIf(1);
+			copyByte(); increment(1);
+			endLoop();
+			inst(WasmOpcode::ELSE, "else");
+			// Backward copy
+			getLocal(SIZE); setLocal(I);
+			beginWords();
+			beginLoop();
+			isAligned(P0); breakIf(1);
+			increment(-1); copyByte();
+			endLoop();
+			beginLoop();
+			getLocal(I); i32Const(8); inst(WasmOpcode::I32_LT_U, "i32.lt_u"); breakIf(1);
+			increment(-8); copyWord();
+			endLoop();
+			inst(WasmOpcode::END, "end");
+			beginLoop();
+			getLocal(I); inst(WasmOpcode::I32_EQZ, "i32.eqz"); breakIf(1);
+			increment(-1); copyByte();
+			endLoop();
+			inst(WasmOpcode::END, "end");
+			break;
+		}
+		case MEMSET_HELPER:
+		{
+			getLocal(P1); i32Const(255); inst(WasmOpcode::I32_AND, "i32.and"); setLocal(P1);
+			beginWords();
+			// Splat the byte over a 64-bit word
+			getLocal(P1);
+			inst(WasmOpcode::I64_EXTEND_U_I32, "i64.extend_u/i32");
+			if (mode == WASM)
+			{
+				body << char(WasmOpcode::I64_CONST);
+				encodeSLEB128(0x0101010101010101LL, body);
+			}
+			else
+				body << "i64.const " << 0x0101010101010101LL << '\n';
+			inst(WasmOpcode::I64_MUL, "i64.mul");
+			setLocal(L4);
+			beginLoop();
+			isAligned(P0); breakIf(1);
+			address(P0); getLocal(P1);
+			encodeLoadStoreInst(WasmOpcode::I32_STORE8, "i32.store8", 0, body);
+			increment(1);
+			endLoop();
+			beginLoop();
+			lessThanWordLeft(); breakIf(1);
+			address(P0); getLocal(L4);
+			encodeLoadStoreInst(WasmOpcode::I64_STORE, "i64.store", 3, body);
+			increment(8);
+			endLoop();
+			inst(WasmOpcode::END, "end");
+			beginLoop();
+			getLocal(I); getLocal(SIZE); inst(WasmOpcode::I32_GE_U, "i32.ge_u"); breakIf(1);
+			address(P0); getLocal(P1);
+			encodeLoadStoreInst(WasmOpcode::I32_STORE8, "i32.store8", 0, body);
+			increment(1);
+			endLoop();
+			break;
+		}
+		case MEMCMP_HELPER:
+		{
+			// Skip the equal words, then find the first difference bytewise
+			beginWords();
+			beginLoop();
+			lessThanWordLeft(); breakIf(1);
+			address(P0);
+			encodeLoadStoreInst(WasmOpcode::I64_LOAD, "i64.load", 0, body);
+			address(P1);
+			encodeLoadStoreInst(WasmOpcode::I64_LOAD, "i64.load", 0, body);
+			inst(WasmOpcode::I64_NE, "i64.ne"); breakIf(1);
+			increment(8);
+			endLoop();
+			inst(WasmOpcode::END, "end");
+			beginLoop();
+			getLocal(I); getLocal(SIZE); inst(WasmOpcode::I32_GE_U, "i32.ge_u"); breakIf(1);
+			address(P0);
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD8_U, "i32.load8_u", 0, body);
+			setLocal(L4);
+			address(P1);
+			encodeLoadStoreInst(WasmOpcode::I32_LOAD8_U, "i32.load8_u", 0, body);
+			setLocal(L5);
+			getLocal(L4); getLocal(L5); inst(WasmOpcode::I32_NE, "i32.ne");
+			encodeBlockInst(WasmOpcode::IF, "if", body);
+			getLocal(L4); getLocal(L5); inst(WasmOpcode::I32_SUB, "i32.sub");
+			inst(WasmOpcode::RETURN, "return");
+			inst(WasmOpcode::END, "end");
+			increment(1);
+			endLoop();
+			i32Const(0);
+			break;
+		}
+		default:
+			llvm_unreachable("Unexpected memory helper");
 	}
-	stream << ")\n";
-}
 
-void CheerpWastWriter::compileImport(const Function& F)
-{
-	assert(useWastLoader);
-	stream << "(func (import \"imports\" \"";
-	stream << NameGenerator::filterLLVMName(F.getName(),NameGenerator::NAME_FILTER_MODE::GLOBAL);
-	stream << "\")";
-	uint32_t numArgs = F.arg_size();
-	if(numArgs)
+	if (mode == WASM)
 	{
-		stream << "(param";
-		llvm::FunctionType* FTy = F.getFunctionType();
-		for(uint32_t i = 0; i < numArgs; i++)
-			stream << ' ' << getTypeString(FTy->getParamType(i));
-		stream << ')';
+		encodeInst(WasmOpcode::END, "end", body);
+		StringRef contents = bufStream.str();
+		encodeULEB128(contents.size(), code);
+		code << contents;
 	}
-	if(!F.getReturnType()->isVoidTy())
-		stream << "(result " << getTypeString(F.getReturnType()) << ')';
-	stream << ")\n";
+	else
+		code << ")\n";
 }
 
 void CheerpWastWriter::compileDataSection()
 {
+	// Memory starts zeroed, so only the non zero parts of the globals are
+	// written. A run of zeroes shorter than this is cheaper to write than the
+	// header of a new segment
+	const uint32_t minZeroRun = 8;
+	struct GlobalData
+	{
+		const GlobalVariable* GV;
+		LinearMemoryHelper::ByteBuffer buffer;
+		std::vector<LinearMemoryHelper::Segment> segments;
+	};
+	WastBytesWriter tableOffsets(nulls(), functionTableOffsets, mode);
+	std::vector<GlobalData> globals;
+	uint32_t numSegments = 0;
 	for ( const GlobalVariable & GV : module.getGlobalList() )
 	{
 		if (GV.getSection() != StringRef("asmjs"))
 			continue;
-		if (GV.hasInitializer())
+		if (LinearMemoryHelper::isZeroInitialized(&GV))
+			continue;
+		const Constant* init = GV.getInitializer();
+		Type* ty = init->getType();
+		// If the initializer is a function, skip it
+		if (ty->isPointerTy() && ty->getPointerElementType()->isFunctionTy())
+			continue;
+		globals.push_back(GlobalData{&GV, LinearMemoryHelper::ByteBuffer(tableOffsets), {}});
+		GlobalData& data = globals.back();
+		linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &data.buffer);
+		data.buffer.splitZeroRuns(minZeroRun, data.segments);
+		numSegments += data.segments.size();
+	}
+	if (numSegments == 0)
+		return;
+
+	Section section(SECTION_DATA, *this);
+	if (mode == WASM)
+		encodeULEB128(numSegments, section.code);
+	for (const GlobalData& data : globals)
+	{
+		uint64_t start = section.code.tell();
+		uint32_t address = linearHelper.getGlobalVariableAddress(data.GV);
+		for (const LinearMemoryHelper::Segment& segment : data.segments)
 		{
-			const Constant* init = GV.getInitializer();
-			Type* ty = init->getType();
-			// If the initializer is a function, skip it
-			if (ty->isPointerTy() && ty->getPointerElementType()->isFunctionTy())
-				continue;
-			// The offset into memory, which is the address
-			stream << "(data (i32.const " << linearHelper.getGlobalVariableAddress(&GV) << ") \"";
-			WastBytesWriter bytesWriter(stream, functionTableOffsets);
-			linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &bytesWriter);
-			stream << "\")\n";
+			ArrayRef<uint8_t> bytes(data.buffer.bytes.data() + segment.offset, segment.size);
+			compileDataSegment(section.code, address + segment.offset, bytes);
 		}
+		if (sizeReport)
+			sizeReport->add(data.GV, SizeReport::WASM, section.code.tell() - start);
+	}
+}
+
+void CheerpWastWriter::compileDataSegment(raw_ostream& code, uint32_t address, ArrayRef<uint8_t> bytes)
+{
+	if (mode == WASM)
+	{
+		// Memory 0, the offset into memory is the address
+		encodeULEB128(0, code);
+		encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", address, code);
+		encodeInst(WasmOpcode::END, "end", code);
+		// The contents are prefixed by their size
+		encodeULEB128(bytes.size(), code);
+		code.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+		return;
 	}
+	// The offset into memory, which is the address
+	WastBytesWriter bytesWriter(code, functionTableOffsets, mode);
+	code << "(data (i32.const " << address << ") \"";
+	for (uint8_t b : bytes)
+		bytesWriter.addByte(b);
+	code << "\")\n";
 }
 
 void CheerpWastWriter::makeWast()
 {
+	relooperCache = std::make_shared<RelooperCache>();
 	// First run, assign required Ids to functions and globals
 	if (useWastLoader) {
 		for ( const Function * F : globalDeps.asmJSImports() )
@@ -1757,108 +3697,145 @@ void CheerpWastWriter::makeWast()
 		}
 	}
 
-	// Emit S-expressions for the module
-	stream << "(module\n";
-
-	// Second run, actually compile the code (imports needs to be before everything)
-	if (useWastLoader) {
-		for ( const Function * F : globalDeps.asmJSImports() )
+	// The memory helpers that are used go after the functions and the
+	// constructors
+	for ( const Function & F : module.getFunctionList() )
+	{
+		if (F.empty() || F.getSection() != StringRef("asmjs"))
+			continue;
+		for (const BasicBlock& BB : F)
 		{
-			compileImport(*F);
+			for (const Instruction& I : BB)
+			{
+				const CallInst* ci = dyn_cast<CallInst>(&I);
+				if (!ci || !ci->getCalledFunction())
+					continue;
+				MEM_HELPER helper = getMemHelper(ci->getCalledFunction());
+				if (helper != NUM_MEM_HELPERS)
+					memHelperIds[helper] = 0;
+			}
 		}
 	}
-
-	// Define function type variables
-	for (const auto& table : globalDeps.functionTables())
+	uint32_t nextHelperId = functionIds.size();
+	if (!globalDeps.constructors().empty() && !useWastLoader)
+		nextHelperId++;
+	for (uint32_t& id : memHelperIds)
 	{
-		stream << "(type " << "$vt_" << table.second.name << " (func ";
-		const llvm::Function& F = *table.second.functions[0];
-		compileMethodParams(F);
-		compileMethodResult(F);
-		stream << "))\n";
+		if (id != UINT32_MAX)
+			id = nextHelperId++;
 	}
 
-	// Define 'table' with functions
-	if (!globalDeps.functionTables().empty())
-		stream << "(table anyfunc (elem";
-
+	// Assign the offsets of the function tables, the ones which are not in
+	// the wasm table go last
 	uint32_t functionTableOffset = 0;
-	for (const auto& table : globalDeps.functionTables()) {
-		for (const auto& F : table.second.functions) {
-			stream << " $" << F->getName();
+	for (bool inWasmTable : {true, false})
+	{
+		for (const auto& table : globalDeps.functionTables()) {
+			if (table.second.hasIndirectCalls != inWasmTable)
+				continue;
+			functionTableOffsets.insert(std::make_pair(StringRef(table.second.name),
+													   functionTableOffset));
+			functionTableOffset += table.second.functions.size();
 		}
-		functionTableOffsets.insert(std::make_pair(StringRef(table.second.name),
-												   functionTableOffset));
-		functionTableOffset += table.second.functions.size();
 	}
 
-	if (!globalDeps.functionTables().empty())
-		stream << "))\n";
-
-	// Define the memory for the module (these should be parameter, they are min and max in WasmPage units)
-	uint32_t minMemory = 1;
-	uint32_t maxMemory = 2;
-	stream << "(memory (export \"memory\") " << minMemory << ' ' << maxMemory << ")\n";
-
-	// Assign globals in the module, these are used for codegen they are not part of the user program
-	stackTopGlobal = usedGlobals++;
-	// Start the stack from the end of default memory
-	stream << "(global (mut i32) (i32.const " << (minMemory*WasmPage) << "))\n";
-
-	// Experimental entry point for wast code
-	llvm::Function* wastStart = module.getFunction("_Z9wastStartv");
-	if(wastStart && globalDeps.constructors().empty())
-	{
-		assert(functionIds.count(wastStart));
-		stream << "(start " << functionIds[wastStart] << ")\n";
-	}
-	else if (!globalDeps.constructors().empty() && !useWastLoader)
+	// Collect the signatures, the ones of the function tables go first
+	if (mode == WASM)
 	{
-		stream << "(start " << functionIds.size() << ")\n";
+		for (const auto& table : globalDeps.functionTables())
+			getTypeIndex(table.first);
+		if (useWastLoader)
+		{
+			for (const Function* F : globalDeps.asmJSImports())
+				getTypeIndex(F->getFunctionType());
+		}
+		for (const Function& F : module.getFunctionList())
+		{
+			if (!F.empty() && F.getSection() == StringRef("asmjs"))
+				getTypeIndex(F.getFunctionType());
+		}
+		if (!globalDeps.constructors().empty() && !useWastLoader)
+			getTypeIndex(FunctionType::get(Type::getVoidTy(Ctx), false));
+		for (uint32_t i = 0; i < NUM_MEM_HELPERS; i++)
+		{
+			if (memHelperIds[i] != UINT32_MAX)
+				getTypeIndex(getMemHelperType(MEM_HELPER(i)));
+		}
 	}
 
-	for ( const GlobalVariable & GV : module.getGlobalList() )
-	{
-		if (GV.getSection() != StringRef("asmjs"))
-			continue;
-		linearHelper.addGlobalVariable(&GV);
-	}
+	// Assign globals in the module, these are used for codegen they are not part of the user program
+	stackTopGlobal = usedGlobals++;
 
-	// Second run, actually compile the code
-	for ( const Function & F : module.getFunctionList() )
+	// The stack is placed after the global variables and before the heap,
+	// so that the heap is at the end of memory and can be grown.
+	// _heapStart marks the beginning of the heap used by malloc
+	const GlobalVariable* heapStartVar = linearHelper.addGlobalVariables(module);
+	stackStart = linearHelper.addStack(stackSize*1024);
+	if (heapStartVar)
+		linearHelper.addGlobalVariable(heapStartVar);
+
+	// The initial memory must at least contain the globals and the stack
+	uint32_t usedMemory = linearHelper.getTotalMemory();
+	minMemory = std::max<uint64_t>(uint64_t(heapSize)*1024*1024, usedMemory + WasmPage - 1) / WasmPage;
+	maxMemory = 0;
+	if (maxHeapSize)
 	{
-		if (!F.empty() && F.getSection() == StringRef("asmjs"))
+		maxMemory = uint64_t(maxHeapSize)*1024*1024 / WasmPage;
+		if (maxMemory < minMemory)
 		{
-			compileMethod(F);
+			llvm::errs() << "warning: the maximum memory size is less than the initial size of " << minMemory << " pages\n";
+			maxMemory = minMemory;
 		}
 	}
 
-	// Construct an anonymous function that calls the global constructors.
-	if (!globalDeps.constructors().empty() && !useWastLoader)
+	if (mode == WASM)
 	{
-		stream << "(func\n";
-		for (const Function* F : globalDeps.constructors())
-		{
-			if (F->getSection() == StringRef("asmjs"))
-				stream << "call " << functionIds.at(F) << "\n";
-		}
+		// Magic number and version of the binary format
+		stream.write("\0asm", 4);
+		stream.write("\1\0\0\0", 4);
+	}
+	else
+	{
+		// Emit S-expressions for the module
+		stream << "(module\n";
+	}
+
+	// Sections must be emitted in this order in the binary format, imports
+	// need to be before everything in the text format
+	compileTypeSection();
+	compileImportSection();
+	compileFunctionSection();
+	compileTableSection();
+	compileMemorySection();
+	compileGlobalSection();
+	compileExportSection();
+	compileStartSection();
+	compileElementSection();
+	compileCodeSection();
+	compileDataSection();
 
-		if (wastStart)
-			stream << "call " << functionIds.at(wastStart) << "\n";
+	if (mode == WAST)
+		stream << ')';
 
-		stream << ")\n";
+	if (timeReport)
+	{
+		timeReport->addCounter("wasm_bytes_total", stream.tell());
+		timeReport->addCounter("relooper_functions", relooperCache->NumCalculated + relooperCache->NumReused);
+		timeReport->addCounter("relooper_cache_hits", relooperCache->NumReused);
+		timeReport->addCounter("relooper_shapes", relooperCache->NumShapes);
 	}
-
-	compileDataSection();
-	
-	stream << ')';
 }
 
 void CheerpWastWriter::WastBytesWriter::addByte(uint8_t byte)
 {
+	if (mode == WASM)
+	{
+		code << char(byte);
+		return;
+	}
 	char buf[4];
 	snprintf(buf, 4, "\\%02x", byte);
-	stream << buf;
+	code << buf;
 }
 
 uint32_t CheerpWastWriter::WastBytesWriter::getFunctionTableOffset(llvm::StringRef tableName)
@@ -1868,23 +3845,22 @@ uint32_t CheerpWastWriter::WastBytesWriter::getFunctionTableOffset(llvm::StringR
 
 void CheerpWastWriter::WastGepWriter::addValue(const llvm::Value* v, uint32_t size)
 {
-	writer.compileOperand(v);
-	writer.stream << '\n';
+	writer.compileOperand(code, v);
 	if(size != 1)
 	{
-		writer.stream << "i32.const " << size << '\n';
-		writer.stream << "i32.mul\n";
+		writer.encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", size, code);
+		writer.encodeInst(WasmOpcode::I32_MUL, "i32.mul", code);
 	}
 	if(!first)
-		writer.stream << "i32.add\n";
+		writer.encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
 	first = false;
 }
 
 void CheerpWastWriter::WastGepWriter::addConst(uint32_t v)
 {
 	assert(v);
-	writer.stream << "i32.const " << v << '\n';
+	writer.encodeS32Inst(WasmOpcode::I32_CONST, "i32.const", v, code);
 	if(!first)
-		writer.stream << "i32.add\n";
+		writer.encodeInst(WasmOpcode::I32_ADD, "i32.add", code);
 	first = false;
 }
@@ -9,6 +9,9 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <atomic>
+#include <thread>
+
 #include "Relooper.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/Analysis/ValueTracking.h"
@@ -460,7 +463,15 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 	}
 
 	
-	if (info.useTypedArray())
+	if (isPooledAllocation(info))
+	{
+		stream << "__poolAlloc(__pool";
+		compileTypedArrayType(t);
+		stream << ',';
+		compileTypedArrayType(t);
+		stream << ',' << compileArraySize(info, /* shouldPrint */false) << ')';
+	}
+	else if (info.useTypedArray())
 	{
 		stream << "new ";
 		compileTypedArrayType(t);
@@ -581,6 +592,40 @@ void CheerpWriter::compileAllocation(const DynamicAllocInfo & info)
 void CheerpWriter::compileFree(const Value* obj)
 {
 	//TODO: Clean up class related data structures
+	if(!typedArrayPoolSize)
+		return;
+	// Only pooled typed arrays are recycled, __poolFree ignores everything else
+	POINTER_KIND kind = PA.getPointerKind(obj);
+	if(kind != REGULAR && kind != SPLIT_REGULAR)
+		return;
+	stream << "__poolFree(";
+	compilePointerBase(obj);
+	stream << ')';
+}
+
+bool CheerpWriter::isPooledAllocation(const DynamicAllocInfo & info)
+{
+	if(!typedArrayPoolSize || !info.useTypedArray() || info.sizeIsRuntime() ||
+		info.getAllocType() == DynamicAllocInfo::cheerp_reallocate)
+	{
+		return false;
+	}
+	const Value* numberOfElements = info.getNumberOfElementsArg();
+	if(numberOfElements && !isa<ConstantInt>(numberOfElements))
+		return false;
+	uint32_t numElem = compileArraySize(info, /* shouldPrint */false);
+	Type* t = info.getCastedType()->getElementType();
+	return numElem > 0 && numElem * targetData.getTypeAllocSize(t) <= typedArrayPoolSize;
+}
+
+void CheerpWriter::compileTypedArrayPoolHelpers()
+{
+	// Free arrays are kept in a list for each length, they are tagged with their list when created.
+	// Recycled arrays are cleared since new typed arrays are zero initialized
+	stream << "function __poolAlloc(p,C,n){var l=p[n],a=null;if(l===undefined)l=p[n]=[];else if(l.length>0){a=l.pop();a.fill(0);return a;}a=new C(n);a.__pool=l;return a;}" << NewLine;
+	stream << "function __poolFree(a){if(a===null)return;var l=a.__pool;if(l!==undefined&&l.length<1024)l.push(a);}" << NewLine;
+	for (const char* name : typedArrayNames)
+		stream << "var __pool" << name << "=[];" << NewLine;
 }
 
 CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(ImmutableCallSite callV, const Function * func)
@@ -621,6 +666,17 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 			return COMPILE_OK;
 		}
 	}
+	else if(intrinsicId==Intrinsic::memset && asmjs)
+	{
+		stream << "__asmjs_memset(";
+		compileOperand(*(it),LOWEST);
+		stream << ",";
+		compileOperand(*(it+1),LOWEST);
+		stream << ",";
+		compileOperand(*(it+2),LOWEST);
+		stream << ")|0";
+		return COMPILE_OK;
+	}
 	else if(intrinsicId==Intrinsic::memset)
 	{
 		llvm::report_fatal_error("Unsupported memory intrinsic, please rebuild the code using an updated version of Cheerp", false);
@@ -768,11 +824,34 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 		compileOperand(*it, LOWEST);
 		return COMPILE_OK;
 	}
+	else if(intrinsicId==Intrinsic::cheerp_current_memory && asmjs)
+	{
+		// The asm.js heap has a fixed size, in 64KiB pages
+		stream << heapSize*16;
+		return COMPILE_OK;
+	}
+	else if(intrinsicId==Intrinsic::cheerp_grow_memory && asmjs)
+	{
+		// The asm.js heap cannot grow, fail like grow_memory does
+		stream << "-1";
+		return COMPILE_OK;
+	}
 	else if(!asmjs && (ident=="free" || ident=="_ZdlPv" || ident=="_ZdaPv" || intrinsicId==Intrinsic::cheerp_deallocate))
 	{
 		compileFree(*it);
 		return COMPILE_OK;
 	}
+	else if(asmjs && func->isDeclaration() && ident=="memcmp" && func->arg_size()==3)
+	{
+		stream << "__asmjs_memcmp(";
+		compileOperand(*(it),LOWEST);
+		stream << ",";
+		compileOperand(*(it+1),LOWEST);
+		stream << ",";
+		compileOperand(*(it+2),LOWEST);
+		stream << ")|0";
+		return COMPILE_OK;
+	}
 	else if(ident=="fmod" || ident=="fmodf")
 	{
 		// Handle this internally, C++ does not have float mod operation
@@ -995,40 +1074,7 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::handleBuiltinCall(Immut
 		StringRef str;
 		if(llvm::getConstantStringInfo(*it, str))
 		{
-			stream << '"';
-			for(uint8_t c: str)
-			{
-				if(c=='\b')
-					stream << "\\b";
-				else if(c=='\f')
-					stream << "\\f";
-				else if(c=='\n')
-					stream << "\\n";
-				else if(c=='\r')
-					stream << "\\r";
-				else if(c=='\t')
-					stream << "\\t";
-				else if(c=='\v')
-					stream << "\\v";
-				else if(c=='\'')
-					stream << "\\'";
-				else if(c=='"')
-					stream << "\\\"";
-				else if(c=='\\')
-					stream << "\\\\";
-				else if(c>=' ' && c<='~')
-				{
-					// Printable ASCII after we exscluded the previous one
-					stream << c;
-				}
-				else
-				{
-					char buf[5];
-					snprintf(buf, 5, "\\x%02x", c);
-					stream << buf;
-				}
-			}
-			stream << '"';
+			compileStringLiteral(str);
 			return COMPILE_OK;
 		}
 	}
@@ -2373,6 +2419,9 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileTerminatorInstru
 						compileOperand(retVal, LOWEST);
 						stream << ')';
 						break;
+					case Registerize::VECTOR:
+						llvm::report_fatal_error("Vector values cannot be returned in JavaScript", false);
+						break;
 					case Registerize::OBJECT:
 						POINTER_KIND k=PA.getPointerKindForReturn(ri.getParent()->getParent());
 						// For SPLIT_REGULAR we return the .d part and store the .o part into oSlot
@@ -3630,6 +3679,9 @@ CheerpWriter::COMPILE_INSTRUCTION_FEEDBACK CheerpWriter::compileInlineableInstru
 							stream << namegen.getSecondaryName(&ci) << "=oSlot";
 						}
 						break;
+					case Registerize::VECTOR:
+						llvm::report_fatal_error("Vector values cannot be returned in JavaScript", false);
+						break;
 				}
 			}
 			// If this was a vararg function, pop the arguments from the stack
@@ -4061,7 +4113,7 @@ void CheerpWriter::compileMethodLocals(const Function& F, bool needsLabel)
 		stream << ';' << NewLine;
 }
 
-void CheerpWriter::compileMethod(const Function& F)
+void CheerpWriter::compileMethod(const Function& F, bool anonymous)
 {
 	bool asmjs = F.getSection() == StringRef("asmjs");
 	if (sourceMapGenerator) {
@@ -4079,7 +4131,10 @@ void CheerpWriter::compileMethod(const Function& F)
 		}
 	}
 	currentFun = &F;
-	stream << "function " << namegen.getName(&F) << '(';
+	stream << "function ";
+	if (!anonymous)
+		stream << namegen.getName(&F);
+	stream << '(';
 	const Function::const_arg_iterator A=F.arg_begin();
 	const Function::const_arg_iterator AE=F.arg_end();
 	for(Function::const_arg_iterator curArg=A;curArg!=AE;++curArg)
@@ -4109,12 +4164,13 @@ void CheerpWriter::compileMethod(const Function& F)
 	}
 	else
 	{
-		Relooper* rl = runRelooperOnFunction(F);
+		Relooper* rl = runRelooperOnFunction(F, relooperCache.get());
 		CheerpRenderInterface ri(this, NewLine, asmjs);
 		compileMethodLocals(F, rl->needsLabel());
 		if (asmjs)
 			compileStackFrame();
 		rl->Render(&ri);
+		delete rl;
 	}
 	if (asmjs)
 	{
@@ -4141,6 +4197,10 @@ void CheerpWriter::compileMethod(const Function& F)
 					llvm::errs() << "OBJECT register kind should not appear in asm.js functions\n";
 					llvm::report_fatal_error("please report a bug");
 					break;
+				case Registerize::VECTOR:
+					llvm::errs() << "VECTOR register kind should not appear in asm.js functions\n";
+					llvm::report_fatal_error("please report a bug");
+					break;
 			}
 		}
 		stream << ';' << NewLine;
@@ -4149,6 +4209,66 @@ void CheerpWriter::compileMethod(const Function& F)
 	currentFun = NULL;
 }
 
+void CheerpWriter::compileMethods(const std::vector<const Function*>& functions)
+{
+	// Source maps follow the output line by line, so they need a single stream
+	if (codegenThreads > 1 && functions.size() > 1 && !sourceMapGenerator)
+	{
+		compileMethodsParallel(functions);
+		return;
+	}
+	for (const Function* F : functions)
+	{
+		uint64_t start = stream.tell();
+		compileMethod(*F);
+		if (sizeReport)
+			sizeReport->add(F, SizeReport::JS, stream.tell() - start);
+	}
+}
+
+void CheerpWriter::compileMethodsParallel(const std::vector<const Function*>& functions)
+{
+	// The struct layouts are computed lazily, populate them before starting
+	// the workers. The PointerAnalyzer fills its caches under its own lock
+	linearHelper.computeStructLayouts(module);
+	PA.setConcurrentQueries(true);
+
+	// Every function is compiled to its own buffer by a copy of this writer,
+	// the buffers are then written in order so the output does not depend
+	// on the scheduling
+	std::vector<std::string> bodies(functions.size());
+	std::atomic<uint32_t> nextFunction(0);
+	auto worker = [&]()
+	{
+		std::string buffer;
+		raw_string_ostream out(buffer);
+		CheerpWriter writer(*this, out);
+		for (uint32_t i = nextFunction++; i < functions.size(); i = nextFunction++)
+		{
+			writer.compileMethod(*functions[i]);
+			out.flush();
+			// The stream keeps appending to the now empty buffer
+			bodies[i].swap(buffer);
+		}
+	};
+
+	uint32_t numThreads = std::min<size_t>(codegenThreads, functions.size());
+	std::vector<std::thread> threads;
+	for (uint32_t i = 1; i < numThreads; i++)
+		threads.emplace_back(worker);
+	worker();
+	for (std::thread& t : threads)
+		t.join();
+	PA.setConcurrentQueries(false);
+
+	for (uint32_t i = 0; i < functions.size(); i++)
+	{
+		stream.append(bodies[i]);
+		if (sizeReport)
+			sizeReport->add(functions[i], SizeReport::JS, bodies[i].size());
+	}
+}
+
 CheerpWriter::GlobalSubExprInfo CheerpWriter::compileGlobalSubExpr(const GlobalDepsAnalyzer::SubExprVec& subExpr)
 {
 	for ( auto it = std::next(subExpr.begin()); it != subExpr.end(); ++it )
@@ -4324,64 +4444,77 @@ void CheerpWriter::compileGlobalAsmJS(const GlobalVariable& G)
 	}
 	if (symbolicGlobalsAsmJS)
 		stream << "var " << namegen.getName(&G) << '=';
-	uint32_t globalAddr = linearHelper.addGlobalVariable(&G);
 	if (symbolicGlobalsAsmJS)
-		stream << globalAddr << ';' << NewLine;
+		stream << linearHelper.getGlobalVariableAddress(&G) << ';' << NewLine;
 }
 
 void CheerpWriter::compileGlobalsInitAsmJS()
 {
+	// Memory starts zeroed, so zero initialized globals are not written.
+	// They are placed after all the others, so the initialized part of the
+	// memory is contiguous
+	std::vector<const GlobalVariable*> globals;
+	for ( const GlobalVariable & GV : module.getGlobalList() )
+	{
+		if (GV.getSection() != StringRef("asmjs"))
+			continue;
+		if (LinearMemoryHelper::isZeroInitialized(&GV))
+			continue;
+		Type* ty = GV.getInitializer()->getType();
+		// If the initializer is a function, skip it
+		if (ty->isPointerTy() && ty->getPointerElementType()->isFunctionTy())
+			continue;
+		globals.push_back(&GV);
+	}
+	// Sort by address, the memory file is written sequentially
+	std::sort(globals.begin(), globals.end(), [this](const GlobalVariable* lhs, const GlobalVariable* rhs)
+	{
+		return linearHelper.getGlobalVariableAddress(lhs) < linearHelper.getGlobalVariableAddress(rhs);
+	});
 	if (asmJSMem)
 	{
 		ostream_proxy os(*asmJSMem, nullptr, false);
 		BinaryBytesWriter bytesWriter(os);
-		uint32_t last_address = 0;
-		uint32_t last_size = 0;
-		for ( const GlobalVariable & GV : module.getGlobalList() )
+		uint32_t last_end = 0;
+		for ( const GlobalVariable* GV : globals )
 		{
-			if (GV.getSection() != StringRef("asmjs"))
-				continue;
-			if (GV.hasInitializer())
+			uint32_t cur_address = linearHelper.getGlobalVariableAddress(GV);
+			for ( uint32_t i = last_end; i < cur_address; i++ )
 			{
-				const Constant* init = GV.getInitializer();
-				Type* ty = init->getType();
-				// If the initializer is a function, skip it
-				if (ty->isPointerTy() && ty->getPointerElementType()->isFunctionTy())
-					continue;
-				uint32_t cur_address = linearHelper.getGlobalVariableAddress(&GV);
-				uint32_t padding = cur_address - (last_address+last_size);
-				for ( uint32_t i = 0; i < padding; i++ )
-				{
-					os << (char)0;
-				}
-				linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &bytesWriter);
-				last_size = targetData.getTypeAllocSize(ty);
-				last_address = cur_address;
-			}
-			else
-			{
-				last_size = 0;
+				os << (char)0;
 			}
+			uint64_t start = os.tell();
+			linearHelper.compileConstantAsBytes(GV->getInitializer(),/* asmjs */ true, &bytesWriter);
+			if (sizeReport)
+				sizeReport->add(GV, SizeReport::JS, os.tell() - start);
+			last_end = cur_address + targetData.getTypeAllocSize(GV->getInitializer()->getType());
 		}
 	}
 	else
 	{
-		for ( const GlobalVariable & GV : module.getGlobalList() )
-		{
-			if (GV.getSection() != StringRef("asmjs"))
-				continue;
-			if (GV.hasInitializer())
+		// A run of zeroes shorter than this is cheaper to write than a new
+		// HEAP8.set call
+		const uint32_t minZeroRun = 16;
+		JSBytesWriter tableOffsets(stream);
+		std::vector<LinearMemoryHelper::Segment> segments;
+		for ( const GlobalVariable* GV : globals )
+		{
+			LinearMemoryHelper::ByteBuffer buffer(tableOffsets);
+			linearHelper.compileConstantAsBytes(GV->getInitializer(),/* asmjs */ true, &buffer);
+			segments.clear();
+			buffer.splitZeroRuns(minZeroRun, segments);
+			uint32_t address = linearHelper.getGlobalVariableAddress(GV);
+			uint64_t start = stream.tell();
+			for (const LinearMemoryHelper::Segment& segment : segments)
 			{
-				const Constant* init = GV.getInitializer();
-				Type* ty = init->getType();
-				// If the initializer is a function, skip it
-				if (ty->isPointerTy() && ty->getPointerElementType()->isFunctionTy())
-					continue;
 				stream  << heapNames[HEAP8] << ".set([";
 				JSBytesWriter bytesWriter(stream);
-				linearHelper.compileConstantAsBytes(init,/* asmjs */ true, &bytesWriter);
-				stream << "]," << linearHelper.getGlobalVariableAddress(&GV) << ");" << NewLine;
+				for (uint32_t i = segment.offset; i < segment.offset + segment.size; i++)
+					bytesWriter.addByte(buffer.bytes[i]);
+				stream << "]," << address + segment.offset << ");" << NewLine;
 			}
+			if (sizeReport)
+				sizeReport->add(GV, SizeReport::JS, stream.tell() - start);
 		}
 	}
 }
@@ -4410,6 +4543,10 @@ void CheerpWriter::compileParamTypeAnnotationsAsmJS(const Function* F)
 				llvm::errs() << "OBJECT register kind should not appear in asm.js functions\n";
 				llvm::report_fatal_error("please report a bug");
 				break;
+			case Registerize::VECTOR:
+				llvm::errs() << "VECTOR register kind should not appear in asm.js functions\n";
+				llvm::report_fatal_error("please report a bug");
+				break;
 		}
 		stream << ';' << NewLine;
 	}
@@ -4488,21 +4625,106 @@ void CheerpWriter::compileAllocaAsmJS(const Value* n, uint32_t elem_size, uint32
 	stream << elem_size << ',' << num << ")|0))&" << uint32_t(0-alignment);
 }
 
-void CheerpWriter::compileMemmoveHelperAsmJS()
+void CheerpWriter::compileMemFuncHelpersAsmJS()
 {
-	stream << "function __asmjs_memmove(src,dst,size){" << NewLine;
-	stream << "src=src|0;dst=dst|0;size=size|0;" << NewLine;
-	stream << "var i=0;var end=0;var inc=1;" << NewLine;
-	stream << "if(src>>>0<dst>>>0){i=size-1|0;end=-1;inc=-1;}else end=size;"<<NewLine;
-	stream << "while(1){if((i|0)==(end|0))break;HEAP8[dst+i|0]=HEAP8[src+i|0];i=i+inc|0;}"<<NewLine;
-	stream << "return dst|0;"<<NewLine;
-	stream << "}"<<NewLine;
+	// Only the helpers called by the asm.js functions are emitted
+	bool needsMemmove = false, needsMemset = false, needsMemcmp = false;
+	for ( const Function & F : module.getFunctionList() )
+	{
+		if (F.empty() || F.getSection() != StringRef("asmjs"))
+			continue;
+		for (const BasicBlock& BB : F)
+		{
+			for (const Instruction& I : BB)
+			{
+				const CallInst* ci = dyn_cast<CallInst>(&I);
+				const Function* calledFunc = ci ? ci->getCalledFunction() : nullptr;
+				if (!calledFunc)
+					continue;
+				switch (calledFunc->getIntrinsicID())
+				{
+					case Intrinsic::memcpy:
+					case Intrinsic::memmove:
+						needsMemmove = true;
+						break;
+					case Intrinsic::memset:
+						needsMemset = true;
+						break;
+					case Intrinsic::not_intrinsic:
+						// Only calls to a missing memcmp are replaced by the helper
+						if (calledFunc->isDeclaration() && calledFunc->getName() == "memcmp" && calledFunc->arg_size() == 3)
+							needsMemcmp = true;
+						break;
+					default:
+						break;
+				}
+			}
+		}
+	}
+
+	// The helpers move the unaligned head and tail bytewise and the aligned middle through HEAP32.
+	// HEAPF64 is not used since reading and writing doubles may not preserve NaN payloads
+	if (needsMemmove)
+	{
+		stream << "function __asmjs_memmove(dst,src,size){" << NewLine;
+		stream << "dst=dst|0;src=src|0;size=size|0;" << NewLine;
+		stream << "var i=0;" << NewLine;
+		// A forward copy is safe unless dst is inside [src,src+size)
+		stream << "if((dst-src|0)>>>0>=size>>>0){" << NewLine;
+		stream << "if(((dst^src)&3)==0&(size|0)>=4){" << NewLine;
+		stream << "while((dst+i&3)!=0){HEAP8[dst+i|0]=HEAP8[src+i|0];i=i+1|0;}" << NewLine;
+		stream << "while((size-i|0)>=4){HEAP32[dst+i>>2]=HEAP32[src+i>>2];i=i+4|0;}" << NewLine;
+		stream << "}" << NewLine;
+		stream << "while((i|0)<(size|0)){HEAP8[dst+i|0]=HEAP8[src+i|0];i=i+1|0;}" << NewLine;
+		stream << "}else{" << NewLine;
+		stream << "i=size;" << NewLine;
+		stream << "if(((dst^src)&3)==0&(size|0)>=4){" << NewLine;
+		stream << "while((dst+i&3)!=0){i=i-1|0;HEAP8[dst+i|0]=HEAP8[src+i|0];}" << NewLine;
+		stream << "while((i|0)>=4){i=i-4|0;HEAP32[dst+i>>2]=HEAP32[src+i>>2];}" << NewLine;
+		stream << "}" << NewLine;
+		stream << "while((i|0)>0){i=i-1|0;HEAP8[dst+i|0]=HEAP8[src+i|0];}" << NewLine;
+		stream << "}" << NewLine;
+		stream << "return dst|0;" << NewLine;
+		stream << "}" << NewLine;
+	}
+	if (needsMemset)
+	{
+		stream << "function __asmjs_memset(dst,val,size){" << NewLine;
+		stream << "dst=dst|0;val=val|0;size=size|0;" << NewLine;
+		stream << "var i=0;var w=0;" << NewLine;
+		stream << "val=val&255;" << NewLine;
+		stream << "if((size|0)>=4){" << NewLine;
+		stream << "w=val|val<<8;w=w|w<<16;" << NewLine;
+		stream << "while((dst+i&3)!=0){HEAP8[dst+i|0]=val;i=i+1|0;}" << NewLine;
+		stream << "while((size-i|0)>=4){HEAP32[dst+i>>2]=w;i=i+4|0;}" << NewLine;
+		stream << "}" << NewLine;
+		stream << "while((i|0)<(size|0)){HEAP8[dst+i|0]=val;i=i+1|0;}" << NewLine;
+		stream << "return dst|0;" << NewLine;
+		stream << "}" << NewLine;
+	}
+	if (needsMemcmp)
+	{
+		// Equal words are skipped, the first difference is then found bytewise
+		stream << "function __asmjs_memcmp(a,b,size){" << NewLine;
+		stream << "a=a|0;b=b|0;size=size|0;" << NewLine;
+		stream << "var i=0;var d=0;" << NewLine;
+		stream << "if(((a^b)&3)==0&(size|0)>=4){" << NewLine;
+		stream << "while((a+i&3)!=0){d=(HEAP8[a+i|0]&255)-(HEAP8[b+i|0]&255)|0;if(d)return d|0;i=i+1|0;}" << NewLine;
+		stream << "while((size-i|0)>=4){if((HEAP32[a+i>>2]|0)!=(HEAP32[b+i>>2]|0))break;i=i+4|0;}" << NewLine;
+		stream << "}" << NewLine;
+		stream << "while((i|0)<(size|0)){d=(HEAP8[a+i|0]&255)-(HEAP8[b+i|0]&255)|0;if(d)return d|0;i=i+1|0;}" << NewLine;
+		stream << "return 0;" << NewLine;
+		stream << "}" << NewLine;
+	}
 }
 
 void CheerpWriter::compileFunctionTablesAsmJS()
 {
 	for (const auto& table : globalDeps.functionTables())
 	{
+		// Tables not used by indirect calls are only needed for the addresses
+		if (!table.second.hasIndirectCalls)
+			continue;
 		stream << "var " << "__FUNCTION_TABLE_" << table.second.name << "=[";
 		bool first = true;
 		uint32_t num = 0;
@@ -4627,6 +4849,44 @@ void CheerpWriter::compileAsmJSExports()
 	}
 }
 
+void CheerpWriter::compileStringLiteral(StringRef str)
+{
+	stream << '"';
+	for(uint8_t c: str)
+	{
+		if(c=='\b')
+			stream << "\\b";
+		else if(c=='\f')
+			stream << "\\f";
+		else if(c=='\n')
+			stream << "\\n";
+		else if(c=='\r')
+			stream << "\\r";
+		else if(c=='\t')
+			stream << "\\t";
+		else if(c=='\v')
+			stream << "\\v";
+		else if(c=='\'')
+			stream << "\\'";
+		else if(c=='"')
+			stream << "\\\"";
+		else if(c=='\\')
+			stream << "\\\\";
+		else if(c>=' ' && c<='~')
+		{
+			// Printable ASCII after we exscluded the previous one
+			stream << c;
+		}
+		else
+		{
+			char buf[5];
+			snprintf(buf, 5, "\\x%02x", c);
+			stream << buf;
+		}
+	}
+	stream << '"';
+}
+
 void CheerpWriter::compileFetchBuffer()
 {
 	stream << "function fetchBuffer(path) {" << NewLine;
@@ -4650,8 +4910,77 @@ void CheerpWriter::compileFetchBuffer()
 	stream << "}" << NewLine;
 }
 
+void CheerpWriter::compileLazyStubs()
+{
+	// The chunk is fetched synchronously, with XHR in browsers and web
+	// workers, fs in node and read in JS shells
+	stream << "function __cheerp_fetch_lazy(){" << NewLine;
+	stream << "var u=";
+	compileStringLiteral(lazyChunkURL);
+	stream << ";" << NewLine;
+	stream << "if(typeof XMLHttpRequest!=='undefined'){" << NewLine;
+	stream << "var x=new XMLHttpRequest();" << NewLine;
+	stream << "x.open('GET',u,false);" << NewLine;
+	stream << "x.send();" << NewLine;
+	stream << "return x.responseText;" << NewLine;
+	stream << "}else if(typeof require!=='undefined'){" << NewLine;
+	stream << "return require('fs').readFileSync(u,'utf8');" << NewLine;
+	stream << "}else{" << NewLine;
+	stream << "return read(u);" << NewLine;
+	stream << "}" << NewLine;
+	stream << "}" << NewLine;
+	// The chunk is evaluated in this scope so that it can access all the
+	// other functions and globals. The function declares no locals, which
+	// would shadow the module names used by the chunk
+	stream << "var __cheerp_lazy=null;" << NewLine;
+	stream << "function __cheerp_load_lazy(){" << NewLine;
+	stream << "if(__cheerp_lazy===null)" << NewLine;
+	stream << "__cheerp_lazy=eval(__cheerp_fetch_lazy());" << NewLine;
+	stream << "return __cheerp_lazy;" << NewLine;
+	stream << "}" << NewLine;
+	// The stubs are the only function objects for the entry points, so
+	// pointers taken before and after loading the chunk compare equal
+	const std::vector<const Function*>& entryPoints = globalDeps.lazyEntryPoints();
+	for (uint32_t i = 0; i < entryPoints.size(); i++)
+	{
+		stream << "function " << namegen.getName(entryPoints[i]);
+		stream << "(){return __cheerp_load_lazy()[" << i << "].apply(null,arguments);}" << NewLine;
+	}
+}
+
+void CheerpWriter::makeLazyChunk()
+{
+	relooperCache = std::make_shared<RelooperCache>();
+	stream << "(function(){" << NewLine;
+	for (const Function* F : globalDeps.lazyFunctions())
+	{
+		if (globalDeps.isLazyEntryPoint(F))
+			continue;
+		uint64_t start = stream.tell();
+		compileMethod(*F);
+		if (sizeReport)
+			sizeReport->add(F, SizeReport::JS, stream.tell() - start);
+	}
+	// The entry points are anonymous, their names keep referring to the
+	// stubs in the main output
+	stream << "return [";
+	const std::vector<const Function*>& entryPoints = globalDeps.lazyEntryPoints();
+	for (uint32_t i = 0; i < entryPoints.size(); i++)
+	{
+		if (i)
+			stream << ',';
+		uint64_t start = stream.tell();
+		compileMethod(*entryPoints[i], /*anonymous*/true);
+		if (sizeReport)
+			sizeReport->add(entryPoints[i], SizeReport::JS, stream.tell() - start);
+	}
+	stream << "];" << NewLine;
+	stream << "})()" << NewLine;
+}
+
 void CheerpWriter::makeJS()
 {
+	relooperCache = std::make_shared<RelooperCache>();
 	if (sourceMapGenerator) {
 		sourceMapGenerator->beginFile();
 
@@ -4711,6 +5040,9 @@ void CheerpWriter::makeJS()
 
 	compileBuiltins(false);
 
+	if (typedArrayPoolSize)
+		compileTypedArrayPoolHelpers();
+
 	std::vector<StringRef> exportedClassNames = compileClassesExportedToJs();
 	compileNullPtrs();
 
@@ -4718,6 +5050,7 @@ void CheerpWriter::makeJS()
 	if(!wasmFile.empty() || asmJSMem)
 		compileFetchBuffer();
 
+	uint64_t asmJSStart = stream.tell();
 	if (globalDeps.needAsmJS() && wasmFile.empty())
 	{
 		// compile boilerplate
@@ -4742,20 +5075,23 @@ void CheerpWriter::makeJS()
 			stream << "var " << namegen.getName(imported) << "=ffi." << namegen.getName(imported) << ';' << NewLine;
 		}
 
-		// Declare globals
+		// Declare globals, zero initialized ones are placed last so that the
+		// initial memory does not need to contain them
+		if (const GlobalVariable* heapStartVar = linearHelper.addGlobalVariables(module))
+			linearHelper.addGlobalVariable(heapStartVar);
 		for ( const GlobalVariable & GV : module.getGlobalList() )
 		{
 			if (GV.getSection() == StringRef("asmjs"))
 				compileGlobalAsmJS(GV);
 		}
+		std::vector<const Function*> asmJSFunctions;
 		for ( const Function & F : module.getFunctionList() )
 		{
 			if (!F.empty() && F.getSection() == StringRef("asmjs"))
-			{
-				compileMethod(F);
-			}
+				asmJSFunctions.push_back(&F);
 		}
-		compileMemmoveHelperAsmJS();
+		compileMethods(asmJSFunctions);
+		compileMemFuncHelpersAsmJS();
 		
 		compileFunctionTablesAsmJS();
 
@@ -4816,22 +5152,36 @@ void CheerpWriter::makeJS()
 		compileGlobalsInitAsmJS();
 	}
 
+	uint64_t functionsStart = stream.tell();
+	std::vector<const Function*> functions;
 	for ( const Function & F : module.getFunctionList() )
-		if (!F.empty() && F.getSection() != StringRef("asmjs"))
+		if (!F.empty() && F.getSection() != StringRef("asmjs") && !globalDeps.isLazy(&F))
 		{
 #ifdef CHEERP_DEBUG_POINTERS
 			dumpAllPointers(F, PA);
 #endif //CHEERP_DEBUG_POINTERS
-			compileMethod(F);
+			functions.push_back(&F);
 		}
+	compileMethods(functions);
+	if (!globalDeps.lazyEntryPoints().empty())
+		compileLazyStubs();
+	uint64_t globalsStart = stream.tell();
 	for ( const GlobalVariable & GV : module.getGlobalList() )
 	{
 		// Skip global ctors array
 		if (GV.getName() == "llvm.global_ctors")
 			continue;
 		if (GV.getSection() != StringRef("asmjs"))
+		{
+			// Globals compiled early as dependencies of others are counted
+			// as part of the first one
+			uint64_t start = stream.tell();
 			compileGlobal(GV);
+			if (sizeReport)
+				sizeReport->add(&GV, SizeReport::JS, stream.tell() - start);
+		}
 	}
+	uint64_t globalsEnd = stream.tell();
 
 	for ( StructType * st : globalDeps.classesUsed() )
 	{
@@ -4954,9 +5304,22 @@ void CheerpWriter::makeJS()
 		sourceMapGenerator->endFile();
 		stream << "//# sourceMappingURL=" << sourceMapGenerator->getSourceMapName();
 	}
+
+	if (timeReport)
+	{
+		timeReport->addCounter("js_bytes_asmjs_module", functionsStart - asmJSStart);
+		timeReport->addCounter("js_bytes_genericjs_functions", globalsStart - functionsStart);
+		timeReport->addCounter("js_bytes_genericjs_globals", globalsEnd - globalsStart);
+		timeReport->addCounter("js_bytes_total", stream.tell());
+		if (asmJSMem)
+			timeReport->addCounter("asmjs_mem_file_bytes", asmJSMem->tell());
+		timeReport->addCounter("relooper_functions", relooperCache->NumCalculated + relooperCache->NumReused);
+		timeReport->addCounter("relooper_cache_hits", relooperCache->NumReused);
+		timeReport->addCounter("relooper_shapes", relooperCache->NumShapes);
+	}
 }
 
-Relooper* CheerpWriter::runRelooperOnFunction(const llvm::Function& F)
+Relooper* CheerpWriter::runRelooperOnFunction(const llvm::Function& F, RelooperCache* cache)
 {
 	//TODO: Support exceptions
 	Function::const_iterator B=F.begin();
@@ -5069,8 +5432,22 @@ Relooper* CheerpWriter::runRelooperOnFunction(const llvm::Function& F)
 			continue;
 		rl->AddBlock(relooperMap[&(*B)]);
 	}
+	if(!cache)
+	{
+		rl->Calculate(relooperMap[&F.getEntryBlock()]);
+		return rl;
+	}
+	// Reuse the shapes if a function with the same CFG has already been seen
+	RelooperCache::ShapeKey key;
+	std::vector<const void*> privates;
+	RelooperCache::ComputeKey(rl, key, privates);
+	if(Relooper* cached = cache->Get(key, privates))
+	{
+		delete rl;
+		return cached;
+	}
 	rl->Calculate(relooperMap[&F.getEntryBlock()]);
-	return rl;
+	return cache->Add(key, privates, rl);
 }
 
 uint32_t CheerpWriter::JSBytesWriter::getFunctionTableOffset(llvm::StringRef tableName)
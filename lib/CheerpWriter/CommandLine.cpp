@@ -6,6 +6,14 @@ llvm::cl::opt<std::string> WastLoader("cheerp-wast-loader", llvm::cl::Optional,
 llvm::cl::opt<std::string> WasmFile("cheerp-wasm-file", llvm::cl::Optional,
   llvm::cl::desc("If specified, the file name of the wasm file"), llvm::cl::value_desc("filename"));
 
+llvm::cl::opt<bool> WasmBinary("cheerp-wasm-binary", llvm::cl::desc("Generate the WebAssembly module in the binary format instead of the text format") );
+
+llvm::cl::opt<unsigned> CodegenThreads("cheerp-codegen-threads", llvm::cl::init(1), llvm::cl::desc("Number of threads used to compile the functions of the wasm module and of the JavaScript output") );
+
+llvm::cl::opt<bool> WasmRelooper("cheerp-wasm-relooper", llvm::cl::desc("Use the relooper to generate the control flow of all wasm functions, instead of only the ones with an irreducible CFG") );
+
+llvm::cl::opt<bool> WasmSIMD("cheerp-wasm-simd", llvm::cl::desc("Vectorize the loops of the asmjs section and emit 128-bit SIMD instructions in the wasm module, vectors are scalarized otherwise") );
+
 llvm::cl::opt<std::string> AsmJSMemFile("cheerp-asmjs-mem-file", llvm::cl::Optional,
   llvm::cl::desc("If specified, the file name of the asm.js module initialized memory dump"), llvm::cl::value_desc("filename"));
 
@@ -15,6 +23,21 @@ llvm::cl::opt<std::string> SourceMap("cheerp-sourcemap", llvm::cl::Optional,
 llvm::cl::opt<std::string> SourceMapPrefix("cheerp-sourcemap-prefix", llvm::cl::Optional,
   llvm::cl::desc("If specified, this prefix will be removed from source map file paths"), llvm::cl::value_desc("path"));
 
+llvm::cl::opt<unsigned> SourceMapSectionSize("cheerp-sourcemap-section-size", llvm::cl::init(0),
+  llvm::cl::desc("If not 0, generate an index source map with a section every this many KB of mappings"), llvm::cl::value_desc("size"));
+
+llvm::cl::opt<std::string> TimeReportFile("cheerp-time-report", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file name where the time, memory usage and counters of each phase of the backend are written as JSON"), llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<std::string> SizeReportFile("cheerp-size-report", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file name where the output size of each function and global is written as JSON"), llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<std::string> ProfileFile("cheerp-profile", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file name of an instrumentation profile used to keep the hot functions together and the cold ones at the end"), llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<std::string> PointerSummaries("cheerp-pointer-summaries", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file name where the resolved pointer kinds are stored, the ones which did not change since the previous compilation are not resolved again"), llvm::cl::value_desc("filename"));
+
 llvm::cl::opt<bool> PrettyCode("cheerp-pretty-code", llvm::cl::desc("Generate human-readable JS") );
 
 llvm::cl::opt<bool> SymbolicGlobalsAsmJS("cheerp-asmjs-symbolic-globals", llvm::cl::desc("Compile global variables addresses as js variables in the asm.js module") );
@@ -23,6 +46,8 @@ llvm::cl::opt<bool> MakeModule("cheerp-make-module", llvm::cl::desc("Create a cl
 
 llvm::cl::opt<bool> NoRegisterize("cheerp-no-registerize", llvm::cl::desc("Disable registerize pass") );
 
+llvm::cl::opt<bool> RegisterizeLinearScan("cheerp-registerize-linear-scan", llvm::cl::desc("Use linear scan instead of first fit to assign registers, faster on huge functions") );
+
 llvm::cl::opt<bool> NoNativeJavaScriptMath("cheerp-no-native-math", llvm::cl::desc("Disable native JavaScript math functions") );
 
 llvm::cl::opt<bool> NoJavaScriptMathImul("cheerp-no-math-imul", llvm::cl::desc("Disable JavaScript Math.imul") );
@@ -35,10 +60,28 @@ llvm::cl::opt<bool> MeasureTimeToMain("cheerp-measure-time-to-main", llvm::cl::d
 
 llvm::cl::opt<bool> ForceTypedArrays("cheerp-force-typed-arrays", llvm::cl::desc("Use typed arrays instead of normal arrays for arrays of doubles") );
 
+llvm::cl::opt<unsigned> TypedArrayPoolSize("cheerp-typed-array-pool-size", llvm::cl::init(0), llvm::cl::desc("Recycle freed typed arrays of up to this size (in bytes) allocated by generic JavaScript code, 0 disables the pools") );
+
+llvm::cl::opt<unsigned> DevirtualizeMaxTargets("cheerp-devirtualize-max-targets", llvm::cl::init(2), llvm::cl::desc("Maximum number of possible targets of an indirect call which are turned into guarded direct calls, 0 disables devirtualization") );
+
+llvm::cl::list<std::string> LazyEntryPoints("cheerp-lazy-entry-points", llvm::cl::value_desc("list"), llvm::cl::desc("A list of generic JS functions which, together with the functions only they use, are loaded when first called"), llvm::cl::CommaSeparated);
+
+llvm::cl::opt<std::string> LazyChunkFile("cheerp-lazy-chunk-file", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the file name of the chunk containing the functions loaded lazily"), llvm::cl::value_desc("filename"));
+
+llvm::cl::opt<bool> LazyColdFunctions("cheerp-lazy-cold-functions", llvm::cl::desc("Also load lazily the generic JS functions marked as cold, like the ones never executed according to -cheerp-profile") );
+
+llvm::cl::opt<std::string> LazyChunkURL("cheerp-lazy-chunk-url", llvm::cl::Optional,
+  llvm::cl::desc("If specified, the URL the chunk of the functions loaded lazily is fetched from, by default the chunk file name is used"), llvm::cl::value_desc("url"));
+
 llvm::cl::list<std::string> ReservedNames("cheerp-reserved-names", llvm::cl::value_desc("list"), llvm::cl::desc("A list of JS identifiers that should not be used by Cheerp"), llvm::cl::CommaSeparated);
 
 llvm::cl::opt<unsigned> CheerpAsmJSHeapSize("cheerp-asmjs-heap-size", llvm::cl::init(1), llvm::cl::desc("Desired heap size for the cheerp asmjs module (in MB)") );
 
+llvm::cl::opt<unsigned> CheerpWasmStackSize("cheerp-wasm-stack-size", llvm::cl::init(64), llvm::cl::desc("Desired stack size for the cheerp wasm module (in KB)") );
+
+llvm::cl::opt<unsigned> CheerpWasmMaxMemory("cheerp-wasm-max-memory", llvm::cl::init(0), llvm::cl::desc("Maximum size the memory of the cheerp wasm module can grow to (in MB), no limit if 0") );
+
 llvm::cl::opt<bool> BoundsCheck("cheerp-bounds-check", llvm::cl::desc("Generate debug code for bounds-checking arrays") );
 
 llvm::cl::opt<bool> DefinedCheck("cheerp-defined-members-check", llvm::cl::desc("Generate debug code for checking if accessed object members are defined") );
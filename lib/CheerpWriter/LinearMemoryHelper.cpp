@@ -10,7 +10,9 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Cheerp/LinearMemoryHelper.h"
+#include "llvm/IR/TypeFinder.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 
 using namespace cheerp;
 using namespace llvm;
@@ -211,6 +213,17 @@ const llvm::Value* LinearMemoryHelper::compileGEP(const llvm::Value* p, GepListe
 }
 
 
+void LinearMemoryHelper::computeStructLayouts(const Module& M) const
+{
+	TypeFinder structTypes;
+	structTypes.run(M, /*onlyNamed*/ false);
+	for (StructType* ST : structTypes)
+	{
+		if (ST->isSized())
+			targetData.getStructLayout(ST);
+	}
+}
+
 uint32_t LinearMemoryHelper::addGlobalVariable(const GlobalVariable* G)
 {
 	Type* ty = G->getType();
@@ -224,6 +237,80 @@ uint32_t LinearMemoryHelper::addGlobalVariable(const GlobalVariable* G)
 	return ret;
 }
 
+const GlobalVariable* LinearMemoryHelper::addGlobalVariables(const Module& M)
+{
+	const GlobalVariable* heapStartVar = nullptr;
+	for (bool zeroInitialized : {false, true})
+	{
+		for (const GlobalVariable& GV : M.getGlobalList())
+		{
+			if (GV.getSection() != StringRef("asmjs"))
+				continue;
+			if (GV.hasName() && GV.getName() == StringRef("_heapStart"))
+			{
+				heapStartVar = &GV;
+				continue;
+			}
+			if (isZeroInitialized(&GV) == zeroInitialized)
+				addGlobalVariable(&GV);
+		}
+	}
+	return heapStartVar;
+}
+
+bool LinearMemoryHelper::isZeroInitialized(const GlobalVariable* G)
+{
+	if (!G->hasInitializer())
+		return true;
+	const Constant* init = G->getInitializer();
+	if (init->isNullValue() || isa<UndefValue>(init))
+		return true;
+	if (const ConstantDataSequential* CD = dyn_cast<ConstantDataSequential>(init))
+	{
+		StringRef data = CD->getRawDataValues();
+		return std::all_of(data.begin(), data.end(), [](char c) { return c == 0; });
+	}
+	return false;
+}
+
+void LinearMemoryHelper::ByteBuffer::splitZeroRuns(uint32_t minZeroRun, std::vector<Segment>& segments) const
+{
+	uint32_t i = 0;
+	while (i < bytes.size())
+	{
+		// Skip the zeroes before the segment
+		while (i < bytes.size() && bytes[i] == 0)
+			i++;
+		if (i == bytes.size())
+			break;
+		Segment segment{i, 0};
+		// The segment ends before the first long enough run of zeroes
+		uint32_t end = i;
+		uint32_t zeroRun = 0;
+		for (; i < bytes.size() && zeroRun < minZeroRun; i++)
+		{
+			if (bytes[i] == 0)
+				zeroRun++;
+			else
+			{
+				zeroRun = 0;
+				end = i + 1;
+			}
+		}
+		segment.size = end - segment.offset;
+		segments.push_back(segment);
+	}
+}
+
+uint32_t LinearMemoryHelper::addStack(uint32_t size)
+{
+	// Keep the stack pointer aligned to 8 bytes, which is the maximum
+	// alignment used by allocas
+	heapStart = (heapStart + 7) & ~7;
+	heapStart += (size + 7) & ~7;
+	return heapStart;
+}
+
 uint32_t LinearMemoryHelper::getGlobalVariableAddress(const GlobalVariable* G) const
 {
 	assert(gVarsAddr.count(G));
@@ -13,9 +13,11 @@
 #include "llvm/Cheerp/NameGenerator.h"
 #include "llvm/Cheerp/GlobalDepsAnalyzer.h"
 #include "llvm/Cheerp/Utility.h"
+#include "llvm/Cheerp/Writer.h"
 #include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
 #include <functional>
-#include <set>
+#include <queue>
 
 using namespace llvm;
 
@@ -200,6 +202,150 @@ SmallString< 4 > NameGenerator::filterLLVMName(StringRef s, NAME_FILTER_MODE fil
 	return ans;
 }
 
+/**
+ * Counts how many times the writer refers to the helpers of each type: the
+ * class function of types with a downcast array, the constructor of objects
+ * too big for a literal and the createArray function of arrays.
+ *
+ * Every helper is also referenced once by its own definition
+ */
+class TypeUses
+{
+public:
+	typedef std::vector<std::pair<unsigned, Type*>> UsesVec;
+	UsesVec classTypes;
+	UsesVec constructorTypes;
+	UsesVec arrayTypes;
+
+	explicit TypeUses(const GlobalDepsAnalyzer& gda):gda(gda)
+	{
+		for(Type* T: gda.classesWithBaseInfo())
+			addHelper(classTypes, classIndex, T);
+		for(Type* T: gda.classesUsed())
+			addHelper(constructorTypes, constructorIndex, T);
+		for(Type* T: gda.dynAllocArrays())
+			addHelper(arrayTypes, arrayIndex, T);
+	}
+	// An object of type T is created, count the helpers used by its literal
+	void addObject(Type* T, unsigned times)
+	{
+		if(StructType* st = dyn_cast<StructType>(T))
+		{
+			if(TypeSupport::hasByteLayout(st))
+				return;
+			if(st->getNumElements() > V8MaxLiteralProperties)
+			{
+				addUse(constructorTypes, constructorIndex, st, times);
+				return;
+			}
+			if(StructType* base = gda.needsDowncastArray(st))
+				addUse(classTypes, classIndex, base, times);
+			for(Type* element: st->elements())
+				addObject(element, times);
+		}
+		else if(ArrayType* at = dyn_cast<ArrayType>(T))
+		{
+			Type* element = at->getElementType();
+			if(at->getNumElements() > 8)
+				addArray(element, times);
+			else
+				addObject(element, times * at->getNumElements());
+		}
+	}
+	// An array of elementType is created using its createArray function
+	void addArray(Type* elementType, unsigned times)
+	{
+		addUse(arrayTypes, arrayIndex, elementType, times);
+	}
+	// The class function of T is called directly
+	void addClass(Type* T)
+	{
+		addUse(classTypes, classIndex, T, 1);
+	}
+private:
+	typedef std::unordered_map<Type*, uint32_t> IndexMap;
+	static void addHelper(UsesVec& uses, IndexMap& index, Type* T)
+	{
+		index.emplace(T, uses.size());
+		uses.emplace_back(1, T);
+	}
+	static void addUse(UsesVec& uses, IndexMap& index, Type* T, unsigned times)
+	{
+		// Only the helpers which are actually generated are interesting
+		auto it = index.find(T);
+		if(it != index.end())
+			uses[it->second].first += times;
+	}
+	const GlobalDepsAnalyzer& gda;
+	IndexMap classIndex;
+	IndexMap constructorIndex;
+	IndexMap arrayIndex;
+};
+
+static void countTypeAndBuiltinUses(const Module& M, const GlobalDepsAnalyzer& gda, TypeUses& typeUses,
+				std::array<unsigned, NameGenerator::Builtin::END>& builtinUses)
+{
+	for (const GlobalVariable& GV : M.getGlobalList())
+	{
+		if (GV.getSection() == StringRef("asmjs") || !GV.hasInitializer())
+			continue;
+		Type* T = GV.getType()->getPointerElementType();
+		typeUses.addObject(T, 1);
+		if (StructType* st = dyn_cast<StructType>(T))
+		{
+			if (st->hasName() && M.getNamedMetadata(Twine(st->getName(),"_bases")))
+				typeUses.addClass(st);
+		}
+	}
+	for (const Function& F : M.getFunctionList())
+	{
+		if (F.empty())
+			continue;
+		bool asmjs = F.getSection() == StringRef("asmjs");
+		if (asmjs)
+		{
+			// Arguments are coerced at the start of the function
+			for (const Argument& A : F.args())
+				builtinUses[NameGenerator::Builtin::FROUND] += A.getType()->isFloatTy();
+		}
+		for (const BasicBlock& BB : F)
+		{
+			for (const Instruction& I : BB)
+			{
+				if (I.getOpcode() == Instruction::Mul && I.getType()->isIntegerTy() &&
+					I.getType()->getIntegerBitWidth() <= 32)
+				{
+					builtinUses[NameGenerator::Builtin::IMUL]++;
+				}
+				if (asmjs)
+				{
+					// Float values are coerced both when produced and when used
+					unsigned floatUses = I.getType()->isFloatTy();
+					for (const Use& op : I.operands())
+						floatUses += op->getType()->isFloatTy();
+					builtinUses[NameGenerator::Builtin::FROUND] += floatUses;
+					continue;
+				}
+				if (const AllocaInst* AI = dyn_cast<AllocaInst>(&I))
+				{
+					typeUses.addObject(AI->getAllocatedType(), 1);
+				}
+				else if (isa<CallInst>(I) || isa<InvokeInst>(I))
+				{
+					DynamicAllocInfo ai(&I, M.getDataLayout(), /*forceTypedArrays*/false);
+					if (!ai.isValidAlloc())
+						continue;
+					Type* T = ai.getCastedType()->getElementType();
+					if (gda.dynAllocArrays().count(T))
+						typeUses.addArray(T, 1);
+					else
+						typeUses.addObject(T, 1);
+				}
+			}
+		}
+	}
+}
+
 void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAnalyzer& gda)
 {
 	typedef std::pair<unsigned, const GlobalValue *> useGlobalPair;
@@ -215,9 +361,6 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 	typedef std::pair<unsigned, std::vector<localData>> useLocalsPair;
 	typedef std::vector<useLocalPair> useLocalVec;
 	typedef std::vector<useLocalsPair> useLocalsVec;
-	typedef std::pair<unsigned, Type*> useTypesPair;
-
-	typedef std::set<useTypesPair, std::greater<useTypesPair>> useTypesSet;
         
 	// Class to handle giving names to temporary variables needed for recursively dependent PHIs
 	class CompressedPHIHandler: public EndOfBlockPHIHandler
@@ -250,26 +393,13 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		}
 	};
 	/**
-	 * Collect the types that need a constructor.
-	 * 
-	 * We use a frequency count of 1, because counting the actual number of uses
-	 * is not trivial, and the benefits in code size would not be significant
+	 * Count how many times the writer refers to the helpers of each type,
+	 * and to the builtins
 	 */
-	useTypesSet classTypes;
-	useTypesSet constructorTypes;
-	useTypesSet arrayTypes;
-	for(Type* T: gda.classesWithBaseInfo())
-	{
-		classTypes.insert(std::make_pair(1,T));
-	}
-	for(Type* T: gda.classesUsed())
-	{
-		constructorTypes.insert(std::make_pair(1,T));
-	}
-	for(Type* T: gda.dynAllocArrays())
-	{
-		arrayTypes.insert(std::make_pair(1,T));
-	}
+	TypeUses typeUses(gda);
+	std::array<unsigned, Builtin::END> builtinUses;
+	builtinUses.fill(0);
+	countTypeAndBuiltinUses(M, gda, typeUses, builtinUses);
 
 	/**
 	 * Collect the local values.
@@ -282,10 +412,8 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
         
 	useLocalsVec allLocalValues;
         
-	/**
-	 * We use a std::set to automatically sort the global values by number of uses
-	 */
-	std::set< useGlobalPair, std::greater< useGlobalPair > > allGlobalValues;
+	// The global values with their number of uses, in module order
+	std::vector< useGlobalPair > allGlobalValues;
 
 	for (const Function & f : M.getFunctionList() )
 	{
@@ -298,7 +426,7 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 		if ( std::find(gda.constructors().begin(), gda.constructors().end(), &f ) != gda.constructors().end() )
 			++nUses;
 
-		allGlobalValues.emplace( nUses, &f );
+		allGlobalValues.emplace_back( nUses, &f );
 
 		/**
 		 * TODO, some cheerp-internals functions are actually generated even with an empty IR.
@@ -383,7 +511,7 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 			continue;
 		}
 
-		allGlobalValues.emplace( GV.getNumUses(), &GV );
+		allGlobalValues.emplace_back( GV.getNumUses(), &GV );
 	}
 
 	/**
@@ -394,114 +522,104 @@ void NameGenerator::generateCompressedNames(const Module& M, const GlobalDepsAna
 	 * of the global inside the function.
 	 */
 	name_iterator<JSSymbols> name_it((JSSymbols(reservedNames)));
-	
-	// We need to iterate over allGlobalValues and allLocalValues
-	// at the same time incrementing selectively only one of the iterators
-	
-	std::set< useGlobalPair >::const_iterator global_it = allGlobalValues.begin();
-	useLocalsVec::const_iterator local_it = allLocalValues.begin();
-	useTypesSet::const_iterator class_it = classTypes.begin();
-	useTypesSet::const_iterator constructor_it = constructorTypes.begin();
-	useTypesSet::const_iterator array_it = arrayTypes.begin();
-
-	bool globalsFinished = global_it == allGlobalValues.end();
-	bool localsFinished = local_it == allLocalValues.end();
-	bool classTypesFinished = class_it == classTypes.end();
-	bool constructorTypesFinished = constructor_it == constructorTypes.end();
-	bool arrayTypesFinished = array_it == arrayTypes.end();
-	for ( ; !globalsFinished || !localsFinished || !classTypesFinished || !constructorTypesFinished || !arrayTypesFinished; ++name_it )
+
+	/**
+	 * All the candidates for a name go in a single priority queue, so that
+	 * the most used ones get the shortest names, whatever their kind.
+	 * Ties are broken by kind and then by position
+	 */
+	enum CANDIDATE_KIND { GLOBAL_VALUE = 0, LOCAL_VALUES, CLASS_TYPE, CONSTRUCTOR_TYPE, ARRAY_TYPE, BUILTIN };
+	struct Candidate
 	{
-		if ( !globalsFinished &&
-			(localsFinished || global_it->first >= local_it->first) &&
-			(classTypesFinished || global_it->first >= class_it->first) &&
-			(constructorTypesFinished || global_it->first >= constructor_it->first) &&
-			(arrayTypesFinished || global_it->first >= array_it->first))
+		unsigned uses;
+		CANDIDATE_KIND kind;
+		uint32_t index;
+		bool operator<(const Candidate& rhs) const
 		{
-			// Assign this name to a global value
-			namemap.emplace( global_it->second, *name_it );
-			// We need to consume another name to assign the secondary one
-			if(needsSecondaryName(global_it->second, PA))
-			{
-				++name_it;
-				secondaryNamemap.emplace( global_it->second, *name_it );
-			}
-			++global_it;
+			// std::priority_queue pops the greatest element first
+			if (uses != rhs.uses)
+				return uses < rhs.uses;
+			if (kind != rhs.kind)
+				return kind > rhs.kind;
+			return index > rhs.index;
 		}
-		else if ( !localsFinished &&
-			(globalsFinished || local_it->first >= global_it->first) &&
-			(classTypesFinished || local_it->first >= class_it->first) &&
-			(constructorTypesFinished || local_it->first >= constructor_it->first) &&
-			(arrayTypesFinished || local_it->first >= array_it->first))
+	};
+	std::vector<Candidate> candidates;
+	candidates.reserve(allGlobalValues.size() + allLocalValues.size() + typeUses.classTypes.size() +
+			typeUses.constructorTypes.size() + typeUses.arrayTypes.size() + builtinUses.size());
+	for (uint32_t i = 0; i < allGlobalValues.size(); i++)
+		candidates.push_back(Candidate{allGlobalValues[i].first, GLOBAL_VALUE, i});
+	for (uint32_t i = 0; i < allLocalValues.size(); i++)
+		candidates.push_back(Candidate{allLocalValues[i].first, LOCAL_VALUES, i});
+	for (uint32_t i = 0; i < typeUses.classTypes.size(); i++)
+		candidates.push_back(Candidate{typeUses.classTypes[i].first, CLASS_TYPE, i});
+	for (uint32_t i = 0; i < typeUses.constructorTypes.size(); i++)
+		candidates.push_back(Candidate{typeUses.constructorTypes[i].first, CONSTRUCTOR_TYPE, i});
+	for (uint32_t i = 0; i < typeUses.arrayTypes.size(); i++)
+		candidates.push_back(Candidate{typeUses.arrayTypes[i].first, ARRAY_TYPE, i});
+	for (uint32_t i = 0; i < builtinUses.size(); i++)
+		candidates.push_back(Candidate{builtinUses[i], BUILTIN, i});
+	std::priority_queue<Candidate> queue(std::less<Candidate>(), std::move(candidates));
+
+	for ( ; !queue.empty(); queue.pop(), ++name_it )
+	{
+		const Candidate& c = queue.top();
+		switch (c.kind)
 		{
-			// Assign this name to all the local values
-			SmallString<4> primaryName = *name_it;
-			SmallString<4> secondaryName;
-			for ( const localData& v : local_it->second )
+			case GLOBAL_VALUE:
 			{
-				if(v.needsSecondaryName && secondaryName.empty())
+				const GlobalValue* GV = allGlobalValues[c.index].second;
+				// Assign this name to a global value
+				namemap.emplace( GV, *name_it );
+				// We need to consume another name to assign the secondary one
+				if(needsSecondaryName(GV, PA))
 				{
 					++name_it;
-					secondaryName = *name_it;
-				}
-				if(const llvm::Function* f = dyn_cast<llvm::Function>(v.argOrFunc))
-				{
-					regNamemap.emplace( std::make_pair( f, v.regId ), primaryName);
-					if(v.needsSecondaryName)
-						regSecondaryNamemap.emplace( std::make_pair( f, v.regId ), secondaryName);
+					secondaryNamemap.emplace( GV, *name_it );
 				}
-				else
+				break;
+			}
+			case LOCAL_VALUES:
+			{
+				// Assign this name to all the local values
+				SmallString<4> primaryName = *name_it;
+				SmallString<4> secondaryName;
+				for ( const localData& v : allLocalValues[c.index].second )
 				{
-					namemap.emplace( v.argOrFunc, primaryName );
-					// We need to consume another name to assign the secondary one
-					if(v.needsSecondaryName)
-						secondaryNamemap.emplace( v.argOrFunc, secondaryName );
+					if(v.needsSecondaryName && secondaryName.empty())
+					{
+						++name_it;
+						secondaryName = *name_it;
+					}
+					if(const llvm::Function* f = dyn_cast<llvm::Function>(v.argOrFunc))
+					{
+						regNamemap.emplace( std::make_pair( f, v.regId ), primaryName);
+						if(v.needsSecondaryName)
+							regSecondaryNamemap.emplace( std::make_pair( f, v.regId ), secondaryName);
+					}
+					else
+					{
+						namemap.emplace( v.argOrFunc, primaryName );
+						// We need to consume another name to assign the secondary one
+						if(v.needsSecondaryName)
+							secondaryNamemap.emplace( v.argOrFunc, secondaryName );
+					}
 				}
+				break;
 			}
-			
-			++local_it;
-		}
-		else if ( !classTypesFinished &&
-			(globalsFinished || class_it->first >= global_it->first) &&
-			(localsFinished || class_it->first >= local_it->first) &&
-			(constructorTypesFinished || class_it->first >= constructor_it->first) &&
-			(arrayTypesFinished || class_it->first >= array_it->first))
-		{
-			SmallString<4> name = *name_it;
-			++name_it;
-			classmap.emplace(class_it->second, name);
-			++class_it;
-		}
-		else if ( !constructorTypesFinished &&
-			(globalsFinished || constructor_it->first >= global_it->first) &&
-			(localsFinished || constructor_it->first >= local_it->first) &&
-			(classTypesFinished || constructor_it->first >= class_it->first) &&
-			(arrayTypesFinished || constructor_it->first >= array_it->first))
-		{
-			SmallString<4> name = *name_it;
-			++name_it;
-			constructormap.emplace(constructor_it->second, name);
-			++constructor_it;
-		}
-		else
-		{
-			SmallString<4> name = *name_it;
-			++name_it;
-			arraymap.emplace(array_it->second, name);
-			++array_it;
+			case CLASS_TYPE:
+				classmap.emplace(typeUses.classTypes[c.index].second, *name_it);
+				break;
+			case CONSTRUCTOR_TYPE:
+				constructormap.emplace(typeUses.constructorTypes[c.index].second, *name_it);
+				break;
+			case ARRAY_TYPE:
+				arraymap.emplace(typeUses.arrayTypes[c.index].second, *name_it);
+				break;
+			case BUILTIN:
+				builtins[c.index] = *name_it;
+				break;
 		}
-
-		globalsFinished = global_it == allGlobalValues.end();
-		localsFinished = local_it == allLocalValues.end();
-		classTypesFinished = class_it == classTypes.end();
-		constructorTypesFinished = constructor_it == constructorTypes.end();
-		arrayTypesFinished = array_it == arrayTypes.end();
-	}
-	// We generate the builtin names last because we do not have statistics about
-	// them (for now)
-	for (unsigned i = 0; i < builtins.size(); i++)
-	{
-		builtins[i] = *name_it;
-		++name_it;
 	}
 }
 
@@ -59,8 +59,9 @@ Block::Block(const void* b, bool s, int Id, const void* si)
 { }
 
 Block::~Block() {
-  for (BlockSet::iterator iter = ProcessedBranchesIn.begin(); iter != ProcessedBranchesIn.end(); iter++) {
-    delete *iter;
+  // Blocks own the Branch objects in both maps, branches of unreachable blocks are never processed
+  for (BlockBranchMap::iterator iter = BranchesOut.begin(); iter != BranchesOut.end(); iter++) {
+    delete iter->second;
   }
   for (BlockBranchMap::iterator iter = ProcessedBranchesOut.begin(); iter != ProcessedBranchesOut.end(); iter++) {
     delete iter->second;
@@ -1051,6 +1052,158 @@ void Relooper::Render(RenderInterface* renderInterface) {
   Root->Render(false, renderInterface);
 }
 
+Relooper* Relooper::Clone(const std::map<const void*, const void*>& PrivateMap) const {
+  auto MapPrivate = [&](const void* Private) -> const void* {
+    if (!Private) return NULL;
+    auto it = PrivateMap.find(Private);
+    assert(it != PrivateMap.end());
+    return it->second;
+  };
+  std::map<const Block*, Block*> BlockMap;
+  std::map<const Shape*, Shape*> ShapeMap;
+  auto MapShape = [&](const Shape* S) -> Shape* {
+    if (!S) return NULL;
+    assert(ShapeMap.count(S));
+    return ShapeMap.find(S)->second;
+  };
+  auto MapBlock = [&](const Block* B) -> Block* {
+    if (!B) return NULL;
+    assert(BlockMap.count(B));
+    return BlockMap.find(B)->second;
+  };
+
+  Relooper* Ret = new Relooper(IdCounter);
+  Ret->MinSize = MinSize;
+  Ret->NeedsLabel = NeedsLabel;
+  for (Block* Old : Blocks) {
+    Block* New = new Block(MapPrivate(Old->privateBlock), Old->IsSplittable, Old->Id, MapPrivate(Old->privateSwitchInst));
+    New->IsCheckedMultipleEntry = Old->IsCheckedMultipleEntry;
+    BlockMap[Old] = New;
+    Ret->Blocks.push_back(New);
+  }
+  for (Shape* Old : Shapes) {
+    Shape* New = NULL;
+    if (SimpleShape* Simple = Shape::IsSimple(Old)) {
+      New = new SimpleShape(Simple->Id);
+    } else if (MultipleShape* Multiple = Shape::IsMultiple(Old)) {
+      MultipleShape* NewMultiple = new MultipleShape(Multiple->Id);
+      NewMultiple->Labeled = Multiple->Labeled;
+      NewMultiple->Breaks = Multiple->Breaks;
+      NewMultiple->UseSwitch = Multiple->UseSwitch;
+      New = NewMultiple;
+    } else if (LoopShape* Loop = Shape::IsLoop(Old)) {
+      LoopShape* NewLoop = new LoopShape(Loop->Id);
+      NewLoop->Labeled = Loop->Labeled;
+      New = NewLoop;
+    }
+    assert(New);
+    ShapeMap[Old] = New;
+    Ret->Shapes.push_back(New);
+  }
+  Ret->Root = MapShape(Root);
+
+  for (Shape* Old : Shapes) {
+    Shape* New = MapShape(Old);
+    New->Next = MapShape(Old->Next);
+    New->Natural = MapShape(Old->Natural);
+    if (SimpleShape* Simple = Shape::IsSimple(Old)) {
+      ((SimpleShape*)New)->Inner = MapBlock(Simple->Inner);
+    } else if (MultipleShape* Multiple = Shape::IsMultiple(Old)) {
+      for (IdShapeMap::iterator iter = Multiple->InnerMap.begin(); iter != Multiple->InnerMap.end(); iter++) {
+        ((MultipleShape*)New)->InnerMap[iter->first] = MapShape(iter->second);
+      }
+    } else if (LoopShape* Loop = Shape::IsLoop(Old)) {
+      ((LoopShape*)New)->Inner = MapShape(Loop->Inner);
+    }
+  }
+
+  auto CloneBranch = [&](const Branch* Old) {
+    Branch* New = new Branch(Old->branchId);
+    New->Ancestor = MapShape(Old->Ancestor);
+    New->Type = Old->Type;
+    New->Labeled = Old->Labeled;
+    return New;
+  };
+  for (Block* Old : Blocks) {
+    Block* New = MapBlock(Old);
+    New->Parent = MapShape(Old->Parent);
+    New->DefaultTarget = MapBlock(Old->DefaultTarget);
+    for (BlockBranchMap::iterator iter = Old->BranchesOut.begin(); iter != Old->BranchesOut.end(); iter++) {
+      New->BranchesOut[MapBlock(iter->first)] = CloneBranch(iter->second);
+    }
+    for (BlockBranchMap::iterator iter = Old->ProcessedBranchesOut.begin(); iter != Old->ProcessedBranchesOut.end(); iter++) {
+      New->ProcessedBranchesOut[MapBlock(iter->first)] = CloneBranch(iter->second);
+    }
+    for (BlockSet::iterator iter = Old->BranchesIn.begin(); iter != Old->BranchesIn.end(); iter++) {
+      New->BranchesIn.insert(MapBlock(*iter));
+    }
+    for (BlockSet::iterator iter = Old->ProcessedBranchesIn.begin(); iter != Old->ProcessedBranchesIn.end(); iter++) {
+      New->ProcessedBranchesIn.insert(MapBlock(*iter));
+    }
+  }
+  return Ret;
+}
+
+// RelooperCache
+
+RelooperCache::~RelooperCache() {
+  for (auto& iter : Entries) delete iter.second.R;
+}
+
+void RelooperCache::ComputeKey(const Relooper* R, ShapeKey& Key, std::vector<const void*>& Privates) {
+  // MinSize changes the calculated shapes
+  Key.push_back(R->MinSize ? 1 : 0);
+  // Blocks are identified by their index, which is also their Id before Calculate
+  for (unsigned i = 0; i < R->Blocks.size(); i++) {
+    Block* B = R->Blocks[i];
+    assert(B->Id == (int)i);
+    Key.push_back((B->IsSplittable ? 1 : 0) | (B->privateSwitchInst ? 2 : 0));
+    Key.push_back(B->BranchesOut.size());
+    for (BlockBranchMap::iterator iter = B->BranchesOut.begin(); iter != B->BranchesOut.end(); iter++) {
+      Key.push_back(iter->first->Id);
+      Key.push_back(iter->second->branchId);
+    }
+    Privates.push_back(B->privateBlock);
+    Privates.push_back(B->privateSwitchInst);
+  }
+}
+
+Relooper* RelooperCache::Get(const ShapeKey& Key, const std::vector<const void*>& Privates) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  auto it = Entries.find(Key);
+  if (it == Entries.end() || !it->second.R) return NULL;
+  const Entry& Cached = it->second;
+  assert(Cached.Privates.size() == Privates.size());
+  NumReused++;
+  std::map<const void*, const void*> PrivateMap;
+  for (unsigned i = 0; i < Privates.size(); i++) {
+    if (Cached.Privates[i]) PrivateMap[Cached.Privates[i]] = Privates[i];
+  }
+  return Cached.R->Clone(PrivateMap);
+}
+
+Relooper* RelooperCache::Add(const ShapeKey& Key, const std::vector<const void*>& Privates, Relooper* R) {
+  std::lock_guard<std::mutex> Guard(Lock);
+  NumCalculated++;
+  NumShapes += R->Shapes.size();
+  Entry& Cached = Entries[Key];
+  // The first time a shape is seen only its key is remembered, so that unique
+  // CFGs do not pay for a copy. Another thread may also have cached the same
+  // shape in the meantime. In both cases R can be rendered directly.
+  if (!Cached.Seen || Cached.R) {
+    Cached.Seen = true;
+    return R;
+  }
+  // Rendering modifies the shapes, so the cached relooper is never returned
+  std::map<const void*, const void*> PrivateMap;
+  for (const void* Private : Privates) {
+    if (Private) PrivateMap[Private] = Private;
+  }
+  Cached.R = R;
+  Cached.Privates = Privates;
+  return R->Clone(PrivateMap);
+}
+
 
 #if DEBUG
 // Debugging
@@ -21,6 +21,8 @@ LLVM.
 #include <set>
 #include <vector>
 #include <list>
+#include <mutex>
+#include <unordered_map>
 
 struct Block;
 struct Shape;
@@ -259,7 +261,7 @@ struct Shape {
   };
   ShapeType Type;
 
-  Shape(ShapeType TypeInit, int Id) : Id(Id), Next(NULL), Type(TypeInit) {}
+  Shape(ShapeType TypeInit, int Id) : Id(Id), Next(NULL), Natural(NULL), Type(TypeInit) {}
   virtual ~Shape() {}
 
   virtual void Render(bool InLoop, RenderInterface* renderInterface) = 0;
@@ -342,6 +344,58 @@ struct Relooper {
   void Render(RenderInterface* renderInterface);
 
   bool needsLabel() const { return NeedsLabel; }
+
+  // Returns a deep copy of the calculated shapes and blocks. The private values of
+  // the blocks are replaced using PrivateMap, so that the result can be rendered
+  // for another function with the same control flow graph
+  Relooper* Clone(const std::map<const void*, const void*>& PrivateMap) const;
+};
+
+// Caches the calculated shapes by the shape of the control flow graph. The key
+// is built from the blocks and branches added to a relooper, before Calculate is
+// run, so it identifies uniquely the input of the algorithm. Reusing a result only
+// requires cloning it and rendering it again.
+// The cache is thread safe and owns the cached reloopers.
+struct RelooperCache {
+  typedef std::vector<int> ShapeKey;
+
+  RelooperCache() : NumCalculated(0), NumReused(0), NumShapes(0) {}
+  ~RelooperCache();
+
+  // Build the key and the list of private values of a relooper which is not calculated yet
+  static void ComputeKey(const Relooper* R, ShapeKey& Key, std::vector<const void*>& Privates);
+
+  // Returns a copy of the cached relooper for Key, translated to Privates, or NULL
+  Relooper* Get(const ShapeKey& Key, const std::vector<const void*>& Privates);
+
+  // Takes a relooper calculated after Get failed and returns the one to render.
+  // It is stored, and a copy returned, only when its key has been seen before
+  Relooper* Add(const ShapeKey& Key, const std::vector<const void*>& Privates, Relooper* R);
+
+  // Statistics, only valid when no other thread is using the cache
+  unsigned NumCalculated; // Reloopers calculated after a miss
+  unsigned NumReused; // Reloopers returned by Get
+  unsigned NumShapes; // Shapes created by the calculated reloopers
+
+private:
+  struct KeyHash {
+    size_t operator()(const ShapeKey& Key) const {
+      size_t Hash = Key.size();
+      for (int Value : Key) Hash = Hash * 31 + (unsigned)Value;
+      return Hash;
+    }
+  };
+  struct Entry {
+    Relooper* R;
+    std::vector<const void*> Privates;
+    bool Seen;
+    Entry() : R(NULL), Seen(false) {}
+  };
+  std::unordered_map<ShapeKey, Entry, KeyHash> Entries;
+  std::mutex Lock;
+
+  RelooperCache(const RelooperCache&) = delete;
+  RelooperCache& operator=(const RelooperCache&) = delete;
 };
 
 typedef InsertOrderedMap<Block*, BlockSet> BlockBlockSetMap;
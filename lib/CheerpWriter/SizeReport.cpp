@@ -0,0 +1,64 @@
+//===-- SizeReport.cpp - Cheerp output size report ------------------------===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/SizeReport.h"
+#include "llvm/IR/Function.h"
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+namespace cheerp
+{
+
+void SizeReport::add(const GlobalValue* GV, OUTPUT output, uint64_t bytes)
+{
+	sizes[std::make_pair(GV, output)] += bytes;
+}
+
+void SizeReport::print(raw_ostream& out) const
+{
+	typedef std::pair<std::pair<const GlobalValue*, OUTPUT>, uint64_t> Entry;
+	std::vector<Entry> entries(sizes.begin(), sizes.end());
+	// Biggest first, ties are broken by name to have a stable output
+	std::sort(entries.begin(), entries.end(), [](const Entry& lhs, const Entry& rhs)
+	{
+		if (lhs.second != rhs.second)
+			return lhs.second > rhs.second;
+		if (lhs.first.first->getName() != rhs.first.first->getName())
+			return lhs.first.first->getName() < rhs.first.first->getName();
+		return lhs.first.second < rhs.first.second;
+	});
+	uint64_t totals[2][2] = {{0, 0}, {0, 0}};
+	out << "{\n\t\"entries\": [";
+	for (uint32_t i = 0; i < entries.size(); i++)
+	{
+		const GlobalValue* GV = entries[i].first.first;
+		OUTPUT output = entries[i].first.second;
+		bool isFunction = isa<Function>(GV);
+		totals[output][isFunction] += entries[i].second;
+		out << (i ? ",\n" : "\n") << "\t\t{\"name\": \"";
+		out.write_escaped(GV->getName());
+		out << "\", \"kind\": \"" << (isFunction ? "function" : "global") << "\"";
+		out << ", \"section\": \"" << (GV->getSection() == StringRef("asmjs") ? "asmjs" : "genericjs") << "\"";
+		out << ", \"output\": \"" << (output == WASM ? "wasm" : "js") << "\"";
+		out << ", \"bytes\": " << entries[i].second << "}";
+	}
+	out << "\n\t],\n";
+	out << "\t\"totals\": {\n";
+	out << "\t\t\"js_functions\": " << totals[JS][1] << ",\n";
+	out << "\t\t\"js_globals\": " << totals[JS][0] << ",\n";
+	out << "\t\t\"wasm_functions\": " << totals[WASM][1] << ",\n";
+	out << "\t\t\"wasm_globals\": " << totals[WASM][0] << "\n";
+	out << "\t}\n}\n";
+}
+
+}
@@ -19,34 +19,56 @@ using namespace llvm;
 namespace cheerp
 {
 
-SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C, std::error_code& ErrorCode):
+SourceMapGenerator::SourceMapGenerator(const std::string& sourceMapName, const std::string& sourceMapPrefix, llvm::LLVMContext& C,
+		uint32_t sectionSize, std::error_code& ErrorCode):
 	sourceMap(sourceMapName.c_str(), ErrorCode, sys::fs::F_None), sourceMapName(sourceMapName), sourceMapPrefix(sourceMapPrefix),
-	Ctx(C), lastFile(0), lastLine(0), lastColumn(0), lastOffset(0), lineOffset(0), lastName(0), lineBegin(true)
+	Ctx(C), lastFile(0), lastLine(0), lastColumn(0), lastOffset(0), lineOffset(0), lastName(0), lineBegin(true),
+	sectionSize(sectionSize), sectionMappingsSize(0), generatedLine(0)
 {
 }
 
 static char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-void SourceMapGenerator::writeBase64VLQInt(int i)
+char* SourceMapGenerator::encodeBase64VLQInt(int32_t i, char* out)
 {
 	// The sign is encoded as the least significant bit
+	uint32_t v;
 	if (i < 0)
-		i = ((-i) << 1) | 1;
+		v = (uint32_t(-i) << 1) | 1;
 	else
-		i = i << 1;
+		v = uint32_t(i) << 1;
 	do
 	{
 		// 5 bit of data, 1 of continuation
-		int base64Char = i & 0x1f;
-		i >>= 5;
-		if(i)
+		int base64Char = v & 0x1f;
+		v >>= 5;
+		if(v)
 			base64Char |= 0x20;
-		sourceMap.os() << base64Chars[base64Char];
+		*out++ = base64Chars[base64Char];
 	}
-	while(i);
+	while(v);
+	return out;
+}
+
+void SourceMapGenerator::writeSegment(const int32_t* fields, uint32_t numFields)
+{
+	// A 32 bit value takes at most 7 characters, the segment is written at once
+	char buf[1 + 5 * 7];
+	assert(numFields <= 5);
+	char* out = buf;
+	if(!lineBegin)
+		*out++ = ',';
+	lineBegin = false;
+	for(uint32_t i = 0; i < numFields; i++)
+		out = encodeBase64VLQInt(fields[i], out);
+	sourceMap.os().write(buf, out - buf);
+	sectionMappingsSize += out - buf;
 }
 
 void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
+	if(sectionSize && sectionMappingsSize >= sectionSize)
+		splitSection();
+
 	StringRef fileName = method.getFilename();
 	unsigned lineNumber = method.getLineNumber();
 	StringRef functionName = method.getLinkageName();
@@ -70,22 +92,21 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
 	uint32_t currentName = functionNameMapIt->second;
 	uint32_t currentColumn = 0;
 
-	if(!lineBegin)
-		sourceMap.os() << ',';
-	lineBegin = false;
-
-	// Starting column in the generated code
-	writeBase64VLQInt(lineOffset - lastOffset);
 	// Other fields are encoded as difference from the previous one in the file
 	// We can use the last value directly because it is initialized as 0
-	// File index
-	writeBase64VLQInt(currentFile - lastFile);
-	// Line index
-	writeBase64VLQInt(currentLine - lastLine);
-	// Column index
-	writeBase64VLQInt(currentColumn - lastColumn);
-	// Name index
-	writeBase64VLQInt(currentName - lastName);
+	int32_t fields[] = {
+		// Starting column in the generated code
+		int32_t(lineOffset - lastOffset),
+		// File index
+		int32_t(currentFile - lastFile),
+		// Line index
+		int32_t(currentLine - lastLine),
+		// Column index
+		int32_t(currentColumn - lastColumn),
+		// Name index
+		int32_t(currentName - lastName)
+	};
+	writeSegment(fields, 5);
 	lastFile = currentFile;
 	lastLine = currentLine;
 	lastColumn = currentColumn;
@@ -95,6 +116,9 @@ void SourceMapGenerator::setFunctionName(const llvm::DISubprogram &method) {
 
 void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 {
+	if(sectionSize && sectionMappingsSize >= sectionSize)
+		splitSection();
+
 	MDNode* file = debugLoc.getScope(Ctx);
 	assert(file->getNumOperands()>=2);
 	MDNode* fileNamePath = cast<MDNode>(file->getOperand(1));
@@ -107,19 +131,19 @@ void SourceMapGenerator::setDebugLoc(const llvm::DebugLoc& debugLoc)
 	uint32_t currentFile = fileMapIt->second;
 	uint32_t currentLine = debugLoc.getLine() - 1;
 	uint32_t currentColumn = debugLoc.getCol() - 1;
-	if(!lineBegin)
-		sourceMap.os() << ',';
-	lineBegin = false;
-	// Starting column in the generated code
-	writeBase64VLQInt(lineOffset - lastOffset);
 	// Other fields are encoded as difference from the previous one in the file
 	// We can use the last value directly because it is initialized as 0
-	// File index
-	writeBase64VLQInt(currentFile - lastFile);
-	// Line index
-	writeBase64VLQInt(currentLine - lastLine);
-	// Column index
-	writeBase64VLQInt(currentColumn - lastColumn);
+	int32_t fields[] = {
+		// Starting column in the generated code
+		int32_t(lineOffset - lastOffset),
+		// File index
+		int32_t(currentFile - lastFile),
+		// Line index
+		int32_t(currentLine - lastLine),
+		// Column index
+		int32_t(currentColumn - lastColumn)
+	};
+	writeSegment(fields, 4);
 	lastFile = currentFile;
 	lastLine = currentLine;
 	lastColumn = currentColumn;
@@ -131,7 +155,31 @@ void SourceMapGenerator::beginFile()
 	// Output the prologue of the file
 	sourceMap.os() << "{\n";
 	sourceMap.os() << "\"version\": 3,\n";
+	// Big outputs are split in sections, each one with its own sources and names,
+	// so that the mappings can be written as they are generated
+	if(sectionSize)
+		sourceMap.os() << "\"sections\": [\n";
+	beginSection();
+}
+
+void SourceMapGenerator::beginSection()
+{
+	if(sectionSize)
+	{
+		// Only the first line of the section is relative to the offset column
+		sourceMap.os() << "{\"offset\": {\"line\": " << generatedLine << ", \"column\": " << lineOffset << "}, \"map\": {\n";
+		sourceMap.os() << "\"version\": 3,\n";
+	}
 	sourceMap.os() << "\"mappings\": \"";
+	fileMap.clear();
+	functionNameMap.clear();
+	lastFile = 0;
+	lastLine = 0;
+	lastColumn = 0;
+	lastName = 0;
+	lastOffset = lineOffset;
+	lineBegin = true;
+	sectionMappingsSize = 0;
 }
 
 void SourceMapGenerator::finishLine()
@@ -140,12 +188,27 @@ void SourceMapGenerator::finishLine()
 	lastOffset = 0;
 	lineOffset = 0;
 	lineBegin = true;
+	sectionMappingsSize++;
+	generatedLine++;
 }
 
-void SourceMapGenerator::endFile()
+void SourceMapGenerator::endSection()
 {
-	// Output the prologue of the file
 	sourceMap.os() << "\",\n";
+	writeSourcesAndNames();
+	if(sectionSize)
+		sourceMap.os() << "}}";
+}
+
+void SourceMapGenerator::splitSection()
+{
+	endSection();
+	sourceMap.os() << ",\n";
+	beginSection();
+}
+
+void SourceMapGenerator::writeSourcesAndNames()
+{
 	// Output file names
 	SmallVector<StringRef, 10> files(fileMap.size());
 	for(auto mapItem: fileMap)
@@ -186,6 +249,13 @@ void SourceMapGenerator::endFile()
 		sourceMap.os() << '"' << functions[i] << '"';
 	}
 	sourceMap.os() << "]\n";
+}
+
+void SourceMapGenerator::endFile()
+{
+	endSection();
+	if(sectionSize)
+		sourceMap.os() << "\n]\n";
 	sourceMap.os() << "}\n";
 	sourceMap.keep();
 }
@@ -22,6 +22,7 @@
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/Host.h"
 #include "llvm/Support/MathExtras.h"
 #include <algorithm>
 #include <cmath>
@@ -40,7 +41,16 @@ static cl::opt<bool> PrintVolatile("interpreter-print-volatile", cl::Hidden,
 //===----------------------------------------------------------------------===//
 
 static void SetValue(Value *V, GenericValue Val, ExecutionContext &SF) {
-  SF.Values[V] = Val;
+  SF.getValue(V) = Val;
+}
+
+// setIntValue - Store an integer of at most 64 bits, the bits above Width are
+// cleared. The storage of the APInt is reused when it has the same width.
+static void setIntValue(GenericValue &Dest, unsigned Width, uint64_t Val) {
+  if (Dest.IntVal.getBitWidth() == Width)
+    Dest.IntVal = Val;
+  else
+    Dest.IntVal = APInt(Width, Val);
 }
 
 //===----------------------------------------------------------------------===//
@@ -275,8 +285,47 @@ static GenericValue executeICMP_SGE(GenericValue Src1, GenericValue Src2,
   return Dest;
 }
 
+// Compare integers of at most 64 bits, or pointers, which are compared as
+// unsigned values like in executeICMP_*
+static bool executeWordICmp(unsigned Predicate, uint64_t Src1, uint64_t Src2,
+                            int64_t SSrc1, int64_t SSrc2) {
+  switch (Predicate) {
+  case ICmpInst::ICMP_EQ:  return Src1 == Src2;
+  case ICmpInst::ICMP_NE:  return Src1 != Src2;
+  case ICmpInst::ICMP_ULT: return Src1 < Src2;
+  case ICmpInst::ICMP_UGT: return Src1 > Src2;
+  case ICmpInst::ICMP_ULE: return Src1 <= Src2;
+  case ICmpInst::ICMP_UGE: return Src1 >= Src2;
+  case ICmpInst::ICMP_SLT: return SSrc1 < SSrc2;
+  case ICmpInst::ICMP_SGT: return SSrc1 > SSrc2;
+  case ICmpInst::ICMP_SLE: return SSrc1 <= SSrc2;
+  case ICmpInst::ICMP_SGE: return SSrc1 >= SSrc2;
+  default:
+    llvm_unreachable("Don't know how to handle this ICmp predicate!");
+  }
+}
+
 void Interpreter::visitICmpInst(ICmpInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind == FunctionSlots::Int) {
+    uint64_t Src1 = getOperand(D, 0, SF).IntVal.getZExtValue();
+    uint64_t Src2 = getOperand(D, 1, SF).IntVal.getZExtValue();
+    bool R = executeWordICmp(I.getPredicate(), Src1, Src2,
+                             SignExtend64(Src1, D.Width),
+                             SignExtend64(Src2, D.Width));
+    setIntValue(SF.Values[D.Slot], 1, R);
+    return;
+  }
+  if (D.Kind == FunctionSlots::Pointer) {
+    uint64_t Src1 = (uintptr_t)getOperand(D, 0, SF).PointerVal;
+    uint64_t Src2 = (uintptr_t)getOperand(D, 1, SF).PointerVal;
+    bool R = executeWordICmp(ICmpInst::getUnsignedPredicate(I.getPredicate()),
+                             Src1, Src2, 0, 0);
+    setIntValue(SF.Values[D.Slot], 1, R);
+    return;
+  }
+
   Type *Ty    = I.getOperand(0)->getType();
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
@@ -678,12 +727,57 @@ static GenericValue executeCmpInst(unsigned predicate, GenericValue Src1,
   }
 }
 
+// Operations on integers of at most 64 bits, the bits above Width of the
+// sources are clear and the ones of the result are ignored. Returns false for
+// the other operations, and for the divisions which would trap or overflow.
+static bool executeWordBinaryOp(unsigned Opcode, uint64_t Src1, uint64_t Src2,
+                                unsigned Width, uint64_t &Dest) {
+  switch (Opcode) {
+  case Instruction::Add: Dest = Src1 + Src2; return true;
+  case Instruction::Sub: Dest = Src1 - Src2; return true;
+  case Instruction::Mul: Dest = Src1 * Src2; return true;
+  case Instruction::And: Dest = Src1 & Src2; return true;
+  case Instruction::Or:  Dest = Src1 | Src2; return true;
+  case Instruction::Xor: Dest = Src1 ^ Src2; return true;
+  case Instruction::UDiv:
+  case Instruction::URem:
+    if (Src2 == 0)
+      return false;
+    Dest = Opcode == Instruction::UDiv ? Src1 / Src2 : Src1 % Src2;
+    return true;
+  case Instruction::SDiv:
+  case Instruction::SRem: {
+    int64_t SSrc1 = SignExtend64(Src1, Width);
+    int64_t SSrc2 = SignExtend64(Src2, Width);
+    if (SSrc2 == 0 || SSrc2 == -1)
+      return false;
+    Dest = Opcode == Instruction::SDiv ? SSrc1 / SSrc2 : SSrc1 % SSrc2;
+    return true;
+  }
+  default: return false;
+  }
+}
+
 void Interpreter::visitBinaryOperator(BinaryOperator &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
   Type *Ty    = I.getOperand(0)->getType();
+  GenericValue R;   // Result
+
+  // Integers of at most 64 bits fit in a single word, compute the common
+  // operations directly on it
+  uint64_t IntResult;
+  if (D.Kind == FunctionSlots::Int &&
+      executeWordBinaryOp(I.getOpcode(),
+                          getOperand(D, 0, SF).IntVal.getZExtValue(),
+                          getOperand(D, 1, SF).IntVal.getZExtValue(), D.Width,
+                          IntResult)) {
+    setIntValue(SF.Values[D.Slot], D.Width, IntResult);
+    return;
+  }
+
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
-  GenericValue R;   // Result
 
   // First process vector operation
   if (Ty->isVectorTy()) {
@@ -805,6 +899,12 @@ static GenericValue executeSelectInst(GenericValue Src1, GenericValue Src2,
 
 void Interpreter::visitSelectInst(SelectInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind != FunctionSlots::Slow) {
+    bool Cond = getOperand(D, 0, SF).IntVal != 0;
+    SF.Values[D.Slot] = getOperand(D, Cond ? 1 : 2, SF);
+    return;
+  }
   const Type * Ty = I.getOperand(0)->getType();
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
@@ -868,7 +968,7 @@ void Interpreter::visitReturnInst(ReturnInst &I) {
   // Save away the return value... (if we are not 'ret void')
   if (I.getNumOperands()) {
     RetTy  = I.getReturnValue()->getType();
-    Result = getOperandValue(I.getReturnValue(), SF);
+    Result = getOperand(*CurDecoded, 0, SF);
   }
 
   popStackAndReturnValueToCaller(RetTy, Result);
@@ -880,19 +980,31 @@ void Interpreter::visitUnreachableInst(UnreachableInst &I) {
 
 void Interpreter::visitBranchInst(BranchInst &I) {
   ExecutionContext &SF = ECStack.back();
-  BasicBlock *Dest;
-
-  Dest = I.getSuccessor(0);          // Uncond branches have a fixed dest...
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  unsigned Succ = 0;                 // Uncond branches have a fixed dest...
   if (!I.isUnconditional()) {
-    Value *Cond = I.getCondition();
-    if (getOperandValue(Cond, SF).IntVal == 0) // If false cond...
-      Dest = I.getSuccessor(1);
+    // The condition is the first operand
+    if (getOperand(D, 0, SF).IntVal == 0) // If false cond...
+      Succ = 1;
   }
-  SwitchToNewBasicBlock(Dest, SF);
+  SwitchToSuccessor(D, Succ, SF);
 }
 
 void Interpreter::visitSwitchInst(SwitchInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind == FunctionSlots::Int) {
+    uint64_t CondVal = getOperand(D, 0, SF).IntVal.getZExtValue();
+    unsigned Succ = 0;                // The default destination
+    for (SwitchInst::CaseIt i = I.case_begin(), e = I.case_end(); i != e; ++i)
+      if (i.getCaseValue()->getZExtValue() == CondVal) {
+        Succ = i.getSuccessorIndex();
+        break;
+      }
+    SwitchToSuccessor(D, Succ, SF);
+    return;
+  }
+
   Value* Cond = I.getCondition();
   Type *ElTy = Cond->getType();
   GenericValue CondVal = getOperandValue(Cond, SF);
@@ -921,38 +1033,46 @@ void Interpreter::visitIndirectBrInst(IndirectBrInst &I) {
 // This function handles the actual updating of block and instruction iterators
 // as well as execution of all of the PHI nodes in the destination block.
 //
-// This method does this because all of the PHI nodes must be executed
-// atomically, reading their inputs before any of the results are updated.  Not
-// doing this can cause problems if the PHI nodes depend on other PHI nodes for
-// their inputs.  If the input PHI node is updated before it is read, incorrect
-// results can happen.  Thus we use a two phase approach.
+// The PHI nodes must be executed atomically, reading their inputs before any
+// of the results are updated, when they depend on other PHI nodes of the same
+// block. Otherwise an input PHI node could be updated before it is read. The
+// decoded edge records whether the two phase approach is needed.
 //
 void Interpreter::SwitchToNewBasicBlock(BasicBlock *Dest, ExecutionContext &SF){
-  BasicBlock *PrevBB = SF.CurBB;      // Remember where we came from...
-  SF.CurBB   = Dest;                  // Update CurBB to branch destination
-  SF.CurInst = SF.CurBB->begin();     // Update new instruction ptr...
-
-  if (!isa<PHINode>(SF.CurInst)) return;  // Nothing fancy to do
+  // Find the edge among the successors of the terminator of the current block
+  TerminatorInst *T = SF.CurBB->getTerminator();
+  const FunctionSlots::DecodedInst &D =
+      SF.Slots->Code[SF.Slots->InstIndex.lookup(T)];
+  assert(D.I == T && "Terminator has not been decoded");
+  unsigned Succ = 0;
+  while (T->getSuccessor(Succ) != Dest) {
+    ++Succ;
+    assert(Succ < T->getNumSuccessors() && "Destination is not a successor");
+  }
+  SwitchToSuccessor(D, Succ, SF);
+}
+
+void Interpreter::SwitchToSuccessor(const FunctionSlots::DecodedInst &T,
+                                    unsigned Succ, ExecutionContext &SF) {
+  const FunctionSlots::Edge &E = SF.Slots->Edges[T.FirstEdge + Succ];
+  SF.CurBB    = E.Dest;               // Update CurBB to branch destination
+  SF.CurIndex = E.FirstInst;          // Skip the PHI nodes...
+  SF.CurInst  = SF.Slots->Code[E.FirstInst].I;
+
+  if (!E.NeedsTemporaries) {
+    for (const auto &Copy : E.Copies)
+      SF.Values[Copy.first] = getOperand(Copy.second, SF);
+    return;
+  }
 
   // Loop over all of the PHI nodes in the current block, reading their inputs.
-  std::vector<GenericValue> ResultValues;
-
-  for (; PHINode *PN = dyn_cast<PHINode>(SF.CurInst); ++SF.CurInst) {
-    // Search for the value corresponding to this previous bb...
-    int i = PN->getBasicBlockIndex(PrevBB);
-    assert(i != -1 && "PHINode doesn't contain entry for predecessor??");
-    Value *IncomingValue = PN->getIncomingValue(i);
-
-    // Save the incoming value for this PHI node...
-    ResultValues.push_back(getOperandValue(IncomingValue, SF));
-  }
+  SmallVector<GenericValue, 4> ResultValues;
+  for (const auto &Copy : E.Copies)
+    ResultValues.push_back(getOperand(Copy.second, SF));
 
   // Now loop over all of the PHI nodes setting their values...
-  SF.CurInst = SF.CurBB->begin();
-  for (unsigned i = 0; isa<PHINode>(SF.CurInst); ++SF.CurInst, ++i) {
-    PHINode *PN = cast<PHINode>(SF.CurInst);
-    SetValue(PN, ResultValues[i], SF);
-  }
+  for (unsigned i = 0, e = E.Copies.size(); i != e; ++i)
+    SF.Values[E.Copies[i].first] = ResultValues[i];
 }
 
 //===----------------------------------------------------------------------===//
@@ -1032,12 +1152,52 @@ GenericValue Interpreter::executeGEPOperation(Value *Ptr, gep_type_iterator I,
 
 void Interpreter::visitGetElementPtrInst(GetElementPtrInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind != FunctionSlots::Slow) {
+    // The constant indices are folded in the offset, only the variable ones
+    // have a stride
+    const int64_t *Strides = &SF.Slots->Strides[D.FirstOperand];
+    int64_t Total = D.Offset;
+    for (unsigned i = 1, e = I.getNumOperands(); i != e; ++i)
+      if (Strides[i])
+        Total += Strides[i] * getOperand(D, i, SF).IntVal.getSExtValue();
+    SF.Values[D.Slot].PointerVal =
+        (char*)getOperand(D, 0, SF).PointerVal + Total;
+    return;
+  }
   SetValue(&I, executeGEPOperation(I.getPointerOperand(),
                                    gep_type_begin(I), gep_type_end(I), SF), SF);
 }
 
 void Interpreter::visitLoadInst(LoadInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind != FunctionSlots::Slow) {
+    // Host and target have the same byte order, see LoadValueFromMemory
+    const void *Ptr = GVTOP(getOperand(D, 0, SF));
+    GenericValue &Result = SF.Values[D.Slot];
+    switch (D.Kind) {
+    case FunctionSlots::Int: {
+      uint64_t Val = 0;
+      memcpy(&Val, Ptr, D.Bytes);
+      setIntValue(Result, D.Width, Val);
+      break;
+    }
+    case FunctionSlots::Pointer:
+      Result.PointerVal = nullptr;
+      memcpy(&Result.PointerVal, Ptr, D.Bytes);
+      break;
+    case FunctionSlots::Float:
+      memcpy(&Result.FloatVal, Ptr, sizeof(float));
+      break;
+    case FunctionSlots::Double:
+      memcpy(&Result.DoubleVal, Ptr, sizeof(double));
+      break;
+    default:
+      llvm_unreachable("Unexpected load kind");
+    }
+    return;
+  }
   GenericValue SRC = getOperandValue(I.getPointerOperand(), SF);
   GenericValue *Ptr = (GenericValue*)GVTOP(SRC);
   GenericValue Result;
@@ -1049,6 +1209,36 @@ void Interpreter::visitLoadInst(LoadInst &I) {
 
 void Interpreter::visitStoreInst(StoreInst &I) {
   ExecutionContext &SF = ECStack.back();
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind != FunctionSlots::Slow) {
+    // Host and target have the same byte order, see StoreValueToMemory
+    const GenericValue &Val = getOperand(D, 0, SF);
+    void *Ptr = GVTOP(getOperand(D, 1, SF));
+    switch (D.Kind) {
+    case FunctionSlots::Int: {
+      uint64_t IntVal = Val.IntVal.getZExtValue();
+      memcpy(Ptr, &IntVal, D.Bytes);
+      break;
+    }
+    case FunctionSlots::Pointer:
+      memcpy(Ptr, &Val.PointerVal, D.Bytes);
+      break;
+    case FunctionSlots::Float:
+      memcpy(Ptr, &Val.FloatVal, sizeof(float));
+      break;
+    case FunctionSlots::Double:
+      memcpy(Ptr, &Val.DoubleVal, sizeof(double));
+      break;
+    default:
+      llvm_unreachable("Unexpected store kind");
+    }
+    if (StoreListener)
+    {
+      assert(ForPreExecute);
+      StoreListener(Ptr);
+    }
+    return;
+  }
   GenericValue Val = getOperandValue(I.getOperand(0), SF);
   GenericValue SRC = getOperandValue(I.getPointerOperand(), SF);
   StoreValueToMemory(Val, (GenericValue *)GVTOP(SRC),
@@ -1109,6 +1299,8 @@ void Interpreter::visitCallSite(CallSite CS) {
         SF.CurInst = me;
         ++SF.CurInst;
       }
+      // The decoded instructions refer to the lowered call
+      redecodeFunction(SF.CurFunction);
       return;
     }
 
@@ -1117,18 +1309,15 @@ void Interpreter::visitCallSite(CallSite CS) {
   std::vector<GenericValue> ArgVals;
   const unsigned NumArgs = SF.Caller.arg_size();
   ArgVals.reserve(NumArgs);
-  uint16_t pNum = 1;
-  for (CallSite::arg_iterator i = SF.Caller.arg_begin(),
-         e = SF.Caller.arg_end(); i != e; ++i, ++pNum) {
-    Value *V = *i;
-    ArgVals.push_back(getOperandValue(V, SF));
-  }
+  // The arguments are the first operands of calls and invokes
+  for (unsigned i = 0; i != NumArgs; ++i)
+    ArgVals.push_back(getOperand(*CurDecoded, i, SF));
 
   // To handle indirect calls, we must get the pointer value from the argument
   // and treat it as a function pointer.
-  GenericValue SRC = getOperandValue(SF.Caller.getCalledValue(), SF);
   if (SF.Caller.getCalledFunction() == nullptr)
   {
+    GenericValue SRC = getOperandValue(SF.Caller.getCalledValue(), SF);
     FunctionProxy* proxy = static_cast<FunctionProxy*>(GVTOP(SRC));
     callFunction(proxy->getFunction(), ArgVals);
   }
@@ -1150,9 +1339,42 @@ static unsigned getShiftAmount(uint64_t orgShiftAmount,
   return (NextPowerOf2(valueWidth-1) - 1) & orgShiftAmount;
 }
 
+// Shifts of integers of at most 64 bits, with the same rule as getShiftAmount
+// for the amounts larger than the width
+static uint64_t executeWordShift(unsigned Opcode, uint64_t Value,
+                                 uint64_t Amount, unsigned Width) {
+  if (Amount >= Width)
+    Amount &= NextPowerOf2(Width - 1) - 1;
+  switch (Opcode) {
+  case Instruction::Shl:
+    return Amount >= 64 ? 0 : Value << Amount;
+  case Instruction::LShr:
+    return Amount >= 64 ? 0 : Value >> Amount;
+  case Instruction::AShr:
+    return SignExtend64(Value, Width) >> std::min<uint64_t>(Amount, 63);
+  default:
+    llvm_unreachable("Not a shift");
+  }
+}
+
+// executeFastShift - The fast path of the shift instructions, returns false
+// when the generic implementation must be used
+bool Interpreter::executeFastShift(BinaryOperator &I, ExecutionContext &SF) {
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind != FunctionSlots::Int)
+    return false;
+  uint64_t Value = getOperand(D, 0, SF).IntVal.getZExtValue();
+  uint64_t Amount = getOperand(D, 1, SF).IntVal.getZExtValue();
+  setIntValue(SF.Values[D.Slot], D.Width,
+              executeWordShift(I.getOpcode(), Value, Amount, D.Width));
+  return true;
+}
+
 
 void Interpreter::visitShl(BinaryOperator &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastShift(I, SF))
+    return;
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
   GenericValue Dest;
@@ -1180,6 +1402,8 @@ void Interpreter::visitShl(BinaryOperator &I) {
 
 void Interpreter::visitLShr(BinaryOperator &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastShift(I, SF))
+    return;
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
   GenericValue Dest;
@@ -1207,6 +1431,8 @@ void Interpreter::visitLShr(BinaryOperator &I) {
 
 void Interpreter::visitAShr(BinaryOperator &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastShift(I, SF))
+    return;
   GenericValue Src1 = getOperandValue(I.getOperand(0), SF);
   GenericValue Src2 = getOperandValue(I.getOperand(1), SF);
   GenericValue Dest;
@@ -1669,18 +1895,52 @@ GenericValue Interpreter::executeBitCastInst(Value *SrcVal, Type *DstTy,
   return Dest;
 }
 
+// executeFastCast - The fast path of the integer and pointer casts, returns
+// false when the generic implementation must be used
+bool Interpreter::executeFastCast(CastInst &I, ExecutionContext &SF) {
+  const FunctionSlots::DecodedInst &D = *CurDecoded;
+  if (D.Kind == FunctionSlots::Slow)
+    return false;
+  const GenericValue &Src = getOperand(D, 0, SF);
+  GenericValue &Dest = SF.Values[D.Slot];
+  switch (I.getOpcode()) {
+  case Instruction::Trunc:
+  case Instruction::ZExt:
+    setIntValue(Dest, D.Width, Src.IntVal.getZExtValue());
+    return true;
+  case Instruction::SExt:
+    setIntValue(Dest, D.Width,
+                SignExtend64(Src.IntVal.getZExtValue(), D.SrcWidth));
+    return true;
+  case Instruction::PtrToInt:
+    setIntValue(Dest, D.Width, (intptr_t)Src.PointerVal);
+    return true;
+  case Instruction::BitCast:
+    Dest.PointerVal = Src.PointerVal;
+    return true;
+  default:
+    return false;
+  }
+}
+
 void Interpreter::visitTruncInst(TruncInst &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastCast(I, SF))
+    return;
   SetValue(&I, executeTruncInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
 void Interpreter::visitSExtInst(SExtInst &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastCast(I, SF))
+    return;
   SetValue(&I, executeSExtInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
 void Interpreter::visitZExtInst(ZExtInst &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastCast(I, SF))
+    return;
   SetValue(&I, executeZExtInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
@@ -1716,6 +1976,8 @@ void Interpreter::visitFPToSIInst(FPToSIInst &I) {
 
 void Interpreter::visitPtrToIntInst(PtrToIntInst &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastCast(I, SF))
+    return;
   SetValue(&I, executePtrToIntInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
@@ -1726,6 +1988,8 @@ void Interpreter::visitIntToPtrInst(IntToPtrInst &I) {
 
 void Interpreter::visitBitCastInst(BitCastInst &I) {
   ExecutionContext &SF = ECStack.back();
+  if (executeFastCast(I, SF))
+    return;
   SetValue(&I, executeBitCastInst(I.getOperand(0), I.getType(), SF), SF);
 }
 
@@ -2080,7 +2344,228 @@ GenericValue Interpreter::getOperandValue(Value *V, ExecutionContext &SF) {
   } else if (GlobalValue *GV = dyn_cast<GlobalValue>(V)) {
     return PTOGV(getPointerToGlobal(GV));
   } else {
-    return SF.Values[V];
+    return SF.getValue(V);
+  }
+}
+
+const GenericValue &Interpreter::getConstantOperand(unsigned Index,
+                                                    ExecutionContext &SF) {
+  FunctionSlots &Slots = *SF.Slots;
+  if (!Slots.ConstantReady[Index]) {
+    Slots.ConstantValues[Index] =
+        getOperandValue(Slots.ConstantOperands[Index], SF);
+    Slots.ConstantReady[Index] = true;
+  }
+  return Slots.ConstantValues[Index];
+}
+
+// getFastIntWidth - The width of an integer type handled by the fast paths,
+// or 0
+static unsigned getFastIntWidth(Type *Ty) {
+  IntegerType *ITy = dyn_cast<IntegerType>(Ty);
+  return ITy && ITy->getBitWidth() <= 64 ? ITy->getBitWidth() : 0;
+}
+
+static FunctionSlots::FastKind getFastKind(Type *Ty) {
+  if (getFastIntWidth(Ty))
+    return FunctionSlots::Int;
+  if (Ty->isPointerTy())
+    return FunctionSlots::Pointer;
+  if (Ty->isFloatTy())
+    return FunctionSlots::Float;
+  if (Ty->isDoubleTy())
+    return FunctionSlots::Double;
+  return FunctionSlots::Slow;
+}
+
+// decodeFastPath - Select the fast path of an instruction, if any, and compute
+// the sizes and offsets it needs
+static void decodeFastPath(FunctionSlots::DecodedInst &D,
+                           std::vector<int64_t> &Strides,
+                           const DataLayout &TD) {
+  Instruction &I = *D.I;
+  // Loads and stores copy the bytes of the GenericValue fields directly
+  bool SameByteOrder = sys::IsLittleEndianHost && TD.isLittleEndian();
+  switch (I.getOpcode()) {
+  case Instruction::Add: case Instruction::Sub: case Instruction::Mul:
+  case Instruction::UDiv: case Instruction::SDiv: case Instruction::URem:
+  case Instruction::SRem: case Instruction::And: case Instruction::Or:
+  case Instruction::Xor: case Instruction::Shl: case Instruction::LShr:
+  case Instruction::AShr:
+    if ((D.Width = getFastIntWidth(I.getType())))
+      D.Kind = FunctionSlots::Int;
+    break;
+  case Instruction::ICmp: {
+    Type *Ty = I.getOperand(0)->getType();
+    if ((D.Width = getFastIntWidth(Ty)))
+      D.Kind = FunctionSlots::Int;
+    else if (Ty->isPointerTy())
+      D.Kind = FunctionSlots::Pointer;
+    break;
+  }
+  case Instruction::Trunc: case Instruction::ZExt: case Instruction::SExt:
+    D.Width = getFastIntWidth(I.getType());
+    D.SrcWidth = getFastIntWidth(I.getOperand(0)->getType());
+    if (D.Width && D.SrcWidth)
+      D.Kind = FunctionSlots::Int;
+    break;
+  case Instruction::PtrToInt:
+    if (I.getOperand(0)->getType()->isPointerTy() &&
+        (D.Width = getFastIntWidth(I.getType())))
+      D.Kind = FunctionSlots::Int;
+    break;
+  case Instruction::BitCast:
+    if (I.getType()->isPointerTy() && I.getOperand(0)->getType()->isPointerTy())
+      D.Kind = FunctionSlots::Pointer;
+    break;
+  case Instruction::Select:
+    if (!I.getOperand(0)->getType()->isVectorTy())
+      D.Kind = FunctionSlots::Int;
+    break;
+  case Instruction::Switch:
+    if (getFastIntWidth(I.getOperand(0)->getType()))
+      D.Kind = FunctionSlots::Int;
+    break;
+  case Instruction::GetElementPtr: {
+    if (!I.getOperand(0)->getType()->isPointerTy())
+      break;
+    D.Kind = FunctionSlots::Pointer;
+    unsigned OpNo = 1;
+    for (gep_type_iterator GTI = gep_type_begin(I), E = gep_type_end(I);
+         GTI != E; ++GTI, ++OpNo) {
+      if (StructType *STy = dyn_cast<StructType>(*GTI)) {
+        unsigned Index = cast<ConstantInt>(GTI.getOperand())->getZExtValue();
+        D.Offset += TD.getStructLayout(STy)->getElementOffset(Index);
+        continue;
+      }
+      int64_t Stride =
+          TD.getTypeAllocSize(cast<SequentialType>(*GTI)->getElementType());
+      if (ConstantInt *CI = dyn_cast<ConstantInt>(GTI.getOperand()))
+        D.Offset += Stride * CI->getSExtValue();
+      else if (getFastIntWidth(GTI.getOperand()->getType()))
+        Strides[D.FirstOperand + OpNo] = Stride;
+      else {
+        D.Kind = FunctionSlots::Slow;
+        break;
+      }
+    }
+    break;
+  }
+  case Instruction::Load:
+  case Instruction::Store: {
+    Type *Ty = isa<LoadInst>(I) ? I.getType() : I.getOperand(0)->getType();
+    bool Volatile = isa<LoadInst>(I) ? cast<LoadInst>(I).isVolatile()
+                                     : cast<StoreInst>(I).isVolatile();
+    if (!SameByteOrder || (Volatile && PrintVolatile))
+      break;
+    D.Kind = getFastKind(Ty);
+    D.Width = getFastIntWidth(Ty);
+    D.Bytes = TD.getTypeStoreSize(Ty);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void FunctionSlots::decode(Function &F, const DataLayout &TD) {
+  Code.clear();
+  Operands.clear();
+  Strides.clear();
+  ConstantOperands.clear();
+  ConstantValues.clear();
+  ConstantReady.clear();
+  InstIndex.clear();
+  Edges.clear();
+
+  // Number all the values first, operands may be defined later
+  for (Argument &A : F.args())
+    getSlot(&A);
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB)
+      getSlot(&I);
+
+  DenseMap<Constant *, OperandRef> ConstantRefs;
+  auto getOperandRef = [&](Value *V) -> OperandRef {
+    if (isa<Instruction>(V) || isa<Argument>(V))
+      return getSlot(V);
+    Constant *C = dyn_cast<Constant>(V);
+    if (!C)
+      return NoOperand;
+    auto Inserted = ConstantRefs.insert(
+        std::make_pair(C, ~OperandRef(ConstantOperands.size())));
+    if (Inserted.second)
+      ConstantOperands.push_back(C);
+    return Inserted.first->second;
+  };
+
+  for (BasicBlock &BB : F)
+    for (Instruction &I : BB) {
+      InstIndex[&I] = Code.size();
+      DecodedInst D;
+      D.I = &I;
+      D.Slot = getSlot(&I);
+      D.FirstOperand = Operands.size();
+      D.Kind = Slow;
+      D.Width = D.SrcWidth = D.Bytes = 0;
+      D.Offset = 0;
+      D.FirstEdge = 0;
+      for (Value *Op : I.operand_values()) {
+        Operands.push_back(getOperandRef(Op));
+        Strides.push_back(0);
+      }
+      decodeFastPath(D, Strides, TD);
+      Code.push_back(D);
+    }
+
+  // The edges of each terminator, the first instruction of their destination
+  // is known only now
+  for (DecodedInst &D : Code) {
+    TerminatorInst *T = dyn_cast<TerminatorInst>(D.I);
+    if (!T)
+      continue;
+    D.FirstEdge = Edges.size();
+    BasicBlock *BB = T->getParent();
+    for (unsigned i = 0, e = T->getNumSuccessors(); i != e; ++i) {
+      Edges.push_back(Edge());
+      Edge &E = Edges.back();
+      E.Dest = T->getSuccessor(i);
+      E.FirstInst = InstIndex[E.Dest->getFirstNonPHI()];
+      E.NeedsTemporaries = false;
+      for (BasicBlock::iterator PI = E.Dest->begin();
+           PHINode *PN = dyn_cast<PHINode>(PI); ++PI) {
+        Value *Incoming = PN->getIncomingValueForBlock(BB);
+        E.Copies.push_back(std::make_pair(getSlot(PN),
+                                          getOperandRef(Incoming)));
+        if (PHINode *IncomingPN = dyn_cast<PHINode>(Incoming))
+          if (IncomingPN->getParent() == E.Dest)
+            E.NeedsTemporaries = true;
+      }
+    }
+  }
+
+  ConstantValues.resize(ConstantOperands.size());
+  ConstantReady.assign(ConstantOperands.size(), false);
+}
+
+FunctionSlots *Interpreter::getFunctionSlots(Function *F) {
+  std::unique_ptr<FunctionSlots> &Slots = FunctionSlotMap[F];
+  if (!Slots)
+    Slots.reset(new FunctionSlots(*F, TD));
+  return Slots.get();
+}
+
+// redecodeFunction - Decode F again after its instructions have been changed,
+// and move the frames which are executing it to the new decoded instructions
+void Interpreter::redecodeFunction(Function *F) {
+  FunctionSlots *Slots = getFunctionSlots(F);
+  Slots->decode(*F, TD);
+  for (ExecutionContext &SF : ECStack) {
+    if (SF.Slots != Slots)
+      continue;
+    SF.Values.resize(Slots->size());
+    assert(Slots->InstIndex.count(&*SF.CurInst) && "Frame is not in F");
+    SF.CurIndex = Slots->InstIndex.lookup(&*SF.CurInst);
   }
 }
 
@@ -2109,20 +2594,24 @@ void Interpreter::callFunction(Function *F,
     return;
   }
 
+  // Allocate the slots of all the values of the function at once
+  StackFrame.Slots = getFunctionSlots(F);
+  StackFrame.Values.resize(StackFrame.Slots->size());
+
   // Get pointers to first LLVM BB & Instruction in function.
   StackFrame.CurBB     = F->begin();
   StackFrame.CurInst   = StackFrame.CurBB->begin();
+  StackFrame.CurIndex  = 0;
 
   // Run through the function arguments and initialize their values...
   assert((ArgVals.size() == F->arg_size() ||
          (ArgVals.size() > F->arg_size() && F->getFunctionType()->isVarArg()))&&
          "Invalid number of values passed to function invocation!");
 
-  // Handle non-varargs arguments...
+  // Handle non-varargs arguments, the arguments have the first slots...
   unsigned i = 0;
-  for (Function::arg_iterator AI = F->arg_begin(), E = F->arg_end(); 
-       AI != E; ++AI, ++i)
-    SetValue(AI, ArgVals[i], StackFrame);
+  for (unsigned e = F->arg_size(); i != e; ++i)
+    StackFrame.Values[i] = ArgVals[i];
 
   // Handle varargs arguments...
   StackFrame.VarArgs.assign(ArgVals.begin()+i, ArgVals.end());
@@ -2130,13 +2619,17 @@ void Interpreter::callFunction(Function *F,
 
 
 void Interpreter::run() {
+  // The statistic is atomic, count the instructions locally
+  unsigned Executed = 0;
   while (!ECStack.empty() && !CleanAbort) {
     // Interpret a single instruction & increment the "PC".
     ExecutionContext &SF = ECStack.back();  // Current stack frame
     Instruction &I = *SF.CurInst++;         // Increment before execute
+    CurDecoded = &SF.Slots->Code[SF.CurIndex++];
+    assert(CurDecoded->I == &I && "Decoded instructions are out of sync");
 
     // Track the number of dynamic instructions executed.
-    ++NumDynamicInsts;
+    ++Executed;
 
     DEBUG(dbgs() << "About to interpret: " << I << "\n");
     visit(I);   // Dispatch to one of the visit* methods...
@@ -2146,7 +2639,7 @@ DEBUG(
     if (!isa<CallInst>(I) && !isa<InvokeInst>(I) && 
         I.getType() != Type::VoidTy) {
       dbgs() << "  --> ";
-      const GenericValue &Val = SF.Values[&I];
+      const GenericValue &Val = SF.getValue(&I);
       switch (I.getType()->getTypeID()) {
       default: llvm_unreachable("Invalid GenericValue Type");
       case Type::VoidTyID:    dbgs() << "void"; break;
@@ -2163,4 +2656,5 @@ DEBUG(
     });
 #endif
   }
+  NumDynamicInsts += Executed;
 }
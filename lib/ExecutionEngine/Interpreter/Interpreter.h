@@ -14,6 +14,8 @@
 #ifndef LLVM_LIB_EXECUTIONENGINE_INTERPRETER_INTERPRETER_H
 #define LLVM_LIB_EXECUTIONENGINE_INTERPRETER_INTERPRETER_H
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/GenericValue.h"
 #include "llvm/ExecutionEngine/FunctionProxy.h"
@@ -24,6 +26,8 @@
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
+#include <climits>
+#include <memory>
 
 namespace llvm {
 
@@ -61,6 +65,77 @@ public:
 
 typedef std::vector<GenericValue> ValuePlaneTy;
 
+// FunctionSlots - Dense numbering of the values of a function which live in
+// its stack frames, so that frames can store them in a flat array. The
+// arguments and instructions are numbered once, before the first call.
+// Instructions created later (e.g. by intrinsic lowering) get a new number
+// the first time they are used.
+//
+// The function is also decoded once: the operands of every instruction are
+// resolved to slots or to entries of a pool of constants, and the types,
+// offsets and sizes needed by the fast paths of the common instructions are
+// computed in advance. The PHI copies of every CFG edge are precomputed too.
+//
+class FunctionSlots {
+  DenseMap<const Value *, unsigned> SlotMap;
+
+public:
+  /// OperandRef - A slot of the frame when not negative, otherwise the complement
+  /// of the index of a constant. NoOperand is used for basic blocks and other
+  /// operands which are not values.
+  typedef int OperandRef;
+  static const OperandRef NoOperand = INT_MIN;
+
+  /// FastKind - The type handled by the fast path of an instruction, Slow
+  /// when the generic implementation must be used.
+  enum FastKind { Slow, Int, Pointer, Float, Double };
+
+  struct DecodedInst {
+    Instruction *I;
+    unsigned Slot;          // The slot of the result
+    unsigned FirstOperand;  // The index of the first operand in Operands
+    FastKind Kind;          // The type computed, compared or accessed
+    unsigned Width;         // The bit width of an integer Kind
+    unsigned SrcWidth;      // The bit width of the source of an integer cast
+    unsigned Bytes;         // The bytes read or written by a load or a store
+    int64_t Offset;         // The constant offset of a GEP
+    unsigned FirstEdge;     // The edge to the first successor of a terminator
+  };
+
+  struct Edge {
+    BasicBlock *Dest;
+    unsigned FirstInst;     // The first instruction after the PHIs
+    // The PHI slots of the destination and their incoming values
+    SmallVector<std::pair<unsigned, OperandRef>, 4> Copies;
+    // Some incoming value is a PHI of the destination itself, so all the
+    // incoming values must be read before the PHIs are written
+    bool NeedsTemporaries;
+  };
+
+  std::vector<DecodedInst> Code;
+  std::vector<OperandRef> Operands;
+  // The stride of each variable GEP index, indexed like Operands
+  std::vector<int64_t> Strides;
+  // The constant operands, their values are computed on first use
+  std::vector<Constant *> ConstantOperands;
+  std::vector<GenericValue> ConstantValues;
+  std::vector<bool> ConstantReady;
+  DenseMap<const Instruction *, unsigned> InstIndex;
+  std::vector<Edge> Edges;
+
+  FunctionSlots(Function &F, const DataLayout &TD) { decode(F, TD); }
+
+  /// decode - Decode F again, after its instructions have been changed. The
+  /// slots of the existing values do not change.
+  void decode(Function &F, const DataLayout &TD);
+
+  unsigned getSlot(const Value *V) {
+    return SlotMap.insert(std::make_pair(V, SlotMap.size())).first->second;
+  }
+
+  unsigned size() const { return SlotMap.size(); }
+};
+
 // ExecutionContext struct - This struct represents one stack frame currently
 // executing.
 //
@@ -68,29 +143,45 @@ struct ExecutionContext {
   Function             *CurFunction;// The currently executing function
   BasicBlock           *CurBB;      // The currently executing BB
   BasicBlock::iterator  CurInst;    // The next instruction to execute
+  unsigned              CurIndex;   // The decoded index of CurInst
   CallSite             Caller;     // Holds the call that called subframes.
                                    // NULL if main func or debugger invoked fn
-  std::map<Value *, GenericValue> Values; // LLVM values used in this invocation
+  FunctionSlots        *Slots;      // The slot numbers of CurFunction
+  ValuePlaneTy          Values;     // LLVM values used in this invocation,
+                                    // indexed by slot number
   std::vector<GenericValue>  VarArgs; // Values passed through an ellipsis
   AllocaHolder Allocas;            // Track memory allocated by alloca
 
-  ExecutionContext() : CurFunction(nullptr), CurBB(nullptr), CurInst(nullptr) {}
+  ExecutionContext()
+      : CurFunction(nullptr), CurBB(nullptr), CurInst(nullptr), CurIndex(0),
+        Slots(nullptr) {}
 
   ExecutionContext(ExecutionContext &&O)
       : CurFunction(O.CurFunction), CurBB(O.CurBB), CurInst(O.CurInst),
-        Caller(O.Caller), Values(std::move(O.Values)),
+        CurIndex(O.CurIndex), Caller(O.Caller), Slots(O.Slots), Values(std::move(O.Values)),
         VarArgs(std::move(O.VarArgs)), Allocas(std::move(O.Allocas)) {}
 
   ExecutionContext &operator=(ExecutionContext &&O) {
     CurFunction = O.CurFunction;
     CurBB = O.CurBB;
     CurInst = O.CurInst;
+    CurIndex = O.CurIndex;
     Caller = O.Caller;
+    Slots = O.Slots;
     Values = std::move(O.Values);
     VarArgs = std::move(O.VarArgs);
     Allocas = std::move(O.Allocas);
     return *this;
   }
+
+  /// getValue - Return the storage of V, which must be an argument or an
+  /// instruction of CurFunction.
+  GenericValue &getValue(const Value *V) {
+    unsigned Slot = Slots->getSlot(V);
+    if (Slot >= Values.size())
+      Values.resize(Slots->size());
+    return Values[Slot];
+  }
 };
 
 // Interpreter - This class represents the entirety of the interpreter.
@@ -104,6 +195,13 @@ class Interpreter : public ExecutionEngine, public InstVisitor<Interpreter> {
   // function record.
   std::vector<ExecutionContext> ECStack;
 
+  // The slot numbers and the decoded instructions of each function which has
+  // been called, computed the first time it is called
+  DenseMap<const Function *, std::unique_ptr<FunctionSlots>> FunctionSlotMap;
+
+  // The decoded form of the instruction being executed
+  const FunctionSlots::DecodedInst *CurDecoded;
+
   // AtExitHandlers - List of functions to call when the program exits,
   // registered with the atexit() library function.
   std::vector<Function*> AtExitHandlers;
@@ -226,6 +324,10 @@ private:  // Helper functions
   // control flow.
   //
   void SwitchToNewBasicBlock(BasicBlock *Dest, ExecutionContext &SF);
+  // SwitchToSuccessor - The same, for the successor Succ of the decoded
+  // terminator T.
+  void SwitchToSuccessor(const FunctionSlots::DecodedInst &T, unsigned Succ,
+                         ExecutionContext &SF);
 
   void *getPointerToFunction(Function *F) override { 
 	  return FunctionProxy::getProxy(F);
@@ -235,6 +337,22 @@ private:  // Helper functions
   void initializeExternalFunctions();
   GenericValue getConstantExprValue(ConstantExpr *CE, ExecutionContext &SF);
   GenericValue getOperandValue(Value *V, ExecutionContext &SF);
+  /// getOperand - Fast path of getOperandValue for a decoded operand, which
+  /// avoids any lookup or copy.
+  const GenericValue &getOperand(FunctionSlots::OperandRef Ref,
+                                 ExecutionContext &SF) {
+    assert(Ref != FunctionSlots::NoOperand && "Operand is not a value");
+    if (Ref >= 0)
+      return SF.Values[Ref];
+    return getConstantOperand(~Ref, SF);
+  }
+  const GenericValue &getOperand(const FunctionSlots::DecodedInst &D,
+                                 unsigned i, ExecutionContext &SF) {
+    return getOperand(SF.Slots->Operands[D.FirstOperand + i], SF);
+  }
+  const GenericValue &getConstantOperand(unsigned Index, ExecutionContext &SF);
+  FunctionSlots *getFunctionSlots(Function *F);
+  void redecodeFunction(Function *F);
   GenericValue executeTruncInst(Value *SrcVal, Type *DstTy,
                                 ExecutionContext &SF);
   GenericValue executeSExtInst(Value *SrcVal, Type *DstTy,
@@ -259,6 +377,8 @@ private:  // Helper functions
                                    ExecutionContext &SF);
   GenericValue executeBitCastInst(Value *SrcVal, Type *DstTy,
                                   ExecutionContext &SF);
+  bool executeFastCast(CastInst &I, ExecutionContext &SF);
+  bool executeFastShift(BinaryOperator &I, ExecutionContext &SF);
   GenericValue executeCastOperation(Instruction::CastOps opcode, Value *SrcVal, 
                                     Type *Ty, ExecutionContext &SF);
   void popStackAndReturnValueToCaller(Type *RetTy, GenericValue Result);
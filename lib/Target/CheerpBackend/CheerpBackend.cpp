@@ -22,11 +22,15 @@
 #include "llvm/Cheerp/WastWriter.h"
 #include "llvm/Cheerp/LinearMemoryHelper.h"
 #include "llvm/Cheerp/AllocaMerging.h"
+#include "llvm/Cheerp/Devirtualizer.h"
+#include "llvm/Cheerp/FunctionLayout.h"
 #include "llvm/Cheerp/PointerPasses.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/ResolveAliases.h"
 #include "llvm/Cheerp/SourceMaps.h"
+#include "llvm/Cheerp/TimeReport.h"
 #include "llvm/Cheerp/CommandLine.h"
+#include "llvm/Transforms/Scalar.h"
 
 using namespace llvm;
 
@@ -39,11 +43,20 @@ namespace {
   class CheerpWritePass : public ModulePass {
   private:
     formatted_raw_ostream &Out;
+    // Collects the time spent in each phase, null if not requested
+    std::unique_ptr<cheerp::TimeReport> timeReport;
     static char ID;
     void getAnalysisUsage(AnalysisUsage& AU) const;
+    void beginPhase(StringRef name)
+    {
+      if (timeReport)
+        timeReport->beginPhase(name);
+    }
+    void writeTimeReport();
+    void writeSizeReport(const cheerp::SizeReport& sizeReport);
   public:
-    explicit CheerpWritePass(formatted_raw_ostream &o) :
-      ModulePass(ID), Out(o) { }
+    explicit CheerpWritePass(formatted_raw_ostream &o, cheerp::TimeReport* timeReport) :
+      ModulePass(ID), Out(o), timeReport(timeReport) { }
     bool runOnModule(Module &M);
     const char *getPassName() const {
 	return "CheerpWritePass";
@@ -57,11 +70,15 @@ bool CheerpWritePass::runOnModule(Module& M)
   cheerp::GlobalDepsAnalyzer &GDA = getAnalysis<cheerp::GlobalDepsAnalyzer>();
   cheerp::Registerize &registerize = getAnalysis<cheerp::Registerize>();
   std::unique_ptr<cheerp::SourceMapGenerator> sourceMapGenerator;
+  std::unique_ptr<cheerp::SizeReport> sizeReport;
+  if (!SizeReportFile.empty())
+    sizeReport.reset(new cheerp::SizeReport());
   GDA.forceTypedArrays = ForceTypedArrays;
   if (!SourceMap.empty())
   {
     std::error_code ErrorCode;
-    sourceMapGenerator.reset(new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, M.getContext(), ErrorCode));
+    sourceMapGenerator.reset(new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, M.getContext(),
+        SourceMapSectionSize * 1024, ErrorCode));
     if (ErrorCode)
     {
        // An error occurred opening the source map file, bail out
@@ -69,9 +86,23 @@ bool CheerpWritePass::runOnModule(Module& M)
        return false;
     }
   }
-  PA.fullResolve();
+  beginPhase("fullResolve");
+  uint32_t numResolved = PointerSummaries.empty() ? PA.fullResolve() : PA.fullResolve(M, PointerSummaries);
+  beginPhase("computeConstantOffsets");
   PA.computeConstantOffsets(M);
+  beginPhase("assignRegisters");
   registerize.assignRegisters(M, PA);
+  if ((!LazyEntryPoints.empty() || LazyColdFunctions) && LazyChunkFile.empty())
+  {
+    llvm::report_fatal_error("-cheerp-lazy-entry-points and -cheerp-lazy-cold-functions require -cheerp-lazy-chunk-file", false);
+    return false;
+  }
+  if (!LazyChunkFile.empty())
+  {
+    std::vector<std::string> lazyEntryPoints(LazyEntryPoints.begin(), LazyEntryPoints.end());
+    GDA.computeLazyFunctions(M, lazyEntryPoints, LazyColdFunctions);
+  }
+  beginPhase("nameGeneration");
   // Build the ordered list of reserved names
   std::vector<std::string> reservedNames(ReservedNames.begin(), ReservedNames.end());
   std::sort(reservedNames.begin(), reservedNames.end());
@@ -90,8 +121,39 @@ bool CheerpWritePass::runOnModule(Module& M)
   cheerp::CheerpWriter writer(M, Out, PA, registerize, GDA, linearHelper, memOut.get(), AsmJSMemFile,
           sourceMapGenerator.get(), reservedNames, PrettyCode, MakeModule, NoRegisterize, !NoNativeJavaScriptMath,
           !NoJavaScriptMathImul, !NoJavaScriptMathFround, !NoCredits, MeasureTimeToMain, CheerpAsmJSHeapSize,
-          BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, std::string(), ForceTypedArrays);
+          BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, std::string(), ForceTypedArrays,
+          TypedArrayPoolSize, timeReport.get(), sizeReport.get(), LazyChunkURL.empty() ? LazyChunkFile : LazyChunkURL,
+          CodegenThreads);
+  beginPhase("emission");
   writer.makeJS();
+  if (!GDA.lazyFunctions().empty())
+  {
+    std::error_code ChunkErrorCode;
+    llvm::tool_output_file chunkFile(LazyChunkFile, ChunkErrorCode, sys::fs::F_None);
+    if (ChunkErrorCode)
+    {
+      // An error occurred opening the lazy chunk file, bail out
+      llvm::report_fatal_error(ChunkErrorCode.message(), false);
+      return false;
+    }
+    // The names are generated in the same way, so the chunk can refer to
+    // the functions and globals of the main output
+    cheerp::CheerpWriter chunkWriter(M, chunkFile.os(), PA, registerize, GDA, linearHelper, nullptr, std::string(),
+            nullptr, reservedNames, PrettyCode, MakeModule, NoRegisterize, !NoNativeJavaScriptMath,
+            !NoJavaScriptMathImul, !NoJavaScriptMathFround, !NoCredits, MeasureTimeToMain, CheerpAsmJSHeapSize,
+            BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, std::string(), ForceTypedArrays,
+            TypedArrayPoolSize, nullptr, sizeReport.get());
+    chunkWriter.makeLazyChunk();
+    chunkFile.keep();
+  }
+  if (sizeReport)
+    writeSizeReport(*sizeReport);
+  if (timeReport)
+  {
+    timeReport->addCounter("constraints_solved", numResolved);
+    timeReport->addCounter("registers_assigned", registerize.getNumRegisters());
+    writeTimeReport();
+  }
   if (ErrorCode)
   {
     if(!AsmJSMemFile.empty())
@@ -106,6 +168,35 @@ bool CheerpWritePass::runOnModule(Module& M)
   return false;
 }
 
+void CheerpWritePass::writeTimeReport()
+{
+  timeReport->endPhase();
+  std::error_code ErrorCode;
+  llvm::tool_output_file reportFile(TimeReportFile, ErrorCode, sys::fs::F_None);
+  if (ErrorCode)
+  {
+    // An error occurred opening the time report file, bail out
+    llvm::report_fatal_error(ErrorCode.message(), false);
+    return;
+  }
+  timeReport->print(reportFile.os());
+  reportFile.keep();
+}
+
+void CheerpWritePass::writeSizeReport(const cheerp::SizeReport& sizeReport)
+{
+  std::error_code ErrorCode;
+  llvm::tool_output_file reportFile(SizeReportFile, ErrorCode, sys::fs::F_None);
+  if (ErrorCode)
+  {
+    // An error occurred opening the size report file, bail out
+    llvm::report_fatal_error(ErrorCode.message(), false);
+    return;
+  }
+  sizeReport.print(reportFile.os());
+  reportFile.keep();
+}
+
 void CheerpWritePass::getAnalysisUsage(AnalysisUsage& AU) const
 {
   AU.addRequired<cheerp::GlobalDepsAnalyzer>();
@@ -126,18 +217,32 @@ bool CheerpTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                                            AnalysisID StartAfter,
                                            AnalysisID StopAfter) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
-  PM.add(createResolveAliasesPass());
-  PM.add(createFreeAndDeleteRemovalPass());
-  PM.add(cheerp::createGlobalDepsAnalyzerPass());
-  PM.add(createPointerArithmeticToArrayIndexingPass());
-  PM.add(createPointerToImmutablePHIRemovalPass());
-  PM.add(cheerp::createRegisterizePass(!NoJavaScriptMathFround, NoRegisterize));
-  PM.add(cheerp::createPointerAnalyzerPass());
-  PM.add(cheerp::createAllocaMergingPass());
-  PM.add(createIndirectCallOptimizerPass());
-  PM.add(createAllocaArraysPass());
-  PM.add(cheerp::createAllocaArraysMergingPass());
-  PM.add(createDelayAllocasPass());
-  PM.add(new CheerpWritePass(o));
+  cheerp::TimeReport* timeReport = TimeReportFile.empty() ? nullptr : new cheerp::TimeReport();
+  // When the time report is requested, each pass is preceded by a pass
+  // starting its phase
+  auto addPass = [&](Pass* P)
+  {
+    if (timeReport)
+      PM.add(cheerp::createTimeReportPhasePass(*timeReport, P->getPassName()));
+    PM.add(P);
+  };
+  // Vector instructions cannot be represented, lower them to scalar ones
+  addPass(createScalarizerPass(/*ScalarizeLoadStore*/ true));
+  addPass(createResolveAliasesPass());
+  addPass(createScalarizeNonEscapingObjectsPass());
+  addPass(createFreeAndDeleteRemovalPass(TypedArrayPoolSize != 0));
+  addPass(cheerp::createGlobalDepsAnalyzerPass());
+  addPass(cheerp::createDevirtualizerPass(DevirtualizeMaxTargets));
+  addPass(createPointerArithmeticToArrayIndexingPass());
+  addPass(createPointerToImmutablePHIRemovalPass());
+  addPass(cheerp::createRegisterizePass(!NoJavaScriptMathFround, NoRegisterize, RegisterizeLinearScan));
+  addPass(cheerp::createPointerAnalyzerPass());
+  addPass(cheerp::createAllocaMergingPass());
+  addPass(createIndirectCallOptimizerPass());
+  addPass(createAllocaArraysPass());
+  addPass(cheerp::createAllocaArraysMergingPass());
+  addPass(createDelayAllocasPass());
+  addPass(cheerp::createFunctionLayoutPass(ProfileFile));
+  PM.add(new CheerpWritePass(o, timeReport));
   return false;
 }
@@ -23,10 +23,14 @@
 #include "llvm/Cheerp/PointerPasses.h"
 #include "llvm/Cheerp/ResolveAliases.h"
 #include "llvm/Cheerp/AllocaMerging.h"
+#include "llvm/Cheerp/Devirtualizer.h"
+#include "llvm/Cheerp/FunctionLayout.h"
 #include "llvm/Cheerp/Registerize.h"
 #include "llvm/Cheerp/ResolveAliases.h"
 #include "llvm/Cheerp/SourceMaps.h"
+#include "llvm/Cheerp/TimeReport.h"
 #include "llvm/Cheerp/CommandLine.h"
+#include "llvm/Transforms/Scalar.h"
 
 using namespace llvm;
 
@@ -39,11 +43,20 @@ namespace {
   class CheerpWastWritePass : public ModulePass {
   private:
     formatted_raw_ostream &Out;
+    // Collects the time spent in each phase, null if not requested
+    std::unique_ptr<cheerp::TimeReport> timeReport;
     static char ID;
     void getAnalysisUsage(AnalysisUsage& AU) const;
+    void beginPhase(StringRef name)
+    {
+      if (timeReport)
+        timeReport->beginPhase(name);
+    }
+    void writeTimeReport();
+    void writeSizeReport(const cheerp::SizeReport& sizeReport);
   public:
-    explicit CheerpWastWritePass(formatted_raw_ostream &o) :
-      ModulePass(ID), Out(o) { }
+    explicit CheerpWastWritePass(formatted_raw_ostream &o, cheerp::TimeReport* timeReport) :
+      ModulePass(ID), Out(o), timeReport(timeReport) { }
     bool runOnModule(Module &M);
     const char *getPassName() const {
 	return "CheerpWastWritePass";
@@ -56,13 +69,35 @@ bool CheerpWastWritePass::runOnModule(Module& M)
   cheerp::PointerAnalyzer &PA = getAnalysis<cheerp::PointerAnalyzer>();
   cheerp::GlobalDepsAnalyzer &GDA = getAnalysis<cheerp::GlobalDepsAnalyzer>();
   cheerp::Registerize &registerize = getAnalysis<cheerp::Registerize>();
-  PA.fullResolve();
+  std::unique_ptr<cheerp::SizeReport> sizeReport;
+  if (!SizeReportFile.empty())
+    sizeReport.reset(new cheerp::SizeReport());
+  beginPhase("fullResolve");
+  uint32_t numResolved = PointerSummaries.empty() ? PA.fullResolve() : PA.fullResolve(M, PointerSummaries);
+  beginPhase("computeConstantOffsets");
   PA.computeConstantOffsets(M);
+  beginPhase("assignRegisters");
   registerize.assignRegisters(M, PA);
+  // The lazily loaded functions are generic JS, they are part of the loader
+  if ((!LazyEntryPoints.empty() || LazyColdFunctions || !LazyChunkFile.empty()) && (WastLoader.empty() || LazyChunkFile.empty()))
+  {
+    llvm::report_fatal_error("-cheerp-lazy-entry-points and -cheerp-lazy-cold-functions require -cheerp-lazy-chunk-file and -cheerp-wast-loader", false);
+    return false;
+  }
+  if (!LazyChunkFile.empty())
+  {
+    std::vector<std::string> lazyEntryPoints(LazyEntryPoints.begin(), LazyEntryPoints.end());
+    GDA.computeLazyFunctions(M, lazyEntryPoints, LazyColdFunctions);
+  }
+  beginPhase("emission");
   DataLayout targetData(&M);
   cheerp::LinearMemoryHelper linearHelper(targetData, GDA);
   cheerp::CheerpWastWriter writer(M, Out, PA, registerize, GDA, linearHelper,
-                                  M.getContext(), !WastLoader.empty());
+                                  M.getContext(), !WastLoader.empty(),
+                                  CheerpAsmJSHeapSize, CheerpWasmStackSize, CheerpWasmMaxMemory,
+                                  WasmBinary ? cheerp::CheerpWastWriter::WASM : cheerp::CheerpWastWriter::WAST,
+                                  CodegenThreads, WasmRelooper, timeReport.get(),
+                                  sizeReport.get());
   writer.makeWast();
   if (!WastLoader.empty())
   {
@@ -71,7 +106,8 @@ bool CheerpWastWritePass::runOnModule(Module& M)
     if (!SourceMap.empty())
     {
       std::error_code ErrorCode;
-      sourceMapGenerator = new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, M.getContext(), ErrorCode);
+      sourceMapGenerator = new cheerp::SourceMapGenerator(SourceMap, SourceMapPrefix, M.getContext(),
+        SourceMapSectionSize * 1024, ErrorCode);
       if (ErrorCode)
       {
          // An error occurred opening the source map file, bail out
@@ -87,12 +123,36 @@ bool CheerpWastWritePass::runOnModule(Module& M)
     std::error_code ErrorCode;
     llvm::tool_output_file jsFile(WastLoader.c_str(), ErrorCode, sys::fs::F_None);
     llvm::formatted_raw_ostream jsOut(jsFile.os());
+    beginPhase("loaderEmission");
 
     cheerp::CheerpWriter writer(M, jsOut, PA, registerize, GDA, linearHelper, nullptr, std::string(),
             sourceMapGenerator, reservedNames, PrettyCode, MakeModule, NoRegisterize, !NoNativeJavaScriptMath,
             !NoJavaScriptMathImul, !NoJavaScriptMathFround, !NoCredits, MeasureTimeToMain, CheerpAsmJSHeapSize,
-            BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, WasmFile, ForceTypedArrays);
+            BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, WasmFile, ForceTypedArrays,
+            TypedArrayPoolSize, timeReport.get(), sizeReport.get(), LazyChunkURL.empty() ? LazyChunkFile : LazyChunkURL,
+            CodegenThreads);
     writer.makeJS();
+    if (!GDA.lazyFunctions().empty())
+    {
+      std::error_code ChunkErrorCode;
+      llvm::tool_output_file chunkFile(LazyChunkFile, ChunkErrorCode, sys::fs::F_None);
+      if (ChunkErrorCode)
+      {
+        // An error occurred opening the lazy chunk file, bail out
+        llvm::report_fatal_error(ChunkErrorCode.message(), false);
+        delete sourceMapGenerator;
+        return false;
+      }
+      // The names are generated in the same way, so the chunk can refer to
+      // the functions and globals of the loader
+      cheerp::CheerpWriter chunkWriter(M, chunkFile.os(), PA, registerize, GDA, linearHelper, nullptr, std::string(),
+              nullptr, reservedNames, PrettyCode, MakeModule, NoRegisterize, !NoNativeJavaScriptMath,
+              !NoJavaScriptMathImul, !NoJavaScriptMathFround, !NoCredits, MeasureTimeToMain, CheerpAsmJSHeapSize,
+              BoundsCheck, DefinedCheck, SymbolicGlobalsAsmJS, WasmFile, ForceTypedArrays,
+              TypedArrayPoolSize, nullptr, sizeReport.get());
+      chunkWriter.makeLazyChunk();
+      chunkFile.keep();
+    }
     if (ErrorCode)
     {
        // An error occurred opening the wast loader file, bail out
@@ -103,9 +163,46 @@ bool CheerpWastWritePass::runOnModule(Module& M)
     jsFile.keep();
     delete sourceMapGenerator;
   }
+  if (sizeReport)
+    writeSizeReport(*sizeReport);
+  if (timeReport)
+  {
+    timeReport->addCounter("constraints_solved", numResolved);
+    timeReport->addCounter("registers_assigned", registerize.getNumRegisters());
+    writeTimeReport();
+  }
   return false;
 }
 
+void CheerpWastWritePass::writeTimeReport()
+{
+  timeReport->endPhase();
+  std::error_code ErrorCode;
+  llvm::tool_output_file reportFile(TimeReportFile, ErrorCode, sys::fs::F_None);
+  if (ErrorCode)
+  {
+    // An error occurred opening the time report file, bail out
+    llvm::report_fatal_error(ErrorCode.message(), false);
+    return;
+  }
+  timeReport->print(reportFile.os());
+  reportFile.keep();
+}
+
+void CheerpWastWritePass::writeSizeReport(const cheerp::SizeReport& sizeReport)
+{
+  std::error_code ErrorCode;
+  llvm::tool_output_file reportFile(SizeReportFile, ErrorCode, sys::fs::F_None);
+  if (ErrorCode)
+  {
+    // An error occurred opening the size report file, bail out
+    llvm::report_fatal_error(ErrorCode.message(), false);
+    return;
+  }
+  sizeReport.print(reportFile.os());
+  reportFile.keep();
+}
+
 void CheerpWastWritePass::getAnalysisUsage(AnalysisUsage& AU) const
 {
   AU.addRequired<cheerp::GlobalDepsAnalyzer>();
@@ -119,6 +216,12 @@ char CheerpWastWritePass::ID = 0;
 //                       External Interface declaration
 //===----------------------------------------------------------------------===//
 
+void CheerpWastTargetMachine::addAnalysisPasses(PassManagerBase &PM) {
+  // There is no target lowering to build the BasicTTI on, the Cheerp pass
+  // only reports which vector operations can be lowered to SIMD
+  PM.add(createCheerpWastTargetTransformInfoPass(this));
+}
+
 bool CheerpWastTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                                            formatted_raw_ostream &o,
                                            CodeGenFileType FileType,
@@ -126,18 +229,36 @@ bool CheerpWastTargetMachine::addPassesToEmitFile(PassManagerBase &PM,
                                            AnalysisID StartAfter,
                                            AnalysisID StopAfter) {
   if (FileType != TargetMachine::CGFT_AssemblyFile) return true;
-  PM.add(createResolveAliasesPass());
-  PM.add(createFreeAndDeleteRemovalPass());
-  PM.add(cheerp::createGlobalDepsAnalyzerPass());
-  PM.add(createPointerArithmeticToArrayIndexingPass());
-  PM.add(createPointerToImmutablePHIRemovalPass());
-  PM.add(cheerp::createRegisterizePass(true, false));
-  PM.add(cheerp::createPointerAnalyzerPass());
-  PM.add(cheerp::createAllocaMergingPass());
-  PM.add(createIndirectCallOptimizerPass());
-  PM.add(createAllocaArraysPass());
-  PM.add(cheerp::createAllocaArraysMergingPass());
-  PM.add(createDelayAllocasPass());
-  PM.add(new CheerpWastWritePass(o));
+  cheerp::TimeReport* timeReport = TimeReportFile.empty() ? nullptr : new cheerp::TimeReport();
+  // When the time report is requested, each pass is preceded by a pass
+  // starting its phase
+  auto addPass = [&](Pass* P)
+  {
+    if (timeReport)
+      PM.add(cheerp::createTimeReportPhasePass(*timeReport, P->getPassName()));
+    PM.add(P);
+  };
+  // Vector instructions are lowered to SIMD ones when possible, the functions
+  // using unsupported vectors are scalarized entirely
+  if (WasmSIMD)
+    addPass(createScalarizerPass(/*ScalarizeLoadStore*/ true, cheerp::needsVectorScalarization));
+  else
+    addPass(createScalarizerPass(/*ScalarizeLoadStore*/ true));
+  addPass(createResolveAliasesPass());
+  addPass(createScalarizeNonEscapingObjectsPass());
+  addPass(createFreeAndDeleteRemovalPass(TypedArrayPoolSize != 0));
+  addPass(cheerp::createGlobalDepsAnalyzerPass());
+  addPass(cheerp::createDevirtualizerPass(DevirtualizeMaxTargets));
+  addPass(createPointerArithmeticToArrayIndexingPass());
+  addPass(createPointerToImmutablePHIRemovalPass());
+  addPass(cheerp::createRegisterizePass(true, false, RegisterizeLinearScan));
+  addPass(cheerp::createPointerAnalyzerPass());
+  addPass(cheerp::createAllocaMergingPass());
+  addPass(createIndirectCallOptimizerPass());
+  addPass(createAllocaArraysPass());
+  addPass(cheerp::createAllocaArraysMergingPass());
+  addPass(createDelayAllocasPass());
+  addPass(cheerp::createFunctionLayoutPass(ProfileFile));
+  PM.add(new CheerpWastWritePass(o, timeReport));
   return false;
 }
@@ -19,6 +19,7 @@
 namespace llvm {
 
 class formatted_raw_ostream;
+class ImmutablePass;
 
 class CheerpWastSubtarget : public TargetSubtargetInfo {
 private:
@@ -53,10 +54,13 @@ public:
                                    bool DisableVerify,
                                    AnalysisID StartAfter,
                                    AnalysisID StopAfter) override;
+  void addAnalysisPasses(PassManagerBase &PM) override;
 };
 
 extern Target TheCheerpWastBackendTarget;
 
+ImmutablePass *createCheerpWastTargetTransformInfoPass(const CheerpWastTargetMachine *TM);
+
 } // End llvm namespace
 
 #endif
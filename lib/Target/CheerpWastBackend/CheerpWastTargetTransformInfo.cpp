@@ -0,0 +1,218 @@
+//===-- CheerpWastTargetTransformInfo.cpp - Cheerp wasm specific TTI pass ---===//
+//
+//                     Cheerp: The C++ compiler for the Web
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+// Copyright 2017 Leaning Technologies
+//
+//===----------------------------------------------------------------------===//
+/// \file
+/// This file implements a TargetTransformInfo analysis pass specific to the
+/// Cheerp wasm target. It tells the vectorizers which vector operations the
+/// writer can lower to 128-bit SIMD instructions. A function using any other
+/// vector operation is scalarized entirely by the backend, so those are
+/// given a prohibitive cost.
+///
+//===----------------------------------------------------------------------===//
+
+#include "CheerpWastTargetMachine.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/Cheerp/CommandLine.h"
+#include "llvm/Cheerp/WastWriter.h"
+#include "llvm/IR/Instruction.h"
+#include "llvm/IR/Type.h"
+using namespace llvm;
+
+#define DEBUG_TYPE "cheerpwasttti"
+
+// Declare the pass initialization routine locally as target-specific passes
+// don't have a target-wide initialization entry point, and so we rely on the
+// pass constructor initialization.
+namespace llvm {
+void initializeCheerpWastTTIPass(PassRegistry &);
+}
+
+namespace {
+
+class CheerpWastTTI final : public ImmutablePass, public TargetTransformInfo {
+  // Cost of the vector operations which force the function to be scalarized
+  static const unsigned ScalarizedCost = 1000;
+
+  static bool isSIMDMask(Type *Ty) {
+    return Ty->isVectorTy() && Ty->getVectorElementType()->isIntegerTy(1);
+  }
+
+  static bool isSIMDValue(Type *Ty) {
+    return cheerp::isSIMDType(Ty) && !isSIMDMask(Ty);
+  }
+
+public:
+  CheerpWastTTI() : ImmutablePass(ID) {
+    llvm_unreachable("This pass cannot be directly constructed");
+  }
+
+  CheerpWastTTI(const CheerpWastTargetMachine *TM)
+      : ImmutablePass(ID) {
+    initializeCheerpWastTTIPass(*PassRegistry::getPassRegistry());
+  }
+
+  void initializePass() override {
+    pushTTIStack(this);
+  }
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    TargetTransformInfo::getAnalysisUsage(AU);
+  }
+
+  static char ID;
+
+  void *getAdjustedAnalysisPointer(const void *ID) override {
+    if (ID == &TargetTransformInfo::ID)
+      return (TargetTransformInfo*)this;
+    return this;
+  }
+
+  unsigned getNumberOfRegisters(bool Vector) const override {
+    // Without SIMD the vectors would be scalarized again by the backend
+    if (Vector)
+      return WasmSIMD ? 16 : 0;
+    return TargetTransformInfo::getNumberOfRegisters(Vector);
+  }
+
+  unsigned getRegisterBitWidth(bool Vector) const override {
+    return Vector ? 128 : 32;
+  }
+
+  unsigned getArithmeticInstrCost(unsigned Opcode, Type *Ty,
+                                  OperandValueKind Opd1Info,
+                                  OperandValueKind Opd2Info,
+                                  OperandValueProperties Opd1PropInfo,
+                                  OperandValueProperties Opd2PropInfo) const override {
+    if (!Ty->isVectorTy())
+      return TargetTransformInfo::getArithmeticInstrCost(Opcode, Ty, Opd1Info,
+                                     Opd2Info, Opd1PropInfo, Opd2PropInfo);
+    if (!cheerp::isSIMDType(Ty))
+      return ScalarizedCost;
+    Type *ElemTy = Ty->getVectorElementType();
+    switch (Opcode) {
+    case Instruction::And:
+    case Instruction::Or:
+    case Instruction::Xor:
+      return 1;
+    case Instruction::Add:
+    case Instruction::Sub:
+      return isSIMDMask(Ty) ? ScalarizedCost : 1;
+    case Instruction::Mul:
+      return ElemTy->isIntegerTy(16) || ElemTy->isIntegerTy(32) ? 1 : ScalarizedCost;
+    case Instruction::Shl:
+    case Instruction::LShr:
+    case Instruction::AShr:
+      // All the lanes must be shifted by the same amount
+      if (isSIMDMask(Ty) || (Opd2Info != OK_UniformValue &&
+                             Opd2Info != OK_UniformConstantValue))
+        return ScalarizedCost;
+      return 1;
+    case Instruction::FAdd:
+    case Instruction::FSub:
+    case Instruction::FMul:
+    case Instruction::FDiv:
+      return 1;
+    default:
+      return ScalarizedCost;
+    }
+  }
+
+  unsigned getShuffleCost(ShuffleKind Kind, Type *Tp, int Index,
+                          Type *SubTp) const override {
+    // Only shuffles between vectors of the same type are supported
+    if (!cheerp::isSIMDType(Tp) || (SubTp && SubTp != Tp))
+      return ScalarizedCost;
+    return 1;
+  }
+
+  unsigned getCastInstrCost(unsigned Opcode, Type *Dst,
+                            Type *Src) const override {
+    if (!Dst->isVectorTy() && !Src->isVectorTy())
+      return TargetTransformInfo::getCastInstrCost(Opcode, Dst, Src);
+    if (!cheerp::isSIMDType(Dst) || !cheerp::isSIMDType(Src))
+      return ScalarizedCost;
+    switch (Opcode) {
+    case Instruction::BitCast:
+      return isSIMDValue(Dst) && isSIMDValue(Src) ? 0 : ScalarizedCost;
+    case Instruction::SIToFP:
+    case Instruction::UIToFP:
+      return Dst->getVectorElementType()->isFloatTy() &&
+             Src->getVectorElementType()->isIntegerTy(32) ? 1 : ScalarizedCost;
+    case Instruction::FPToSI:
+    case Instruction::FPToUI:
+      return Dst->getVectorElementType()->isIntegerTy(32) &&
+             Src->getVectorElementType()->isFloatTy() ? 1 : ScalarizedCost;
+    case Instruction::ZExt:
+    case Instruction::SExt:
+      return isSIMDMask(Src) && isSIMDValue(Dst) ? 1 : ScalarizedCost;
+    default:
+      return ScalarizedCost;
+    }
+  }
+
+  unsigned getCmpSelInstrCost(unsigned Opcode, Type *ValTy,
+                              Type *CondTy) const override {
+    if (!ValTy->isVectorTy())
+      return TargetTransformInfo::getCmpSelInstrCost(Opcode, ValTy, CondTy);
+    if (!cheerp::isSIMDType(ValTy))
+      return ScalarizedCost;
+    if (Opcode == Instruction::Select)
+      return !CondTy || !CondTy->isVectorTy() || cheerp::isSIMDType(CondTy) ? 1 : ScalarizedCost;
+    // Masks cannot be compared
+    return isSIMDValue(ValTy) ? 1 : ScalarizedCost;
+  }
+
+  unsigned getVectorInstrCost(unsigned Opcode, Type *Val,
+                              unsigned Index) const override {
+    // Lanes are immediates, and masks can only be read
+    if (!cheerp::isSIMDType(Val) || Index == -1U ||
+        (Opcode == Instruction::InsertElement && isSIMDMask(Val)))
+      return ScalarizedCost;
+    return 1;
+  }
+
+  unsigned getMemoryOpCost(unsigned Opcode, Type *Src, unsigned Alignment,
+                           unsigned AddressSpace) const override {
+    if (!Src->isVectorTy())
+      return TargetTransformInfo::getMemoryOpCost(Opcode, Src, Alignment,
+                                                  AddressSpace);
+    return isSIMDValue(Src) ? 1 : ScalarizedCost;
+  }
+
+  unsigned getIntrinsicInstrCost(Intrinsic::ID ID, Type *RetTy,
+                                 ArrayRef<Type*> Tys) const override {
+    // Calls are never lowered to SIMD instructions
+    if (RetTy->isVectorTy())
+      return ScalarizedCost;
+    return TargetTransformInfo::getIntrinsicInstrCost(ID, RetTy, Tys);
+  }
+
+  unsigned getAddressComputationCost(Type *Ty, bool IsComplex) const override {
+    // Vectors of pointers are used by gathers and scatters
+    if (Ty->isVectorTy() && Ty->getScalarType()->isPointerTy())
+      return ScalarizedCost;
+    return TargetTransformInfo::getAddressComputationCost(Ty, IsComplex);
+  }
+
+  unsigned getNumberOfParts(Type *Tp) const override {
+    return cheerp::isSIMDType(Tp) ? 1 : 0;
+  }
+};
+
+} // end anonymous namespace
+
+INITIALIZE_AG_PASS(CheerpWastTTI, TargetTransformInfo, "cheerpwasttti",
+                   "Cheerp wasm Target Transform Info", true, true, false)
+char CheerpWastTTI::ID = 0;
+
+ImmutablePass *
+llvm::createCheerpWastTargetTransformInfoPass(const CheerpWastTargetMachine *TM) {
+  return new CheerpWastTTI(TM);
+}
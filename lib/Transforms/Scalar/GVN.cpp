@@ -36,6 +36,7 @@
 #include "llvm/Analysis/ValueTracking.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Dominators.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/IntrinsicInst.h"
@@ -833,14 +834,98 @@ SpeculationFailure:
 }
 
 
+/// isTypedUpcast - Cheerp: return true if From is a pointer to a struct
+/// derived from the one To points to. Such a pointer can be bitcast to To on
+/// NBA targets.
+static bool isTypedUpcast(Type *From, Type *To) {
+  if (!From->isPointerTy() || !To->isPointerTy())
+    return false;
+  StructType *Derived = dyn_cast<StructType>(From->getPointerElementType());
+  StructType *Base = dyn_cast<StructType>(To->getPointerElementType());
+  if (!Derived || !Base)
+    return false;
+  while ((Derived = Derived->getDirectBase()))
+    if (Derived == Base)
+      return true;
+  return false;
+}
+
+/// getTypedSlot - Cheerp: on NBA targets memory is made of typed slots, which
+/// are identified by the object and by the path of indices to reach them.
+/// Compute them for Ptr. The fields of a base class are the first fields of
+/// the derived ones, so an upcast keeps the path. LastIsField is set if the
+/// last index of the path selects a struct field. Returns null if the path
+/// cannot be determined.
+static Value *getTypedSlot(Value *Ptr, SmallVectorImpl<Value *> &Path,
+                           bool &LastIsField) {
+  if (GEPOperator *GEP = dyn_cast<GEPOperator>(Ptr)) {
+    Value *Base = getTypedSlot(GEP->getPointerOperand(), Path, LastIsField);
+    if (!Base)
+      return nullptr;
+    // The first index moves the pointer, so it adds to the last one of the
+    // path. This is only possible between the elements of an array.
+    gep_type_iterator GTI = gep_type_begin(GEP);
+    User::op_iterator Idx = GEP->idx_begin();
+    ConstantInt *First = dyn_cast<ConstantInt>(*Idx);
+    if (!First || !First->isZero()) {
+      if (LastIsField)
+        return nullptr;
+      ConstantInt *Last = dyn_cast<ConstantInt>(Path.back());
+      if (Last && Last->isZero())
+        Path.back() = *Idx;
+      else if (First && Last)
+        Path.back() = ConstantInt::get(Last->getType(),
+                                       Last->getSExtValue() + First->getSExtValue());
+      else
+        return nullptr;
+    }
+    for (++Idx, ++GTI; Idx != GEP->idx_end(); ++Idx, ++GTI) {
+      Path.push_back(*Idx);
+      LastIsField = isa<StructType>(*GTI);
+    }
+    return Base;
+  }
+  if (Operator::getOpcode(Ptr) == Instruction::BitCast) {
+    Value *Src = cast<Operator>(Ptr)->getOperand(0);
+    if (!isTypedUpcast(Src->getType(), Ptr->getType()))
+      return nullptr;
+    return getTypedSlot(Src, Path, LastIsField);
+  }
+  // This is the object, the pointer itself is the first slot
+  Path.push_back(ConstantInt::get(Type::getInt32Ty(Ptr->getContext()), 0));
+  LastIsField = false;
+  return Ptr;
+}
+
+/// isSameTypedSlot - Cheerp: return true if the two pointers are known to
+/// point to the same typed slot on NBA targets.
+static bool isSameTypedSlot(Value *PtrA, Value *PtrB) {
+  SmallVector<Value *, 8> PathA, PathB;
+  bool LastIsFieldA, LastIsFieldB;
+  Value *BaseA = getTypedSlot(PtrA, PathA, LastIsFieldA);
+  Value *BaseB = getTypedSlot(PtrB, PathB, LastIsFieldB);
+  if (!BaseA || BaseA != BaseB || PathA.size() != PathB.size())
+    return false;
+  for (unsigned i = 0; i < PathA.size(); ++i) {
+    if (PathA[i] == PathB[i])
+      continue;
+    // Constant indices of different types may still have the same value
+    ConstantInt *A = dyn_cast<ConstantInt>(PathA[i]);
+    ConstantInt *B = dyn_cast<ConstantInt>(PathB[i]);
+    if (!A || !B || A->getSExtValue() != B->getSExtValue())
+      return false;
+  }
+  return true;
+}
+
 /// CanCoerceMustAliasedValueToLoad - Return true if
 /// CoerceAvailableValueToLoadType will succeed.
 static bool CanCoerceMustAliasedValueToLoad(Value *StoredVal,
                                             Type *LoadTy,
                                             const DataLayout &DL) {
-  // Do not even try on NBA targets
+  // On NBA targets only pointers to derived classes can be converted
   if (!DL.isByteAddressable())
-    return false;
+    return isTypedUpcast(StoredVal->getType(), LoadTy);
 
   // If the loaded or stored value is an first class array or struct, don't try
   // to transform them.  We need to be able to bitcast to integer.
@@ -1037,6 +1122,13 @@ static int AnalyzeLoadFromClobberingStore(Type *LoadTy, Value *LoadPtr,
     return -1;
 
   Value *StorePtr = DepSI->getPointerOperand();
+  // On NBA targets the store can only feed a load of the same typed slot
+  if (!DL.isByteAddressable()) {
+    Type *StoredTy = DepSI->getValueOperand()->getType();
+    if (StoredTy != LoadTy && !isTypedUpcast(StoredTy, LoadTy))
+      return -1;
+    return isSameTypedSlot(LoadPtr, StorePtr) ? 0 : -1;
+  }
   uint64_t StoreSize =DL.getTypeSizeInBits(DepSI->getValueOperand()->getType());
   return AnalyzeLoadFromClobberingWrite(LoadTy, LoadPtr,
                                         StorePtr, StoreSize, DL);
@@ -1052,6 +1144,12 @@ static int AnalyzeLoadFromClobberingLoad(Type *LoadTy, Value *LoadPtr,
     return -1;
 
   Value *DepPtr = DepLI->getPointerOperand();
+  // On NBA targets the load can only feed a load of the same typed slot
+  if (!DL.isByteAddressable()) {
+    if (DepLI->getType() != LoadTy && !isTypedUpcast(DepLI->getType(), LoadTy))
+      return -1;
+    return isSameTypedSlot(LoadPtr, DepPtr) ? 0 : -1;
+  }
   uint64_t DepSize = DL.getTypeSizeInBits(DepLI->getType());
   int R = AnalyzeLoadFromClobberingWrite(LoadTy, LoadPtr, DepPtr, DepSize, DL);
   if (R != -1) return R;
@@ -1152,6 +1250,15 @@ static Value *GetStoreValueForLoad(Value *SrcVal, unsigned Offset,
                                    Instruction *InsertPt, const DataLayout &DL){
   LLVMContext &Ctx = SrcVal->getType()->getContext();
 
+  // On NBA targets the value is from the same typed slot, see
+  // AnalyzeLoadFromClobberingStore
+  if (!DL.isByteAddressable()) {
+    assert(Offset == 0 && "Forwarding from a different typed slot");
+    if (SrcVal->getType() == LoadTy)
+      return SrcVal;
+    return new BitCastInst(SrcVal, LoadTy, "", InsertPt);
+  }
+
   uint64_t StoreSize = (DL.getTypeSizeInBits(SrcVal->getType()) + 7) / 8;
   uint64_t LoadSize = (DL.getTypeSizeInBits(LoadTy) + 7) / 8;
 
@@ -1490,7 +1597,7 @@ void GVN::AnalyzeLoadAvailability(LoadInst *LI, LoadDepVect &Deps,
       if (LoadInst *DepLI = dyn_cast<LoadInst>(DepInfo.getInst())) {
         // If this is a clobber and L is the first instruction in its block, then
         // we have the first instruction in the entry block.
-        if (DepLI != LI && Address && DL && DL->isByteAddressable()) {
+        if (DepLI != LI && Address && DL) {
           int Offset = AnalyzeLoadFromClobberingLoad(LI->getType(), Address,
                                                      DepLI, *DL);
 
@@ -1897,9 +2004,9 @@ bool GVN::processLoad(LoadInst *L) {
   MemDepResult Dep = MD->getDependency(L);
 
   // If we have a clobber and target data is around, see if this is a clobber
-  // that we can fix up through code synthesis.
-  // TODO: Cheerp: Verify if we can relax the byte addressable requirement
-  if (Dep.isClobber() && DL && DL->isByteAddressable()) {
+  // that we can fix up through code synthesis. On NBA targets only accesses
+  // to the same typed slot are forwarded.
+  if (Dep.isClobber() && DL) {
     // Check to see if we have something like this:
     //   store i32 123, i32* %P
     //   %A = bitcast i32* %P to i8*
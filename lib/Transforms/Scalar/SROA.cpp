@@ -1582,6 +1582,64 @@ static void speculateSelectInstLoads(SelectInst &SI) {
   SI.eraseFromParent();
 }
 
+/// \brief Cheerp: Check if a pointer is the alloca or a chain of GEPs with
+/// constant indices into it.
+static bool isTypedPointerInto(Value *V, AllocaInst &AI) {
+  while (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(V)) {
+    if (!GEP->hasAllConstantIndices())
+      return false;
+    V = GEP->getPointerOperand();
+  }
+  return V == &AI;
+}
+
+/// \brief Cheerp: Speculate the loads through PHIs and selects which only
+/// merge typed pointers into the alloca.
+///
+/// On NBA targets the rewriter can't always build a pointer into the new
+/// allocas for a PHI or a select, so they would prevent splitting. Once the
+/// loads are speculated there are only typed loads from the alloca left.
+static bool speculateTypedPHIsAndSelects(AllocaInst &AI,
+                                         const DataLayout *DL) {
+  SmallVector<Instruction *, 8> Worklist;
+  SmallSetVector<PHINode *, 4> PHIs;
+  SmallSetVector<SelectInst *, 4> Selects;
+  Worklist.push_back(&AI);
+  while (!Worklist.empty()) {
+    Instruction *I = Worklist.pop_back_val();
+    for (User *U : I->users()) {
+      if (GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(U)) {
+        if (GEP->getPointerOperand() == I && GEP->hasAllConstantIndices())
+          Worklist.push_back(GEP);
+      } else if (PHINode *PN = dyn_cast<PHINode>(U)) {
+        PHIs.insert(PN);
+      } else if (SelectInst *SI = dyn_cast<SelectInst>(U)) {
+        Selects.insert(SI);
+      }
+    }
+  }
+
+  bool Changed = false;
+  for (PHINode *PN : PHIs) {
+    bool AllTyped = true;
+    for (unsigned Idx = 0, Num = PN->getNumIncomingValues(); Idx != Num; ++Idx)
+      AllTyped &= isTypedPointerInto(PN->getIncomingValue(Idx), AI);
+    if (!AllTyped || !isSafePHIToSpeculate(*PN, DL))
+      continue;
+    speculatePHINodeLoads(*PN);
+    Changed = true;
+  }
+  for (SelectInst *SI : Selects) {
+    if (!isTypedPointerInto(SI->getTrueValue(), AI) ||
+        !isTypedPointerInto(SI->getFalseValue(), AI) ||
+        !isSafeSelectToSpeculate(*SI, DL))
+      continue;
+    speculateSelectInstLoads(*SI);
+    Changed = true;
+  }
+  return Changed;
+}
+
 /// \brief Build a GEP out of a base pointer and indices.
 ///
 /// This will return the BasePtr if that is valid, or build a new GEP
@@ -4353,6 +4411,12 @@ bool SROA::runOnAlloca(AllocaInst &AI) {
   AggLoadStoreRewriter AggRewriter(*DL);
   Changed |= AggRewriter.rewrite(AI);
 
+  // Cheerp: Loads through PHIs and selects of typed pointers into the alloca
+  // can be handled on NBA targets once they are speculated
+  if (!DL->isByteAddressable() &&
+      AI.getParent()->getParent()->getSection() != StringRef("asmjs"))
+    Changed |= speculateTypedPHIsAndSelects(AI, DL);
+
   // Build the slices using a recursive instruction-visiting builder.
   AllocaSlices AS(*DL, AI);
   DEBUG(AS.print(dbgs()));
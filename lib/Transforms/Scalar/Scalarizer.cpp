@@ -17,10 +17,14 @@
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/InstVisitor.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/ValueHandle.h"
 #include "llvm/Pass.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Local.h"
 
 using namespace llvm;
 
@@ -127,8 +131,9 @@ class Scalarizer : public FunctionPass,
 public:
   static char ID;
 
-  Scalarizer() :
-    FunctionPass(ID) {
+  Scalarizer(bool ForceLoadStore = false,
+             std::function<bool(const Function &)> Ftor = nullptr) :
+    FunctionPass(ID), ForceLoadStore(ForceLoadStore), PredicateFtor(Ftor) {
     initializeScalarizerPass(*PassRegistry::getPassRegistry());
   }
 
@@ -149,6 +154,9 @@ public:
   bool visitPHINode(PHINode &);
   bool visitLoadInst(LoadInst &);
   bool visitStoreInst(StoreInst &);
+  bool visitExtractElementInst(ExtractElementInst &);
+  bool visitInsertElementInst(InsertElementInst &);
+  bool visitCallInst(CallInst &);
 
   static void registerOptions() {
     // This is disabled by default because having separate loads and stores
@@ -167,14 +175,24 @@ private:
   void transferMetadata(Instruction *, const ValueVector &);
   bool getVectorLayout(Type *, unsigned, VectorLayout &);
   bool finish();
+  void deleteDeadVectorPointers();
 
   template<typename T> bool splitBinary(Instruction &, const T &);
 
   ScatterMap Scattered;
   GatherList Gathered;
+  // Scalar instructions replaced by one of the scattered components
+  SmallVector<Instruction *, 16> Replaced;
+  // Vector pointers of the scalarized loads and stores, the JS backend needs
+  // the casts to be removed when they become dead
+  SmallVector<WeakVH, 16> VectorPointers;
   unsigned ParallelLoopAccessMDKind;
   const DataLayout *DL;
   bool ScalarizeLoadStore;
+  // Cheerp: targets without vector types need loads and stores to be
+  // scalarized as well, whatever the option says
+  bool ForceLoadStore;
+  std::function<bool(const Function &)> PredicateFtor;
 };
 
 char Scalarizer::ID = 0;
@@ -211,7 +229,19 @@ Value *Scatterer::operator[](unsigned I) {
       Type *Ty =
         PointerType::get(PtrTy->getElementType()->getVectorElementType(),
                          PtrTy->getAddressSpace());
-      CV[0] = Builder.CreateBitCast(V, Ty, V->getName() + ".i0");
+      // Cheerp: Address the first element of the pointer the vector pointer
+      // was cast from, the JS backend can only index typed pointers
+      Value *Base = V;
+      Operator *BC = dyn_cast<Operator>(V);
+      if (BC && BC->getOpcode() == Instruction::BitCast)
+        Base = BC->getOperand(0);
+      ArrayType *AT =
+        dyn_cast<ArrayType>(Base->getType()->getPointerElementType());
+      if (AT && PointerType::get(AT->getElementType(),
+                                 PtrTy->getAddressSpace()) == Ty)
+        CV[0] = Builder.CreateConstGEP2_32(Base, 0, 0, V->getName() + ".i0");
+      else
+        CV[0] = Builder.CreateBitCast(Base, Ty, V->getName() + ".i0");
     }
     if (I != 0)
       CV[I] = Builder.CreateConstGEP1_32(CV[0], I,
@@ -242,12 +272,14 @@ Value *Scatterer::operator[](unsigned I) {
 bool Scalarizer::doInitialization(Module &M) {
   ParallelLoopAccessMDKind =
       M.getContext().getMDKindID("llvm.mem.parallel_loop_access");
-  ScalarizeLoadStore =
+  ScalarizeLoadStore = ForceLoadStore ||
       M.getContext().getOption<bool, Scalarizer, &Scalarizer::ScalarizeLoadStore>();
   return false;
 }
 
 bool Scalarizer::runOnFunction(Function &F) {
+  if (PredicateFtor && !PredicateFtor(F))
+    return false;
   DataLayoutPass *DLP = getAnalysisIfAvailable<DataLayoutPass>();
   DL = DLP ? &DLP->getDataLayout() : nullptr;
   for (Function::iterator BBI = F.begin(), BBE = F.end(); BBI != BBE; ++BBI) {
@@ -601,6 +633,7 @@ bool Scalarizer::visitLoadInst(LoadInst &LI) {
   unsigned NumElems = Layout.VecTy->getNumElements();
   IRBuilder<> Builder(LI.getParent(), &LI);
   Scatterer Ptr = scatter(&LI, LI.getPointerOperand());
+  VectorPointers.push_back(LI.getPointerOperand());
   ValueVector Res;
   Res.resize(NumElems);
 
@@ -626,6 +659,7 @@ bool Scalarizer::visitStoreInst(StoreInst &SI) {
   IRBuilder<> Builder(SI.getParent(), &SI);
   Scatterer Ptr = scatter(&SI, SI.getPointerOperand());
   Scatterer Val = scatter(&SI, FullValue);
+  VectorPointers.push_back(SI.getPointerOperand());
 
   ValueVector Stores;
   Stores.resize(NumElems);
@@ -637,11 +671,144 @@ bool Scalarizer::visitStoreInst(StoreInst &SI) {
   return true;
 }
 
+// Return true if ID applies the same scalar intrinsic to each element, and
+// only the first operand of the ones with a second scalar operand is a vector.
+static bool isElementwiseIntrinsic(Intrinsic::ID ID) {
+  switch (ID) {
+  case Intrinsic::sqrt:
+  case Intrinsic::sin:
+  case Intrinsic::cos:
+  case Intrinsic::exp:
+  case Intrinsic::exp2:
+  case Intrinsic::log:
+  case Intrinsic::log10:
+  case Intrinsic::log2:
+  case Intrinsic::fabs:
+  case Intrinsic::minnum:
+  case Intrinsic::maxnum:
+  case Intrinsic::copysign:
+  case Intrinsic::floor:
+  case Intrinsic::ceil:
+  case Intrinsic::trunc:
+  case Intrinsic::rint:
+  case Intrinsic::nearbyint:
+  case Intrinsic::round:
+  case Intrinsic::bswap:
+  case Intrinsic::ctpop:
+  case Intrinsic::pow:
+  case Intrinsic::fma:
+  case Intrinsic::fmuladd:
+  case Intrinsic::ctlz:
+  case Intrinsic::cttz:
+  case Intrinsic::powi:
+    return true;
+  default:
+    return false;
+  }
+}
+
+bool Scalarizer::visitExtractElementInst(ExtractElementInst &EEI) {
+  IRBuilder<> Builder(EEI.getParent(), &EEI);
+  Scatterer Op0 = scatter(&EEI, EEI.getOperand(0));
+  Value *Idx = EEI.getOperand(1);
+  Value *Res;
+  if (ConstantInt *CI = dyn_cast<ConstantInt>(Idx)) {
+    if (CI->getZExtValue() >= Op0.size())
+      Res = UndefValue::get(EEI.getType());
+    else
+      Res = Op0[CI->getZExtValue()];
+  } else {
+    // Select the element matching the variable index
+    Res = Op0[0];
+    for (unsigned I = 1, E = Op0.size(); I < E; ++I) {
+      Value *Cmp = Builder.CreateICmpEQ(Idx,
+                                        ConstantInt::get(Idx->getType(), I),
+                                        EEI.getName() + ".is" + Twine(I));
+      Res = Builder.CreateSelect(Cmp, Op0[I], Res,
+                                 EEI.getName() + ".upto" + Twine(I));
+    }
+  }
+  // The extracts created by the Scatterer are already scalar
+  if (Res == &EEI)
+    return false;
+  EEI.replaceAllUsesWith(Res);
+  Replaced.push_back(&EEI);
+  return true;
+}
+
+bool Scalarizer::visitInsertElementInst(InsertElementInst &IEI) {
+  VectorType *VT = IEI.getType();
+  unsigned NumElems = VT->getNumElements();
+  IRBuilder<> Builder(IEI.getParent(), &IEI);
+  Scatterer Op0 = scatter(&IEI, IEI.getOperand(0));
+  Value *NewElt = IEI.getOperand(1);
+  Value *Idx = IEI.getOperand(2);
+  ValueVector Res;
+  Res.resize(NumElems);
+  if (ConstantInt *CI = dyn_cast<ConstantInt>(Idx)) {
+    for (unsigned I = 0; I < NumElems; ++I)
+      Res[I] = CI->getValue() == I ? NewElt : Op0[I];
+  } else {
+    // Each element is replaced if it matches the variable index
+    for (unsigned I = 0; I < NumElems; ++I) {
+      Value *Cmp = Builder.CreateICmpEQ(Idx,
+                                        ConstantInt::get(Idx->getType(), I),
+                                        IEI.getName() + ".is" + Twine(I));
+      Res[I] = Builder.CreateSelect(Cmp, NewElt, Op0[I],
+                                    IEI.getName() + ".i" + Twine(I));
+    }
+  }
+  gather(&IEI, Res);
+  return true;
+}
+
+bool Scalarizer::visitCallInst(CallInst &CI) {
+  VectorType *VT = dyn_cast<VectorType>(CI.getType());
+  Function *F = CI.getCalledFunction();
+  if (!VT || !F)
+    return false;
+  Intrinsic::ID ID = (Intrinsic::ID)F->getIntrinsicID();
+  if (!isElementwiseIntrinsic(ID))
+    return false;
+
+  unsigned NumElems = VT->getNumElements();
+  unsigned NumArgs = CI.getNumArgOperands();
+  IRBuilder<> Builder(CI.getParent(), &CI);
+  Function *NewF = Intrinsic::getDeclaration(F->getParent(), ID,
+                                             VT->getElementType());
+  SmallVector<Scatterer, 4> Ops;
+  Ops.resize(NumArgs);
+  for (unsigned J = 0; J < NumArgs; ++J)
+    if (CI.getArgOperand(J)->getType()->isVectorTy())
+      Ops[J] = scatter(&CI, CI.getArgOperand(J));
+
+  ValueVector Res;
+  Res.resize(NumElems);
+  for (unsigned I = 0; I < NumElems; ++I) {
+    SmallVector<Value *, 4> Args;
+    for (unsigned J = 0; J < NumArgs; ++J) {
+      Value *Arg = CI.getArgOperand(J);
+      Args.push_back(Arg->getType()->isVectorTy() ? Ops[J][I] : Arg);
+    }
+    Res[I] = Builder.CreateCall(NewF, Args, CI.getName() + ".i" + Twine(I));
+  }
+  gather(&CI, Res);
+  return true;
+}
+
 // Delete the instructions that we scalarized.  If a full vector result
 // is still needed, recreate it using InsertElements.
 bool Scalarizer::finish() {
-  if (Gathered.empty())
-    return false;
+  // The replaced instructions may be the last users of gathered vectors
+  bool Changed = !Replaced.empty();
+  for (Instruction *I : Replaced)
+    I->eraseFromParent();
+  Replaced.clear();
+  if (Gathered.empty()) {
+    Scattered.clear();
+    deleteDeadVectorPointers();
+    return Changed;
+  }
   for (GatherList::iterator GMI = Gathered.begin(), GME = Gathered.end();
        GMI != GME; ++GMI) {
     Instruction *Op = GMI->first;
@@ -666,9 +833,22 @@ bool Scalarizer::finish() {
   }
   Gathered.clear();
   Scattered.clear();
+  deleteDeadVectorPointers();
   return true;
 }
 
+void Scalarizer::deleteDeadVectorPointers() {
+  for (Value *V : VectorPointers)
+    if (V)
+      RecursivelyDeleteTriviallyDeadInstructions(V);
+  VectorPointers.clear();
+}
+
 FunctionPass *llvm::createScalarizerPass() {
   return new Scalarizer();
 }
+
+FunctionPass *llvm::createScalarizerPass(bool ScalarizeLoadStore,
+                                         std::function<bool(const Function &)> Ftor) {
+  return new Scalarizer(ScalarizeLoadStore, Ftor);
+}
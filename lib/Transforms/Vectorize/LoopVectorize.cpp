@@ -1301,9 +1301,10 @@ struct LoopVectorize : public FunctionPass {
       return false;
     }
 
-    //Cheerp: currently JS does not support vector instructions,
-    //they might be supported in the future though.
-    if (!DL->isByteAddressable()) {
+    //Cheerp: JS does not support vector instructions. Functions in the asmjs
+    //section use linear memory, and the target decides if vectors are
+    //profitable through the number of vector registers
+    if (!DL->isByteAddressable() && F.getSection() != StringRef("asmjs")) {
       DEBUG(dbgs() << "LV: Not vectorizing on NBA target");
       return false;
     }
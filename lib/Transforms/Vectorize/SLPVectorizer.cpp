@@ -2906,7 +2906,11 @@ struct SLPVectorizer : public FunctionPass {
 
     // Must have DataLayout. We can't require it because some tests run w/o
     // triple.
-    if (!DL || !DL->isByteAddressable())
+    if (!DL)
+      return false;
+
+    // Cheerp: only functions in the asmjs section use linear memory
+    if (!DL->isByteAddressable() && F.getSection() != StringRef("asmjs"))
       return false;
 
     // Don't vectorize when the attribute NoImplicitFloat is used.
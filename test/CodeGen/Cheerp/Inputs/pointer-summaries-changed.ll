@@ -0,0 +1,51 @@
+; The module of pointer-summaries.ll, reader does pointer arithmetic on the loaded member
+
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.elem = type { i32 }
+%struct.slot = type { %struct.elem* }
+%struct.other = type { %struct.elem* }
+
+@elems = global [4 x %struct.elem] zeroinitializer
+@slot = global %struct.slot zeroinitializer
+@other = global %struct.other zeroinitializer
+@result = global i32 0
+
+define void @writer(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  ret void
+}
+
+define i32 @reader() {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  %p = load %struct.elem** %f
+  %n = getelementptr inbounds %struct.elem* %p, i32 1
+  %v = getelementptr inbounds %struct.elem* %n, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+}
+
+define i32 @unrelated(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.other* @other, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  %v = getelementptr inbounds %struct.elem* %p, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+entry:
+  %e = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 1
+  call void @writer(%struct.elem* %e)
+  %a = call i32 @reader()
+  %o = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 2
+  %b = call i32 @unrelated(%struct.elem* %o)
+  %r = add i32 %a, %b
+  store i32 %r, i32* @result
+  ret void
+}
@@ -0,0 +1,34 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code -o - < %s | FileCheck %s
+; Only the asm.js memory helpers which are called are emitted, and a user
+; implementation of memcmp is called instead of the helper
+
+; CHECK: function _memcmp(
+; CHECK: __asmjs_memmove(
+; CHECK-NOT: __asmjs_memcmp(
+; CHECK: return _memcmp(
+; CHECK: function __asmjs_memmove(
+; CHECK-NOT: function __asmjs_memset(
+; CHECK-NOT: function __asmjs_memcmp(
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+@a = global [16 x i8] zeroinitializer, section "asmjs"
+@b = global [16 x i8] zeroinitializer, section "asmjs"
+
+define i32 @memcmp(i8* %x, i8* %y, i32 %n) section "asmjs" {
+  ret i32 42
+}
+
+define i32 @copy_and_compare() section "asmjs" {
+  %pa = getelementptr [16 x i8]* @a, i32 0, i32 0
+  %pb = getelementptr [16 x i8]* @b, i32 0, i32 0
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %pa, i8* %pb, i32 16, i32 1, i1 false)
+  %r = call i32 @memcmp(i8* %pa, i8* %pb, i32 16)
+  ret i32 %r
+}
+
+define void @_Z7webMainv() section "asmjs" {
+  %r = call i32 @copy_and_compare()
+  ret void
+}
+
+declare void @llvm.memcpy.p0i8.p0i8.i32(i8*, i8*, i32, i32, i1)
@@ -0,0 +1,87 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code -o - < %s | FileCheck --check-prefix=NOPROFILE %s
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-profile=%S/Inputs/function-layout.proftext -cheerp-size-report=%t.json -o - < %s | FileCheck %s
+; RUN: FileCheck --check-prefix=SIZE %s < %t.json
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-profile=%S/Inputs/function-layout.proftext -cheerp-lazy-cold-functions -cheerp-lazy-chunk-file=%t.chunk.js -o - < %s | FileCheck --check-prefix=LAZY %s
+; RUN: FileCheck --check-prefix=CHUNK %s < %t.chunk.js
+
+; Without a profile the functions are emitted in module order
+; NOPROFILE: function _cold(
+; NOPROFILE: function _cold_helper(
+; NOPROFILE: function _unknown(
+; NOPROFILE: function _warm(
+; NOPROFILE: function _hot(
+; NOPROFILE: function __Z7webMainv(
+
+; Executed functions go first by decreasing entry count, functions missing
+; from the profile keep their order and never executed ones go last
+; CHECK: function _hot(
+; CHECK: function _warm(
+; CHECK: function _cold_helper(
+; CHECK: function _unknown(
+; CHECK: function __Z7webMainv(
+; CHECK: function _cold(
+
+; The size report lists every function, largest first
+; SIZE: "entries": [
+; SIZE-NEXT: {"name": "_Z7webMainv", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}},
+; SIZE-DAG: {"name": "cold_helper", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}}
+; SIZE-DAG: {"name": "cold", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}}
+; SIZE-DAG: {"name": "unknown", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}}
+; SIZE-DAG: {"name": "warm", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}}
+; SIZE-DAG: {"name": "hot", "kind": "function", "section": "genericjs", "output": "js", "bytes": {{[0-9]+}}}
+; SIZE: "totals": {
+; SIZE-NEXT: "js_functions": {{[1-9][0-9]*}},
+
+; Never executed functions, and the ones only they call, are moved to the
+; lazily loaded chunk
+; LAZY-NOT: function _cold_helper(
+; LAZY: function _hot(
+; LAZY: function _warm(
+; LAZY: function _unknown(
+; LAZY: function __Z7webMainv(
+; LAZY-NOT: function _cold_helper(
+; LAZY: function _cold(){return __cheerp_load_lazy()[0].apply(null,arguments);}
+; CHUNK: function _cold_helper(
+; CHUNK: return [function (Lx){
+; CHUNK-NEXT: return _cold_helper(Lx)
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+define i32 @cold(i32 %x) {
+  %r = call i32 @cold_helper(i32 %x)
+  ret i32 %r
+}
+
+define i32 @cold_helper(i32 %x) {
+  %r = mul i32 %x, 7
+  ret i32 %r
+}
+
+define i32 @unknown(i32 %x) {
+  %r = add i32 %x, 3
+  ret i32 %r
+}
+
+define i32 @warm(i32 %x) {
+  %r = add i32 %x, 2
+  ret i32 %r
+}
+
+define i32 @hot(i32 %x) {
+  %r = add i32 %x, 1
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+entry:
+  %a = call i32 @hot(i32 1)
+  %b = call i32 @warm(i32 %a)
+  %c = call i32 @unknown(i32 %b)
+  %t = icmp eq i32 %c, 0
+  br i1 %t, label %then, label %exit
+then:
+  %d = call i32 @cold(i32 %c)
+  br label %exit
+exit:
+  ret void
+}
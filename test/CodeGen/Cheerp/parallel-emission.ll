@@ -0,0 +1,110 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code -o %t.serial %s
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-codegen-threads=4 -o %t.parallel %s
+; RUN: diff %t.serial %t.parallel
+; RUN: FileCheck %s < %t.parallel
+; RUN: llc -march=cheerp -o %t.serial.min %s
+; RUN: llc -march=cheerp -cheerp-codegen-threads=4 -o %t.parallel.min %s
+; RUN: diff %t.serial.min %t.parallel.min
+; The functions compiled by the workers are written in module order, with the
+; same indentation and the same PHI temporaries as in a serial compilation
+
+; CHECK: function asmJS(
+; CHECK: {{^}}	function _asm_square(
+; CHECK: {{^}}	function _asm_sum_squares(
+; CHECK: {{^}}function _sum(
+; CHECK: {{^}}function _swap(
+; CHECK: {{^}}function _length(
+; CHECK: {{^}}function __Z7webMainv(
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.node = type { i32, %struct.node* }
+
+@values = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+@last = global %struct.node { i32 2, %struct.node* null }
+@first = global %struct.node { i32 1, %struct.node* @last }
+@result = global i32 0
+
+define i32 @asm_square(i32 %x) section "asmjs" {
+entry:
+  %r = mul i32 %x, %x
+  ret i32 %r
+}
+
+define i32 @asm_sum_squares(i32 %n) section "asmjs" {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %sq = call i32 @asm_square(i32 %i)
+  %acc.next = add i32 %acc, %sq
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %acc.next
+}
+
+; A pointer PHI which walks an array
+define i32 @sum(i32* %p, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %cur = phi i32* [ %p, %entry ], [ %next, %loop ]
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %v = load i32* %cur
+  %acc.next = add i32 %acc, %v
+  %next = getelementptr inbounds i32* %cur, i32 1
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret i32 %acc.next
+}
+
+; Swapped PHIs need temporaries on the back edge
+define i32 @swap(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %a = phi i32 [ 0, %entry ], [ %b, %loop ]
+  %b = phi i32 [ 1, %entry ], [ %a, %loop ]
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %r = sub i32 %a, %b
+  ret i32 %r
+}
+
+define i32 @length(%struct.node* %head) {
+entry:
+  br label %loop
+loop:
+  %cur = phi %struct.node* [ %head, %entry ], [ %next, %loop ]
+  %count = phi i32 [ 0, %entry ], [ %count.next, %loop ]
+  %count.next = add i32 %count, 1
+  %link = getelementptr inbounds %struct.node* %cur, i32 0, i32 1
+  %next = load %struct.node** %link
+  %done = icmp eq %struct.node* %next, null
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 %count.next
+}
+
+define void @_Z7webMainv() {
+entry:
+  %p = getelementptr inbounds [8 x i32]* @values, i32 0, i32 2
+  %a = call i32 @sum(i32* %p, i32 4)
+  %b = call i32 @swap(i32 %a)
+  %c = call i32 @length(%struct.node* @first)
+  %d = call i32 @asm_sum_squares(i32 %c)
+  %ab = add i32 %a, %b
+  %cd = add i32 %c, %d
+  %r = add i32 %ab, %cd
+  store i32 %r, i32* @result
+  ret void
+}
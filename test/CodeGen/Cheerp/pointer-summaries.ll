@@ -0,0 +1,91 @@
+; REQUIRES: asserts
+; RUN: rm -f %t.summaries
+; RUN: llc -march=cheerp -cheerp-pretty-code -o %t.js %s
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-pointer-summaries=%t.summaries -o %t.first.js %s
+; RUN: diff %t.js %t.first.js
+; RUN: FileCheck %s < %t.summaries
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-pointer-summaries=%t.summaries -stats -info-output-file %t.same.stats -o %t.same.js %s
+; RUN: diff %t.js %t.same.js
+; RUN: FileCheck --check-prefix=SAME %s < %t.same.stats
+; RUN: llc -march=cheerp -cheerp-pretty-code -o %t.changed.js %S/Inputs/pointer-summaries-changed.ll
+; RUN: llc -march=cheerp -cheerp-pretty-code -cheerp-pointer-summaries=%t.summaries -stats -info-output-file %t.changed.stats -o %t.changed.summaries.js %S/Inputs/pointer-summaries-changed.ll
+; RUN: diff %t.changed.js %t.changed.summaries.js
+; RUN: FileCheck --check-prefix=CHANGED %s < %t.changed.stats
+; RUN: FileCheck --check-prefix=CHANGED-SUMMARY %s < %t.summaries
+; The summaries hold the kinds of the arguments, of the return values and of
+; the slots stored to. When reader starts doing pointer arithmetic on the
+; member of @slot, writer stores to a REGULAR slot and main passes a REGULAR
+; argument, so both are solved again even if their body is the same.
+
+; CHECK: slot {{[0-9a-f]+}} 0 member %struct.slot 0
+; CHECK: function {{[0-9a-f]+}} writer
+; CHECK-NEXT: slot {{[0-9a-f]+}} 0 arg writer 0
+; CHECK-NEXT: slot {{[0-9a-f]+}} 0 base_and_index %struct.slot 0
+; CHECK-NEXT: function {{[0-9a-f]+}} reader
+; CHECK-NEXT: function {{[0-9a-f]+}} unrelated
+; CHECK-NEXT: slot {{[0-9a-f]+}} 0 arg unrelated 0
+; CHECK-NEXT: slot {{[0-9a-f]+}} 0 base_and_index %struct.other 0
+; CHECK-NEXT: function {{[0-9a-f]+}} _Z7webMainv
+
+; SAME-NOT: Number of functions whose body or input pointer kind slots changed
+; SAME: 7 CheerpPointerAnalyzer - Number of pointer kind slots reused from the summaries
+; SAME-NOT: Number of pointer kind slots solved again
+
+; CHANGED: 3 CheerpPointerAnalyzer - Number of functions whose body or input pointer kind slots changed
+; CHANGED: 5 CheerpPointerAnalyzer - Number of pointer kind slots reused from the summaries
+; CHANGED: 2 CheerpPointerAnalyzer - Number of pointer kind slots solved again
+
+; CHANGED-SUMMARY: function {{[0-9a-f]+}} writer
+; CHANGED-SUMMARY-NEXT: slot {{[0-9a-f]+}} 1 arg writer 0
+; CHANGED-SUMMARY-NEXT: slot {{[0-9a-f]+}} 1 base_and_index %struct.slot 0
+; CHANGED-SUMMARY: function {{[0-9a-f]+}} unrelated
+; CHANGED-SUMMARY-NEXT: slot {{[0-9a-f]+}} 0 arg unrelated 0
+
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.elem = type { i32 }
+%struct.slot = type { %struct.elem* }
+%struct.other = type { %struct.elem* }
+
+@elems = global [4 x %struct.elem] zeroinitializer
+@slot = global %struct.slot zeroinitializer
+@other = global %struct.other zeroinitializer
+@result = global i32 0
+
+define void @writer(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  ret void
+}
+
+define i32 @reader() {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  %p = load %struct.elem** %f
+  %v = getelementptr inbounds %struct.elem* %p, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+}
+
+define i32 @unrelated(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.other* @other, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  %v = getelementptr inbounds %struct.elem* %p, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+entry:
+  %e = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 1
+  call void @writer(%struct.elem* %e)
+  %a = call i32 @reader()
+  %o = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 2
+  %b = call i32 @unrelated(%struct.elem* %o)
+  %r = add i32 %a, %b
+  store i32 %r, i32* @result
+  ret void
+}
@@ -0,0 +1,60 @@
+; RUN: llc -march=cheerp -cheerp-pretty-code -o %t.js %s
+; RUN: FileCheck %s < %t.js
+; JavaScript and asm.js have no vector types, the vector operations are
+; scalarized, variable lanes are chosen by comparing the index, and the
+; elements of vector pointers are addressed through the original array
+
+; CHECK-LABEL: function _asm_pick(
+; CHECK: HEAP32[8>>2]
+; CHECK: HEAP32[12+8>>2]
+; CHECK: HEAP32[16+8>>2]
+; CHECK: HEAP32[28+8>>2]
+; CHECK: HEAP32[12+8>>2]=
+; CHECK: (Li|0)==3?La$pi3:((Li|0)==2?La$pi2|0:((Li|0)==1?La$pi1:La$pi0)|0)
+; CHECK-LABEL: function _pick(
+; CHECK: _ints[0]|0
+; CHECK: _ints[3]|0
+; CHECK: _ints[4]|0
+; CHECK: _ints[7]|0
+; CHECK: _ints[0]=
+; CHECK: _ints[3]=
+; CHECK: (Li|0)===3?La$pi3:((Li|0)===2?La$pi2|0:((Li|0)===1?La$pi1:La$pi0)|0)
+; CHECK: var _ints=new Int32Array(
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@ints = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8]
+@heap = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8], section "asmjs"
+
+define i32 @pick(i32 %i) {
+entry:
+  %p0 = bitcast [8 x i32]* @ints to <4 x i32>*
+  %p1 = getelementptr [8 x i32]* @ints, i32 0, i32 4
+  %p1v = bitcast i32* %p1 to <4 x i32>*
+  %a = load <4 x i32>* %p0, align 4
+  %b = load <4 x i32>* %p1v, align 4
+  %sum = add <4 x i32> %a, %b
+  store <4 x i32> %sum, <4 x i32>* %p0, align 4
+  %r = extractelement <4 x i32> %sum, i32 %i
+  ret i32 %r
+}
+
+define i32 @asm_pick(i32 %i) section "asmjs" {
+entry:
+  %p0 = bitcast [8 x i32]* @heap to <4 x i32>*
+  %p1 = getelementptr [8 x i32]* @heap, i32 0, i32 4
+  %p1v = bitcast i32* %p1 to <4 x i32>*
+  %a = load <4 x i32>* %p0, align 4
+  %b = load <4 x i32>* %p1v, align 4
+  %sum = add <4 x i32> %a, %b
+  store <4 x i32> %sum, <4 x i32>* %p0, align 4
+  %r = extractelement <4 x i32> %sum, i32 %i
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+entry:
+  %a = call i32 @pick(i32 2)
+  %b = call i32 @asm_pick(i32 %a)
+  ret void
+}
@@ -0,0 +1,33 @@
+; The loop is vectorized by simd-run.test
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@xs = global [16 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15, i32 16], section "asmjs"
+@ys = global [16 x i32] [i32 16, i32 15, i32 14, i32 13, i32 12, i32 11, i32 10, i32 9, i32 8, i32 7, i32 6, i32 5, i32 4, i32 3, i32 2, i32 1], section "asmjs"
+
+define i32 @dot(i32 %n) section "asmjs" {
+entry:
+  %empty = icmp sle i32 %n, 0
+  br i1 %empty, label %exit, label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %px = getelementptr inbounds [16 x i32]* @xs, i32 0, i32 %i
+  %py = getelementptr inbounds [16 x i32]* @ys, i32 0, i32 %i
+  %x = load i32* %px, align 4
+  %y = load i32* %py, align 4
+  %m = mul i32 %x, %y
+  %s = shl i32 %m, 1
+  %acc.next = add i32 %acc, %s
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %r = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  ret i32 %r
+}
+
+define void @_Z7webMainv() section "asmjs" {
+  %r = call i32 @dot(i32 16)
+  ret void
+}
@@ -0,0 +1,62 @@
+#!/usr/bin/env python
+
+# Prints the section layout of a binary WebAssembly module, and the bytes of
+# every function body, so that FileCheck can check the encoding.
+#
+# The section sizes must add up to the file size and the known sections must
+# appear in increasing id order, otherwise the script fails.
+
+import sys
+
+SECTION_NAMES = ['custom', 'type', 'import', 'function', 'table', 'memory',
+                 'global', 'export', 'start', 'element', 'code', 'data']
+
+def read_uleb(data, pos):
+    result = 0
+    shift = 0
+    while True:
+        byte = data[pos]
+        pos += 1
+        result |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return result, pos
+
+def fail(message):
+    sys.stderr.write('wasm-dump: %s\n' % message)
+    sys.exit(1)
+
+def main():
+    with open(sys.argv[1], 'rb') as f:
+        data = bytearray(f.read())
+    if data[0:4] != bytearray(b'\0asm'):
+        fail('bad magic')
+    print('version %d' % (data[4] | data[5] << 8 | data[6] << 16 | data[7] << 24))
+    pos = 8
+    last_id = 0
+    while pos < len(data):
+        section_id = data[pos]
+        size, start = read_uleb(data, pos + 1)
+        end = start + size
+        if end > len(data):
+            fail('section %d overflows the file' % section_id)
+        if section_id >= len(SECTION_NAMES):
+            fail('unknown section %d' % section_id)
+        if section_id != 0:
+            if section_id <= last_id:
+                fail('section %d after section %d' % (section_id, last_id))
+            last_id = section_id
+        count, body = read_uleb(data, start)
+        print('section %s size %d count %d' % (SECTION_NAMES[section_id], size, count))
+        if SECTION_NAMES[section_id] == 'code':
+            for i in range(count):
+                body_size, body = read_uleb(data, body)
+                print('body %d: %s' % (i, ' '.join('%02x' % b for b in data[body:body + body_size])))
+                body += body_size
+            if body != end:
+                fail('function bodies do not fill the code section')
+        pos = end
+    print('end')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,12 @@
+// Validates a binary WebAssembly module, instantiates it and calls an export:
+//   node wasm-run.js module.wasm export [args...]
+var fs = require('fs');
+var bytes = fs.readFileSync(process.argv[2]);
+if (!WebAssembly.validate(bytes)) {
+	console.log('invalid');
+	process.exit(1);
+}
+console.log('valid');
+var instance = new WebAssembly.Instance(new WebAssembly.Module(bytes), {});
+var args = process.argv.slice(4).map(Number);
+console.log(process.argv[3] + ' = ' + instance.exports[process.argv[3]].apply(null, args));
@@ -0,0 +1,46 @@
+; RUN: llc -march=cheerp-wast -cheerp-wasm-binary -cheerp-wast-loader=%t.js -o %t.wasm < %s
+; RUN: %python %S/Inputs/wasm-dump.py %t.wasm | FileCheck %s
+; RUN: llc -march=cheerp-wast -cheerp-wasm-binary -cheerp-wast-loader=%t.js -cheerp-size-report=%t.json -o %t.wasm < %s
+; RUN: FileCheck --check-prefix=SIZE %s < %t.json
+; The sections of the binary module are in order and their sizes add up to
+; the file size, which wasm-dump.py checks, and integers use LEB128
+
+; CHECK: version 1
+; CHECK-NEXT: section type size 9 count 2
+; CHECK-NEXT: section function size 3 count 2
+; CHECK-NEXT: section memory size 3 count 1
+; CHECK-NEXT: section global size 8 count 1
+; CHECK-NEXT: section export size 32 count 3
+; CHECK-NEXT: section code size 59 count 2
+; CHECK-NEXT: body 0: {{.*}} 41 e5 8e 26 6a 41 c0 bb 78 6a {{.*}} 0f 0b
+; CHECK-NEXT: body 1: {{.*}} 41 07 10 00 1a {{.*}} 0f 0b
+; CHECK-NEXT: section data size 260 count 1
+; CHECK-NEXT: end
+
+; The size report counts the encoded function bodies with their size and the
+; data segment of each global
+; SIZE-DAG: {"name": "table", "kind": "global", "section": "asmjs", "output": "wasm", "bytes": 259}
+; SIZE-DAG: {"name": "big", "kind": "function", "section": "asmjs", "output": "wasm", "bytes": 39}
+; SIZE-DAG: {"name": "_Z7webMainv", "kind": "function", "section": "asmjs", "output": "wasm", "bytes": 19}
+; SIZE: "wasm_functions": 58,
+; SIZE-NEXT: "wasm_globals": 259
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+; The 256 bytes of data need a two byte section size
+@table = global [64 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8, i32 9, i32 10, i32 11, i32 12, i32 13, i32 14, i32 15, i32 16, i32 17, i32 18, i32 19, i32 20, i32 21, i32 22, i32 23, i32 24, i32 25, i32 26, i32 27, i32 28, i32 29, i32 30, i32 31, i32 32, i32 33, i32 34, i32 35, i32 36, i32 37, i32 38, i32 39, i32 40, i32 41, i32 42, i32 43, i32 44, i32 45, i32 46, i32 47, i32 48, i32 49, i32 50, i32 51, i32 52, i32 53, i32 54, i32 55, i32 56, i32 57, i32 58, i32 59, i32 60, i32 61, i32 62, i32 63, i32 64], section "asmjs"
+
+; 624485 and -123456 are encoded in three byte LEB128
+define i32 @big(i32 %x) section "asmjs" {
+  %a = add i32 %x, 624485
+  %b = add i32 %a, -123456
+  %p = getelementptr [64 x i32]* @table, i32 0, i32 2
+  %v = load i32* %p
+  %c = add i32 %b, %v
+  ret i32 %c
+}
+
+define void @_Z7webMainv() section "asmjs" {
+  %r = call i32 @big(i32 7)
+  ret void
+}
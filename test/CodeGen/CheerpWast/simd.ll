@@ -0,0 +1,112 @@
+; RUN: llc -march=cheerp-wast -cheerp-wasm-simd -o %t.wast < %s
+; RUN: FileCheck %s < %t.wast
+; RUN: llc -march=cheerp-wast -o %t.scalar.wast < %s
+; RUN: FileCheck --check-prefix=SCALAR %s < %t.scalar.wast
+; The vector operations of the asmjs section become 128-bit SIMD instructions,
+; the functions with operations which have no SIMD equivalent are scalarized.
+; Without -cheerp-wasm-simd every function is scalarized.
+
+; CHECK-LABEL: (func $ops
+; CHECK: (local i32 v128 v128 v128)
+; CHECK: v128.load
+; CHECK: v128.load
+; CHECK: i32x4.add
+; CHECK-NEXT: get_local 0
+; CHECK-NEXT: i32x4.splat
+; CHECK-NEXT: i32x4.mul
+; CHECK-NEXT: i32.const 1
+; CHECK-NEXT: i32x4.shl
+; CHECK-NEXT: v128.const i8x16 0 0 0 0 1 0 0 0 2 0 0 0 3 0 0 0
+; CHECK-NEXT: i32x4.sub
+; CHECK: i32x4.gt_s
+; CHECK-NEXT: v128.bitselect
+; CHECK-NEXT: get_local 3
+; CHECK-NEXT: i8x16.shuffle 12 13 14 15 24 25 26 27 4 5 6 7 0 1 2 3
+; CHECK: v128.store
+; CHECK: f32x4.convert_i32x4_s
+; CHECK-NEXT: f32x4.mul
+; CHECK: i32x4.trunc_sat_f32x4_s
+; CHECK: f32x4.lt
+; CHECK-NEXT: v128.const i8x16 1 0 0 0 1 0 0 0 1 0 0 0 1 0 0 0
+; CHECK-NEXT: v128.and
+; CHECK-NEXT: i32x4.add
+; CHECK: i32x4.extract_lane 0
+; CHECK: i32x4.extract_lane 1
+; CHECK: i32x4.extract_lane 3
+; CHECK: f32x4.lt
+; CHECK-NEXT: i32x4.extract_lane 2
+; CHECK-NEXT: i32.const 1
+; CHECK-NEXT: i32.and
+; CHECK-LABEL: (func $div
+; CHECK-NOT: v128
+; CHECK-NOT: x4
+; CHECK: i32.div_s
+; CHECK-LABEL: (func $_Z7webMainv
+
+; SCALAR-NOT: v128
+; SCALAR-NOT: x4
+; SCALAR-NOT: x16
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@ints = global [8 x i32] [i32 1, i32 2, i32 3, i32 4, i32 5, i32 6, i32 7, i32 8], section "asmjs"
+@floats = global [4 x float] [float 1.0, float 2.0, float 3.0, float 4.0], section "asmjs"
+
+; Memory, arithmetic, comparisons, masks, shuffles and conversions
+define i32 @ops(i32 %x) section "asmjs" {
+entry:
+  %p0 = bitcast [8 x i32]* @ints to <4 x i32>*
+  %p1 = getelementptr [8 x i32]* @ints, i32 0, i32 4
+  %p1v = bitcast i32* %p1 to <4 x i32>*
+  %a = load <4 x i32>* %p0, align 4
+  %b = load <4 x i32>* %p1v, align 4
+  %ins = insertelement <4 x i32> undef, i32 %x, i32 0
+  %splat = shufflevector <4 x i32> %ins, <4 x i32> undef, <4 x i32> zeroinitializer
+  %sum = add <4 x i32> %a, %b
+  %mul = mul <4 x i32> %sum, %splat
+  %shl = shl <4 x i32> %mul, <i32 1, i32 1, i32 1, i32 1>
+  %sub = sub <4 x i32> %shl, <i32 0, i32 1, i32 2, i32 3>
+  %cmp = icmp sgt <4 x i32> %sub, <i32 40, i32 40, i32 40, i32 40>
+  %sel = select <4 x i1> %cmp, <4 x i32> %sub, <4 x i32> %a
+  %rev = shufflevector <4 x i32> %sel, <4 x i32> %b, <4 x i32> <i32 3, i32 6, i32 1, i32 0>
+  store <4 x i32> %rev, <4 x i32>* %p0, align 4
+  %fp = bitcast [4 x float]* @floats to <4 x float>*
+  %f = load <4 x float>* %fp, align 4
+  %fi = sitofp <4 x i32> %rev to <4 x float>
+  %fm = fmul <4 x float> %f, %fi
+  %fc = fcmp olt <4 x float> %fm, <float 100.0, float 100.0, float 100.0, float 100.0>
+  %fz = zext <4 x i1> %fc to <4 x i32>
+  %fb = fptosi <4 x float> %fm to <4 x i32>
+  %t = add <4 x i32> %fb, %fz
+  %m = extractelement <4 x i1> %fc, i32 2
+  %e0 = extractelement <4 x i32> %t, i32 0
+  %e1 = extractelement <4 x i32> %t, i32 1
+  %e3 = extractelement <4 x i32> %t, i32 3
+  %r0 = add i32 %e0, %e1
+  %r1 = add i32 %r0, %e3
+  %mz = zext i1 %m to i32
+  %r = add i32 %r1, %mz
+  ret i32 %r
+}
+
+; There is no SIMD integer division, the whole function is scalarized
+define i32 @div(i32 %x) section "asmjs" {
+entry:
+  %p0 = bitcast [8 x i32]* @ints to <4 x i32>*
+  %a = load <4 x i32>* %p0, align 4
+  %ins = insertelement <4 x i32> undef, i32 %x, i32 0
+  %splat = shufflevector <4 x i32> %ins, <4 x i32> undef, <4 x i32> zeroinitializer
+  %q = sdiv <4 x i32> %a, %splat
+  %s = add <4 x i32> %q, %a
+  store <4 x i32> %s, <4 x i32>* %p0, align 4
+  %e0 = extractelement <4 x i32> %s, i32 0
+  %e3 = extractelement <4 x i32> %s, i32 3
+  %r = add i32 %e0, %e3
+  ret i32 %r
+}
+
+define void @_Z7webMainv() section "asmjs" {
+  %r = call i32 @ops(i32 3)
+  %q = call i32 @div(i32 %r)
+  ret void
+}
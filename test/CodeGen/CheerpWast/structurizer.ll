@@ -0,0 +1,176 @@
+; RUN: llc -march=cheerp-wast -cheerp-wast-loader=%t.js -o - < %s | FileCheck --strict-whitespace %s
+; Reducible CFGs are structured directly into block/loop/br nesting, without
+; the label local that the relooper uses to dispatch between blocks.
+; Irreducible CFGs still go through the relooper.
+
+; Nested loops with a continue of the inner loop and a break out of both
+; CHECK-LABEL: (func $nested
+; CHECK-NOT: if
+; CHECK: {{^}}loop
+; CHECK: {{^}}  loop
+; CHECK-NEXT: {{^}}    block
+; CHECK-NEXT: {{^}}      block
+; CHECK: i32.eq
+; CHECK-NEXT: br_if 0
+; CHECK: i32.gt_s
+; CHECK-NEXT: br_if 1
+; CHECK-NEXT: br 0
+; CHECK-NEXT: {{^}}      end
+; CHECK-NOT: if
+; CHECK: i32.lt_s
+; CHECK-NEXT: br_if 1
+; CHECK-NOT: if
+; CHECK: i32.lt_s
+; CHECK-NEXT: br_if 2
+; CHECK-NOT: if
+; CHECK: br 0
+; CHECK-NEXT: {{^}}    end
+; CHECK-NOT: if
+; CHECK: return
+; CHECK-NEXT: {{^}}  end
+; CHECK-NEXT: {{^}}end
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+define i32 @nested(i32 %n, i32 %m) section "asmjs" {
+entry:
+  br label %outer
+outer:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.inner, %outer.latch ]
+  br label %inner
+inner:
+  %j = phi i32 [ 0, %outer ], [ %j.next, %inner.latch ]
+  %acc.j = phi i32 [ %acc, %outer ], [ %acc.next, %inner.latch ]
+  %odd = and i32 %j, 1
+  %skip = icmp eq i32 %odd, 0
+  br i1 %skip, label %inner.latch, label %body
+body:
+  %stop = icmp sgt i32 %acc.j, 1000
+  br i1 %stop, label %exit, label %inner.latch
+inner.latch:
+  %acc.next = add i32 %acc.j, %j
+  %j.next = add i32 %j, 1
+  %inner.c = icmp slt i32 %j.next, %m
+  br i1 %inner.c, label %inner, label %outer.latch
+outer.latch:
+  %acc.inner = phi i32 [ %acc.next, %inner.latch ]
+  %i.next = add i32 %i, 1
+  %outer.c = icmp slt i32 %i.next, %n
+  br i1 %outer.c, label %outer, label %exit
+exit:
+  %r = phi i32 [ %acc.j, %body ], [ %acc.inner, %outer.latch ]
+  ret i32 %r
+}
+
+; Dense cases use br_table, the blocks of duplicate cases are shared
+; CHECK-LABEL: (func $dense
+; CHECK: {{^}}block
+; CHECK-NEXT: {{^}}  block
+; CHECK-NEXT: {{^}}    block
+; CHECK-NEXT: {{^}}      block
+; CHECK-NEXT: {{^}}        block
+; CHECK-NEXT: get_local 0
+; CHECK-NEXT: br_table 1 2 3 2 0
+; CHECK-NEXT: {{^}}        end
+; CHECK: i32.const 40
+; CHECK: br 3
+; CHECK-NEXT: {{^}}      end
+; CHECK: i32.const 10
+; CHECK: br 2
+; CHECK-NEXT: {{^}}    end
+; CHECK: i32.const 20
+; CHECK: br 1
+; CHECK-NEXT: {{^}}  end
+; CHECK: i32.const 30
+; CHECK: br 0
+; CHECK-NEXT: {{^}}end
+define i32 @dense(i32 %x) section "asmjs" {
+entry:
+  switch i32 %x, label %def [
+    i32 0, label %a
+    i32 1, label %b
+    i32 2, label %c
+    i32 3, label %b
+  ]
+a:
+  br label %exit
+b:
+  br label %exit
+c:
+  br label %exit
+def:
+  br label %exit
+exit:
+  %r = phi i32 [ 10, %a ], [ 20, %b ], [ 30, %c ], [ 40, %def ]
+  ret i32 %r
+}
+
+; Sparse cases use a br_if chain
+; CHECK-LABEL: (func $sparse
+; CHECK-NOT: br_table
+; CHECK: i32.const 1
+; CHECK-NEXT: i32.eq
+; CHECK-NEXT: br_if 1
+; CHECK: i32.const 1000
+; CHECK-NEXT: i32.eq
+; CHECK-NEXT: br_if 2
+; CHECK-NEXT: br 0
+define i32 @sparse(i32 %x) section "asmjs" {
+entry:
+  switch i32 %x, label %def [
+    i32 1, label %a
+    i32 1000, label %b
+  ]
+a:
+  br label %exit
+b:
+  br label %exit
+def:
+  br label %exit
+exit:
+  %r = phi i32 [ 10, %a ], [ 20, %b ], [ 40, %def ]
+  ret i32 %r
+}
+
+; A loop with two entries falls back to the relooper label dispatch
+; CHECK-LABEL: (func $irreducible
+; CHECK: i32.const 1
+; CHECK-NEXT: set_local [[LABEL:[0-9]+]]
+; CHECK: {{^}}loop
+; CHECK-NEXT: {{^}}block
+; CHECK-NEXT: i32.const 1
+; CHECK-NEXT: get_local [[LABEL]]
+; CHECK-NEXT: i32.eq
+; CHECK-NEXT: {{^}}  if
+; CHECK: {{^}}  end
+; CHECK-NEXT: i32.const 2
+; CHECK-NEXT: get_local [[LABEL]]
+; CHECK-NEXT: i32.eq
+; CHECK-NEXT: {{^}}  if
+define i32 @irreducible(i32 %x, i32 %n) section "asmjs" {
+entry:
+  %c = icmp sgt i32 %x, 0
+  br i1 %c, label %left, label %right
+left:
+  %l = phi i32 [ %x, %entry ], [ %r1, %right ]
+  %l1 = add i32 %l, 1
+  %lc = icmp slt i32 %l1, %n
+  br i1 %lc, label %right, label %exit
+right:
+  %r = phi i32 [ 0, %entry ], [ %l1, %left ]
+  %r1 = add i32 %r, 2
+  %rc = icmp slt i32 %r1, %n
+  br i1 %rc, label %left, label %exit
+exit:
+  %e = phi i32 [ %l1, %left ], [ %r1, %right ]
+  ret i32 %e
+}
+
+define void @_Z7webMainv() section "asmjs" {
+  %a = call i32 @nested(i32 3, i32 4)
+  %b = call i32 @dense(i32 %a)
+  %c = call i32 @sparse(i32 %b)
+  %d = call i32 @irreducible(i32 %c, i32 9)
+  ret void
+}
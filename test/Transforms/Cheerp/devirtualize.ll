@@ -0,0 +1,94 @@
+; RUN: opt < %s -Devirtualizer -S | FileCheck %s
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@one = global i32 (i32, i32)* @one_target
+@two = global [2 x float (float)*] [float (float)* @two_a, float (float)* @two_b]
+@casted = global i32 (i8*)* bitcast (i32 (double)* @cast_target to i32 (i8*)*)
+@asm_one = global i32 (i32)* @asm_target
+
+define i32 @one_target(i32 %x, i32 %y) {
+  ret i32 %x
+}
+
+define float @two_a(float %x) {
+  ret float %x
+}
+
+define float @two_b(float %x) {
+  %y = fadd float %x, 1.0
+  ret float %y
+}
+
+define i32 @cast_target(double %d) {
+  %v = fptosi double %d to i32
+  ret i32 %v
+}
+
+define i32 @other_ptr_target(i8* %p) {
+  ret i32 0
+}
+
+define i32 @asm_target(i32 %x) section "asmjs" {
+  ret i32 %x
+}
+
+; A single generic JS target is called directly, the indirect call stays as
+; a fallback for pointers coming from JavaScript
+define i32 @call_one(i32 (i32, i32)* %f) {
+; CHECK-LABEL: @call_one(
+; CHECK: icmp eq i32 (i32, i32)* %f, @one_target
+; CHECK: call i32 @one_target(i32 1, i32 2)
+; CHECK: call i32 %f(i32 1, i32 2)
+  %r = call i32 %f(i32 1, i32 2)
+  ret i32 %r
+}
+
+; Two generic JS targets become two guarded direct calls plus the fallback
+define float @call_two(float (float)* %f) {
+; CHECK-LABEL: @call_two(
+; CHECK: icmp eq float (float)* %f, @two_a
+; CHECK: call float @two_a(float 1.000000e+00)
+; CHECK: icmp eq float (float)* %f, @two_b
+; CHECK: call float @two_b(float 1.000000e+00)
+; CHECK: call float %f(float 1.000000e+00)
+; CHECK: phi float
+  %r = call float %f(float 1.0)
+  ret float %r
+}
+
+; A function whose address is taken through a cast to an incompatible type is
+; a target of the calls through the cast type
+define i32 @call_casted(i32 (i8*)* %f, i8* %p) {
+; CHECK-LABEL: @call_casted(
+; CHECK-DAG: icmp eq i32 (i8*)* %f, bitcast (i32 (double)* @cast_target to i32 (i8*)*)
+; CHECK-DAG: icmp eq i32 (i8*)* %f, @other_ptr_target
+; CHECK: call i32 %f(i8* %p)
+  %r = call i32 %f(i8* %p)
+  ret i32 %r
+}
+
+; The asm.js function tables are complete, so no fallback is needed
+define i32 @call_asm(i32 (i32)* %f) section "asmjs" {
+; CHECK-LABEL: @call_asm(
+; CHECK-NOT: icmp
+; CHECK: call i32 @asm_target(i32 2)
+; CHECK-NOT: call i32 %f
+; CHECK: ret i32
+  %r = call i32 %f(i32 2)
+  ret i32 %r
+}
+
+define void @_Z7webMainv() {
+  %f1 = load i32 (i32, i32)** @one
+  %r1 = call i32 @call_one(i32 (i32, i32)* %f1)
+  %t = getelementptr [2 x float (float)*]* @two, i32 0, i32 1
+  %f2 = load float (float)** %t
+  %r2 = call float @call_two(float (float)* %f2)
+  %f3 = load i32 (i8*)** @casted
+  %r3 = call i32 @call_casted(i32 (i8*)* %f3, i8* null)
+  %r4 = call i32 @call_casted(i32 (i8*)* @other_ptr_target, i8* null)
+  %f5 = load i32 (i32)** @asm_one
+  %r5 = call i32 @call_asm(i32 (i32)* %f5)
+  ret void
+}
@@ -0,0 +1,188 @@
+; RUN: opt < %s -PreExecute -S | FileCheck %s
+; The constructor is executed at compile time and its results become the
+; initializers of the globals. It covers the fast paths of the interpreter and
+; the instructions created by intrinsic lowering.
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.rec = type { i8, i32, [4 x i16] }
+
+; CHECK: @ints = global [12 x i32] [i32 -3, i32 -1, i32 2147483647, i32 3, i32 -8, i32 -2, i32 249, i32 -1, i32 15, i32 4, i32 1, i32 1]
+; CHECK: @wide = global [8 x i32] [i32 1431655763, i32 1431655765, i32 0, i32 -7, i32 1, i32 0, i32 42, i32 0]
+; CHECK: @flags = global [8 x i8] c"\01\00\01\01\01\00\01\00"
+; CHECK: @rec = global %struct.rec { i8 -7, i32 -77, [4 x i16] [i16 0, i16 -1, i16 2, i16 0] }
+; CHECK: @fib = global [2 x i32] [i32 55, i32 89]
+; CHECK: @reals = global { float, double } { float 1.500000e+00, double 2.250000e+00 }
+; CHECK: @picked = global i32* getelementptr inbounds ([12 x i32]* @ints, i32 0, i32 3)
+; CHECK-NOT: @llvm.global_ctors
+@ints = global [12 x i32] zeroinitializer
+@wide = global [8 x i32] zeroinitializer
+@flags = global [8 x i8] zeroinitializer
+@rec = global %struct.rec zeroinitializer
+@fib = global [2 x i32] zeroinitializer
+@reals = global { float, double } zeroinitializer
+@picked = global i32* null
+
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @init }]
+
+declare i32 @llvm.ctpop.i32(i32)
+
+define internal i32 @divide(i32 %a, i32 %b) {
+entry:
+  %q = sdiv i32 %a, %b
+  ret i32 %q
+}
+
+define internal void @init() {
+entry:
+  %m7 = sub i32 0, 7
+  ; Signed and unsigned divisions of negative values
+  %d0 = call i32 @divide(i32 %m7, i32 2)
+  %r0 = srem i32 %m7, 3
+  %u0 = udiv i32 -2, 2
+  %u1 = urem i32 %m7, 6
+  ; Shifts, the arithmetic one keeps the sign
+  %s0 = shl i32 %m7, 31
+  %s1 = ashr i32 %s0, 28
+  %s2 = lshr i32 %m7, 31
+  %s3 = ashr i32 %m7, 2
+  ; Casts through narrower and wider integers
+  %t0 = trunc i32 %m7 to i8
+  %t1 = zext i8 %t0 to i32
+  %t2 = sext i8 %t0 to i32
+  %t3 = trunc i32 %t1 to i4
+  %t4 = zext i4 %t3 to i32
+  ; Lowered to a sequence of shifts, masks and adds
+  %p0 = call i32 @llvm.ctpop.i32(i32 %t1)
+  %p1 = call i32 @llvm.ctpop.i32(i32 15)
+  %a0 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 0
+  store i32 %d0, i32* %a0
+  %a1 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 1
+  store i32 %r0, i32* %a1
+  %a2 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 2
+  store i32 %u0, i32* %a2
+  %a3 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 3
+  store i32 %u1, i32* %a3
+  %a4 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 4
+  store i32 %s1, i32* %a4
+  %a5 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 5
+  store i32 %s3, i32* %a5
+  %a6 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 6
+  store i32 %t1, i32* %a6
+  %a7 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 7
+  %s2m = sub i32 0, %s2
+  store i32 %s2m, i32* %a7
+  %a8 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 8
+  %t4x = xor i32 %t4, 6
+  store i32 %t4x, i32* %a8
+  %a9 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 9
+  store i32 %p1, i32* %a9
+  %a10 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 10
+  %p0m = sub i32 %p0, 5
+  store i32 %p0m, i32* %a10
+  %a11 = getelementptr inbounds [12 x i32]* @ints, i32 0, i32 11
+  %t2m = add i32 %t2, 8
+  store i32 %t2m, i32* %a11
+  ; 64 bit values
+  %w0 = sext i32 %m7 to i64
+  %w1 = udiv i64 %w0, 3
+  %w2 = shl i64 %w0, 32
+  %w3 = ashr i64 %w2, 63
+  %w4 = and i64 %w3, 1
+  %w5 = mul i64 %w0, -6
+  ; The initializers are computed from i32 elements, store both halves
+  %wb = bitcast [8 x i32]* @wide to i64*
+  store i64 %w1, i64* %wb
+  %b1 = getelementptr inbounds i64* %wb, i64 1
+  store i64 %w2, i64* %b1
+  %b2 = getelementptr inbounds i64* %wb, i32 2
+  store i64 %w4, i64* %b2
+  %b3 = getelementptr inbounds i64* %wb, i32 3
+  store i64 %w5, i64* %b3
+  ; Signed, unsigned and pointer comparisons, the results are stored as i1
+  %c0 = icmp slt i32 %m7, 0
+  %c1 = icmp ult i32 %m7, 0
+  %c2 = icmp sgt i8 %t0, -8
+  %c3 = icmp ugt i8 %t0, -8
+  %c4 = icmp ult i32* %a0, %a1
+  %c5 = icmp sgt i32* %a0, %a1
+  %c6 = icmp eq i64 %w4, 1
+  %c7 = icmp ne i64 %w4, 1
+  %f0 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 0
+  %f0b = bitcast i8* %f0 to i1*
+  store i1 %c0, i1* %f0b
+  %f1 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 1
+  %f1b = bitcast i8* %f1 to i1*
+  store i1 %c1, i1* %f1b
+  %f2 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 2
+  %f2b = bitcast i8* %f2 to i1*
+  store i1 %c2, i1* %f2b
+  %f3 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 3
+  %f3b = bitcast i8* %f3 to i1*
+  store i1 %c3, i1* %f3b
+  %f4 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 4
+  %f4b = bitcast i8* %f4 to i1*
+  store i1 %c4, i1* %f4b
+  %f5 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 5
+  %f5b = bitcast i8* %f5 to i1*
+  store i1 %c5, i1* %f5b
+  %f6 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 6
+  %f6b = bitcast i8* %f6 to i1*
+  store i1 %c6, i1* %f6b
+  %f7 = getelementptr inbounds [8 x i8]* @flags, i32 0, i32 7
+  %f7b = bitcast i8* %f7 to i1*
+  store i1 %c7, i1* %f7b
+  ; Loads and stores through struct fields and variable array indices
+  %g0 = getelementptr inbounds %struct.rec* @rec, i32 0, i32 0
+  store i8 %t0, i8* %g0
+  %g1 = getelementptr inbounds %struct.rec* @rec, i32 0, i32 1
+  %l0 = load i8* %g0
+  %l1 = sext i8 %l0 to i32
+  %l2 = mul i32 %l1, 11
+  store i32 %l2, i32* %g1
+  %i1 = add i32 %s2, 0
+  %g2 = getelementptr inbounds %struct.rec* @rec, i32 0, i32 2, i32 %i1
+  store i16 -1, i16* %g2
+  %i2 = add i64 %w4, 1
+  %g3 = getelementptr inbounds %struct.rec* @rec, i64 0, i32 2, i64 %i2
+  %v0 = select i1 %c0, i16 2, i16 3
+  store i16 %v0, i16* %g3
+  ; A loop with swapped PHIs and a switch
+  br label %loop
+
+loop:
+  %x = phi i32 [ 0, %entry ], [ %y, %latch ]
+  %y = phi i32 [ 1, %entry ], [ %z, %latch ]
+  %n = phi i32 [ 0, %entry ], [ %n.next, %latch ]
+  %z = add i32 %x, %y
+  %n.next = add i32 %n, 1
+  switch i32 %n.next, label %latch [
+    i32 10, label %exit
+    i32 20, label %loop.dead
+  ]
+
+loop.dead:
+  unreachable
+
+latch:
+  br label %loop
+
+exit:
+  %e0 = getelementptr inbounds [2 x i32]* @fib, i32 0, i32 0
+  store i32 %y, i32* %e0
+  %e1 = getelementptr inbounds [2 x i32]* @fib, i32 0, i32 1
+  store i32 %z, i32* %e1
+  ; Floating point loads and stores
+  %h0 = getelementptr inbounds { float, double }* @reals, i32 0, i32 0
+  store float 1.500000e+00, float* %h0
+  %h1 = getelementptr inbounds { float, double }* @reals, i32 0, i32 1
+  %h2 = load float* %h0
+  %h3 = fpext float %h2 to double
+  %h4 = fmul double %h3, %h3
+  store double %h4, double* %h1
+  ; A pointer selected by a comparison of pointers
+  %q0 = icmp uge i32* %a3, %a2
+  %q1 = select i1 %q0, i32* %a3, i32* %a2
+  store i32* %q1, i32** @picked
+  ret void
+}
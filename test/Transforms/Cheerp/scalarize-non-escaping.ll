@@ -0,0 +1,134 @@
+; RUN: opt < %s -ScalarizeNonEscapingObjects -S | FileCheck %s
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.pair = type { i32, float }
+%struct.outer = type { i32, %struct.pair }
+
+@escaped = global %struct.pair* null
+@escaped_field = global i32* null
+
+declare i8* @malloc(i32)
+declare void @free(i8*)
+declare void @take_pair(%struct.pair*)
+declare void @take_bytes(i8*)
+declare void @llvm.lifetime.start.p0i8(i64, i8*)
+declare void @llvm.lifetime.end.p0i8(i64, i8*)
+
+; Fields only accessed through constant GEPs become SSA values
+; CHECK-LABEL: define float @local(
+; CHECK-NOT: alloca
+; CHECK-NOT: getelementptr
+; CHECK: sitofp i32 %x to float
+; CHECK: ret float
+define float @local(i32 %x, float %y) {
+entry:
+  %p = alloca %struct.pair
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  %b = getelementptr inbounds %struct.pair* %p, i32 0, i32 1
+  store i32 %x, i32* %a
+  store float %y, float* %b
+  %x1 = load i32* %a
+  %y1 = load float* %b
+  %xf = sitofp i32 %x1 to float
+  %r = fadd float %xf, %y1
+  ret float %r
+}
+
+; Nested members and lifetime markers, unwritten fields read as zero
+; CHECK-LABEL: define i32 @nested(
+; CHECK-NOT: alloca
+; CHECK-NOT: lifetime
+; CHECK: add i32 %x, 0
+define i32 @nested(i32 %x) {
+entry:
+  %o = alloca %struct.outer
+  %c = bitcast %struct.outer* %o to i8*
+  call void @llvm.lifetime.start.p0i8(i64 12, i8* %c)
+  %a = getelementptr inbounds %struct.outer* %o, i32 0, i32 1, i32 0
+  store i32 %x, i32* %a
+  %b = getelementptr inbounds %struct.outer* %o, i32 0, i32 0
+  %x1 = load i32* %a
+  %y1 = load i32* %b
+  %r = add i32 %x1, %y1
+  call void @llvm.lifetime.end.p0i8(i64 12, i8* %c)
+  ret i32 %r
+}
+
+; A single object from malloc which is freed in the same function
+; CHECK-LABEL: define i32 @heap(
+; CHECK-NOT: @malloc
+; CHECK-NOT: @free
+; CHECK: ret i32 %x
+define i32 @heap(i32 %x) {
+entry:
+  %m = call i8* @malloc(i32 8)
+  %p = bitcast i8* %m to %struct.pair*
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  %x1 = load i32* %a
+  call void @free(i8* %m)
+  ret i32 %x1
+}
+
+; CHECK-LABEL: define void @stored(
+; CHECK: alloca %struct.pair
+; CHECK: store %struct.pair* %p, %struct.pair** @escaped
+define void @stored(i32 %x) {
+entry:
+  %p = alloca %struct.pair
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  store %struct.pair* %p, %struct.pair** @escaped
+  ret void
+}
+
+; CHECK-LABEL: define void @field_stored(
+; CHECK: alloca %struct.pair
+; CHECK: store i32* %a, i32** @escaped_field
+define void @field_stored(i32 %x) {
+entry:
+  %p = alloca %struct.pair
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  store i32* %a, i32** @escaped_field
+  ret void
+}
+
+; CHECK-LABEL: define void @passed(
+; CHECK: alloca %struct.pair
+; CHECK: call void @take_pair(%struct.pair* %p)
+define void @passed(i32 %x) {
+entry:
+  %p = alloca %struct.pair
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  call void @take_pair(%struct.pair* %p)
+  ret void
+}
+
+; CHECK-LABEL: define %struct.pair* @returned(
+; CHECK: call i8* @malloc(i32 8)
+; CHECK: ret %struct.pair* %p
+define %struct.pair* @returned(i32 %x) {
+entry:
+  %m = call i8* @malloc(i32 8)
+  %p = bitcast i8* %m to %struct.pair*
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  ret %struct.pair* %p
+}
+
+; Casts are only allowed to reach free/delete and lifetime markers
+; CHECK-LABEL: define void @casted(
+; CHECK: alloca %struct.pair
+; CHECK: call void @take_bytes(i8* %c)
+define void @casted(i32 %x) {
+entry:
+  %p = alloca %struct.pair
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  %c = bitcast %struct.pair* %p to i8*
+  call void @take_bytes(i8* %c)
+  ret void
+}
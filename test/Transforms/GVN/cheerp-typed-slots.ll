@@ -0,0 +1,113 @@
+; RUN: opt < %s -basicaa -gvn -S | FileCheck %s
+; Cheerp: on non byte addressable targets values are only forwarded between
+; accesses to the same typed slot
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+
+%struct.pair = type { i32, i32 }
+%struct.Base = type { i32 }
+%struct.Derived = type directbase %struct.Base { i32, i32 }
+
+define i32 @same_slot(%struct.pair* %p, i32 %x) {
+; CHECK-LABEL: @same_slot(
+; CHECK-NOT: load
+; CHECK: ret i32 %x
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 1
+  store i32 %x, i32* %a
+  %b = getelementptr inbounds %struct.pair* %p, i32 0, i32 1
+  %v = load i32* %b
+  ret i32 %v
+}
+
+define i32 @same_array_element([4 x i32]* %p, i32 %x) {
+; CHECK-LABEL: @same_array_element(
+; CHECK-NOT: load
+; CHECK: ret i32 %x
+  %a = getelementptr inbounds [4 x i32]* %p, i32 0, i32 1
+  %a1 = getelementptr inbounds i32* %a, i32 1
+  store i32 %x, i32* %a1
+  %b = getelementptr inbounds [4 x i32]* %p, i32 0, i32 2
+  %v = load i32* %b
+  ret i32 %v
+}
+
+define i32 @different_fields(%struct.pair* %p, i32 %x) {
+; CHECK-LABEL: @different_fields(
+; CHECK: %v = load i32* %b
+; CHECK: ret i32 %v
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  %b = getelementptr inbounds %struct.pair* %p, i32 0, i32 1
+  %v = load i32* %b
+  ret i32 %v
+}
+
+define float @different_types(%struct.pair* %p, i32 %x) {
+; CHECK-LABEL: @different_types(
+; CHECK: %v = load float* %b
+; CHECK: ret float %v
+  %a = getelementptr inbounds %struct.pair* %p, i32 0, i32 0
+  store i32 %x, i32* %a
+  %b = bitcast i32* %a to float*
+  %v = load float* %b
+  ret float %v
+}
+
+define i32 @base_field(%struct.Derived* %d, i32 %x) {
+; CHECK-LABEL: @base_field(
+; CHECK-NOT: load
+; CHECK: ret i32 %x
+  %a = getelementptr inbounds %struct.Derived* %d, i32 0, i32 0
+  store i32 %x, i32* %a
+  %base = bitcast %struct.Derived* %d to %struct.Base*
+  %b = getelementptr inbounds %struct.Base* %base, i32 0, i32 0
+  %v = load i32* %b
+  ret i32 %v
+}
+
+define i32 @derived_field(%struct.Derived* %d, i32 %x) {
+; CHECK-LABEL: @derived_field(
+; CHECK: %v = load i32* %b
+; CHECK: ret i32 %v
+  %base = bitcast %struct.Derived* %d to %struct.Base*
+  %a = getelementptr inbounds %struct.Base* %base, i32 0, i32 0
+  store i32 %x, i32* %a
+  %b = getelementptr inbounds %struct.Derived* %d, i32 0, i32 1
+  %v = load i32* %b
+  ret i32 %v
+}
+
+define %struct.Base* @upcast_store(%struct.Derived** %slot, %struct.Derived* %d) {
+; CHECK-LABEL: @upcast_store(
+; CHECK-NOT: load
+; CHECK: [[CAST:%.*]] = bitcast %struct.Derived* %d to %struct.Base*
+; CHECK: ret %struct.Base* [[CAST]]
+  store %struct.Derived* %d, %struct.Derived** %slot
+  %s = bitcast %struct.Derived** %slot to %struct.Base**
+  %v = load %struct.Base** %s
+  ret %struct.Base* %v
+}
+
+define %struct.Base* @upcast_load(%struct.Derived** %slot) {
+; CHECK-LABEL: @upcast_load(
+; CHECK: %d = load %struct.Derived** %slot
+; CHECK-NOT: load
+; CHECK: [[CAST:%.*]] = bitcast %struct.Derived* %d to %struct.Base*
+; CHECK: ret %struct.Base* [[CAST]]
+  %d = load %struct.Derived** %slot
+  call void @use(%struct.Derived* %d)
+  %s = bitcast %struct.Derived** %slot to %struct.Base**
+  %v = load %struct.Base** %s
+  ret %struct.Base* %v
+}
+
+define %struct.Derived* @downcast_store(%struct.Base** %slot, %struct.Base* %b) {
+; CHECK-LABEL: @downcast_store(
+; CHECK: %v = load %struct.Derived** %s
+; CHECK: ret %struct.Derived* %v
+  store %struct.Base* %b, %struct.Base** %slot
+  %s = bitcast %struct.Base** %slot to %struct.Derived**
+  %v = load %struct.Derived** %s
+  ret %struct.Derived* %v
+}
+
+declare void @use(%struct.Derived*) readonly
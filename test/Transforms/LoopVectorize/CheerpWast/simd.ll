@@ -0,0 +1,89 @@
+; RUN: opt < %s -march=cheerp-wast -cheerp-wasm-simd -basicaa -loop-vectorize -S | FileCheck %s
+; RUN: opt < %s -march=cheerp-wast -basicaa -loop-vectorize -S | FileCheck --check-prefix=NOSIMD %s
+; Only the loops of the asmjs section are vectorized, and only when the wasm
+; module can use 128-bit SIMD instructions for all the vector operations
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+; NOSIMD-NOT: x i32>
+; NOSIMD-NOT: x float>
+
+; CHECK-LABEL: @sum(
+; CHECK: vector.body:
+; CHECK: %vec.phi = phi <4 x i32>
+; CHECK: load <4 x i32>*
+; CHECK: load <4 x i32>*
+; CHECK: mul <4 x i32>
+; CHECK: shl <4 x i32> {{.*}}, <i32 1, i32 1, i32 1, i32 1>
+; CHECK: store <4 x i32>
+; CHECK: add <4 x i32> %vec.phi
+; CHECK: middle.block:
+; CHECK: shufflevector <4 x i32>
+; CHECK: extractelement <4 x i32>
+; CHECK: ret i32
+define i32 @sum(i32* noalias %a, i32* noalias %b, i32 %n) section "asmjs" {
+entry:
+  %empty = icmp sle i32 %n, 0
+  br i1 %empty, label %exit, label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  %pa = getelementptr inbounds i32* %a, i32 %i
+  %pb = getelementptr inbounds i32* %b, i32 %i
+  %va = load i32* %pa, align 4
+  %vb = load i32* %pb, align 4
+  %m = mul i32 %va, %vb
+  %s = shl i32 %m, 1
+  store i32 %s, i32* %pa, align 4
+  %acc.next = add i32 %acc, %s
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  %r = phi i32 [ 0, %entry ], [ %acc.next, %loop ]
+  ret i32 %r
+}
+
+; There is no SIMD integer division, the function would be scalarized
+; CHECK-LABEL: @divide(
+; CHECK-NOT: x i32>
+; CHECK: ret void
+define void @divide(i32* noalias %a, i32* noalias %b, i32 %n) section "asmjs" {
+entry:
+  %empty = icmp sle i32 %n, 0
+  br i1 %empty, label %exit, label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds i32* %a, i32 %i
+  %pb = getelementptr inbounds i32* %b, i32 %i
+  %va = load i32* %pa, align 4
+  %vb = load i32* %pb, align 4
+  %d = sdiv i32 %va, %vb
+  store i32 %d, i32* %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+; JavaScript functions do not use linear memory
+; CHECK-LABEL: @scale(
+; CHECK-NOT: x float>
+; CHECK: ret void
+define void @scale(float* noalias %a, float %k, i32 %n) {
+entry:
+  %empty = icmp sle i32 %n, 0
+  br i1 %empty, label %exit, label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr inbounds float* %a, i32 %i
+  %va = load float* %pa, align 4
+  %m = fmul float %va, %k
+  store float %m, float* %pa, align 4
+  %i.next = add nsw i32 %i, 1
+  %c = icmp slt i32 %i.next, %n
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
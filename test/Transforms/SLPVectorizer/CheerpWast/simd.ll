@@ -0,0 +1,72 @@
+; RUN: opt < %s -march=cheerp-wast -cheerp-wasm-simd -basicaa -slp-vectorizer -S | FileCheck %s
+; RUN: opt < %s -march=cheerp-wast -basicaa -slp-vectorizer -S | FileCheck --check-prefix=NOSIMD %s
+; Straight line code of the asmjs section is vectorized when the wasm module
+; can use 128-bit SIMD instructions
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+; NOSIMD-NOT: x float>
+
+; CHECK-LABEL: @add4(
+; CHECK: load <4 x float>*
+; CHECK: load <4 x float>*
+; CHECK: fadd <4 x float>
+; CHECK: store <4 x float>
+; CHECK: ret void
+define void @add4(float* noalias %a, float* noalias %b) section "asmjs" {
+entry:
+  %a1 = getelementptr inbounds float* %a, i32 1
+  %a2 = getelementptr inbounds float* %a, i32 2
+  %a3 = getelementptr inbounds float* %a, i32 3
+  %b1 = getelementptr inbounds float* %b, i32 1
+  %b2 = getelementptr inbounds float* %b, i32 2
+  %b3 = getelementptr inbounds float* %b, i32 3
+  %x0 = load float* %a, align 4
+  %x1 = load float* %a1, align 4
+  %x2 = load float* %a2, align 4
+  %x3 = load float* %a3, align 4
+  %y0 = load float* %b, align 4
+  %y1 = load float* %b1, align 4
+  %y2 = load float* %b2, align 4
+  %y3 = load float* %b3, align 4
+  %z0 = fadd float %x0, %y0
+  %z1 = fadd float %x1, %y1
+  %z2 = fadd float %x2, %y2
+  %z3 = fadd float %x3, %y3
+  store float %z0, float* %a, align 4
+  store float %z1, float* %a1, align 4
+  store float %z2, float* %a2, align 4
+  store float %z3, float* %a3, align 4
+  ret void
+}
+
+; JavaScript functions do not use linear memory
+; CHECK-LABEL: @add4_js(
+; CHECK-NOT: x float>
+; CHECK: ret void
+define void @add4_js(float* noalias %a, float* noalias %b) {
+entry:
+  %a1 = getelementptr inbounds float* %a, i32 1
+  %a2 = getelementptr inbounds float* %a, i32 2
+  %a3 = getelementptr inbounds float* %a, i32 3
+  %b1 = getelementptr inbounds float* %b, i32 1
+  %b2 = getelementptr inbounds float* %b, i32 2
+  %b3 = getelementptr inbounds float* %b, i32 3
+  %x0 = load float* %a, align 4
+  %x1 = load float* %a1, align 4
+  %x2 = load float* %a2, align 4
+  %x3 = load float* %a3, align 4
+  %y0 = load float* %b, align 4
+  %y1 = load float* %b1, align 4
+  %y2 = load float* %b2, align 4
+  %y3 = load float* %b3, align 4
+  %z0 = fadd float %x0, %y0
+  %z1 = fadd float %x1, %y1
+  %z2 = fadd float %x2, %y2
+  %z3 = fadd float %x3, %y3
+  store float %z0, float* %a, align 4
+  store float %z1, float* %a1, align 4
+  store float %z2, float* %a2, align 4
+  store float %z3, float* %a3, align 4
+  ret void
+}
@@ -0,0 +1,65 @@
+; RUN: opt < %s -sroa -S | FileCheck %s
+; Cheerp: loads through PHIs and selects of typed GEPs into the same alloca
+; are speculated on non byte addressable targets
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+
+%struct.pair = type { i32, i32 }
+
+define i32 @phi_of_fields(i1 %cond, i32 %x, i32 %y) {
+; CHECK-LABEL: @phi_of_fields(
+; CHECK-NOT: alloca
+; CHECK: phi i32 [ %x, %then ], [ %y, %else ]
+; CHECK-NOT: load
+; CHECK: ret i32
+entry:
+  %a = alloca %struct.pair
+  %a0 = getelementptr inbounds %struct.pair* %a, i32 0, i32 0
+  %a1 = getelementptr inbounds %struct.pair* %a, i32 0, i32 1
+  store i32 %x, i32* %a0
+  store i32 %y, i32* %a1
+  br i1 %cond, label %then, label %else
+
+then:
+  br label %exit
+
+else:
+  br label %exit
+
+exit:
+  %p = phi i32* [ %a0, %then ], [ %a1, %else ]
+  %v = load i32* %p
+  ret i32 %v
+}
+
+define i32 @select_of_fields(i1 %cond, i32 %x, i32 %y) {
+; CHECK-LABEL: @select_of_fields(
+; CHECK-NOT: alloca
+; CHECK: select i1 %cond, i32 %x, i32 %y
+; CHECK-NOT: load
+; CHECK: ret i32
+entry:
+  %a = alloca %struct.pair
+  %a0 = getelementptr inbounds %struct.pair* %a, i32 0, i32 0
+  %a1 = getelementptr inbounds %struct.pair* %a, i32 0, i32 1
+  store i32 %x, i32* %a0
+  store i32 %y, i32* %a1
+  %p = select i1 %cond, i32* %a0, i32* %a1
+  %v = load i32* %p
+  ret i32 %v
+}
+
+define i32 @select_of_different_objects(i1 %cond, %struct.pair* %q, i32 %x) {
+; CHECK-LABEL: @select_of_different_objects(
+; CHECK: alloca i32
+; CHECK: select i1 %cond, i32* %{{.*}}, i32* %q1
+; CHECK: load i32* %p
+; CHECK: ret i32
+entry:
+  %a = alloca %struct.pair
+  %a0 = getelementptr inbounds %struct.pair* %a, i32 0, i32 0
+  %q1 = getelementptr inbounds %struct.pair* %q, i32 0, i32 1
+  store i32 %x, i32* %a0
+  %p = select i1 %cond, i32* %a0, i32* %q1
+  %v = load i32* %p
+  ret i32 %v
+}
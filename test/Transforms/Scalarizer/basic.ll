@@ -275,14 +275,14 @@ define void @f8(<4 x float *> *%dest, <4 x float *> %ptr0, <4 x i32> %i0,
 ; CHECK: %dest.i1 = getelementptr float** %dest.i0, i32 1
 ; CHECK: %dest.i2 = getelementptr float** %dest.i0, i32 2
 ; CHECK: %dest.i3 = getelementptr float** %dest.i0, i32 3
+; CHECK: %ptr0.i0 = extractelement <4 x float*> %ptr0, i32 0
+; CHECK: %ptr0.i2 = extractelement <4 x float*> %ptr0, i32 2
+; CHECK: %ptr0.i3 = extractelement <4 x float*> %ptr0, i32 3
 ; CHECK: %i0.i1 = extractelement <4 x i32> %i0, i32 1
 ; CHECK: %i0.i3 = extractelement <4 x i32> %i0, i32 3
-; CHECK: %ptr0.i0 = extractelement <4 x float*> %ptr0, i32 0
 ; CHECK: %val.i0 = getelementptr float* %ptr0.i0, i32 100
 ; CHECK: %val.i1 = getelementptr float* %other, i32 %i0.i1
-; CHECK: %ptr0.i2 = extractelement <4 x float*> %ptr0, i32 2
 ; CHECK: %val.i2 = getelementptr float* %ptr0.i2, i32 100
-; CHECK: %ptr0.i3 = extractelement <4 x float*> %ptr0, i32 3
 ; CHECK: %val.i3 = getelementptr float* %ptr0.i3, i32 %i0.i3
 ; CHECK: store float* %val.i0, float** %dest.i0, align 32
 ; CHECK: store float* %val.i1, float** %dest.i1, align 8
@@ -362,14 +362,18 @@ define void @f11(<32 x i1> *%dest, <32 x i1> *%src0) {
   ret void
 }
 
-; Test that variable inserts aren't scalarized.
+; Test that variable inserts are scalarized into a select per element.
 define void @f12(<4 x i32> *%dest, <4 x i32> *%src, i32 %index) {
 ; CHECK: @f12(
-; CHECK: %val1 = insertelement <4 x i32> %val0, i32 1, i32 %index
-; CHECK-DAG: %val1.i0 = extractelement <4 x i32> %val1, i32 0
-; CHECK-DAG: %val1.i1 = extractelement <4 x i32> %val1, i32 1
-; CHECK-DAG: %val1.i2 = extractelement <4 x i32> %val1, i32 2
-; CHECK-DAG: %val1.i3 = extractelement <4 x i32> %val1, i32 3
+; CHECK-NOT: insertelement
+; CHECK: %val1.is0 = icmp eq i32 %index, 0
+; CHECK: %val1.i0 = select i1 %val1.is0, i32 1, i32 %val0.i0
+; CHECK: %val1.is1 = icmp eq i32 %index, 1
+; CHECK: %val1.i1 = select i1 %val1.is1, i32 1, i32 %val0.i1
+; CHECK: %val1.is2 = icmp eq i32 %index, 2
+; CHECK: %val1.i2 = select i1 %val1.is2, i32 1, i32 %val0.i2
+; CHECK: %val1.is3 = icmp eq i32 %index, 3
+; CHECK: %val1.i3 = select i1 %val1.is3, i32 1, i32 %val0.i3
 ; CHECK-DAG: %val2.i0 = shl i32 1, %val1.i0
 ; CHECK-DAG: %val2.i1 = shl i32 2, %val1.i1
 ; CHECK-DAG: %val2.i2 = shl i32 3, %val1.i2
@@ -8,11 +8,14 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/Cheerp/PointerAnalyzer.h"
+#include "llvm/AsmParser/Parser.h"
+#include "llvm/IR/InstIterator.h"
 #include "llvm/IR/IntrinsicInst.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
 namespace llvm {
@@ -31,6 +34,188 @@ const Value * getValueByName( const Function * F, StringRef name )
 
 using namespace cheerp;
 
+/**
+ * writer stores its argument into the member of @slot which reader loads. Only
+ * the version of reader given in readerBody changes between the modules
+ */
+std::unique_ptr<Module> parseSummariesModule( LLVMContext & C, StringRef readerBody )
+{
+	std::string source = R"(
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+%struct.elem = type { i32 }
+%struct.slot = type { %struct.elem* }
+%struct.other = type { %struct.elem* }
+
+@elems = global [4 x %struct.elem] zeroinitializer
+@slot = global %struct.slot zeroinitializer
+@other = global %struct.other zeroinitializer
+
+define void @writer(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  ret void
+}
+
+define i32 @unrelated(%struct.elem* %p) {
+entry:
+  %f = getelementptr inbounds %struct.other* @other, i32 0, i32 0
+  store %struct.elem* %p, %struct.elem** %f
+  %v = getelementptr inbounds %struct.elem* %p, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+}
+
+define i32 @main() {
+entry:
+  %e = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 1
+  call void @writer(%struct.elem* %e)
+  %a = call i32 @reader()
+  %o = getelementptr inbounds [4 x %struct.elem]* @elems, i32 0, i32 2
+  %b = call i32 @unrelated(%struct.elem* %o)
+  %r = add i32 %a, %b
+  ret i32 %r
+}
+
+define i32 @reader() {
+entry:
+  %f = getelementptr inbounds %struct.slot* @slot, i32 0, i32 0
+  %p = load %struct.elem** %f
+)";
+	source += readerBody;
+	source += "}\n";
+	SMDiagnostic Err;
+	return parseAssemblyString( source, Err, C );
+}
+
+const char * readerObject = R"(
+  %v = getelementptr inbounds %struct.elem* %p, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+)";
+
+// The pointer arithmetic makes the loaded pointers, and so the stored ones, REGULAR
+const char * readerArithmetic = R"(
+  %n = getelementptr inbounds %struct.elem* %p, i32 1
+  %v = getelementptr inbounds %struct.elem* %n, i32 0, i32 0
+  %r = load i32* %v
+  ret i32 %r
+)";
+
+std::string writeSummaries( const PointerKindSummaries & summaries )
+{
+	std::string text;
+	raw_string_ostream os(text);
+	summaries.write(os);
+	return os.str();
+}
+
+std::vector<std::string> getNames( const std::vector<const Function*> & functions )
+{
+	std::vector<std::string> names;
+	for ( const Function * F : functions )
+		names.push_back( F->getName() );
+	return names;
+}
+
+// Compare all the kinds of M, resolved with summaries, with the ones of a separate analysis
+void expectSameKinds( const Module & M, const PointerAnalyzer & PA, const Module & expectedM, const PointerAnalyzer & expectedPA )
+{
+	for ( auto F = M.begin(), expectedF = expectedM.begin(); F != M.end(); ++F, ++expectedF )
+	{
+		if ( F->getReturnType()->isPointerTy() )
+			EXPECT_EQ( expectedPA.getPointerKindForReturn(expectedF), PA.getPointerKindForReturn(F) ) << F->getName().str();
+		for ( auto arg = F->arg_begin(), expectedArg = expectedF->arg_begin(); arg != F->arg_end(); ++arg, ++expectedArg )
+			EXPECT_EQ( expectedPA.getPointerKind(expectedArg), PA.getPointerKind(arg) ) << F->getName().str();
+		for ( auto I = inst_begin(F), expectedI = inst_begin(expectedF); I != inst_end(F); ++I, ++expectedI )
+		{
+			if ( I->getType()->isPointerTy() )
+				EXPECT_EQ( expectedPA.getPointerKind(&*expectedI), PA.getPointerKind(&*I) ) << F->getName().str();
+		}
+	}
+	StructType * slot = M.getTypeByName("struct.slot");
+	StructType * expectedSlot = expectedM.getTypeByName("struct.slot");
+	EXPECT_EQ( expectedPA.getPointerKindForMemberPointer(TypeAndIndex(expectedSlot, 0, TypeAndIndex::STRUCT_MEMBER)),
+		PA.getPointerKindForMemberPointer(TypeAndIndex(slot, 0, TypeAndIndex::STRUCT_MEMBER)) );
+}
+
+TEST(CheerpTest, PointerSummariesTest) {
+
+	// Every module has its own context, like in separate compilations
+	LLVMContext C;
+
+	// Without previous summaries every function is new
+	std::unique_ptr<Module> M1 = parseSummariesModule( C, readerObject );
+	ASSERT_TRUE( M1.get() );
+	PointerAnalyzer PA1;
+	PA1.runOnModule( *M1 );
+	PointerKindSummaries empty, first;
+	std::vector<const Function*> changed;
+	PA1.fullResolve( *M1, empty, first, changed );
+	EXPECT_EQ( std::vector<std::string>({"writer", "unrelated", "main", "reader"}), getNames(changed) );
+
+	// The stored-to member slot is summarized with the first function using it
+	ASSERT_EQ( 4u, first.functions.size() );
+	const PointerKindSummaries::FunctionSummary & writer = first.functions[0];
+	EXPECT_EQ( "writer", writer.name );
+	ASSERT_EQ( 2u, writer.slots.size() );
+	EXPECT_EQ( "arg writer 0", writer.slots[0].name );
+	EXPECT_EQ( COMPLETE_OBJECT, writer.slots[0].kind );
+	EXPECT_EQ( "base_and_index %struct.slot 0", writer.slots[1].name );
+	EXPECT_EQ( COMPLETE_OBJECT, writer.slots[1].kind );
+
+	// The summaries can be written and read back
+	std::string text = writeSummaries( first );
+	PointerKindSummaries read;
+	read.read( text );
+	EXPECT_EQ( text, writeSummaries( read ) );
+
+	// Nothing changes for the same module
+	{
+		LLVMContext C;
+		std::unique_ptr<Module> M = parseSummariesModule( C, readerObject );
+		PointerAnalyzer PA;
+		PA.runOnModule( *M );
+		PointerKindSummaries current;
+		PA.fullResolve( *M, read, current, changed );
+		EXPECT_TRUE( changed.empty() );
+		EXPECT_EQ( text, writeSummaries( current ) );
+	}
+
+	// Changing reader changes the kind of the member slot. writer stores to it and main passes
+	// a pointer to writer, so both must be solved again even if their body is the same
+	{
+		LLVMContext C;
+		std::unique_ptr<Module> M = parseSummariesModule( C, readerArithmetic );
+		PointerAnalyzer PA;
+		PA.runOnModule( *M );
+		PointerKindSummaries current;
+		PA.fullResolve( *M, read, current, changed );
+		EXPECT_EQ( std::vector<std::string>({"writer", "main", "reader"}), getNames(changed) );
+
+		LLVMContext expectedC;
+		std::unique_ptr<Module> expectedM = parseSummariesModule( expectedC, readerArithmetic );
+		PointerAnalyzer expectedPA;
+		expectedPA.runOnModule( *expectedM );
+		expectedPA.fullResolve();
+		expectSameKinds( *M, PA, *expectedM, expectedPA );
+		EXPECT_NE( COMPLETE_OBJECT, PA.getPointerKind(M->getFunction("writer")->arg_begin()) );
+		EXPECT_EQ( COMPLETE_OBJECT, PA.getPointerKind(M->getFunction("unrelated")->arg_begin()) );
+
+		// And the kinds go back once reader is reverted
+		PointerKindSummaries reverted;
+		LLVMContext C2;
+		std::unique_ptr<Module> M2 = parseSummariesModule( C2, readerObject );
+		PointerAnalyzer PA2;
+		PA2.runOnModule( *M2 );
+		PA2.fullResolve( *M2, current, reverted, changed );
+		EXPECT_EQ( std::vector<std::string>({"writer", "main", "reader"}), getNames(changed) );
+		EXPECT_EQ( text, writeSummaries( reverted ) );
+	}
+}
+
 TEST(CheerpTest, PointerAnalyzerTest) {
 
 	LLVMContext C;
@@ -0,0 +1,110 @@
+//===- llvm/unittest/Cheerp/CheerpRegisterizeTest.cpp ---------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Cheerp/PointerAnalyzer.h"
+#include "llvm/Cheerp/Registerize.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "gtest/gtest.h"
+#include <set>
+
+namespace llvm {
+namespace {
+
+using namespace cheerp;
+
+/**
+ * Build a straight line function where every value is alive until window values later,
+ * so that exactly window registers are needed
+ */
+Function* buildWindowFunction(Module& M, uint32_t numValues, uint32_t window, std::vector<Instruction*>& values)
+{
+	LLVMContext& C = M.getContext();
+	Type* i32 = Type::getInt32Ty(C);
+	Function* F = Function::Create(FunctionType::get(i32, i32, false), Function::ExternalLinkage, "window", &M);
+	IRBuilder<> Builder(BasicBlock::Create(C, "entry", F));
+	Value* a = F->arg_begin();
+	Value* last = Builder.CreateAdd(a, ConstantInt::get(i32, 1));
+	values.push_back(cast<Instruction>(last));
+	for(uint32_t i=1;i<numValues;i++)
+	{
+		Value* other = i >= window ? values[i-window] : a;
+		last = Builder.CreateAdd(last, other);
+		values.push_back(cast<Instruction>(last));
+	}
+	Builder.CreateRet(last);
+	return F;
+}
+
+void checkWindowRegisters(bool linearScan, uint32_t numValues, uint32_t window)
+{
+	LLVMContext C;
+	Module M("registerize", C);
+	std::vector<Instruction*> values;
+	Function* F = buildWindowFunction(M, numValues, window, values);
+
+	PointerAnalyzer PA;
+	Registerize registerize(false, false, linearScan);
+	registerize.assignRegisters(M, PA);
+
+	// The tail of the chain has a single use and is inlined
+	std::set<uint32_t> usedRegisters;
+	for(uint32_t i=0;i<numValues;i++)
+	{
+		if(!values[i]->hasNUsesOrMore(2))
+			continue;
+		uint32_t reg = registerize.getRegisterId(values[i]);
+		usedRegisters.insert(reg);
+		for(uint32_t j=i+1;j<i+window && j<numValues;j++)
+		{
+			if(values[j]->hasNUsesOrMore(2))
+				ASSERT_NE(reg, registerize.getRegisterId(values[j]));
+		}
+	}
+	EXPECT_EQ(window, usedRegisters.size());
+	EXPECT_EQ(window, registerize.getRegistersForFunction(F).size());
+}
+
+TEST(CheerpTest, RegisterizeFirstFitTest) {
+	checkWindowRegisters(false, 2000, 16);
+}
+
+TEST(CheerpTest, RegisterizeLinearScanTest) {
+	checkWindowRegisters(true, 2000, 16);
+}
+
+// First fit is quadratic on this function, linear scan should complete quickly
+TEST(CheerpTest, RegisterizeLinearScanStressTest) {
+	checkWindowRegisters(true, 200000, 64);
+}
+
+uint64_t countLinearScanChunks(uint32_t numValues, uint32_t window)
+{
+	LLVMContext C;
+	Module M("registerize", C);
+	std::vector<Instruction*> values;
+	buildWindowFunction(M, numValues, window, values);
+
+	PointerAnalyzer PA;
+	Registerize registerize(false, false, true);
+	registerize.assignRegisters(M, PA);
+	return registerize.getNumLinearScanChunks();
+}
+
+// The work done by linear scan must grow linearly, 4 times the code should cost about 4 times more
+TEST(CheerpTest, RegisterizeLinearScanScalingTest) {
+	uint64_t small = countLinearScanChunks(50000, 64);
+	uint64_t large = countLinearScanChunks(200000, 64);
+	ASSERT_GT(small, 0u);
+	EXPECT_LE(large, small * 5);
+}
+
+}
+}
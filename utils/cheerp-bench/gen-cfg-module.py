@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#
+# Generate a generic JavaScript module with many relooper-heavy functions to
+# measure the time spent reconstructing the control flow:
+#
+#   python gen-cfg-module.py 4000 > repeated.ll
+#   python gen-cfg-module.py 4000 --unique > unique.ll
+#   llc -march=cheerp -cheerp-time-report=report.json -o /dev/null repeated.ll
+#
+# Every function is a loop nest around a switch, like the instantiations of a
+# template. By default all of them share the same few CFGs, which is what the
+# relooper cache reuses. With --unique every function gets a CFG of its own.
+
+import sys
+
+def falls(c, cases, mask):
+    return (mask >> c) & 1 and c + 1 < cases
+
+def emit_function(i, cases, mask, out):
+    w = out.write
+    w('define i32 @f%d(i32 %%n, i32 %%m) {\n' % i)
+    w('entry:\n')
+    w('  br label %outer\n')
+    w('outer:\n')
+    w('  %i = phi i32 [ 0, %entry ], [ %i.next, %outer.latch ]\n')
+    w('  %acc = phi i32 [ 0, %entry ], [ %acc.inner, %outer.latch ]\n')
+    w('  br label %inner\n')
+    w('inner:\n')
+    w('  %j = phi i32 [ 0, %outer ], [ %j.next, %inner.latch ]\n')
+    w('  %acc.j = phi i32 [ %acc, %outer ], [ %acc.next, %inner.latch ]\n')
+    w('  %%sel = urem i32 %%j, %d\n' % cases)
+    w('  switch i32 %sel, label %default [\n')
+    for c in range(cases):
+        w('    i32 %d, label %%case%d\n' % (c, c))
+    w('  ]\n')
+    for c in range(cases):
+        w('case%d:\n' % c)
+        w('  %%v%d = add i32 %%acc.j, %d\n' % (c, c * 3 + i % 5))
+        w('  %%b%d = icmp sgt i32 %%v%d, %%m\n' % (c, c))
+        # The cases in mask fall through to the next one, the others go to the latch
+        target = 'case%d' % (c + 1) if falls(c, cases, mask) else 'inner.latch'
+        w('  br i1 %%b%d, label %%early, label %%%s\n' % (c, target))
+    w('default:\n')
+    w('  br label %inner.latch\n')
+    w('inner.latch:\n')
+    w('  %%acc.next = phi i32 [ %%acc.j, %%default ]%s\n' %
+      ''.join(', [ %%v%d, %%case%d ]' % (c, c) for c in range(cases)
+              if not falls(c, cases, mask)))
+    w('  %j.next = add i32 %j, 1\n')
+    w('  %inner.c = icmp slt i32 %j.next, %m\n')
+    w('  br i1 %inner.c, label %inner, label %outer.latch\n')
+    w('outer.latch:\n')
+    w('  %acc.inner = phi i32 [ %acc.next, %inner.latch ]\n')
+    w('  %i.next = add i32 %i, 1\n')
+    w('  %outer.c = icmp slt i32 %i.next, %n\n')
+    w('  br i1 %outer.c, label %outer, label %exit\n')
+    w('early:\n')
+    w('  %%r = phi i32 %s\n' %
+      ', '.join('[ %%v%d, %%case%d ]' % (c, c) for c in range(cases)))
+    w('  ret i32 %r\n')
+    w('exit:\n')
+    w('  ret i32 %acc.inner\n')
+    w('}\n\n')
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 4000
+    unique = '--unique' in sys.argv[2:]
+    out = sys.stdout
+    out.write('target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-'
+              'i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"\n')
+    out.write('target triple = "cheerp-unknown-webbrowser"\n\n')
+    for i in range(count):
+        # Repeated functions cycle through four CFGs, unique ones also change
+        # which cases fall through
+        cases = 12 + i % 4
+        mask = (i // 4) if unique else 0x2aa
+        emit_function(i, cases, mask, out)
+    out.write('define void @_Z7webMainv() {\n')
+    out.write('entry:\n')
+    for i in range(count):
+        out.write('  %%r%d = call i32 @f%d(i32 %d, i32 %d)\n' % (i, i, i % 3, i % 11))
+    out.write('  ret void\n')
+    out.write('}\n')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,52 @@
+#!/usr/bin/env python
+#
+# Generate a module with many global constructors, each one filling a lookup
+# table of its own, to time PreExecute on initialization heavy code:
+#
+#   python gen-ctor-module.py 2000 > ctors.ll
+#   time opt -PreExecute -disable-output ctors.ll
+#
+# Every table is 2048 i32 (8KB) computed by a hashing loop, so that every
+# constructor can be folded into a constant initializer. The global count
+# grows with the constructor count, like in a large C++ code base with one
+# static initializer per translation unit.
+
+import sys
+
+def emit_constructor(i, out):
+    w = out.write
+    w('define internal void @init%d() {\n' % i)
+    w('entry:\n')
+    w('  br label %loop\n')
+    w('loop:\n')
+    w('  %i = phi i32 [ 0, %entry ], [ %next, %loop ]\n')
+    w('  %%h = phi i32 [ %d, %%entry ], [ %%h2, %%loop ]\n' % (2166136261 ^ i))
+    w('  %sq = mul i32 %i, %i\n')
+    w('  %h1 = xor i32 %h, %sq\n')
+    w('  %h2 = mul i32 %h1, 16777619\n')
+    w('  %%slot = getelementptr inbounds [2048 x i32]* @table%d, i32 0, i32 %%i\n' % i)
+    w('  store i32 %h2, i32* %slot\n')
+    w('  %next = add i32 %i, 1\n')
+    w('  %done = icmp eq i32 %next, 2048\n')
+    w('  br i1 %done, label %exit, label %loop\n')
+    w('exit:\n')
+    w('  ret void\n')
+    w('}\n\n')
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+    out = sys.stdout
+    out.write('target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-'
+              'i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"\n')
+    out.write('target triple = "cheerp-unknown-webbrowser"\n\n')
+    for i in range(count):
+        out.write('@table%d = global [2048 x i32] zeroinitializer\n' % i)
+    out.write('\n@llvm.global_ctors = appending global [%d x { i32, void ()* }] [' % count)
+    out.write(', '.join('{ i32, void ()* } { i32 65535, void ()* @init%d }' % i
+                        for i in range(count)))
+    out.write(']\n\n')
+    for i in range(count):
+        emit_constructor(i, out)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+#
+# Generate a large generic JavaScript module to measure the time and memory
+# used by PointerAnalyzer and Registerize:
+#
+#   python gen-large-module.py 4000 > large.ll
+#   llc -march=cheerp -cheerp-time-report=report.json -o /dev/null large.ll
+#
+# Every function mixes pointer phis, selects, struct and array GEPs, stores of
+# pointers into memory and calls to the previous function, so that the
+# pointer kinds depend on each other across the whole module, and has enough
+# values live across blocks to keep Registerize busy.
+
+import sys
+
+def emit_function(i, out):
+    w = out.write
+    w('define %%struct.node* @f%d(%%struct.node* %%n, i32 %%x) {\n' % i)
+    w('entry:\n')
+    w('  %%c = icmp sgt i32 %%x, %d\n' % (i % 7))
+    w('  %next.p = getelementptr inbounds %struct.node* %n, i32 0, i32 0\n')
+    w('  %next = load %struct.node** %next.p\n')
+    w('  br i1 %c, label %then, label %else\n')
+    w('then:\n')
+    for k in range(8):
+        w('  %%t%d.p = getelementptr inbounds %%struct.node* %%n, i32 0, i32 1, i32 %d\n' % (k, k))
+        w('  %%t%d = load i32* %%t%d.p\n' % (k, k))
+    w('  %a = add i32 %t0, %t1\n')
+    for k in range(2, 8):
+        w('  %%a%d = add i32 %s, %%t%d\n' % (k, '%a' if k == 2 else '%%a%d' % (k - 1), k))
+    w('  br label %join\n')
+    w('else:\n')
+    w('  %e.p = getelementptr inbounds %struct.node* %next, i32 0, i32 1, i32 0\n')
+    w('  %e = load i32* %e.p\n')
+    w('  %m = mul i32 %e, %x\n')
+    w('  store %struct.node* %n, %struct.node** %next.p\n')
+    w('  br label %join\n')
+    w('join:\n')
+    w('  %v = phi i32 [ %a7, %then ], [ %m, %else ]\n')
+    w('  %p = phi %struct.node* [ %n, %then ], [ %next, %else ]\n')
+    w('  %q = select i1 %c, %struct.node* %next, %struct.node* %p\n')
+    w('  %%slot = getelementptr inbounds %%struct.node* %%q, i32 0, i32 1, i32 %d\n' % (i % 8))
+    w('  store i32 %v, i32* %slot\n')
+    if i > 0:
+        w('  %%r = call %%struct.node* @f%d(%%struct.node* %%q, i32 %%v)\n' % (i - 1))
+    else:
+        w('  %r = getelementptr inbounds %struct.node* %q, i32 0\n')
+    w('  %r.next = getelementptr inbounds %struct.node* %r, i32 0, i32 0\n')
+    w('  store %struct.node* %p, %struct.node** %r.next\n')
+    w('  ret %struct.node* %r\n')
+    w('}\n\n')
+
+def main():
+    count = int(sys.argv[1]) if len(sys.argv) > 1 else 4000
+    out = sys.stdout
+    out.write('target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"\n')
+    out.write('target triple = "cheerp-unknown-webbrowser"\n\n')
+    out.write('%struct.node = type { %struct.node*, [8 x i32] }\n\n')
+    out.write('@root = global %struct.node zeroinitializer\n\n')
+    for i in range(count):
+        emit_function(i, out)
+    out.write('define void @_Z7webMainv() {\n')
+    out.write('  %%r = call %%struct.node* @f%d(%%struct.node* @root, i32 3)\n' % (count - 1))
+    out.write('  ret void\n')
+    out.write('}\n')
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,35 @@
+; Global constructor that fills a large lookup table, used to time the
+; interpreter behind -PreExecute.
+;
+;   time opt -PreExecute -disable-output preexecute-table.ll
+;
+; All the work happens in the interpreter: 1M iterations of a loop that keeps
+; a handful of values live across the body and stores into a global.
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@table = global [1048576 x i32] zeroinitializer
+
+@llvm.global_ctors = appending global [1 x { i32, void ()* }] [{ i32, void ()* } { i32 65535, void ()* @fill_table }]
+
+define internal void @fill_table() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %h = phi i32 [ 2166136261, %entry ], [ %h2, %loop ]
+  %sq = mul i32 %i, %i
+  %sh = lshr i32 %i, 3
+  %v = xor i32 %sq, %sh
+  %h1 = xor i32 %h, %v
+  %h2 = mul i32 %h1, 16777619
+  %slot = getelementptr inbounds [1048576 x i32]* @table, i32 0, i32 %i
+  store i32 %h2, i32* %slot
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 1048576
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
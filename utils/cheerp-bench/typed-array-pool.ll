@@ -0,0 +1,51 @@
+; Allocation churn of small typed arrays in generic JavaScript, used to
+; compare the output with and without the typed array pools.
+;
+;   llc -march=cheerp -o nopool.js typed-array-pool.ll
+;   llc -march=cheerp -cheerp-typed-array-pool-size=256 -o pool.js typed-array-pool.ll
+;   node --trace-gc nopool.js
+;   node --trace-gc pool.js
+;
+; webMain does 5,000,000 malloc/free pairs of 32 bytes int arrays, touching
+; every element so that the allocations are not dead.
+target datalayout = "b-e-p:32:8:8-i1:8:8-i8:8:8-i16:8:8-i32:8:8-i64:8:8-f32:8:8-f64:8:8-a0:0:8-f80:8:8-n8:8:8-S8"
+target triple = "cheerp-unknown-webbrowser"
+
+@sum = global i32 0
+
+define void @_Z7webMainv() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %inner.exit ]
+  %raw = call i8* @malloc(i32 32)
+  %arr = bitcast i8* %raw to i32*
+  br label %inner
+
+inner:
+  %j = phi i32 [ 0, %loop ], [ %j.next, %inner ]
+  %slot = getelementptr inbounds i32* %arr, i32 %j
+  %v = add i32 %i, %j
+  store i32 %v, i32* %slot
+  %j.next = add i32 %j, 1
+  %j.done = icmp eq i32 %j.next, 8
+  br i1 %j.done, label %inner.exit, label %inner
+
+inner.exit:
+  %last = getelementptr inbounds i32* %arr, i32 7
+  %lv = load i32* %last
+  %s = load i32* @sum
+  %s1 = add i32 %s, %lv
+  store i32 %s1, i32* @sum
+  call void @free(i8* %raw)
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, 5000000
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+declare i8* @malloc(i32)
+declare void @free(i8*)